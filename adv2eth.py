@@ -4,11 +4,8 @@
 
 import sys
 import socket
-from pynput import keyboard
 
-def on_press(key):
-    if key == keyboard.Key.esc:
-        return False
+ADV_HDR_LEN = 10
 
 def main():
 	if(len(sys.argv) < 2):
@@ -17,25 +14,32 @@ def main():
 	if(sys.argv[1] == "-h"):
 		print("Usage: adv2eth <IP address device or url>")
 		sys.exit(0)
-	print("Press 'ESC' to exit")
+	print("Press Ctrl+C to exit")
 	print ('Connecting to '+sys.argv[1]+' ...')
 	sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)  # Create a TCP/IP socket
 	sock.connect((sys.argv[1],1000))  # connect to the server
-	data = bytes(0)
-	with keyboard.Listener(on_press=on_press) as listener:
-		while listener.running:
-			data += sock.recv(1460*2) # TCP MSS * 2 receive response
-			#print('Received from server: %d' % len(data))
-			while(data[0] + 10 < len(data)):
-				l = data[0]
-				evt = data[1:2].hex() 
-				adt = data[2:3].hex() 
-				rssi = data[3:4].hex()
-				xmac = bytes([data[9], data[8], data[7], data[6], data[5], data[4]])
-				mac = xmac.hex() 
-				dump = data[10:l+10].hex()
+	data = bytearray()
+	try:
+		while True:
+			rx = sock.recv(1460*2) # TCP MSS * 2 receive response
+			if not rx:
+				print('Connection closed')
+				break
+			data += rx
+			# frames: [len][adTypes][phy][rssi][mac 6][data: len]
+			pos = 0
+			while len(data) - pos >= ADV_HDR_LEN and len(data) - pos >= data[pos] + ADV_HDR_LEN:
+				l = data[pos]
+				evt = data[pos+1:pos+2].hex()
+				adt = data[pos+2:pos+3].hex()
+				rssi = data[pos+3:pos+4].hex()
+				mac = data[pos+4:pos+10][::-1].hex()
+				dump = data[pos+ADV_HDR_LEN:pos+ADV_HDR_LEN+l].hex()
 				print(evt, adt, rssi, mac, dump)
-				data = data[l + 10:]
+				pos += l + ADV_HDR_LEN
+			del data[:pos] # keep the cut frame only
+	except KeyboardInterrupt:
+		pass
 	sock.close()  # close the connection
 	sys.exit(0)
 
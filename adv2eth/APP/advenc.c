@@ -0,0 +1,323 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advenc.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/16
+ * Description        : Compact advert records: per-connection device
+ *                      dictionary, handles instead of MACs, payload deltas
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "CONFIG.h"
+#include "string.h"
+#include "ctrl.h"
+#include "advenc.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define ADV_KEY_LEN             8       // mac 6, adTypes, phyTypes
+#define ADV_DICT_HASH           64      // hash buckets, power of 2
+#define ADV_NIL                 0xFFFF
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+    uint8_t  key[ADV_KEY_LEN];
+    uint8_t  len;                       // last payload length
+    uint8_t  stored;                    // data[] holds the last payload
+    uint16_t prev;                      // LRU list, head - most recent
+    uint16_t next;
+    uint16_t chain;                     // hash bucket list
+    uint8_t  data[ADV_DICT_DATA_MAX];
+} adv_dict_ent_t;
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+uint8_t advenc_mode;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static adv_dict_ent_t adv_dict[ADV_DICT_SIZE];
+static uint16_t adv_hash[ADV_DICT_HASH];
+static uint16_t adv_used;
+static uint16_t adv_lru_head, adv_lru_tail;
+static uint8_t  adv_resync;                     // ADV_SVC_DICT goes before the next record
+
+// advenc_encode() -> advenc_commit()
+static uint16_t adv_pend_idx;
+static uint8_t  adv_pend_new;
+
+/*********************************************************************
+ * @fn      adv_key_hash
+ */
+__HIGH_CODE
+static uint16_t adv_key_hash(const uint8_t *key)
+{
+    uint32_t h = key[0] | (key[1] << 8) | (key[2] << 16) | ((uint32_t)key[3] << 24);
+
+    h ^= key[4] | (key[5] << 8) | (key[6] << 16) | ((uint32_t)key[7] << 24);
+    h *= 0x9E3779B1;
+    return (uint16_t)(h >> 16) & (ADV_DICT_HASH - 1);
+}
+
+__HIGH_CODE
+static uint16_t adv_lookup(const uint8_t *key)
+{
+    uint16_t i;
+
+    for(i = adv_hash[adv_key_hash(key)]; i != ADV_NIL; i = adv_dict[i].chain)
+    {
+        if(memcmp(adv_dict[i].key, key, ADV_KEY_LEN) == 0)
+            break;
+    }
+    return i;
+}
+
+__HIGH_CODE
+static void adv_lru_unlink(uint16_t i)
+{
+    adv_dict_ent_t *e = &adv_dict[i];
+
+    if(e->prev != ADV_NIL)
+        adv_dict[e->prev].next = e->next;
+    else
+        adv_lru_head = e->next;
+    if(e->next != ADV_NIL)
+        adv_dict[e->next].prev = e->prev;
+    else
+        adv_lru_tail = e->prev;
+}
+
+__HIGH_CODE
+static void adv_lru_push(uint16_t i)
+{
+    adv_dict_ent_t *e = &adv_dict[i];
+
+    e->prev = ADV_NIL;
+    e->next = adv_lru_head;
+    if(adv_lru_head != ADV_NIL)
+        adv_dict[adv_lru_head].prev = i;
+    else
+        adv_lru_tail = i;
+    adv_lru_head = i;
+}
+
+__HIGH_CODE
+static void adv_hash_unlink(uint16_t i)
+{
+    uint16_t *p = &adv_hash[adv_key_hash(adv_dict[i].key)];
+
+    while(*p != i)
+        p = &adv_dict[*p].chain;
+    *p = adv_dict[i].chain;
+}
+
+/*********************************************************************
+ * @fn      adv_dict_clear
+ *
+ * @brief   Empty dictionary, the client is told before the next record.
+ *
+ * @return  none
+ */
+static void adv_dict_clear(void)
+{
+    memset(adv_hash, 0xff, sizeof(adv_hash));
+    adv_used = 0;
+    adv_lru_head = ADV_NIL;
+    adv_lru_tail = ADV_NIL;
+    adv_resync = 1;
+}
+
+/*********************************************************************
+ * @fn      advenc_set_mode
+ *
+ * @brief   Client request. Switching to (or repeating) ADV_ENC_COMPACT
+ *          restarts the dictionary: the client uses it to resync.
+ *
+ * @param   mode - ADV_ENC_FULL or ADV_ENC_COMPACT
+ *
+ * @return  none
+ */
+void advenc_set_mode(uint8_t mode)
+{
+    if(mode > ADV_ENC_COMPACT)
+        return;
+    advenc_mode = mode;
+    adv_dict_clear();
+}
+
+/*********************************************************************
+ * @fn      advenc_reset
+ *
+ * @brief   New connection: full frames, empty dictionary.
+ *
+ * @return  none
+ */
+void advenc_reset(void)
+{
+    advenc_mode = ADV_ENC_FULL;
+    adv_dict_clear();
+}
+
+/*********************************************************************
+ * @fn      advenc_put_handle
+ */
+__HIGH_CODE
+static uint8_t *advenc_put_handle(uint8_t *p, uint8_t kind, uint16_t handle)
+{
+    if(handle > 0xFF)
+    {
+        p[1] = kind | ADV_REC_WIDE;
+        p[2] = (uint8_t)handle;
+        p[3] = (uint8_t)(handle >> 8);
+        return p + 4;
+    }
+    p[1] = kind;
+    p[2] = (uint8_t)handle;
+    return p + 3;
+}
+
+/*********************************************************************
+ * @fn      advenc_encode
+ *
+ * @brief   Encode a v1 frame as a compact record. The dictionary is not
+ *          changed until advenc_commit(): a record dropped for lack of
+ *          room in the FIFO leaves it as the client sees it.
+ *
+ * @param   frame - v1 frame [len][adTypes][phyTypes][rssi][mac 6][data]
+ * @param   out - ADV_ENC_OUT_MAX bytes
+ *
+ * @return  output length
+ */
+__HIGH_CODE
+uint16_t advenc_encode(const uint8_t *frame, uint8_t *out)
+{
+    const uint8_t *data = frame + ADV_HDR_LEN;
+    uint8_t key[ADV_KEY_LEN];
+    uint8_t *p = out, *rec, *bm;
+    uint8_t plen = frame[0];
+    uint16_t i, n;
+    adv_dict_ent_t *e;
+
+    if(adv_resync)
+    {
+        ctrl_svc_hdr(p, ADV_SVC_DICT, 0, ADV_DICT_SVC_LEN, ADV_DICT_SVC_LEN);
+        p[ADV_HDR_LEN] = advenc_mode;
+        p[ADV_HDR_LEN + 1] = (uint8_t)ADV_DICT_SIZE;
+        p[ADV_HDR_LEN + 2] = (uint8_t)(ADV_DICT_SIZE >> 8);
+        p += ADV_HDR_LEN + ADV_DICT_SVC_LEN;
+    }
+    memcpy(key, frame + 4, B_ADDR_LEN);
+    key[6] = frame[1];
+    key[7] = frame[2];
+    rec = p;
+    i = adv_lookup(key);
+    if(i == ADV_NIL)
+    {
+        // new device: a free slot or the least recently used one
+        adv_pend_new = 1;
+        adv_pend_idx = adv_used < ADV_DICT_SIZE ? adv_used : adv_lru_tail;
+        p = advenc_put_handle(p, ADV_REC_NEW, adv_pend_idx);
+        *p++ = frame[1];
+        *p++ = frame[2];
+        *p++ = frame[3];
+        memcpy(p, frame + 4, B_ADDR_LEN);
+        p += B_ADDR_LEN;
+        rec[0] = plen;
+        memcpy(p, data, plen);
+        return p + plen - out;
+    }
+    adv_pend_new = 0;
+    adv_pend_idx = i;
+    e = &adv_dict[i];
+    if(e->stored && e->len == plen)
+    {
+        // changed bytes
+        n = 0;
+        for(i = 0; i < plen; i++)
+            n += e->data[i] != data[i];
+        if(!n)
+        {
+            p = advenc_put_handle(p, ADV_REC_SAME, adv_pend_idx);
+            *p++ = frame[3];
+            rec[0] = 0;
+            return p - out;
+        }
+        if((plen + 7) / 8 + n < plen)
+        {
+            p = advenc_put_handle(p, ADV_REC_DELTA, adv_pend_idx);
+            *p++ = frame[3];
+            bm = p;
+            memset(bm, 0, (plen + 7) / 8);
+            p += (plen + 7) / 8;
+            for(i = 0; i < plen; i++)
+            {
+                if(e->data[i] != data[i])
+                {
+                    bm[i >> 3] |= 1 << (i & 7);
+                    *p++ = data[i];
+                }
+            }
+            rec[0] = (uint8_t)(p - bm);
+            return p - out;
+        }
+    }
+    p = advenc_put_handle(p, ADV_REC_DATA, adv_pend_idx);
+    *p++ = frame[3];
+    rec[0] = plen;
+    memcpy(p, data, plen);
+    return p + plen - out;
+}
+
+/*********************************************************************
+ * @fn      advenc_commit
+ *
+ * @brief   The last encoded record is in the FIFO: bind the handle,
+ *          keep the payload and move the device to the LRU head.
+ *
+ * @param   frame - the v1 frame given to advenc_encode()
+ *
+ * @return  none
+ */
+__HIGH_CODE
+void advenc_commit(const uint8_t *frame)
+{
+    uint16_t i = adv_pend_idx;
+    adv_dict_ent_t *e = &adv_dict[i];
+    uint16_t *h;
+
+    adv_resync = 0;
+    if(adv_pend_new)
+    {
+        if(i < adv_used)
+        {
+            // evict
+            adv_lru_unlink(i);
+            adv_hash_unlink(i);
+        }
+        else
+            adv_used++;
+        memcpy(e->key, frame + 4, B_ADDR_LEN);
+        e->key[6] = frame[1];
+        e->key[7] = frame[2];
+        h = &adv_hash[adv_key_hash(e->key)];
+        e->chain = *h;
+        *h = i;
+    }
+    else
+        adv_lru_unlink(i);
+    adv_lru_push(i);
+    e->len = frame[0];
+    e->stored = frame[0] <= ADV_DICT_DATA_MAX;
+    if(e->stored)
+        memcpy(e->data, frame + ADV_HDR_LEN, frame[0]);
+}
+
+/******************************** endfile @ advenc ******************************/
@@ -10,7 +10,9 @@
  * microcontroller manufactured by Nanjing Qinheng Microelectronics.
  *******************************************************************************/
 
+#include "CONFIG.h"
 #include "app_drv_fifo.h"
+#include "trace.h"
 
 static __inline uint16_t fifo_length(app_drv_fifo_t *fifo)
 {
@@ -18,6 +20,7 @@ static __inline uint16_t fifo_length(app_drv_fifo_t *fifo)
     return fifo->end - tmp;
 }
 
+__HIGH_CODE
 uint16_t app_drv_fifo_length(app_drv_fifo_t *fifo)
 {
     return fifo_length(fifo);
@@ -55,12 +58,24 @@ uint8_t app_drv_fifo_pop(app_drv_fifo_t *fifo)
     return data;
 }
 
+__HIGH_CODE
+uint8_t app_drv_fifo_peek(app_drv_fifo_t *fifo, uint16_t offset)
+{
+    return fifo->data[(fifo->begin + offset) & fifo->size_mask];
+}
+
 void app_drv_fifo_flush(app_drv_fifo_t *fifo)
 {
     fifo->begin = 0;
     fifo->end = 0;
 }
 
+__HIGH_CODE
+void app_drv_fifo_skip(app_drv_fifo_t *fifo, uint16_t length)
+{
+    fifo->begin += length;
+}
+
 bool app_drv_fifo_is_empty(app_drv_fifo_t *fifo)
 {
     return (fifo->begin == fifo->end);
@@ -71,6 +86,7 @@ bool app_drv_fifo_is_full(app_drv_fifo_t *fifo)
     return (fifo_length(fifo) == fifo->size);
 }
 
+__HIGH_CODE
 app_drv_fifo_result_t
 app_drv_fifo_write(app_drv_fifo_t *fifo, uint8_t *data, uint16_t *p_write_length)
 {
@@ -91,6 +107,7 @@ app_drv_fifo_write(app_drv_fifo_t *fifo, uint8_t *data, uint16_t *p_write_length
     // Check if the FIFO is FULL.
     if(available_count == 0)
     {
+        TRACE(TRACE_FIFO_FULL, requested_len, fifo_length(fifo));
         return APP_DRV_FIFO_RESULT_NOT_MEM;
     }
 
@@ -106,6 +123,7 @@ app_drv_fifo_write(app_drv_fifo_t *fifo, uint8_t *data, uint16_t *p_write_length
         fifo->data[fifo->end & fifo->size_mask] = data[index];
         fifo->end++;
     }
+    TRACE(TRACE_FIFO_WRITE, write_size, fifo_length(fifo));
     (*p_write_length) = write_size;
     return APP_DRV_FIFO_RESULT_SUCCESS;
 }
@@ -137,6 +155,7 @@ app_drv_fifo_write_from_same_addr(app_drv_fifo_t *fifo, uint8_t *data, uint16_t
     return APP_DRV_FIFO_RESULT_SUCCESS;
 }
 
+__HIGH_CODE
 app_drv_fifo_result_t
 app_drv_fifo_read(app_drv_fifo_t *fifo, uint8_t *data, uint16_t *p_read_length)
 {
@@ -164,6 +183,7 @@ app_drv_fifo_read(app_drv_fifo_t *fifo, uint8_t *data, uint16_t *p_read_length)
         data[index] = fifo->data[fifo->begin & fifo->size_mask];
         fifo->begin++;
     }
+    TRACE(TRACE_FIFO_READ, read_size, fifo_length(fifo));
 
     (*p_read_length) = read_size;
     return APP_DRV_FIFO_RESULT_SUCCESS;
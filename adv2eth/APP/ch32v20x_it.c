@@ -17,6 +17,8 @@
 #include "CONFIG.h"
 #include "wchnet.h"
 #include "eth_driver.h"
+#include "idle.h"
+#include "fifo_dma.h"
 
 /*********************************************************************
  * LOCAL FUNCTIONS
@@ -26,6 +28,7 @@ void HardFault_Handler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
 void BB_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
 void ETH_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
 void TIM2_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
+void DMA1_Channel7_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
 
 /*********************************************************************
  * @fn      NMI_Handler
@@ -59,22 +62,40 @@ void HardFault_Handler(void)
  *
  * @return  none
  */
+__HIGH_CODE
 void ETH_IRQHandler(void)
 {
     WCHNET_ETHIsr();
+    IDLE_WAKE(IDLE_WAKE_ETH);
 }
 
 /*********************************************************************
  * @fn      TIM2_IRQHandler
  *
- * @brief   This function handles TIM2 exception.
+ * @brief   TIM2 one-shot expired: a network deadline, the main loop
+ *          moves LocalTime itself (WCHNET_TimeUpdate).
  *
  * @return  none
  */
 void TIM2_IRQHandler(void)
 {
-    WCHNET_TimeIsr(WCHNETTIMERPERIOD);
     TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+    IDLE_WAKE(IDLE_WAKE_TICK);
+}
+
+/*********************************************************************
+ * @fn      DMA1_Channel7_IRQHandler
+ *
+ * @brief   FIFO copy channel: the send task continues once the whole
+ *          read is in the send buffer.
+ *
+ * @return  none
+ */
+__HIGH_CODE
+void DMA1_Channel7_IRQHandler(void)
+{
+    if(fifo_dma_isr())
+        IDLE_WAKE(IDLE_WAKE_DMA);
 }
 
 /*********************************************************************
@@ -87,4 +108,5 @@ void TIM2_IRQHandler(void)
 void BB_IRQHandler(void)
 {
     BB_IRQLibHandler();
+    IDLE_WAKE(IDLE_WAKE_BLE);
 }
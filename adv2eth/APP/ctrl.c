@@ -0,0 +1,243 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : ctrl.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/02
+ * Description        : Control commands received on the TCP stream socket
+ *                      and service frames sent back in the advert stream
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "string.h"
+#include "app_drv_fifo.h"
+#include "observer.h"
+#include "trace.h"
+#include "stats.h"
+#include "stream.h"
+#include "advenc.h"
+#include "gwtime.h"
+#include "sntp.h"
+#include "ctrl.h"
+
+/* the statistics snapshot goes in one ADV_SVC_STATS frame */
+_Static_assert(sizeof(gw_stats_rep_t) <= ADV_SVC_DATA_MAX, "gw_stats_rep_t does not fit ADV_SVC_DATA_MAX");
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static uint8_t ctrl_buf[CTRL_BUF_LEN];
+static uint8_t ctrl_len;
+
+static uint8_t  trace_dump;
+static uint32_t trace_dump_offset;
+
+static uint8_t  stats_req;
+
+/*********************************************************************
+ * @fn      ctrl_svc_hdr
+ *
+ * @brief   Fill the header of a service frame.
+ *
+ * @param   hdr - ADV_HDR_LEN bytes
+ * @param   svc - service id ADV_SVC_*
+ * @param   offset - data offset in the object
+ * @param   total - object total size
+ * @param   len - frame data length, <= ADV_SVC_DATA_MAX
+ *
+ * @return  none
+ */
+void ctrl_svc_hdr(uint8_t *hdr, uint8_t svc, uint32_t offset, uint16_t total, uint8_t len)
+{
+    hdr[0] = len;
+    hdr[1] = ADV_SVC_MARKER;
+    hdr[2] = svc;
+    hdr[3] = 0;
+    hdr[4] = (uint8_t)offset;
+    hdr[5] = (uint8_t)(offset >> 8);
+    hdr[6] = (uint8_t)(offset >> 16);
+    hdr[7] = (uint8_t)(offset >> 24);
+    hdr[8] = (uint8_t)total;
+    hdr[9] = (uint8_t)(total >> 8);
+}
+
+/*********************************************************************
+ * @fn      ctrl_put_svc
+ *
+ * @brief   Write a service frame into the TX FIFO.
+ *
+ * @param   svc - service id ADV_SVC_*
+ * @param   offset - data offset in the object
+ * @param   total - object total size
+ * @param   data - frame data
+ * @param   len - frame data length, <= ADV_SVC_DATA_MAX
+ *
+ * @return  1 - queued, 0 - no room in the FIFO
+ */
+static uint8_t ctrl_put_svc(uint8_t svc, uint32_t offset, uint16_t total, void *data, uint8_t len)
+{
+    uint8_t hdr[ADV_HDR_LEN];
+    uint16_t wlen;
+
+    if(app_drv_fifo_length(&app_tx_fifo) + ADV_HDR_LEN + len > app_tx_fifo.size)
+        return 0;
+    ctrl_svc_hdr(hdr, svc, offset, total, len);
+    wlen = ADV_HDR_LEN;
+    app_drv_fifo_write(&app_tx_fifo, hdr, &wlen);
+    if(len)
+    {
+        wlen = len;
+        app_drv_fifo_write(&app_tx_fifo, (uint8_t *)data, &wlen);
+    }
+    return 1;
+}
+
+/*********************************************************************
+ * @fn      ctrl_command
+ *
+ * @brief   Execute a complete command.
+ *
+ * @param   cmd - command CTRL_CMD_*
+ * @param   pdata - payload
+ * @param   len - payload length
+ *
+ * @return  none
+ */
+static void ctrl_command(uint8_t cmd, uint8_t *pdata, uint8_t len)
+{
+    switch(cmd)
+    {
+        case CTRL_CMD_TRACE_DUMP:
+            // freeze the ring until the whole image is queued
+            trace_enable(0);
+            trace_dump = 1;
+            trace_dump_offset = 0;
+            break;
+
+        case CTRL_CMD_STATS:
+            stats_req = 1;
+            break;
+
+        case CTRL_CMD_FRAMING:
+            if(len)
+                stream_set_version(pdata[0]);
+            break;
+
+        case CTRL_CMD_ENCODING:
+            if(len)
+                advenc_set_mode(pdata[0]);
+            break;
+
+        case CTRL_CMD_TIMESTAMP:
+            if(len)
+                gwtime_stamp_enable(pdata[0]);
+            break;
+
+        case CTRL_CMD_SNTP:
+            if(len >= 4)
+                sntp_set_server(pdata);
+            break;
+
+        case CTRL_CMD_COMPRESS:
+            if(len)
+                stream_set_compress(pdata[0]);
+            break;
+
+        case CTRL_CMD_RESUME:
+            if(len >= 4)
+                stream_resume(pdata[0] | (pdata[1] << 8) | (pdata[2] << 16) | ((uint32_t)pdata[3] << 24));
+            break;
+
+        default:
+            break;
+    }
+}
+
+/*********************************************************************
+ * @fn      ctrl_input
+ *
+ * @brief   Parse bytes received from the client.
+ *
+ * @param   buf - received data
+ * @param   len - received data length
+ *
+ * @return  none
+ */
+void ctrl_input(uint8_t *buf, uint32_t len)
+{
+    while(len--)
+    {
+        ctrl_buf[ctrl_len++] = *buf++;
+        if(ctrl_len < 2)
+            continue;
+        if(ctrl_buf[1] > CTRL_BUF_LEN - 2)
+        {
+            // bad length, resync on the next byte
+            ctrl_len = 0;
+            continue;
+        }
+        if(ctrl_len == ctrl_buf[1] + 2)
+        {
+            ctrl_command(ctrl_buf[0], &ctrl_buf[2], ctrl_buf[1]);
+            ctrl_len = 0;
+        }
+    }
+}
+
+/*********************************************************************
+ * @fn      ctrl_process
+ *
+ * @brief   Queue pending service frames into the TX FIFO.
+ *
+ * @return  1 - something is left for the next call
+ */
+uint8_t ctrl_process(void)
+{
+    uint32_t len;
+    gw_stats_rep_t rep;
+
+    if(stats_req)
+    {
+        stats_get(&rep);
+        if(ctrl_put_svc(ADV_SVC_STATS, 0, sizeof(rep), &rep, sizeof(rep)))
+            stats_req = 0;
+    }
+    if(trace_dump)
+    {
+        while(trace_dump_offset < sizeof(trace_ring))
+        {
+            len = MIN(sizeof(trace_ring) - trace_dump_offset, ADV_SVC_DATA_MAX);
+            if(!ctrl_put_svc(ADV_SVC_TRACE, trace_dump_offset, sizeof(trace_ring),
+                             (uint8_t *)&trace_ring + trace_dump_offset, len))
+                break;
+            trace_dump_offset += len;
+        }
+        if(trace_dump_offset >= sizeof(trace_ring))
+        {
+            trace_dump = 0;
+            trace_enable(1);
+        }
+    }
+    return trace_dump | stats_req;
+}
+
+/*********************************************************************
+ * @fn      ctrl_reset
+ *
+ * @brief   Drop the parser state and pending answers.
+ *
+ * @return  none
+ */
+void ctrl_reset(void)
+{
+    ctrl_len = 0;
+    stats_req = 0;
+    if(trace_dump)
+    {
+        trace_dump = 0;
+        trace_enable(1);
+    }
+}
+
+/******************************** endfile @ ctrl ******************************/
@@ -20,15 +20,37 @@
 #include "debug.h"
 #include "wchnet.h"
 #include "observer.h"
+#include "trace.h"
+#include "ctrl.h"
+#include "stream.h"
+#include "advenc.h"
+#include "gwtime.h"
+#include "sntp.h"
+#include "twsync.h"
+#include "idle.h"
+#include "fifo_dma.h"
+#include "resume.h"
+#include "ipcfg.h"
+#include "stats.h"
 
 extern uint32_t volatile LocalTime;
 
+#if (SEND_BUF_LEN < WCHNET_TCP_MSS)
+  #error "SEND_BUF_LEN Error, Please Config SEND_BUF_LEN >= WCHNET_TCP_MSS"
+#endif
+
 u8 WCHNET_DHCPCallBack(u8 status, void *arg);
 /*********************************************************************
  * GLOBAL TYPEDEFS
  */
 
 #define KEEPLIVE_ENABLE         1                           //Enable keeplive function
+#define ETH_SEND_PERIOD_MS      250                         //SendFifo() at least this often while connected
+#define ETH_TIM_HZ              10000                       //TIM2 wakeup counter
+#define ETH_TIM_MAX_MS          6000                        //16-bit TIM2 at ETH_TIM_HZ
+#define ETH_RETRY_MS            10                          //send window full, try again
+#define ETH_SLOW_SEG            (WCHNET_TCP_MSS / 2)        //slow link (ETH_LINK_SLOW): bytes per WCHNET_SocketSend()
+#define ETH_SLOW_PACE_MS        5                           //and the next ones not sooner
 
 u8 MACAddr[6];                                    //MAC address
 u8 IPAddr[4]   = { 0, 0, 0, 0 };	//IP address
@@ -36,14 +58,17 @@ u8 GWIPAddr[4] = { 0, 0, 0, 0 };	//Gateway IP address
 u8 IPMask[4]   = { 0, 0, 0, 0};		//subnet mask
 u16 srcport = 1000;	//source port
 
-u8 SocketId;
 u8 SocketIdForListen;
 u8 socket[WCHNET_MAX_SOCKET_NUM];                           //Save the currently connected socket
-u8 SocketRecvBuf[RECE_BUF_LEN];      //socket receive buffer
-u8 SocketSendBuf[RECE_BUF_LEN];
+u8 SocketRecvBuf[WCHNET_NUM_TCP][RECE_BUF_LEN];                     //socket receive buffer, one per connection
+__attribute__((aligned(4))) u8 SocketSendBuf[SEND_BUF_LEN];    //v2 blocks: CRC is computed over words
 uint8_t eth_TaskID;
 uint8_t socket_connected;
 uint32_t SendTime;
+uint16_t SendLen;                                                   //SocketSendBuf bytes not yet taken by the library
+uint16_t SendOffset;
+static uint8_t dhcp_wait;                                           //the library DHCP runs: its timers need the fast tick
+static uint8_t eth_listen;                                          //SocketIdForListen is open, it takes any address of ours
 /*********************************************************************
  * @fn      mStopIfError
  *
@@ -61,9 +86,11 @@ void mStopIfError(u8 iError)
 }
 
 /*********************************************************************
- * @fn      TIM2_Init  (100Hz?)
+ * @fn      TIM2_Init
  *
- * @brief   Initializes TIM2.
+ * @brief   TIM2 as a one-shot wakeup, ETH_TIM_HZ counter, started by
+ *          eth_timer_arm() for the next network deadline. LocalTime
+ *          itself follows SysTick (WCHNET_TimeUpdate).
  *
  * @return  none
  */
@@ -73,16 +100,60 @@ void TIM2_Init(void)
 
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2, ENABLE);
 
-    TIM_TimeBaseStructure.TIM_Period = SystemCoreClock / 1000000 - 1;
-    TIM_TimeBaseStructure.TIM_Prescaler = WCHNETTIMERPERIOD * 1000 - 1;
+    TIM_TimeBaseStructure.TIM_Period = 0xFFFF;
+    TIM_TimeBaseStructure.TIM_Prescaler = SystemCoreClock / ETH_TIM_HZ - 1;
     TIM_TimeBaseStructure.TIM_ClockDivision = 0;
     TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
     TIM_TimeBaseInit(TIM2, &TIM_TimeBaseStructure);
+    TIM_SelectOnePulseMode(TIM2, TIM_OPMode_Single);
+    TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
     TIM_ITConfig(TIM2, TIM_IT_Update, ENABLE);
+    NVIC_EnableIRQ(TIM2_IRQn);
+}
+
+/*********************************************************************
+ * @fn      eth_timer_arm
+ *
+ * @brief   Start TIM2 for the earliest of: the library timers
+ *          (WCHNET_TimePeriod, DHCP), the lease check, the periodic
+ *          send, SNTP. A
+ *          deadline already armed and not later is kept.
+ *
+ * @param   fired - TIM2 has expired since the previous call
+ *
+ * @return  none
+ */
+static void eth_timer_arm(uint32_t fired)
+{
+    static uint32_t deadline;
+    static uint8_t armed;
+    uint32_t now = LocalTime;
+    uint32_t due, t;
 
+    if(fired)
+        armed = 0;
+    due = now + ((dhcp_wait || ipcfg_guard == IPCFG_GUARD_PROBE) ? WCHNET_TICK_FAST_MS : WCHNET_TimePeriod());
+    if(socket_connected)
+    {
+        t = SendTime + ETH_SEND_PERIOD_MS;
+        if((int32_t)(t - due) < 0)
+            due = t;
+    }
+    t = sntp_due();
+    if((int32_t)(t - due) < 0)
+        due = t;
+    if((int32_t)(due - now) <= 0)
+        due = now + 1;
+    if((int32_t)(due - now) > ETH_TIM_MAX_MS)
+        due = now + ETH_TIM_MAX_MS;
+    if(armed && (int32_t)(deadline - now) > 0 && (int32_t)(deadline - due) <= 0)
+        return;
+    deadline = due;
+    armed = 1;
+    TIM_Cmd(TIM2, DISABLE);
+    TIM_SetAutoreload(TIM2, (due - now) * (ETH_TIM_HZ / 1000) - 1);
+    TIM_SetCounter(TIM2, 0);
     TIM_Cmd(TIM2, ENABLE);
-    TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
-    NVIC_EnableIRQ(TIM2_IRQn);
 }
 
 /*********************************************************************
@@ -119,19 +190,21 @@ void WCHNET_CreateTcpSocketListen(void)
  */
 void WCHNET_CommandData(u8 id)
 {
-    u8 i;
     u32 len;
     u32 endAddr = SocketInf[id].RecvStartPoint + SocketInf[id].RecvBufLen;       //Receive buffer end address
 
-    if ((SocketInf[id].RecvReadPoint + SocketInf[id].RecvRemLen) > endAddr)    //Calculate the length of the received data
-        len = endAddr - SocketInf[id].RecvReadPoint;
-    else
-        len = SocketInf[id].RecvRemLen;
-
-//    i = WCHNET_SocketSend(id, (u8 *) SocketInf[id].RecvReadPoint, &len);         //send data
-//    if (i == WCHNET_ERR_SUCCESS) {
-        WCHNET_SocketRecv(id, NULL, &len);                                       //Clear sent data
-//    }
+    while (SocketInf[id].RecvRemLen)
+    {
+        if ((SocketInf[id].RecvReadPoint + SocketInf[id].RecvRemLen) > endAddr)    //Calculate the length of the received data
+            len = endAddr - SocketInf[id].RecvReadPoint;
+        else
+            len = SocketInf[id].RecvRemLen;
+        TRACE(TRACE_SOCK_RECV, id, len);
+        if (id == socket_connected)
+            ctrl_input((u8 *) SocketInf[id].RecvReadPoint, len);                 //Parse commands
+        WCHNET_SocketRecv(id, NULL, &len);                                       //Clear received data
+    }
+    tmos_set_event(eth_TaskID, ETH_SENG_DATA_EVENT);
 }
 
 /*********************************************************************
@@ -148,6 +221,7 @@ void WCHNET_HandleSockInt(u8 socketid, u8 intstat)
 {
     u8 i;
 
+    TRACE(TRACE_SOCK_INT, socketid, intstat);
     if (intstat & SINT_STAT_RECV)                                 //receive data
     {
     	WCHNET_CommandData(socketid);                            //Command data
@@ -157,21 +231,36 @@ void WCHNET_HandleSockInt(u8 socketid, u8 intstat)
 #if KEEPLIVE_ENABLE                                              //Configure keeplive parameters
         WCHNET_SocketSetKeepLive(socketid, ENABLE);
 #endif
-        WCHNET_ModifyRecvBuf(socketid, (u32) SocketRecvBuf, RECE_BUF_LEN);
-        for (i = 0; i < WCHNET_MAX_SOCKET_NUM; i++) {
+        for (i = 0; i < WCHNET_NUM_TCP; i++) {                   //the slot picks the receive buffer
             if (socket[i] == 0xff) {                              //save connected socket id
                 socket[i] = socketid;
                 break;
             }
         }
-        app_drv_fifo_flush(&app_tx_fifo);
+        if (i >= WCHNET_NUM_TCP) {                                //no receive buffer left: refuse it
+            WCHNET_SocketClose(socketid, TCP_CLOSE_RST);
+            PRINT("TCP Socket %d refused\r\n", socketid);
+            return;
+        }
+        WCHNET_ModifyRecvBuf(socketid, (u32) SocketRecvBuf[i], RECE_BUF_LEN);
+        STATS_BOOT(BOOT_CONNECT);
+        stream_close(SocketSendBuf, SEND_BUF_LEN);              //the records kept for CTRL_CMD_RESUME
+        stream_reset();
+        SendLen = 0;
+        advenc_reset();
+        gwtime_stamp_reset();
+        ctrl_reset();
         socket_connected = socketid;
         SendTime = LocalTime;
         PRINT("TCP Socket %d Connect\r\n", socketid);
     }
     if (intstat & SINT_STAT_DISCONNECT)                           //disconnect
     {
-        socket_connected = 0;
+        if (socketid == socket_connected) {                       //the stream client, not another one (NET_PROFILE_MULTI)
+            socket_connected = 0;
+            ctrl_reset();
+            stream_offline();                                     //record until a client resumes
+        }
         for (i = 0; i < WCHNET_MAX_SOCKET_NUM; i++) {             //delete disconnected socket id
             if (socket[i] == socketid) {
                 socket[i] = 0xff;
@@ -182,7 +271,11 @@ void WCHNET_HandleSockInt(u8 socketid, u8 intstat)
     }
     if (intstat & SINT_STAT_TIM_OUT)                              //timeout disconnect
     {
-        socket_connected = 0;
+        if (socketid == socket_connected) {                       //the stream client
+            socket_connected = 0;
+            ctrl_reset();
+            stream_offline();                                     //record until a client resumes
+        }
         for (i = 0; i < WCHNET_MAX_SOCKET_NUM; i++) {             //delete disconnected socket id
             if (socket[i] == socketid) {
                 socket[i] = 0xff;
@@ -219,8 +312,11 @@ void WCHNET_HandleGlobalInt(void)
         i = WCHNET_GetPHYStatus();
         if (i & PHY_Linked_Status) {
             PRINT("PHY Link Success\r\n");
+#if !IPCFG_STATIC
             WCHNET_DHCPStop();
+            dhcp_wait = 1;
             WCHNET_DHCPStart(WCHNET_DHCPCallBack);				//Start DHCP
+#endif
         }
     }
     if (intstat & GINT_STAT_SOCKET) {                             //socket related interrupt
@@ -235,7 +331,12 @@ void WCHNET_HandleGlobalInt(void)
 /********************************************************************
  * @fn      SendFifo
  *
- * @brief   Send Fifo to TCP socket
+ * @brief   Send Fifo to TCP socket. On a slow link (half duplex or
+ *          errors, ETH_LinkState) the library gets ETH_SLOW_SEG bytes
+ *          at a time, every ETH_SLOW_PACE_MS: short segments, few in
+ *          flight, the ACKs get through between them. A replay
+ *          (CTRL_CMD_RESUME) goes out block after block. Without a
+ *          client the blocks are only kept by the retention ring.
  *
  * @param   task_id - The TMOS assigned task ID.
  * @param   events - events to process.  This is a bit map and can
@@ -243,17 +344,50 @@ void WCHNET_HandleGlobalInt(void)
  *
  * @return  none
  */
+__HIGH_CODE
 void SendFifo() {
 	if(socket_connected) {
-		uint32_t len = MIN(app_drv_fifo_length(&app_tx_fifo), RECE_BUF_LEN);
-		if(len) {
-			app_drv_fifo_read(&app_tx_fifo, SocketSendBuf, (uint16_t *)&len);
-			uint8_t stata = WCHNET_SocketSend(socket_connected, SocketSendBuf, &len);
+		TRACE_BEGIN(TRACE_SEND_FIFO, app_drv_fifo_length(&app_tx_fifo), 0);
+		if(ctrl_process())
+			tmos_start_task(eth_TaskID, ETH_SENG_DATA_EVENT, MS1_TO_SYSTEM_TIME(ETH_RETRY_MS));
+		if(!SendLen) {
+			SendLen = stream_fill(SocketSendBuf, SEND_BUF_LEN);
+			SendOffset = 0;
+		}
+		if(SendLen) {
+			// the library may take less than asked: keep the rest for the next call
+			uint8_t slow = ETH_LinkState() & ETH_LINK_SLOW;
+			uint32_t ask = slow ? MIN(SendLen, ETH_SLOW_SEG) : SendLen;
+			uint32_t len = ask;
+			uint8_t stata = WCHNET_SocketSend(socket_connected, &SocketSendBuf[SendOffset], &len);
+			TRACE(TRACE_SOCK_SEND, len, stata);
 	        if(stata)
 	            PRINT("TCP send fail %x\r\n",stata);
+	        else {
+	        	SendOffset += len;
+	        	SendLen -= len;
+	        	STATS_BOOT(BOOT_SEND);
+	        }
+	        if(SendLen && (stata || len < ask))                         // window full, retry later
+	        	tmos_start_task(eth_TaskID, ETH_SENG_DATA_EVENT, MS1_TO_SYSTEM_TIME(ETH_RETRY_MS));
+	        else if(SendLen || resume_busy() || app_drv_fifo_length(&app_tx_fifo) >= SEND_BUF_LEN) {   // next segment or block
+	        	if(slow)
+	        		tmos_start_task(eth_TaskID, ETH_SENG_DATA_EVENT, MS1_TO_SYSTEM_TIME(ETH_SLOW_PACE_MS));
+	        	else
+	        		tmos_set_event(eth_TaskID, ETH_SENG_DATA_EVENT);
+	        }
 	    	SendTime = LocalTime;
 		}
+		TRACE_END(TRACE_SEND_FIFO, app_drv_fifo_length(&app_tx_fifo), SendLen);
 	}
+#if STREAM_RESUME
+	else {
+		// no client: the blocks go only into the retention ring (stream_offline)
+		stream_fill(SocketSendBuf, SEND_BUF_LEN);
+		if(!fifo_dma_busy() && app_drv_fifo_length(&app_tx_fifo) >= SEND_BUF_LEN)
+			tmos_set_event(eth_TaskID, ETH_SENG_DATA_EVENT);
+	}
+#endif
 }
 
 /*********************************************************************
@@ -288,6 +422,7 @@ uint16_t eth_ProcessEvent(uint8_t task_id, uint16_t events)
 
     if(events & ETH_SENG_DATA_EVENT)
     {
+    	TRACE(TRACE_TMOS_ETH, events, 0);
     	SendFifo();
         return (events ^ ETH_SENG_DATA_EVENT);
     }
@@ -295,6 +430,53 @@ uint16_t eth_ProcessEvent(uint8_t task_id, uint16_t events)
     return 0;
 }
 
+/*********************************************************************
+ * @fn      eth_ip_up
+ *
+ * @brief   The address is set: static, the remembered lease at boot or
+ *          a DHCP lease. The clients can connect, SNTP and twsync start.
+ *          A new lease keeps the listen socket, it is not bound to an
+ *          address.
+ *
+ * @return  none
+ */
+static void eth_ip_up(void)
+{
+    STATS_BOOT(BOOT_IP);
+    if (!eth_listen) {
+        WCHNET_CreateTcpSocketListen(); // Create a TCP listen
+        eth_listen = 1;
+    }
+    sntp_start();                   // SNTP to the gateway unless set by the client
+    twsync_start();                 // collector probes
+}
+
+/*********************************************************************
+ * @fn      eth_ip_change
+ *
+ * @brief   DHCP gave another address: the connections made to the old
+ *          one are closed, the stream goes on recording for a resume.
+ *
+ * @return  none
+ */
+static void eth_ip_change(void)
+{
+    u8 i;
+
+    if (socket_connected) {
+        socket_connected = 0;
+        ctrl_reset();
+        stream_offline();
+    }
+    for (i = 0; i < WCHNET_MAX_SOCKET_NUM; i++) {
+        if (socket[i] != 0xff) {
+            PRINT("DHCP: Close Socket %x\r\n", socket[i]);
+            WCHNET_SocketClose(socket[i], TCP_CLOSE_NORMAL);
+            socket[i] = 0xff;
+        }
+    }
+}
+
 /*********************************************************************
  * @fn      WCHNET_DHCPCallBack
  *
@@ -311,22 +493,29 @@ u8 WCHNET_DHCPCallBack(u8 status, void *arg)
 {
     u8 *p;
     u8 tmp[4] = {0, 0, 0, 0};
+    u8 unused;
 
+    dhcp_wait = 0;
     if(!status)
     {
         p = arg;
         PRINT("DHCP Success\r\n");
+        STATS_BOOT(BOOT_DHCP);
+        unused = ipcfg_bound();                                 //the remembered lease was not in use yet
         /*If the obtained IP is the same as the last IP, exit this function.*/
         if(memcmp(IPAddr, p ,sizeof(IPAddr)) == 0
         	&& memcmp(GWIPAddr, &p[4] ,sizeof(GWIPAddr)) == 0
         	&& memcmp(IPMask, &p[8] ,sizeof(IPMask)) == 0)
+        {
+            if(unused)
+                eth_ip_up();
             return READY;
+        }
         /*Determine whether it is the first successful IP acquisition*/
-        if(memcmp(IPAddr, tmp ,sizeof(IPAddr))){
+        if(memcmp(IPAddr, tmp ,sizeof(IPAddr)) && !unused){
             /*The obtained IP is different from the last value,
-             * then disconnect the last connection.*/
-            PRINT("DHCP: Close Socket %x\r\n", SocketId);
-            WCHNET_SocketClose(SocketId, TCP_CLOSE_NORMAL);
+             * then disconnect the last connections.*/
+            eth_ip_change();
         }
         memcpy(IPAddr, p, sizeof(IPAddr));
         memcpy(GWIPAddr, &p[4], sizeof(GWIPAddr));
@@ -339,19 +528,14 @@ u8 WCHNET_DHCPCallBack(u8 status, void *arg)
                (u16)IPMask[2], (u16)IPMask[3]);
         PRINT("DNS1: %d.%d.%d.%d \r\n", p[12], p[13], p[14], p[15]);
         PRINT("DNS2: %d.%d.%d.%d \r\n", p[16], p[17], p[18], p[19]);
-        //PRINT("DHCP: Create TcpSocketListen\r\n");
-        WCHNET_CreateTcpSocketListen(); // Create a TCP listen
+        ipcfg_save(IPAddr, GWIPAddr, IPMask);                   // the next boot starts with it
+        eth_ip_up();
         return READY;
     }
     else
     {
         PRINT("DHCP Fail %02x \r\n", status);
-        /*Determine whether it is the first successful IP acquisition*/
-        if(memcmp(IPAddr, tmp ,sizeof(IPAddr))){
-            /*The obtained IP is different from the last value*/
-            PRINT("DHCP: Close Socket %x\r\n", SocketId);
-            WCHNET_SocketClose(SocketId, TCP_CLOSE_NORMAL);
-        }
+        /*A static or remembered address stays in use, DHCP retries*/
         return NoREADY;
     }
 }
@@ -359,13 +543,16 @@ u8 WCHNET_DHCPCallBack(u8 status, void *arg)
 /*********************************************************************
  * @fn      eth_init
  *
- * @brief   eth_init
+ * @brief   Network start. A static address opens the listen socket at
+ *          once, the lease kept from the previous boot (ipcfg.h) as soon
+ *          as the ARP check on the link finds it free, DHCP confirms it
+ *          behind.
  *
  * @return  none
  */
 void eth_init(void)
 {
-    uint8_t i;
+    uint8_t i, addr;
     eth_TaskID = TMOS_ProcessEventRegister(eth_ProcessEvent);
     PRINT("net version:%x\r\n", WCHNET_GetVer());
     if ( WCHNET_LIB_VER != WCHNET_GetVer()) {
@@ -379,13 +566,27 @@ void eth_init(void)
     }
     PRINT("\r\n");
     TIM2_Init();
+#if FIFO_DMA
+    fifo_dma_init();
+#endif
+#if STREAM_RESUME
+    resume_init();
+    stream_offline();                                            //adverts are recorded from the start
+#endif
+    addr = ipcfg_load(IPAddr, GWIPAddr, IPMask);                 //static or the last lease, else 0.0.0.0
     WCHNET_DHCPSetHostname("WCHNET");                            //Configure DHCP host name
     i = ETH_LibInit(IPAddr, GWIPAddr, IPMask, MACAddr);          //Ethernet library initialize
     mStopIfError(i);
     if (i == WCHNET_ERR_SUCCESS)
         PRINT("WCHNET_LibInit Success\r\n");
+    STATS_BOOT(BOOT_ETH);
     memset(socket, 0xff, WCHNET_MAX_SOCKET_NUM);
+    if (addr == IPCFG_ADDR_SET)                                  //clients need not wait for DHCP
+        eth_ip_up();
+#if !IPCFG_STATIC
+    dhcp_wait = 1;
     WCHNET_DHCPStart(WCHNET_DHCPCallBack);				//Start DHCP
+#endif
 #if KEEPLIVE_ENABLE                                              //Configure keeplive parameters
     {
         struct _KEEP_CFG cfg;
@@ -401,26 +602,44 @@ void eth_init(void)
 /*********************************************************************
  * @fn      eth_process
  *
- * @brief   eth_process
+ * @brief   Network work marked by the interrupts: the library task after
+ *          a frame or once LocalTime has moved, SNTP and the periodic
+ *          send with the time, then TIM2 for the next deadline. A
+ *          finished FIFO copy (fifo_dma) resumes the send task.
  *
  * @return  none
  */
+__HIGH_CODE
 void eth_process(void)
 {
-    /*Ethernet library main task function,
-     * which needs to be called cyclically*/
-    WCHNET_MainTask();
-    /*Query the Ethernet global interrupt,
-     * if there is an interrupt, call the global interrupt handler*/
+    uint32_t wake = idle_take();
+    uint32_t ms = WCHNET_TimeUpdate();
+
+    /*Ethernet library main task function: received frames,
+     * PHY and the protocol timers*/
+    if((wake & IDLE_WAKE_ETH) || ms)
+        WCHNET_MainTask();
+    /*Query the Ethernet global interrupt, it is also raised by
+     * the socket calls of the TMOS tasks, not only by the task above*/
     if(WCHNET_QueryGlobalInt())
     {
         WCHNET_HandleGlobalInt();
     }
+    /*the FIFO copy for the next block is done (fifo_dma)*/
+    if(wake & IDLE_WAKE_DMA)
+        tmos_set_event(eth_TaskID, ETH_SENG_DATA_EVENT);
+    if(!ms && !(wake & (IDLE_WAKE_ETH | IDLE_WAKE_TICK)))
+        return;
+#if IPCFG_CHECK
+    if(ipcfg_guard == IPCFG_GUARD_PROBE && ipcfg_probe(LocalTime))
+        eth_ip_up();                                            //the remembered lease is free
+#endif
+    sntp_process();
 
-    if(socket_connected && (LocalTime - SendTime) >= 250) {
+    if(socket_connected && (LocalTime - SendTime) >= ETH_SEND_PERIOD_MS) {
     	SendTime = LocalTime;
     	SendFifo();
     }
-
+    eth_timer_arm(wake & IDLE_WAKE_TICK);
 }
 /******************************** endfile @ main ******************************/
@@ -0,0 +1,165 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : fifo_dma.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/27
+ * Description        : TX FIFO drain by a memory-to-memory DMA channel
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "CONFIG.h"
+#include "fifo_dma.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define FIFO_DMA_CH             DMA1_Channel7
+#define FIFO_DMA_IRQn           DMA1_Channel7_IRQn
+#define FIFO_DMA_IT_TC          DMA1_IT_TC7
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static app_drv_fifo_t *fifo_dma_fifo;
+static uint8_t *fifo_dma_dst;
+static uint16_t fifo_dma_len;                   // bytes of the read
+static uint16_t fifo_dma_part;                  // up to the end of the ring buffer
+static volatile uint8_t fifo_dma_run;
+
+/*********************************************************************
+ * @fn      fifo_dma_init
+ *
+ * @brief   Memory-to-memory channel, low priority: the ETH MAC has its
+ *          own DMA, the channel only takes the bus cycles the CPU
+ *          leaves.
+ *
+ * @return  none
+ */
+void fifo_dma_init(void)
+{
+    DMA_InitTypeDef DMA_InitStructure = {0};
+
+    RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+    DMA_InitStructure.DMA_DIR = DMA_DIR_PeripheralSRC;
+    DMA_InitStructure.DMA_PeripheralInc = DMA_PeripheralInc_Enable;
+    DMA_InitStructure.DMA_MemoryInc = DMA_MemoryInc_Enable;
+    DMA_InitStructure.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    DMA_InitStructure.DMA_MemoryDataSize = DMA_MemoryDataSize_Byte;
+    DMA_InitStructure.DMA_Mode = DMA_Mode_Normal;
+    DMA_InitStructure.DMA_Priority = DMA_Priority_Low;
+    DMA_InitStructure.DMA_M2M = DMA_M2M_Enable;
+    DMA_Init(FIFO_DMA_CH, &DMA_InitStructure);
+    DMA_ClearITPendingBit(FIFO_DMA_IT_TC);
+    DMA_ITConfig(FIFO_DMA_CH, DMA_IT_TC, ENABLE);
+    NVIC_EnableIRQ(FIFO_DMA_IRQn);
+}
+
+/*********************************************************************
+ * @fn      fifo_dma_start
+ *
+ * @brief   Program and enable the channel, by words if both ends and
+ *          the length allow.
+ *
+ * @return  none
+ */
+__HIGH_CODE
+static void fifo_dma_start(const uint8_t *src, uint8_t *dst, uint16_t len)
+{
+    uint32_t cfg = FIFO_DMA_CH->CFGR & ~(DMA_CFGR1_EN | DMA_CFGR1_PSIZE | DMA_CFGR1_MSIZE);
+
+    if(!(((uint32_t)src | (uint32_t)dst | len) & 3))
+    {
+        cfg |= DMA_PeripheralDataSize_Word | DMA_MemoryDataSize_Word;
+        len >>= 2;
+    }
+    FIFO_DMA_CH->CFGR = cfg;
+    FIFO_DMA_CH->PADDR = (uint32_t)src;
+    FIFO_DMA_CH->MADDR = (uint32_t)dst;
+    FIFO_DMA_CH->CNTR = len;
+    FIFO_DMA_CH->CFGR = cfg | DMA_CFGR1_EN;
+}
+
+/*********************************************************************
+ * @fn      fifo_dma_read
+ *
+ * @brief   Copy len bytes from the head of the FIFO by DMA, in two
+ *          parts if the ring wraps. The FIFO head moves on completion,
+ *          the writers cannot reuse the space being read.
+ *
+ * @param   fifo - FIFO
+ * @param   data - destination
+ * @param   len - bytes, at most the FIFO length
+ *
+ * @return  1 - started, 0 - too short or the channel is busy
+ */
+__HIGH_CODE
+uint8_t fifo_dma_read(app_drv_fifo_t *fifo, uint8_t *data, uint16_t len)
+{
+    uint16_t pos;
+
+    if(len < FIFO_DMA_MIN || fifo_dma_run || len > app_drv_fifo_length(fifo))
+        return 0;
+    pos = fifo->begin & fifo->size_mask;
+    fifo_dma_fifo = fifo;
+    fifo_dma_dst = data;
+    fifo_dma_len = len;
+    fifo_dma_part = MIN(len, fifo->size - pos);
+    fifo_dma_run = 1;
+    fifo_dma_start(&fifo->data[pos], data, fifo_dma_part);
+    return 1;
+}
+
+/*********************************************************************
+ * @fn      fifo_dma_busy
+ *
+ * @return  1 - a copy is in flight
+ */
+uint8_t fifo_dma_busy(void)
+{
+    return fifo_dma_run;
+}
+
+/*********************************************************************
+ * @fn      fifo_dma_abort
+ *
+ * @brief   Stop the channel, the FIFO head stays where it was.
+ *
+ * @return  none
+ */
+void fifo_dma_abort(void)
+{
+    NVIC_DisableIRQ(FIFO_DMA_IRQn);
+    FIFO_DMA_CH->CFGR &= ~DMA_CFGR1_EN;
+    DMA_ClearITPendingBit(FIFO_DMA_IT_TC);
+    fifo_dma_run = 0;
+    NVIC_EnableIRQ(FIFO_DMA_IRQn);
+}
+
+/*********************************************************************
+ * @fn      fifo_dma_isr
+ *
+ * @brief   Transfer complete: the rest after the ring wrap, or the
+ *          read is done and its bytes leave the FIFO.
+ *
+ * @return  1 - the read is complete
+ */
+__HIGH_CODE
+uint8_t fifo_dma_isr(void)
+{
+    DMA_ClearITPendingBit(FIFO_DMA_IT_TC);
+    if(!fifo_dma_run)
+        return 0;
+    if(fifo_dma_part < fifo_dma_len)
+    {
+        fifo_dma_start(fifo_dma_fifo->data, fifo_dma_dst + fifo_dma_part, fifo_dma_len - fifo_dma_part);
+        fifo_dma_part = fifo_dma_len;
+        return 0;
+    }
+    app_drv_fifo_skip(fifo_dma_fifo, fifo_dma_len);
+    fifo_dma_run = 0;
+    return 1;
+}
+
+/******************************** endfile @ fifo_dma ******************************/
@@ -0,0 +1,294 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : gwtime.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/18
+ * Description        : Gateway clock: microseconds from the SysTick counter
+ *                      disciplined to UTC by SNTP, receive time records
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "CONFIG.h"
+#include "debug.h"
+#include "advenc.h"
+#include "gwtime.h"
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+uint8_t gwtime_synced;
+uint8_t gwtime_stamp;
+gwtime_stat_t gwtime_stat;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static uint64_t gwtime_ref_local;               // local time of the last correction
+static uint64_t gwtime_ref_utc;                 // UTC at gwtime_ref_local
+static uint64_t gwtime_anchor_local;            // rate baseline start: local time
+static uint64_t gwtime_anchor_utc;              // and UTC measured there
+static uint32_t gwtime_rate_min;                // shortest baseline for an estimate, us
+static uint8_t  gwtime_twsync;                  // the clock follows TWSYNC_SET
+static uint64_t gwtime_twsync_local;            // local time of the last one
+
+static uint64_t gwtime_rec_last;                // stamp of the last queued record
+static uint8_t  gwtime_rec_flags = 0xFF;        // its flags, 0xFF - the next one is a TIME
+
+/*********************************************************************
+ * @fn      gwtime_local
+ *
+ * @brief   Free running microseconds since boot. SysTick runs from the
+ *          HSE crystal (HCLK/8), the RTC here is clocked by the LSI and
+ *          is a thousand times less stable.
+ *
+ * @return  us
+ */
+uint64_t gwtime_local(void)
+{
+    return gwtime_from_ticks(SysTick_GetCount64());
+}
+
+uint64_t gwtime_from_ticks(uint64_t ticks)
+{
+    return ticks / (SYSTICK_FREQ / 1000000);
+}
+
+/*********************************************************************
+ * @fn      gwtime_utc
+ *
+ * @brief   Local time -> UTC: the last correction point plus the
+ *          elapsed local time scaled by the rate correction.
+ *
+ * @param   local - gwtime_local() value
+ *
+ * @return  UTC us, local itself while the clock is not synced
+ */
+uint64_t gwtime_utc(uint64_t local)
+{
+    int64_t d;
+
+    if(!gwtime_synced)
+        return local;
+    d = (int64_t)(local - gwtime_ref_local);
+    return gwtime_ref_utc + d + d * gwtime_stat.rate / 1000000000;
+}
+
+uint64_t gwtime_now(void)
+{
+    return gwtime_utc(gwtime_local());
+}
+
+/*********************************************************************
+ * @fn      gwtime_sync
+ *
+ * @brief   Apply an SNTP sample. The first one (or an offset above
+ *          GWTIME_STEP_US) steps the clock, the reported offset is 0
+ *          then. Later ones correct the phase, the rate is the
+ *          measured UTC over the local time elapsed since the
+ *          baseline start: the sample noise is divided by a
+ *          baseline that grows up to GWTIME_RATE_SPAN_US.
+ *          Ignored while the collector corrections come in, the first
+ *          sample after them steps.
+ *
+ * @param   t1 - local time the request was sent
+ * @param   t2 - server UTC the request was received
+ * @param   t3 - server UTC the reply was sent
+ * @param   t4 - local time the reply was received
+ *
+ * @return  none
+ */
+void gwtime_sync(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4)
+{
+    uint64_t u1 = gwtime_utc(t1);
+    uint64_t u4 = gwtime_utc(t4);
+    int64_t offset = ((int64_t)(t2 - u1) + (int64_t)(t3 - u4)) / 2;
+    int64_t delay = (int64_t)(u4 - u1) - (int64_t)(t3 - t2);
+    int64_t dt, rate;
+
+    if(gwtime_twsync)
+    {
+        if((int64_t)(t4 - gwtime_twsync_local) < GWTIME_TWSYNC_HOLD_US)
+            return;
+        gwtime_twsync = 0;
+        gwtime_synced = 0;
+    }
+    gwtime_stat.syncs++;
+    gwtime_stat.delay = delay < 0 ? 0 : (uint32_t)delay;
+    gwtime_ref_utc = u4 + offset;
+    gwtime_ref_local = t4;
+    if(!gwtime_synced || offset > GWTIME_STEP_US || offset < -GWTIME_STEP_US)
+    {
+        // step, the rate is measured anew; no offset is left after it
+        gwtime_stat.offset = 0;
+        gwtime_stat.rate = 0;
+        gwtime_synced = 1;
+        gwtime_anchor_local = t4;
+        gwtime_anchor_utc = gwtime_ref_utc;
+        gwtime_rate_min = GWTIME_RATE_MIN_US;
+        return;
+    }
+    gwtime_stat.offset = offset > INT32_MAX ? INT32_MAX : offset < -INT32_MAX ? -INT32_MAX : (int32_t)offset;
+    dt = (int64_t)(t4 - gwtime_anchor_local);
+    if(dt >= gwtime_rate_min)
+    {
+        rate = ((int64_t)(gwtime_ref_utc - gwtime_anchor_utc) - dt) * 1000000000 / dt;
+        gwtime_stat.rate = rate > GWTIME_RATE_MAX ? GWTIME_RATE_MAX :
+                           rate < -GWTIME_RATE_MAX ? -GWTIME_RATE_MAX : (int32_t)rate;
+    }
+    if(dt >= GWTIME_RATE_SPAN_US)
+    {
+        // follow the crystal drift: a new baseline, the rate is kept until it is long enough
+        gwtime_anchor_local = t4;
+        gwtime_anchor_utc = gwtime_ref_utc;
+        gwtime_rate_min = GWTIME_RATE_SPAN_US / 4;
+    }
+}
+
+/*********************************************************************
+ * @fn      gwtime_set
+ *
+ * @brief   Collector correction (TWSYNC_SET): the collector fits its
+ *          time against the gateway clock, the mapping is taken as is.
+ *
+ * @param   local - gwtime_local() of the reference point
+ * @param   utc - collector time there, us
+ * @param   rate - rate correction, ppb
+ *
+ * @return  none
+ */
+void gwtime_set(uint64_t local, uint64_t utc, int32_t rate)
+{
+    int64_t offset = (int64_t)(utc - gwtime_utc(local));
+
+    gwtime_stat.syncs++;
+    // the first correction of an unset clock is a step, not an offset
+    gwtime_stat.offset = !gwtime_synced ? 0 : offset > INT32_MAX ? INT32_MAX :
+                         offset < -INT32_MAX ? -INT32_MAX : (int32_t)offset;
+    gwtime_stat.rate = rate > GWTIME_RATE_MAX ? GWTIME_RATE_MAX : rate < -GWTIME_RATE_MAX ? -GWTIME_RATE_MAX : rate;
+    gwtime_ref_local = local;
+    gwtime_ref_utc = utc;
+    gwtime_twsync_local = gwtime_local();
+    gwtime_twsync = 1;
+    gwtime_synced = 1;
+}
+
+uint8_t gwtime_flags(void)
+{
+    return gwtime_twsync ? GWTIME_SYNCED | GWTIME_TWSYNC : gwtime_synced ? GWTIME_SYNCED : 0;
+}
+
+/*********************************************************************
+ * @fn      gwtime_stamp_enable
+ *
+ * @brief   Client request: receive time records on/off, the next
+ *          record is a TIME.
+ *
+ * @return  none
+ */
+void gwtime_stamp_enable(uint8_t on)
+{
+    gwtime_stamp = on != 0;
+    gwtime_rec_flags = 0xFF;
+}
+
+void gwtime_stamp_reset(void)
+{
+    gwtime_stamp_enable(0);
+}
+
+/*********************************************************************
+ * @fn      gwtime_rec_abs
+ *
+ * @brief   ADV_REC_TIME record.
+ *
+ * @param   out - ADV_TIME_ABS_LEN bytes
+ * @param   ts - time, us
+ * @param   flags - GWTIME_SYNCED or 0
+ *
+ * @return  record length
+ */
+uint8_t gwtime_rec_abs(uint8_t *out, uint64_t ts, uint8_t flags)
+{
+    int i;
+
+    out[0] = ADV_TIME_ABS_LEN - 2;
+    out[1] = ADV_REC_TIME;
+    out[2] = flags;
+    for(i = 0; i < 8; i++)
+        out[3 + i] = (uint8_t)(ts >> (i * 8));
+    return ADV_TIME_ABS_LEN;
+}
+
+/*********************************************************************
+ * @fn      gwtime_rec_put
+ *
+ * @brief   Time record for a stamp: a delta to the last queued one,
+ *          a TIME at the start of the chain or when the clock has
+ *          just been synced. Nothing changes until gwtime_rec_commit().
+ *
+ * @param   out - ADV_TIME_REC_MAX bytes
+ * @param   ts - gwtime_now() at the advert reception
+ *
+ * @return  record length
+ */
+uint8_t gwtime_rec_put(uint8_t *out, uint64_t ts)
+{
+    uint8_t flags = gwtime_flags();
+    uint8_t *p = out + 2;
+    uint64_t z;
+
+    if(flags != gwtime_rec_flags)
+        return gwtime_rec_abs(out, ts, flags);
+    // zigzag: small negative steps of the clock stay short
+    z = (ts - gwtime_rec_last) << 1;
+    if((int64_t)(ts - gwtime_rec_last) < 0)
+        z = ~z;
+    while(z >= 0x80)
+    {
+        *p++ = (uint8_t)z | 0x80;
+        z >>= 7;
+    }
+    *p++ = (uint8_t)z;
+    out[0] = (uint8_t)(p - out - 2);
+    out[1] = ADV_REC_TIME_DELTA;
+    return (uint8_t)(p - out);
+}
+
+void gwtime_rec_commit(uint64_t ts)
+{
+    gwtime_rec_last = ts;
+    gwtime_rec_flags = gwtime_flags();
+}
+
+/*********************************************************************
+ * @fn      gwtime_rec_parse
+ *
+ * @brief   Apply a time record to the running stamp.
+ *
+ * @param   rec - ADV_REC_TIME or ADV_REC_TIME_DELTA record
+ * @param   ts - running stamp, us
+ * @param   flags - its flags
+ *
+ * @return  none
+ */
+void gwtime_rec_parse(const uint8_t *rec, uint64_t *ts, uint8_t *flags)
+{
+    uint64_t z = 0;
+    int i;
+
+    if(rec[1] == ADV_REC_TIME)
+    {
+        *flags = rec[2];
+        for(i = 7; i >= 0; i--)
+            z = (z << 8) | rec[3 + i];
+        *ts = z;
+        return;
+    }
+    for(i = 0; i < rec[0] && i < 10; i++)
+        z |= (uint64_t)(rec[2 + i] & 0x7F) << (i * 7);
+    *ts += (z >> 1) ^ (0 - (z & 1));
+}
+
+/******************************** endfile @ gwtime ******************************/
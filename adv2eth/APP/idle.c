@@ -0,0 +1,71 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : idle.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/26
+ * Description        : Main loop wake flags and idle accounting
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "debug.h"
+#include "idle.h"
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+volatile uint32_t idle_wake = IDLE_WAKE_ETH | IDLE_WAKE_TICK | IDLE_WAKE_BLE | IDLE_WAKE_DMA;
+idle_stat_t idle_stat;
+
+/*********************************************************************
+ * @fn      idle_take
+ *
+ * @brief   Fetch and clear the wake flags, count the pass. An interrupt
+ *          after this sets its flag again and keeps the loop out of WFI
+ *          until the next pass has seen it.
+ *
+ * @return  IDLE_WAKE_* bits
+ */
+uint32_t idle_take(void)
+{
+    idle_stat.loops++;
+    return __atomic_exchange_n(&idle_wake, 0, __ATOMIC_RELAXED);
+}
+
+/*********************************************************************
+ * @fn      idle_slept
+ *
+ * @brief   Account one WFI.
+ *
+ * @param   t0 - SysTick when WFI was entered
+ *
+ * @return  none
+ */
+void idle_slept(uint64_t t0)
+{
+    idle_stat.sleeps++;
+    idle_stat.idle_ticks += SysTick_GetCount64() - t0;
+}
+
+/*********************************************************************
+ * @fn      idle_ratio
+ *
+ * @brief   Share of the time spent in WFI since the previous call.
+ *
+ * @return  per mille
+ */
+uint32_t idle_ratio(void)
+{
+    uint64_t now = SysTick_GetCount64();
+    uint64_t dt = now - idle_stat.mark;
+    uint64_t di = idle_stat.idle_ticks - idle_stat.mark_idle;
+
+    idle_stat.mark = now;
+    idle_stat.mark_idle = idle_stat.idle_ticks;
+    if(!dt)
+        return 0;
+    return (uint32_t)(di * 1000 / dt);
+}
+
+/******************************** endfile @ idle ******************************/
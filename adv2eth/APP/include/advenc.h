@@ -0,0 +1,130 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advenc.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/16
+ * Description        : Compact advert records: per-connection device
+ *                      dictionary, handles instead of MACs, payload deltas
+ *********************************************************************************/
+
+#ifndef ADVENC_H
+#define ADVENC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include "ctrl.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define ADV_ENC_FULL            0       // v1 frames
+#define ADV_ENC_COMPACT         1       // compact records
+
+// Dictionary entries (LRU), handles 0..ADV_DICT_SIZE-1
+#ifndef ADV_DICT_SIZE
+#define ADV_DICT_SIZE           64
+#endif
+// Longest payload kept for deltas, longer ones are sent whole
+#ifndef ADV_DICT_DATA_MAX
+#define ADV_DICT_DATA_MAX       31
+#endif
+
+/*
+ * Compact record, byte 1 is ADV_REC_* (never a v1 type byte):
+ *  NEW    [len][type][handle][adTypes][phyTypes][rssi][mac 6][data: len]
+ *  DATA   [len][type][handle][rssi][data: len]
+ *  SAME   [0][type][handle][rssi]
+ *  DELTA  [len][type][handle][rssi][bitmap: (plen+7)/8][changed bytes]
+ * handle - 1 byte, 2 bytes (LE) with ADV_REC_WIDE.
+ * NEW binds the handle to the MAC, type and PHY byte (a reused handle
+ * replaces the evicted device). DELTA: bit i of the bitmap set - byte i
+ * of the last payload of the handle is replaced by the next changed byte.
+ * ADV_SVC_DICT service frame [mode][size LE16]: the dictionary is empty.
+ */
+#define ADV_REC_TAG             0x80
+#define ADV_REC_TAG_MASK        0xF8
+#define ADV_REC_KIND_MASK       0xFE
+#define ADV_REC_NEW             0x80
+#define ADV_REC_DATA            0x82
+#define ADV_REC_SAME            0x84
+#define ADV_REC_DELTA           0x86
+#define ADV_REC_WIDE            0x01
+
+/*
+ * Receive time record (gwtime.h), queued before the advert record it
+ * stamps, an ADV_SVC_DICT frame may come in between:
+ *  TIME        [9][type][flags][time: 8 LE]
+ *  TIME_DELTA  [n][type][zigzag LEB128 of time - previous time: n bytes]
+ * time - UTC us with GWTIME_SYNCED in flags, else us since boot.
+ * The first stamp after connect or CTRL_CMD_TIMESTAMP, after the clock
+ * is synced and the first one of every v2 block is a TIME.
+ */
+#define ADV_REC_TIME            0x88
+#define ADV_REC_TIME_DELTA      0x89
+#define ADV_REC_TIME_MASK       0xFE
+#define ADV_TIME_ABS_LEN        11
+#define ADV_TIME_REC_MAX        12
+
+#define ADV_REC_MAX             (12 + 1 + 255)
+#define ADV_DICT_SVC_LEN        3
+// ObserverSendMsg() output: time record, ADV_SVC_DICT frame and a record
+#define ADV_ENC_OUT_MAX         (ADV_TIME_REC_MAX + ADV_HDR_LEN + ADV_DICT_SVC_LEN + ADV_REC_MAX)
+
+/*********************************************************************
+ * MACROS
+ */
+
+/*
+ * Record length from its first two bytes: v1 frame, service frame, compact
+ * or time record
+ */
+static inline uint16_t adv_rec_len(uint8_t b0, uint8_t b1)
+{
+    if((b1 & ADV_REC_TIME_MASK) == ADV_REC_TIME)
+        return 2 + b0;
+    if((b1 & ADV_REC_TAG_MASK) != ADV_REC_TAG)
+        return ADV_HDR_LEN + b0;
+    return 4 + (b1 & ADV_REC_WIDE) + ((b1 & ADV_REC_KIND_MASK) == ADV_REC_NEW ? 8 : 0) + b0;
+}
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+extern uint8_t advenc_mode;
+
+/*
+ * Client request: ADV_ENC_FULL/ADV_ENC_COMPACT, the dictionary starts empty
+ */
+extern void advenc_set_mode(uint8_t mode);
+
+/*
+ * New connection: full frames, empty dictionary
+ */
+extern void advenc_reset(void);
+
+/*
+ * Encode a v1 frame into out (ADV_ENC_OUT_MAX), returns the length
+ */
+extern uint16_t advenc_encode(const uint8_t *frame, uint8_t *out);
+
+/*
+ * The last encoded record is queued: update the dictionary
+ */
+extern void advenc_commit(const uint8_t *frame);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ADVENC_H */
@@ -92,6 +92,15 @@ void app_drv_fifo_push(app_drv_fifo_t *fifo, uint8_t data);
  */
 uint8_t app_drv_fifo_pop(app_drv_fifo_t *fifo);
 
+/*!
+ * Reads a byte without removing it
+ *
+ * \param [IN] fifo   Pointer to the FIFO object
+ * \param [IN] offset Offset from the oldest byte, < FIFO length
+ * \retval data       data at the offset
+ */
+uint8_t app_drv_fifo_peek(app_drv_fifo_t *fifo, uint16_t offset);
+
 /*!
  * Flushes the FIFO
  *
@@ -99,6 +108,14 @@ uint8_t app_drv_fifo_pop(app_drv_fifo_t *fifo);
  */
 void app_drv_fifo_flush(app_drv_fifo_t *fifo);
 
+/*!
+ * Discards the oldest bytes
+ *
+ * \param [IN] fifo   Pointer to the FIFO object
+ * \param [IN] length Number of bytes, <= FIFO length
+ */
+void app_drv_fifo_skip(app_drv_fifo_t *fifo, uint16_t length);
+
 /*!
  * Checks if the FIFO is empty
  *
@@ -0,0 +1,89 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : ctrl.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/02
+ * Description        : Control commands received on the TCP stream socket
+ *                      and service frames sent back in the advert stream
+ *********************************************************************************/
+
+#ifndef CTRL_H
+#define CTRL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+/*
+ * Command from the client: [cmd][len][payload: len bytes]
+ */
+#define CTRL_BUF_LEN            64
+
+#define CTRL_CMD_TRACE_DUMP     0x01    // dump trace_ring, answer: ADV_SVC_TRACE frames
+#define CTRL_CMD_STATS          0x02    // statistics, answer: ADV_SVC_STATS frame
+#define CTRL_CMD_FRAMING        0x03    // [ver]: stream framing STREAM_V1/STREAM_V2 (stream.h)
+#define CTRL_CMD_ENCODING       0x04    // [mode]: ADV_ENC_FULL/ADV_ENC_COMPACT records (advenc.h)
+#define CTRL_CMD_TIMESTAMP      0x05    // [on]: receive time records before adverts (gwtime.h)
+#define CTRL_CMD_SNTP           0x06    // [ip 4]: SNTP server, 0.0.0.0 - the DHCP gateway (sntp.h)
+#define CTRL_CMD_COMPRESS       0x07    // [mode]: v2 block compression STREAM_LZ_OFF/STREAM_LZ_ON (stream.h)
+#define CTRL_CMD_RESUME         0x08    // [seq LE 4]: v2 framing, the retained blocks from seq on first (resume.h)
+
+/*
+ * Service frame: same 10-byte header as an advert frame,
+ * adTypes == ADV_SVC_MARKER (not a valid event/address type),
+ *  [0]    data length
+ *  [1]    ADV_SVC_MARKER
+ *  [2]    service id ADV_SVC_*
+ *  [3]    0
+ *  [4..7] data offset in the object (LE)
+ *  [8..9] object total size (LE)
+ */
+#define ADV_HDR_LEN             10
+#define ADV_SVC_MARKER          0xFF
+#define ADV_SVC_DATA_MAX        240
+
+#define ADV_SVC_TRACE           0x01    // trace_ring image
+#define ADV_SVC_STATS           0x02    // gw_stats_rep_t
+#define ADV_SVC_DICT            0x03    // device dictionary reset (advenc.h)
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Parse bytes received from the client
+ */
+extern void ctrl_input(uint8_t *buf, uint32_t len);
+
+/*
+ * Fill the header of a service frame
+ */
+extern void ctrl_svc_hdr(uint8_t *hdr, uint8_t svc, uint32_t offset, uint16_t total, uint8_t len);
+
+/*
+ * Queue pending service frames into the TX FIFO, returns 1 while something is left
+ */
+extern uint8_t ctrl_process(void);
+
+/*
+ * Drop the parser state and pending answers (connection closed)
+ */
+extern void ctrl_reset(void);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CTRL_H */
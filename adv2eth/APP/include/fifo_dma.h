@@ -0,0 +1,74 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : fifo_dma.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/27
+ * Description        : TX FIFO drain by a memory-to-memory DMA channel: the
+ *                      main loop runs TMOS while a large block is copied
+ *********************************************************************************/
+
+#ifndef FIFO_DMA_H
+#define FIFO_DMA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include "app_drv_fifo.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// 1 - FIFO reads of FIFO_DMA_MIN bytes and more go through DMA1 channel 7
+#ifndef FIFO_DMA
+#define FIFO_DMA                1
+#endif
+
+// Shorter reads are faster done by the CPU than set up and waited for
+#ifndef FIFO_DMA_MIN
+#define FIFO_DMA_MIN            256
+#endif
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Clock and configure the channel, completion interrupt on
+ */
+extern void fifo_dma_init(void);
+
+/*
+ * Start copying len bytes from the head of the FIFO. 1 - started, the bytes
+ * leave the FIFO on completion (IDLE_WAKE_DMA); 0 - read them with the CPU
+ */
+extern uint8_t fifo_dma_read(app_drv_fifo_t *fifo, uint8_t *data, uint16_t len);
+
+/*
+ * A copy is in flight
+ */
+extern uint8_t fifo_dma_busy(void);
+
+/*
+ * Stop a copy in flight, the FIFO is left as it was. Before a flush
+ */
+extern void fifo_dma_abort(void);
+
+/*
+ * DMA1_Channel7_IRQHandler: 1 - the copy is complete
+ */
+extern uint8_t fifo_dma_isr(void);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FIFO_DMA_H */
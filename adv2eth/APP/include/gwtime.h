@@ -0,0 +1,138 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : gwtime.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/18
+ * Description        : Gateway clock: microseconds from the SysTick counter
+ *                      disciplined to UTC by SNTP, receive time records
+ *********************************************************************************/
+
+#ifndef GWTIME_H
+#define GWTIME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// ADV_REC_TIME flags
+#define GWTIME_SYNCED           0x01    // UTC, else time since boot
+#define GWTIME_TWSYNC           0x02    // UTC of the collector time base (twsync.h)
+
+// Offset above which the clock is stepped and the rate estimate restarts, us
+#ifndef GWTIME_STEP_US
+#define GWTIME_STEP_US          128000
+#endif
+// Rate correction limit, ppb (HSE crystal tolerance and then some)
+#define GWTIME_RATE_MAX         500000
+// Rate baseline: the first estimate after a step, the longest one, us
+#define GWTIME_RATE_MIN_US      4000000
+#define GWTIME_RATE_SPAN_US     3600000000ll
+// SNTP samples are ignored this long after the last TWSYNC_SET, us
+#define GWTIME_TWSYNC_HOLD_US   60000000ll
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * Clock state, also reported in gw_stats_rep_t
+ */
+typedef struct
+{
+    uint32_t syncs;             // samples applied
+    int32_t  offset;            // last measured offset, us
+    uint32_t delay;             // last round trip delay, us
+    int32_t  rate;              // rate correction, ppb
+} gwtime_stat_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+extern uint8_t gwtime_synced;
+extern uint8_t gwtime_stamp;            // the client wants receive time records
+extern gwtime_stat_t gwtime_stat;
+
+/*
+ * Free running microseconds since boot (SysTick)
+ */
+extern uint64_t gwtime_local(void);
+
+/*
+ * SysTick count -> gwtime_local() us
+ */
+extern uint64_t gwtime_from_ticks(uint64_t ticks);
+
+/*
+ * Local time -> UTC us, or the local time itself before the first sync
+ */
+extern uint64_t gwtime_utc(uint64_t local);
+
+/*
+ * UTC us now (gwtime_utc(gwtime_local()))
+ */
+extern uint64_t gwtime_now(void);
+
+/*
+ * SNTP sample: t1/t4 - local request send/reply receive time,
+ * t2/t3 - server UTC receive/send time, us
+ */
+extern void gwtime_sync(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4);
+
+/*
+ * Collector correction: UTC utc at the local time local, rate ppb
+ */
+extern void gwtime_set(uint64_t local, uint64_t utc, int32_t rate);
+
+/*
+ * Time record flags of gwtime_now(): GWTIME_SYNCED, GWTIME_TWSYNC
+ */
+extern uint8_t gwtime_flags(void);
+
+/*
+ * Client request: receive time records on/off
+ */
+extern void gwtime_stamp_enable(uint8_t on);
+
+/*
+ * New connection: no receive time records
+ */
+extern void gwtime_stamp_reset(void);
+
+/*
+ * Time record for the stamp ts into out (ADV_TIME_REC_MAX), returns the length
+ */
+extern uint8_t gwtime_rec_put(uint8_t *out, uint64_t ts);
+
+/*
+ * The last record is queued, the next one is a delta to ts
+ */
+extern void gwtime_rec_commit(uint64_t ts);
+
+/*
+ * Absolute time record into out (ADV_TIME_ABS_LEN), returns the length
+ */
+extern uint8_t gwtime_rec_abs(uint8_t *out, uint64_t ts, uint8_t flags);
+
+/*
+ * Apply a time record to the running stamp *ts / *flags
+ */
+extern void gwtime_rec_parse(const uint8_t *rec, uint64_t *ts, uint8_t *flags);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* GWTIME_H */
@@ -0,0 +1,82 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : idle.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/26
+ * Description        : Main loop wake flags and idle accounting: the
+ *                      interrupts mark the pending work, the loop runs
+ *                      only that and sleeps in WFI (HAL_IdleWFI) otherwise
+ *********************************************************************************/
+
+#ifndef IDLE_H
+#define IDLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// idle_wake bits, set by the interrupt handlers
+#define IDLE_WAKE_ETH           0x01        // ETH_IRQHandler: frame in or out, link
+#define IDLE_WAKE_TICK          0x02        // TIM2_IRQHandler: network deadline (eth_timer_arm)
+#define IDLE_WAKE_BLE           0x04        // BB_IRQHandler: controller event for TMOS
+#define IDLE_WAKE_DMA           0x08        // DMA1_Channel7_IRQHandler: FIFO copy done (fifo_dma)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+    uint32_t loops;             // main loop passes
+    uint32_t sleeps;            // WFI entered
+    uint64_t idle_ticks;        // SysTick ticks spent in WFI
+    uint64_t mark;              // SysTick of the last idle_ratio()
+    uint64_t mark_idle;         // idle_ticks at that time
+} idle_stat_t;
+
+extern volatile uint32_t idle_wake;
+extern idle_stat_t idle_stat;
+
+/*********************************************************************
+ * MACROS
+ */
+
+// From an interrupt handler: work for the main loop, WFI must not be entered
+#define IDLE_WAKE(f)            __atomic_fetch_or(&idle_wake, (f), __ATOMIC_RELAXED)
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Once per main loop pass: the wake flags set since the previous call
+ */
+extern uint32_t idle_take(void);
+
+/*
+ * WFI done, t0 - SysTick when it was entered
+ */
+extern void idle_slept(uint64_t t0);
+
+/*
+ * Time in WFI since the previous call, per mille
+ */
+extern uint32_t idle_ratio(void);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IDLE_H */
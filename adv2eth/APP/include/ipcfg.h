@@ -0,0 +1,139 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : ipcfg.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/29
+ * Description        : Address of the gateway at boot: static or the last
+ *                      DHCP lease kept in flash
+ *********************************************************************************/
+
+#ifndef IPCFG_H
+#define IPCFG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// 1 - fixed address IPCFG_STATIC_IP/GW/MASK, no DHCP
+#ifndef IPCFG_STATIC
+#define IPCFG_STATIC            0
+#endif
+
+#ifndef IPCFG_STATIC_IP
+#define IPCFG_STATIC_IP         192, 168, 1, 200
+#endif
+#ifndef IPCFG_STATIC_GW
+#define IPCFG_STATIC_GW         192, 168, 1, 1
+#endif
+#ifndef IPCFG_STATIC_MASK
+#define IPCFG_STATIC_MASK       255, 255, 255, 0
+#endif
+
+// 1 - the last DHCP lease is kept in flash and used from the start, DHCP confirms or replaces it
+#ifndef IPCFG_LEASE_KEEP
+#define IPCFG_LEASE_KEEP        1
+#endif
+
+// Flash page of the lease: FLASH_ErasePage_Fast/FLASH_ProgramPage_Fast page below the BLE SNV pages
+#define IPCFG_PAGE_SIZE         256
+#ifndef IPCFG_LEASE_ADDR
+#define IPCFG_LEASE_ADDR        (BLE_SNV_ADDR - IPCFG_PAGE_SIZE)
+#endif
+
+#define IPCFG_MAGIC             0x3150494C  // "LIP1"
+
+// 1 - the remembered lease is used only after an ARP check: nobody has the address and the router answers,
+// else the gateway waits for DHCP. Until then the driver neither answers for the address nor sends from it
+#ifndef IPCFG_PROBE
+#define IPCFG_PROBE             1
+#endif
+#define IPCFG_CHECK             (IPCFG_LEASE_KEEP && IPCFG_PROBE && !IPCFG_STATIC)
+
+#define IPCFG_PROBE_NUM         2           // ARP requests for the address and for the router, from 0.0.0.0
+#define IPCFG_PROBE_GAP_MS      50          // between them, the answers are awaited as long after the last one
+
+// ipcfg_load()
+#define IPCFG_ADDR_NONE         0           // wait for DHCP
+#define IPCFG_ADDR_SET          1           // static, use it
+#define IPCFG_ADDR_PROBE        2           // the remembered lease, use it once ipcfg_probe() confirms it
+
+// ipcfg_guard
+#define IPCFG_GUARD_OFF         0           // the address is ours
+#define IPCFG_GUARD_PROBE       1           // the ARP check runs
+#define IPCFG_GUARD_WAIT        2           // taken or another network: wait for DHCP
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * Lease record at IPCFG_LEASE_ADDR, the rest of the page is erased
+ */
+typedef struct
+{
+    uint32_t magic;             // IPCFG_MAGIC
+    uint8_t  ip[4];
+    uint8_t  gw[4];
+    uint8_t  mask[4];
+    uint32_t check;             // ~(magic ^ ip ^ gw ^ mask) as LE words
+} ipcfg_lease_t;
+
+extern volatile uint8_t ipcfg_guard;        // IPCFG_GUARD_*
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Address to start with: IPCFG_ADDR_*
+ */
+extern uint8_t ipcfg_load(uint8_t *ip, uint8_t *gw, uint8_t *mask);
+
+/*
+ * Main loop while ipcfg_guard is IPCFG_GUARD_PROBE: send the ARP requests once the link is up,
+ * 1 - the remembered lease is free and the router answers, use it
+ */
+extern uint8_t ipcfg_probe(uint32_t now);
+
+/*
+ * DHCP bound: the address is confirmed, the check stops. Returns the previous ipcfg_guard
+ */
+#if IPCFG_CHECK
+extern uint8_t ipcfg_bound(void);
+#else
+#define ipcfg_bound()           IPCFG_GUARD_OFF
+#endif
+
+/*
+ * ETH interrupt while ipcfg_guard is set: watch ARP for the address and the router,
+ * 0 - drop the frame, the stack would answer for the address
+ */
+extern uint8_t ipcfg_eth_rx(const uint8_t *frame, uint32_t len);
+
+/*
+ * ETH driver while ipcfg_guard is set: 0 - drop the frame, it is sent from the address
+ */
+extern uint8_t ipcfg_eth_tx(const uint8_t *frame, uint32_t len);
+
+/*
+ * DHCP bound: keep the lease for the next boot, flash is written only when it changed
+ */
+extern void ipcfg_save(const uint8_t *ip, const uint8_t *gw, const uint8_t *mask);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IPCFG_H */
@@ -0,0 +1,69 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : lz.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/20
+ * Description        : LZ4 block format compressor for v2 stream blocks,
+ *                      static hash table, the window is one block
+ *********************************************************************************/
+
+#ifndef LZ_H
+#define LZ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+/*
+ * Output is a plain LZ4 block (no frame, no checksum), any LZ4 block
+ * decoder reads it:
+ *  token: literal count (high nibble), match length - 4 (low nibble),
+ *         15 - continued in bytes of 255 and a last byte < 255
+ *  literals, match offset (LE16, 1..65535)
+ * The last 5 bytes are literals, the last match starts 12 bytes or more
+ * before the end.
+ */
+#define LZ_MIN_MATCH            4
+#define LZ_LAST_LITERALS        5
+#define LZ_MFLIMIT              12
+
+// Hash table: 1 << LZ_HASH_LOG entries of uint16_t. A block is at most SEND_BUF_LEN bytes:
+// 512 entries save 1 KB of RAM against 1024 for about 1% more output (lzbench)
+#ifndef LZ_HASH_LOG
+#define LZ_HASH_LOG             9
+#endif
+
+// Worst case output for len input bytes
+#define LZ_BOUND(len)           ((len) + (len) / 255 + 16)
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Compress len bytes (< 65536), returns the output length, 0 - does not fit into max
+ */
+extern uint16_t lz_compress(const uint8_t *src, uint16_t len, uint8_t *dst, uint16_t max);
+
+/*
+ * Decompress a block, returns the output length, -1 - bad block or does not fit into max
+ */
+extern int32_t lz_decompress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t max);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LZ_H */
@@ -17,14 +17,59 @@
 extern "C" {
 #endif
 
+/*********************************************************************
+ * Memory profiles: how the RAM of the stack is split between receive and send
+ *  NET_PROFILE_STREAM   - one client reads the advert stream and sends only short commands: a small
+ *                         receive buffer, 3 send segments in flight (the default)
+ *  NET_PROFILE_MULTI    - up to 3 TCP clients, a receive buffer each, the last one connected gets the stream,
+ *                         the send segments are shared: only the stream sends much
+ *  NET_PROFILE_BALANCED - the WCH sample split: receive buffer of 2 MSS, 2 send segments
+ * Each send segment costs an MSS in the WCHNET heap and in the resume ring (resume.h) and a MAC Tx
+ * buffer: a 4th one does not fit in 64K next to the ring, HAL/Link.ld checks the sum.
+ * NET_RESUME_BUF - the resume ring: the window, the block behind it and in NET_PROFILE_STREAM one MSS
+ * more for the records made while the client connects again.
+ */
+#define NET_PROFILE_STREAM            1
+#define NET_PROFILE_MULTI             2
+#define NET_PROFILE_BALANCED          3
+
+#ifndef NET_PROFILE
+#define NET_PROFILE                   NET_PROFILE_STREAM
+#endif
+
+#if (NET_PROFILE == NET_PROFILE_STREAM)
+#define NET_NUM_TCP                   1
+#define NET_RECV_BUF                  512                  /* commands: a few bytes, ctrl.c */
+#define NET_NUM_TCP_SEG               3                    /* TCP send window of 3 MSS */
+#define NET_NUM_POOL_BUF              3                    /* received frames: ACKs and commands */
+#define NET_TXBUFNB                   3                    /* the window back to back */
+#define NET_RESUME_BUF                ((NET_NUM_TCP_SEG+1)*WCHNET_TCP_MSS+SEND_BUF_LEN)
+#elif (NET_PROFILE == NET_PROFILE_MULTI)
+#define NET_NUM_TCP                   3
+#define NET_RECV_BUF                  512
+#define NET_NUM_TCP_SEG               3
+#define NET_NUM_POOL_BUF              3                    /* 3 receive buffers already take the RAM */
+#define NET_TXBUFNB                   3
+#define NET_RESUME_BUF                (NET_NUM_TCP_SEG*WCHNET_TCP_MSS+SEND_BUF_LEN)
+#elif (NET_PROFILE == NET_PROFILE_BALANCED)
+#define NET_NUM_TCP                   1
+#define NET_RECV_BUF                  (WCHNET_TCP_MSS*2)
+#define NET_NUM_TCP_SEG               (NET_NUM_TCP*2)
+#define NET_NUM_POOL_BUF              (NET_NUM_TCP*2+2)
+#define NET_TXBUFNB                   3
+#define NET_RESUME_BUF                (NET_NUM_TCP_SEG*WCHNET_TCP_MSS+SEND_BUF_LEN)
+#else
+  #error "NET_PROFILE Error, Please Config NET_PROFILE_STREAM, NET_PROFILE_MULTI or NET_PROFILE_BALANCED"
+#endif
+
 /*********************************************************************
  * socket configuration, IPRAW + UDP + TCP + TCP_LISTEN = number of sockets
  */
 #define WCHNET_NUM_IPRAW              0  /* Number of IPRAW connections */
 
-#define WCHNET_NUM_UDP                1  /* The number of UDP connections */
+#define WCHNET_NUM_UDP                2  /* The number of UDP connections: SNTP, twsync */
 
-#define WCHNET_NUM_TCP                1  /* Number of TCP connections (server + client) */
+#define WCHNET_NUM_TCP                NET_NUM_TCP  /* Number of TCP connections (server + client) */
 
 #define WCHNET_NUM_TCP_LISTEN         1  /* Number of TCP listening */
 
@@ -36,7 +81,8 @@ extern "C" {
 /*********************************************************************
  * MAC queue configuration
  */
-#define ETH_TXBUFNB                   1    /* The number of descriptors sent by the MAC  */
+#define ETH_TXBUFNB                   NET_TXBUFNB  /* The number of descriptors sent by the MAC: a TCP window of
+                                                    segments (WCHNET_NUM_TCP_SEG) and an ACK queue back to back */
 
 #define ETH_RXBUFNB                   4    /* Number of MAC received descriptors  */
 
@@ -68,14 +114,15 @@ extern "C" {
 /*********************************************************************
   *  Memory related configuration
  */
-/*If a single socket cannot reach full speed,
- * try to increase RECE_BUF_LEN to (WCHNET_TCP_MSS*4)
- * and increase WCHNET_NUM_TCP_SEG to (WCHNET_NUM_TCP*4)*/
-#define RECE_BUF_LEN                  (WCHNET_TCP_MSS*2)   /* socket receive buffer size */
+/* The send window follows NET_NUM_TCP_SEG, the receive side the profile,
+ * the stream itself is sent in blocks of SEND_BUF_LEN whatever the profile */
+#define RECE_BUF_LEN                  NET_RECV_BUF         /* socket receive buffer size, per TCP connection */
+
+#define SEND_BUF_LEN                  (WCHNET_TCP_MSS*2)   /* stream block: SocketSendBuf, v2 block limit */
 
 #define WCHNET_NUM_PBUF               (WCHNET_MAX_SOCKET_NUM+WCHNET_NUM_TCP)   /* Number of PBUF structures */
 
-#define WCHNET_NUM_TCP_SEG            (WCHNET_NUM_TCP*2)   /* The number of TCP segments used to send */
+#define WCHNET_NUM_TCP_SEG            NET_NUM_TCP_SEG      /* The number of TCP segments used to send */
 
 #define WCHNET_MEM_HEAP_SIZE          (((WCHNET_TCP_MSS+0x10+54)*WCHNET_NUM_TCP_SEG)+ETH_TX_BUF_SZE+64) /* memory heap size */
 
@@ -87,7 +134,7 @@ extern "C" {
 
 #define WCHNET_MEM_ALIGNMENT          4    /* 4 byte alignment */
 
-#define WCHNET_NUM_POOL_BUF           (WCHNET_NUM_TCP*2+2)   /* The number of POOL BUFs, the number of receive queues */
+#define WCHNET_NUM_POOL_BUF           NET_NUM_POOL_BUF     /* The number of POOL BUFs, the number of receive queues */
 
 #define WCHNET_SIZE_POOL_BUF     (((WCHNET_TCP_MSS + 40 + 14 + 4) + 3) & ~3) /* Buffer size for receiving a single packet */
 
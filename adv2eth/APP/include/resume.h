@@ -0,0 +1,102 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : resume.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/28
+ * Description        : Retention ring of the last v2 blocks: recording
+ *                      without a client and the replay after a reconnect
+ *                      (CTRL_CMD_RESUME)
+ *********************************************************************************/
+
+#ifndef RESUME_H
+#define RESUME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// 1 - every v2 block is kept in the ring, adverts are recorded without a client
+#ifndef STREAM_RESUME
+#define STREAM_RESUME           1
+#endif
+
+// Ring size, the oldest blocks are dropped to make room. At least the send window (net_config.h) and one
+// block: what was in flight when the connection broke is replayed, 8760 bytes in NET_PROFILE_STREAM
+#ifndef RESUME_BUF_LEN
+#define RESUME_BUF_LEN          NET_RESUME_BUF
+#endif
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+    uint16_t len;               // bytes held
+    uint16_t blocks;            // blocks held
+    uint32_t first;             // sequence number of the oldest one
+    uint32_t next;              // after the newest one
+} resume_info_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Empty ring
+ */
+extern void resume_init(void);
+
+/*
+ * A v2 block was made (stream_pack): keep it. 1 - a replay runs, the block
+ * is queued behind it and goes out by resume_fill(); 0 - the caller sends it
+ */
+extern uint8_t resume_put(const uint8_t *blk, uint16_t len);
+
+/*
+ * Client request: replay the blocks from sequence number seq on, the
+ * older ones are gone, the newer ones not made yet
+ */
+extern void resume_start(uint32_t seq);
+
+/*
+ * Connection closed: the replay stops, the blocks stay
+ */
+extern void resume_stop(void);
+
+/*
+ * A replay runs
+ */
+#if STREAM_RESUME
+extern uint8_t resume_busy(void);
+#else
+#define resume_busy()           0
+#endif
+
+/*
+ * Copy the next block of the replay into buf, 0 - the replay is done
+ */
+extern uint16_t resume_fill(uint8_t *buf, uint16_t size);
+
+/*
+ * What is held, for the statistics
+ */
+extern void resume_info(resume_info_t *info);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RESUME_H */
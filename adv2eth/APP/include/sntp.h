@@ -0,0 +1,77 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : sntp.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/18
+ * Description        : SNTP client (RFC 4330) on the UDP socket, feeds
+ *                      the gateway clock (gwtime.h)
+ *********************************************************************************/
+
+#ifndef SNTP_H
+#define SNTP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define SNTP_PORT               123
+#define SNTP_LOCAL_PORT         1123
+#define SNTP_MSG_LEN            48
+
+// Poll interval, ms: fast until SNTP_FAST_SAMPLES samples are taken
+#ifndef SNTP_POLL_MS
+#define SNTP_POLL_MS            64000
+#endif
+#define SNTP_POLL_FAST_MS       8000
+#define SNTP_FAST_SAMPLES       8
+// Exchanges per poll, the one with the shortest round trip is used
+#define SNTP_BURST              4
+// No reply, ms: the exchange is lost
+#define SNTP_TIMEOUT_MS         1000
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Server IP, 0.0.0.0 - the gateway given by DHCP
+ */
+extern uint8_t sntp_server[4];
+
+/*
+ * Address is known: create the UDP socket and start polling
+ */
+extern void sntp_start(void);
+
+/*
+ * Client request: server IP, polled at once
+ */
+extern void sntp_set_server(const uint8_t *ip);
+
+/*
+ * LocalTime of the next request or reply timeout
+ */
+extern uint32_t sntp_due(void);
+
+/*
+ * Main loop: send requests, time out lost replies
+ */
+extern void sntp_process(void);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SNTP_H */
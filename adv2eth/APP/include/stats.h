@@ -0,0 +1,156 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : stats.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/05
+ * Description        : Runtime statistics, RAM pool high-water marks
+ *********************************************************************************/
+
+#ifndef STATS_H
+#define STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define STATS_PAINT_BYTE        0xA5
+#define STATS_PAINT_WORD        0xA5A5A5A5
+#define STATS_UNKNOWN           0xFFFFFFFF
+
+#define STATS_VERSION           10
+
+// Boot phases, gw_stats.boot_ms[]: ms since reset when first reached
+#define BOOT_BLE                0           // WCHBLE_Init(), HAL_Init() done
+#define BOOT_ETH                1           // MAC and PHY started (ETH_LibInit)
+#define BOOT_SCAN               2           // first advert received
+#define BOOT_LINK               3           // PHY link up
+#define BOOT_IP                 4           // address: static, remembered DHCP lease or DHCP (ipcfg.h)
+#define BOOT_DHCP               5           // DHCP bound
+#define BOOT_CONNECT            6           // first client connection
+#define BOOT_SEND               7           // first stream data taken by the library
+#define BOOT_NUM                8
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * Counters updated at runtime
+ */
+typedef struct
+{
+    uint16_t fifo_hwm;          // advert FIFO high-water mark, bytes
+    uint32_t adv_count;         // adverts offered to the FIFO
+    uint32_t adv_drop;          // adverts dropped, no room in the FIFO
+    uint32_t lz_in;             // v2 block payload bytes before compression
+    uint32_t lz_out;            // and after, blocks sent raw included
+    uint32_t eth_tx_busy;       // frames refused by the MAC, Tx ring full (the library retries)
+    uint32_t eth_tx_err;        // transmit errors
+    uint8_t  eth_tx_hwm;        // Tx ring high-water mark, descriptors
+    uint32_t eth_rx_filtered;   // frames dropped by ETH_RxAccept(), not for us
+    uint32_t eth_rx_overflow;   // frames lost, no free Rx descriptor
+    uint32_t eth_rx_err;        // receive errors (ESTAT)
+    uint8_t  eth_link;          // ETH_LINK_UP, ETH_LINK_FDX, set by the link interrupt
+    uint16_t eth_slow;          // times the link went slow (ETH_LINK_SLOW)
+    uint32_t eth_crc_err;       // receive error interrupts, CRC and symbol errors
+    uint32_t eth_renego;        // PHY negotiation restarts and resets, polarity flips
+    uint32_t eth_nego_ms;       // time without a link: negotiation, retries and the 500 ms resets
+    uint32_t resume_req;        // CTRL_CMD_RESUME requests
+    uint32_t resume_blocks;     // blocks replayed
+    uint32_t resume_drop;       // blocks dropped from the retention ring to make room
+    uint32_t boot_ms[BOOT_NUM]; // boot phases, ms since reset, 0 - not reached
+} gw_stats_t;
+
+/*
+ * Snapshot sent in an ADV_SVC_STATS service frame (LE, packed by layout)
+ */
+typedef struct
+{
+    uint16_t version;           // STATS_VERSION
+    uint16_t size;              // sizeof(gw_stats_rep_t)
+    uint16_t fifo_size;         // advert FIFO size
+    uint16_t fifo_hwm;          // advert FIFO high-water mark
+    uint32_t stack_size;        // __stack_size budget from Link.ld
+    uint32_t stack_hwm;         // deepest stack use (painted watermark)
+    uint32_t stack_free;        // never touched RAM between heap and stack
+    uint32_t net_heap_size;     // WCHNET heap (Mem_Heap_Memory)
+    uint32_t net_heap_hwm;      // WCHNET heap watermark, STATS_UNKNOWN if not observable
+    uint32_t adv_count;         // adverts offered to the FIFO
+    uint32_t adv_drop;          // adverts dropped, FIFO full
+    uint32_t time_syncs;        // SNTP samples applied, 0 - the clock is not synced
+    int32_t  time_offset;       // last SNTP offset, us
+    uint32_t time_delay;        // last SNTP round trip delay, us
+    int32_t  time_rate;         // clock rate correction, ppb
+    uint32_t lz_in;             // compressed stream: payload bytes in
+    uint32_t lz_out;            // and out, ratio lz_in / lz_out
+    uint16_t eth_tx_num;        // Tx ring size, ETH_TXBUFNB
+    uint16_t eth_tx_hwm;        // Tx ring high-water mark
+    uint32_t eth_tx_busy;       // frames refused, Tx ring full
+    uint32_t eth_tx_err;        // transmit errors
+    uint32_t eth_rx_filtered;   // frames not for us, dropped in the ETH interrupt
+    uint32_t eth_rx_overflow;   // frames lost, all Rx descriptors held by the stack
+    uint32_t eth_rx_err;        // receive errors
+    uint32_t loop_num;          // main loop passes
+    uint32_t sleep_num;         // WFI entered by the TMOS idle callback
+    uint32_t idle_pm;           // time in WFI since the previous snapshot, per mille
+    uint8_t  eth_link;          // ETH_LINK_UP, ETH_LINK_FDX, ETH_LINK_SLOW (eth_driver.h)
+    uint8_t  eth_mbps;          // link rate, 0 - no link
+    uint16_t eth_slow;          // times the sender went to the slow mode
+    uint32_t eth_crc_err;       // receive error interrupts (CRC)
+    uint32_t eth_renego;        // PHY negotiation restarts
+    uint32_t eth_nego_ms;       // time spent negotiating, ms
+    uint16_t resume_size;       // retention ring size, RESUME_BUF_LEN, 0 - no STREAM_RESUME
+    uint16_t resume_len;        // bytes held
+    uint32_t resume_first;      // sequence number of the oldest block held
+    uint32_t resume_next;       // of the next block
+    uint32_t resume_req;        // CTRL_CMD_RESUME requests
+    uint32_t resume_blocks;     // blocks replayed
+    uint32_t resume_drop;       // blocks dropped, the ring was full
+    uint32_t boot_ms[BOOT_NUM]; // boot phases BOOT_*, ms since reset, 0 - not reached
+} gw_stats_rep_t;
+
+extern gw_stats_t gw_stats;
+
+/*********************************************************************
+ * MACROS
+ */
+
+#define STATS_FIFO_HWM(len)     do{ if((len) > gw_stats.fifo_hwm) gw_stats.fifo_hwm = (len); }while(0)
+#define STATS_BOOT(phase)       do{ if(!gw_stats.boot_ms[phase]) stats_boot(phase); }while(0)
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Fill the unused RAM below the stack with STATS_PAINT_WORD, call first in main()
+ */
+extern void stats_stack_paint(void);
+
+/*
+ * Boot phase reached, use STATS_BOOT(): only the first time counts
+ */
+extern void stats_boot(uint8_t phase);
+
+/*
+ * Take a snapshot of all statistics
+ */
+extern void stats_get(gw_stats_rep_t *rep);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATS_H */
@@ -0,0 +1,134 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : stream.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/14
+ * Description        : TCP stream framing: v1 bare frames or v2 blocks with
+ *                      sync word, sequence number and CRC32
+ *********************************************************************************/
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define STREAM_V1               1       // frames back to back
+#define STREAM_V2               2       // frames packed into blocks
+
+// Framing after connect, the client switches with CTRL_CMD_FRAMING
+#ifndef STREAM_DEFAULT
+#define STREAM_DEFAULT          STREAM_V1
+#endif
+
+// Block payload compression, the client switches with CTRL_CMD_COMPRESS
+#define STREAM_LZ_OFF           0
+#define STREAM_LZ_ON            1       // LZ4 block (lz.h), v2 blocks only
+
+// Compressor in the build: lz.c, a raw payload buffer and the hash table, ~5 KB RAM
+#ifndef STREAM_LZ
+#define STREAM_LZ               1
+#endif
+
+/*
+ * v2 block:
+ *  [0..3]   STREAM_MAGIC: A5 FE 42 32, byte 1 (0xFE) is never a v1 type byte
+ *  [4]      STREAM_V2, | STREAM_BLK_LZ - compressed payload
+ *  [5]      header length, 20
+ *  [6..7]   number of records (LE)
+ *  [8..11]  block sequence number since boot, not reset on reconnect (LE),
+ *           the client resumes from it (CTRL_CMD_RESUME, resume.h)
+ *  [12..13] payload length without padding (LE)
+ *  [14..19] gateway id, MAC
+ *  [20..]   payload: whole records (v1 frames, service frames, advenc.h),
+ *           zero padded to a multiple of 4
+ *  [+4]     CRC32 of the header and padded payload (LE)
+ *
+ * A compressed payload (STREAM_LZ_ON) is [raw length (LE16)][LZ4 block],
+ * the header length field counts these bytes, the record count is the one
+ * of the raw payload. Each block is compressed on its own and decodes
+ * after a lost one. A block that does not shrink is sent raw.
+ *
+ * CRC32 is the CRC unit's: poly 0x04C11DB7, init 0xFFFFFFFF, no reflection,
+ * no final xor, over little-endian 32-bit words.
+ */
+#define STREAM_MAGIC            0x3242FEA5
+#define STREAM_CRC_LEN          4
+#define STREAM_BLK_LZ           0x80
+#define STREAM_LZ_HDR_LEN       2
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+    uint32_t magic;             // STREAM_MAGIC
+    uint8_t  ver;               // STREAM_V2 [| STREAM_BLK_LZ]
+    uint8_t  hdr_len;           // sizeof(stream_blk_hdr_t)
+    uint16_t count;             // records in the block
+    uint32_t seq;               // block sequence number
+    uint16_t len;               // payload length, bytes
+    uint8_t  gw_id[6];          // gateway MAC
+} stream_blk_hdr_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Request the framing STREAM_V1/STREAM_V2, applied from the next block
+ */
+extern void stream_set_version(uint8_t ver);
+
+/*
+ * Block payload compression STREAM_LZ_OFF/STREAM_LZ_ON, applied from the next block
+ */
+extern void stream_set_compress(uint8_t mode);
+
+/*
+ * New connection: default framing, no compression, the block sequence goes on
+ */
+extern void stream_reset(void);
+
+/*
+ * No client: the records go on into v2 blocks for the retention ring (resume.h)
+ */
+extern void stream_offline(void);
+
+/*
+ * New connection, before stream_reset(): v2 records left in the FIFO go into
+ * the retention ring, bare v1 frames stay for the new client, the rest is
+ * dropped, buf - 4-byte aligned block buffer
+ */
+extern void stream_close(uint8_t *buf, uint16_t size);
+
+/*
+ * Client request: v2 framing, the retained blocks from seq on first
+ */
+extern void stream_resume(uint32_t seq);
+
+/*
+ * Take the next bytes to send out of the TX FIFO, buf - 4-byte aligned.
+ * 0 also while a DMA copy out of the FIFO runs (FIFO_DMA, IDLE_WAKE_DMA)
+ */
+extern uint16_t stream_fill(uint8_t *buf, uint16_t size);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STREAM_H */
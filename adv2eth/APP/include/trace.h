@@ -0,0 +1,154 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : trace.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/02
+ * Description        : Binary event trace into a RAM ring buffer
+ *********************************************************************************/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include "debug.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// 1 - trace enabled, 0 - all TRACE() hooks compile to nothing
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE            1
+#endif
+
+// Number of records in the ring, power of 2
+#ifndef TRACE_BUF_NUM
+#define TRACE_BUF_NUM           128
+#endif
+
+#define TRACE_MAGIC             0x31435254  // "TRC1"
+
+// Event ids, keep in sync with tools/trace2json.py
+#define TRACE_ID_BEGIN          0x4000      // duration event start
+#define TRACE_ID_END            0x8000      // duration event end
+#define TRACE_ID_MASK           0x0FFF
+
+#define TRACE_ETH_ISR           0x0001      // arg0: EIR flags, arg1: RX length
+#define TRACE_ETH_RX_DROP       0x0002      // arg0: ESTAT, arg1: descriptor status
+#define TRACE_ETH_TX_BUSY       0x0003      // Tx ring full, arg0: frame length, arg1: queued
+#define TRACE_ETH_LINK          0x0004      // link state, arg0: ETH_LINK_* (ETH_LinkState), arg1: ANLPAR or errors
+#define TRACE_BOOT              0x0005      // boot phase reached, arg0: BOOT_* (stats.h), arg1: ms since reset
+#define TRACE_SOCK_INT          0x0010      // arg0: socket id, arg1: Sn_INT
+#define TRACE_SOCK_SEND         0x0011      // arg0: length, arg1: status
+#define TRACE_SOCK_RECV         0x0012      // arg0: socket id, arg1: length
+#define TRACE_ADV_EVT           0x0020      // arg0: GAP opcode, arg1: data length
+#define TRACE_ADV_DROP          0x0021      // arg0: frame length, arg1: drop count
+#define TRACE_ADV_PUT           0x0022      // ObserverSendMsg() duration, arg0: frame/FIFO length, arg1: 1 queued
+#define TRACE_FIFO_WRITE        0x0030      // arg0: write length, arg1: FIFO length
+#define TRACE_FIFO_READ         0x0031      // arg0: read length, arg1: FIFO length
+#define TRACE_FIFO_FULL         0x0032      // arg0: requested, arg1: FIFO length
+#define TRACE_SEND_FIFO         0x0040      // SendFifo() duration
+#define TRACE_TMOS_ETH          0x0041      // eth task events, arg0: events
+#define TRACE_LZ_BLOCK          0x0042      // lz_compress() duration, arg0: raw length, arg1: compressed
+#define TRACE_RESUME            0x0043      // CTRL_CMD_RESUME, arg0: requested sequence number, arg1: the first one replayed
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+typedef struct
+{
+    uint32_t ts;            // SysTick counter, SYSTICK_FREQ
+    uint32_t id;            // TRACE_* | TRACE_ID_BEGIN/END
+    uint32_t arg0;
+    uint32_t arg1;
+} trace_rec_t;
+
+/*
+ * The ring is self-describing: a raw dump of trace_ring
+ * (debug probe or TRACE dump command) is decoded as is.
+ */
+typedef struct
+{
+    uint32_t magic;         // TRACE_MAGIC
+    uint16_t num;           // TRACE_BUF_NUM
+    uint16_t rec_size;      // sizeof(trace_rec_t)
+    uint32_t freq;          // timestamp frequency, Hz
+    volatile uint32_t idx;  // total number of records written
+    volatile uint32_t enable;
+    uint32_t rsv[3];
+    trace_rec_t rec[TRACE_BUF_NUM];
+} trace_ring_t;
+
+extern trace_ring_t trace_ring;
+
+/*********************************************************************
+ * MACROS
+ */
+
+#if TRACE_ENABLE
+
+/*********************************************************************
+ * @fn      trace_put
+ *
+ * @brief   Write a record into the trace ring. Safe from interrupts.
+ *
+ * @param   id - event id
+ * @param   arg0, arg1 - event arguments
+ *
+ * @return  none
+ */
+__attribute__((always_inline)) static inline void trace_put(uint32_t id, uint32_t arg0, uint32_t arg1)
+{
+    trace_rec_t *p;
+
+    if(!trace_ring.enable)
+        return;
+    p = &trace_ring.rec[__atomic_fetch_add(&trace_ring.idx, 1, __ATOMIC_RELAXED) & (TRACE_BUF_NUM - 1)];
+    p->ts = SysTick_GetCount();
+    p->id = id;
+    p->arg0 = arg0;
+    p->arg1 = arg1;
+}
+
+#define TRACE(id, a0, a1)       trace_put((id), (uint32_t)(a0), (uint32_t)(a1))
+#define TRACE_BEGIN(id, a0, a1) trace_put((id) | TRACE_ID_BEGIN, (uint32_t)(a0), (uint32_t)(a1))
+#define TRACE_END(id, a0, a1)   trace_put((id) | TRACE_ID_END, (uint32_t)(a0), (uint32_t)(a1))
+
+#else
+
+#define TRACE(id, a0, a1)
+#define TRACE_BEGIN(id, a0, a1)
+#define TRACE_END(id, a0, a1)
+
+#endif // TRACE_ENABLE
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Initialize the trace ring and start recording
+ */
+extern void trace_init(void);
+
+/*
+ * Pause (0) or resume (1) recording
+ */
+extern void trace_enable(uint32_t on);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H */
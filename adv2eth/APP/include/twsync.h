@@ -0,0 +1,128 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : twsync.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/19
+ * Description        : Two-way time transfer with a collector over UDP,
+ *                      probe receive and reply transmit time stamped in
+ *                      the ETH interrupt
+ *********************************************************************************/
+
+#ifndef TWSYNC_H
+#define TWSYNC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define TWSYNC_PORT             1124
+
+/*
+ * Exchange (all fields LE, twsync_msg_t):
+ *  collector -> gateway  TWSYNC_PROBE  seq, t1 - collector send time
+ *  gateway -> collector  TWSYNC_REPLY  seq, t1 echoed, t2 - probe receive
+ *                        time (end of frame, ETH interrupt), prev_seq and
+ *                        prev_t3 - transmit start of the previous reply
+ *                        (two-step: the reply's own transmit time is known
+ *                        only after it is sent)
+ *  collector -> gateway  TWSYNC_SET    ref_local, ref_utc, rate: the
+ *                        gateway clock follows the collector time base
+ * Gateway times are gwtime_local() us. The probe is sent at the reply
+ * size, both directions spend the same time on the 10 Mbit/s wire.
+ */
+#define TWSYNC_MAGIC0           'T'
+#define TWSYNC_MAGIC1           'W'
+
+#define TWSYNC_PROBE            0x01
+#define TWSYNC_REPLY            0x02
+#define TWSYNC_SET              0x03
+
+// TWSYNC_REPLY flags
+#define TWSYNC_F_T2_HW          0x01    // t2 stamped in the ETH interrupt, else by the socket callback
+#define TWSYNC_F_T3_HW          0x02    // prev_t3 is valid
+#define TWSYNC_F_SET            0x04    // the gateway clock follows TWSYNC_SET
+
+// Probe receive stamps kept between the interrupt and the socket callback
+#define TWSYNC_RX_SLOTS         4       // power of 2, >= ETH_RXBUFNB
+
+// 10BASE-T frame on the wire: preamble/SFD, frame padded to 60 bytes, FCS; 0.8 us a byte
+#define TWSYNC_WIRE_BYTES(len)  (8 + ((len) < 60 ? 60 : (len)) + 4)
+#define TWSYNC_WIRE_TICKS(len)  ((uint32_t)TWSYNC_WIRE_BYTES(len) * (SYSTICK_FREQ / 1250000))
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * TWSYNC_PROBE, TWSYNC_REPLY
+ */
+typedef struct
+{
+    uint8_t  magic[2];          // TWSYNC_MAGIC0, TWSYNC_MAGIC1
+    uint8_t  type;
+    uint8_t  flags;             // TWSYNC_F_*
+    uint32_t seq;               // probe number, echoed in the reply
+    uint64_t t1;                // collector send time, echoed
+    uint64_t t2;                // probe receive time, gateway us
+    uint64_t prev_t3;           // previous reply transmit start, gateway us
+    uint32_t prev_seq;          // its seq
+    uint8_t  gw_id[6];          // gateway MAC
+    uint8_t  res[6];
+} twsync_msg_t;
+
+/*
+ * TWSYNC_SET
+ */
+typedef struct
+{
+    uint8_t  magic[2];
+    uint8_t  type;
+    uint8_t  flags;             // 0
+    uint32_t seq;               // seq of the last probe used
+    uint64_t ref_local;         // gateway us
+    uint64_t ref_utc;           // collector time at ref_local, UTC us
+    int32_t  rate;              // collector time rate against the gateway clock, ppb
+    uint32_t res;
+} twsync_set_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Address is known: create the UDP socket, answer probes
+ */
+extern void twsync_start(void);
+
+/*
+ * ETH interrupt: a received frame, SysTick at the interrupt entry
+ */
+extern void twsync_eth_rx(const uint8_t *frame, uint32_t len, uint64_t ticks);
+
+/*
+ * ETH driver: a frame is handed to the MAC
+ */
+extern void twsync_eth_tx(const uint8_t *frame, uint32_t len);
+
+/*
+ * ETH interrupt: transmit done (ok) or failed, SysTick at the interrupt entry
+ */
+extern void twsync_eth_txdone(uint64_t ticks, uint8_t ok);
+
+/*********************************************************************
+*********************************************************************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWSYNC_H */
@@ -0,0 +1,310 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : ipcfg.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/29
+ * Description        : Address of the gateway at boot: static or the last
+ *                      DHCP lease kept in flash
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "CONFIG.h"
+#include "string.h"
+#include "eth_driver.h"
+#include "ipcfg.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define IPCFG_ETH_HDR           14
+#define IPCFG_ARP_LEN           28
+#define IPCFG_FRAME_MIN         60          // Ethernet minimum without the CRC
+
+/*********************************************************************
+ * EXTERNAL VARIABLES
+ */
+extern uint8_t MACAddr[6];                  // eth.c
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+volatile uint8_t ipcfg_guard;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+#if IPCFG_CHECK
+static uint8_t ipcfg_ip[4];                 // the remembered lease under the check
+static uint8_t ipcfg_gw[4];
+static uint8_t ipcfg_sent;                  // probe rounds sent
+static uint32_t ipcfg_due;                  // LocalTime of the next round or of the decision
+static volatile uint8_t ipcfg_router;       // the router answered
+static volatile uint8_t ipcfg_taken;        // another host has the address or probes for it
+#endif
+
+/*********************************************************************
+ * @fn      ipcfg_check
+ *
+ * @brief   Check word of a lease record.
+ */
+static uint32_t ipcfg_check(const ipcfg_lease_t *l)
+{
+    uint32_t w[3];
+
+    memcpy(w, l->ip, sizeof(w));
+    return ~(l->magic ^ w[0] ^ w[1] ^ w[2]);
+}
+
+/*********************************************************************
+ * @fn      ipcfg_load
+ *
+ * @brief   Address to start with. The remembered lease lets the listen
+ *          socket open before DHCP answers: a DHCP server gives the
+ *          same MAC the same address back, a different one replaces
+ *          it (WCHNET_DHCPCallBack).
+ *
+ * @param   ip, gw, mask - filled when found
+ *
+ * @return  1 - static or the remembered lease, 0 - none, wait for DHCP
+ */
+uint8_t ipcfg_load(uint8_t *ip, uint8_t *gw, uint8_t *mask)
+{
+#if IPCFG_STATIC
+    static const uint8_t s_ip[4] = { IPCFG_STATIC_IP };
+    static const uint8_t s_gw[4] = { IPCFG_STATIC_GW };
+    static const uint8_t s_mask[4] = { IPCFG_STATIC_MASK };
+
+    memcpy(ip, s_ip, 4);
+    memcpy(gw, s_gw, 4);
+    memcpy(mask, s_mask, 4);
+    return IPCFG_ADDR_SET;
+#elif IPCFG_LEASE_KEEP
+    ipcfg_lease_t l;
+
+    memcpy(&l, (const void *)(uintptr_t)IPCFG_LEASE_ADDR, sizeof(l));
+    if(l.magic != IPCFG_MAGIC || l.check != ipcfg_check(&l) || !l.ip[0])
+        return IPCFG_ADDR_NONE;
+    memcpy(ip, l.ip, 4);
+    memcpy(gw, l.gw, 4);
+    memcpy(mask, l.mask, 4);
+#if IPCFG_CHECK
+    memcpy(ipcfg_ip, l.ip, 4);
+    memcpy(ipcfg_gw, l.gw, 4);
+    ipcfg_sent = 0;
+    ipcfg_router = 0;
+    ipcfg_taken = 0;
+    ipcfg_guard = IPCFG_GUARD_PROBE;        // before WCHNET_Init(): nothing goes out from the address
+    return IPCFG_ADDR_PROBE;
+#else
+    return IPCFG_ADDR_SET;
+#endif
+#else
+    (void)ip;
+    (void)gw;
+    (void)mask;
+    return IPCFG_ADDR_NONE;
+#endif
+}
+
+#if IPCFG_CHECK
+/*********************************************************************
+ * @fn      ipcfg_arp_send
+ *
+ * @brief   Broadcast an ARP request for tpa from spa, 0.0.0.0 - a probe
+ *          (RFC 5227): the answers do not update ARP caches with us.
+ */
+static void ipcfg_arp_send(const uint8_t *spa, const uint8_t *tpa)
+{
+    uint32_t frame[IPCFG_FRAME_MIN / 4];
+    uint8_t *f = (uint8_t *)frame;
+    uint8_t *a = f + IPCFG_ETH_HDR;
+    static const uint8_t arp_req[8] = { 0x00, 0x01, 0x08, 0x00, 6, 4, 0x00, 0x01 };
+
+    memset(f, 0, sizeof(frame));
+    memset(f, 0xFF, 6);
+    memcpy(f + 6, MACAddr, 6);
+    f[12] = 0x08;
+    f[13] = 0x06;
+    memcpy(a, arp_req, sizeof(arp_req));
+    memcpy(a + 8, MACAddr, 6);
+    if(spa)
+        memcpy(a + 14, spa, 4);
+    memcpy(a + 24, tpa, 4);
+    ETH_TxPktChainMode(sizeof(frame), frame);
+}
+
+/*********************************************************************
+ * @fn      ipcfg_probe
+ *
+ * @brief   ARP check of the remembered lease, the main loop while
+ *          ipcfg_guard is IPCFG_GUARD_PROBE. Once the link is up a
+ *          probe for the address and a request for the router go out
+ *          IPCFG_PROBE_NUM times. An answer for the address or a probe
+ *          of another host for it, or no answer of the router, leaves
+ *          the address to DHCP: the gateway may be on another network.
+ *          Else the address is announced and used.
+ *
+ * @param   now - LocalTime, ms
+ *
+ * @return  1 - use the address
+ */
+uint8_t ipcfg_probe(uint32_t now)
+{
+    if(ipcfg_guard != IPCFG_GUARD_PROBE)
+        return 0;
+    if(ipcfg_taken)
+    {
+        PRINT("IP lease taken, wait for DHCP\r\n");
+        ipcfg_guard = IPCFG_GUARD_WAIT;
+        return 0;
+    }
+    if(!(ETH_LinkState() & ETH_LINK_UP))
+    {
+        ipcfg_sent = 0;                     // all rounds on the link
+        return 0;
+    }
+    if(ipcfg_sent && (int32_t)(now - ipcfg_due) < 0)
+        return 0;
+    if(ipcfg_sent < IPCFG_PROBE_NUM)
+    {
+        ipcfg_arp_send(NULL, ipcfg_ip);
+        ipcfg_arp_send(NULL, ipcfg_gw);
+        ipcfg_sent++;
+        ipcfg_due = now + IPCFG_PROBE_GAP_MS;
+        return 0;
+    }
+    if(!ipcfg_router)
+    {
+        PRINT("IP lease: no router, wait for DHCP\r\n");
+        ipcfg_guard = IPCFG_GUARD_WAIT;
+        return 0;
+    }
+    ipcfg_guard = IPCFG_GUARD_OFF;
+    ipcfg_arp_send(ipcfg_ip, ipcfg_ip);     // announce: the caches of the old owner are updated
+    PRINT("IP lease checked\r\n");
+    return 1;
+}
+
+/*********************************************************************
+ * @fn      ipcfg_bound
+ *
+ * @brief   DHCP bound: its address is ours, the check is over.
+ *
+ * @return  the previous ipcfg_guard, set - the address is not in use yet
+ */
+uint8_t ipcfg_bound(void)
+{
+    uint8_t g = ipcfg_guard;
+
+    ipcfg_guard = IPCFG_GUARD_OFF;
+    return g;
+}
+
+/*********************************************************************
+ * @fn      ipcfg_eth_rx
+ *
+ * @brief   ETH interrupt while the address is not confirmed: ARP from
+ *          the router or for the address is noted. The stack does not
+ *          see ARP requests for the address nor IPv4 to it, except the
+ *          DHCP replies: it would answer for the address.
+ *
+ * @param   frame - Ethernet frame
+ * @param   len - frame length
+ *
+ * @return  0 - drop
+ */
+uint8_t ipcfg_eth_rx(const uint8_t *frame, uint32_t len)
+{
+    const uint8_t *p = frame + IPCFG_ETH_HDR;
+
+    if(len < IPCFG_ETH_HDR + 20)
+        return 1;
+    if(frame[12] == 0x08 && frame[13] == 0x06)
+    {
+        if(len < IPCFG_ETH_HDR + IPCFG_ARP_LEN)
+            return 1;
+        if(!memcmp(p + 8, MACAddr, 6))
+            return 1;                                           // our own
+        if(!memcmp(p + 14, ipcfg_gw, 4))
+            ipcfg_router = 1;
+        if(!memcmp(p + 14, ipcfg_ip, 4)                         // somebody has it
+           || (!(p[14] | p[15] | p[16] | p[17]) && !memcmp(p + 24, ipcfg_ip, 4)))    // or probes for it
+            ipcfg_taken = 1;
+        return p[7] != 0x01 || memcmp(p + 24, ipcfg_ip, 4);
+    }
+    if(frame[12] == 0x08 && frame[13] == 0x00 && !memcmp(p + 16, ipcfg_ip, 4))
+    {
+        p += (p[0] & 0x0F) * 4;
+        return p + 4 <= frame + len && frame[IPCFG_ETH_HDR + 9] == 17 && p[2] == 0 && p[3] == 68;
+    }
+    return 1;
+}
+
+/*********************************************************************
+ * @fn      ipcfg_eth_tx
+ *
+ * @brief   ETH driver while the address is not confirmed: the stack
+ *          announces it or answers from it. The DHCP client goes out.
+ *
+ * @param   frame - Ethernet frame
+ * @param   len - frame length
+ *
+ * @return  0 - drop
+ */
+uint8_t ipcfg_eth_tx(const uint8_t *frame, uint32_t len)
+{
+    const uint8_t *p = frame + IPCFG_ETH_HDR;
+
+    if(len < IPCFG_ETH_HDR + 20)
+        return 1;
+    if(frame[12] == 0x08 && frame[13] == 0x06)
+        return len < IPCFG_ETH_HDR + IPCFG_ARP_LEN || memcmp(p + 14, ipcfg_ip, 4);
+    if(frame[12] == 0x08 && frame[13] == 0x00 && !memcmp(p + 12, ipcfg_ip, 4))
+    {
+        p += (p[0] & 0x0F) * 4;
+        return p + 2 <= frame + len && frame[IPCFG_ETH_HDR + 9] == 17 && p[0] == 0 && p[1] == 68;
+    }
+    return 1;
+}
+#endif
+
+/*********************************************************************
+ * @fn      ipcfg_save
+ *
+ * @brief   Keep a DHCP lease for the next boot. The page is written
+ *          only when the lease changed: once per new network, not on
+ *          every renewal.
+ *
+ * @param   ip, gw, mask - the lease
+ *
+ * @return  none
+ */
+void ipcfg_save(const uint8_t *ip, const uint8_t *gw, const uint8_t *mask)
+{
+#if IPCFG_LEASE_KEEP && !IPCFG_STATIC
+    uint32_t page[IPCFG_PAGE_SIZE / 4];
+    ipcfg_lease_t *l = (ipcfg_lease_t *)page;
+
+    memset(page, 0xFF, sizeof(page));
+    l->magic = IPCFG_MAGIC;
+    memcpy(l->ip, ip, 4);
+    memcpy(l->gw, gw, 4);
+    memcpy(l->mask, mask, 4);
+    l->check = ipcfg_check(l);
+    if(!memcmp(l, (const void *)(uintptr_t)IPCFG_LEASE_ADDR, sizeof(*l)))
+        return;
+    FLASH_Unlock_Fast();
+    FLASH_ErasePage_Fast(IPCFG_LEASE_ADDR);
+    FLASH_ProgramPage_Fast(IPCFG_LEASE_ADDR, page);
+    FLASH_Lock_Fast();
+    PRINT("IP lease saved\r\n");
+#else
+    (void)ip;
+    (void)gw;
+    (void)mask;
+#endif
+}
+
+/******************************** endfile @ ipcfg ******************************/
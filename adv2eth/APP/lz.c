@@ -0,0 +1,215 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : lz.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/20
+ * Description        : LZ4 block format compressor for v2 stream blocks,
+ *                      static hash table, the window is one block
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "string.h"
+#include "lz.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define LZ_HASH_SIZE            (1 << LZ_HASH_LOG)
+#define LZ_SKIP_TRIGGER         6           // step up the search after 64 missed bytes
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+// input position + 1 of the last 4 bytes with this hash, 0 - none
+static uint16_t lz_hash_tab[LZ_HASH_SIZE];
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_LOG);
+}
+
+/*********************************************************************
+ * @fn      lz_put_len
+ *
+ * @brief   Length continuation bytes after a token nibble of 15.
+ */
+static uint8_t *lz_put_len(uint8_t *op, uint32_t n)
+{
+    while(n >= 255)
+    {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+/*********************************************************************
+ * @fn      lz_put_seq
+ *
+ * @brief   One sequence: token, literals, offset and match length. The
+ *          last one (ml == 0) has literals only.
+ *
+ * @return  end of the output, NULL - does not fit
+ */
+static uint8_t *lz_put_seq(uint8_t *op, const uint8_t *oend, const uint8_t *lit, uint32_t nlit,
+                           uint32_t off, uint32_t ml)
+{
+    uint8_t *token = op++;
+
+    if(op + nlit + nlit / 255 + 1 + (ml ? 2 + (ml - LZ_MIN_MATCH) / 255 + 1 : 0) > oend)
+        return NULL;
+    *token = (uint8_t)((nlit >= 15 ? 15 : nlit) << 4);
+    if(nlit >= 15)
+        op = lz_put_len(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+    if(!ml)
+        return op;
+    *op++ = (uint8_t)off;
+    *op++ = (uint8_t)(off >> 8);
+    ml -= LZ_MIN_MATCH;
+    *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+    if(ml >= 15)
+        op = lz_put_len(op, ml - 15);
+    return op;
+}
+
+/*********************************************************************
+ * @fn      lz_compress
+ *
+ * @brief   Greedy single-probe LZ4: a hash of the next 4 bytes gives
+ *          the last position with the same hash, a match is extended
+ *          both ways. The table is cleared per call, every block
+ *          decodes on its own.
+ *
+ * @param   src - input
+ * @param   len - input length
+ * @param   dst - output
+ * @param   max - output buffer size
+ *
+ * @return  output length, 0 - does not fit into max
+ */
+uint16_t lz_compress(const uint8_t *src, uint16_t len, uint8_t *dst, uint16_t max)
+{
+    const uint8_t *ip = src, *anchor = src, *ref;
+    const uint8_t *end = src + len;
+    const uint8_t *mflimit = end - LZ_MFLIMIT;
+    const uint8_t *mlimit = end - LZ_LAST_LITERALS;
+    const uint8_t *oend = dst + max;
+    uint8_t *op = dst;
+    uint32_t v, h, ml;
+
+    memset(lz_hash_tab, 0, sizeof(lz_hash_tab));
+    if(len > LZ_MFLIMIT)
+    {
+        while(ip < mflimit)
+        {
+            v = lz_read32(ip);
+            h = lz_hash(v);
+            ref = lz_hash_tab[h] ? src + lz_hash_tab[h] - 1 : NULL;
+            lz_hash_tab[h] = (uint16_t)(ip - src + 1);
+            if(!ref || lz_read32(ref) != v)
+            {
+                ip += 1 + ((ip - anchor) >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+            while(ip > anchor && ref > src && ip[-1] == ref[-1])
+            {
+                ip--;
+                ref--;
+            }
+            ml = LZ_MIN_MATCH;
+            while(ip + ml < mlimit && ip[ml] == ref[ml])
+                ml++;
+            op = lz_put_seq(op, oend, anchor, ip - anchor, ip - ref, ml);
+            if(!op)
+                return 0;
+            ip += ml;
+            anchor = ip;
+            if(ip < mflimit)
+                lz_hash_tab[lz_hash(lz_read32(ip - 2))] = (uint16_t)(ip - 2 - src + 1);
+        }
+    }
+    op = lz_put_seq(op, oend, anchor, end - anchor, 0, 0);
+    return op ? (uint16_t)(op - dst) : 0;
+}
+
+/*********************************************************************
+ * @fn      lz_decompress
+ *
+ * @brief   LZ4 block decoder with bounds checks, for the host clients
+ *          (not linked into the firmware).
+ *
+ * @param   src - block
+ * @param   len - block length
+ * @param   dst - output
+ * @param   max - output buffer size
+ *
+ * @return  output length, -1 - bad block
+ */
+int32_t lz_decompress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t max)
+{
+    const uint8_t *ip = src, *end = src + len;
+    uint8_t *op = dst, *oend = dst + max;
+    uint32_t n, off, b;
+
+    while(ip < end)
+    {
+        b = *ip++;
+        n = b >> 4;
+        if(n == 15)
+        {
+            do
+            {
+                if(ip >= end)
+                    return -1;
+                n += *ip;
+            } while(*ip++ == 255);
+        }
+        if(n > (uint32_t)(end - ip) || n > (uint32_t)(oend - op))
+            return -1;
+        memcpy(op, ip, n);
+        op += n;
+        ip += n;
+        if(ip == end)
+            break;                  // the last sequence
+        if(end - ip < 2)
+            return -1;
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(!off || off > (uint32_t)(op - dst))
+            return -1;
+        n = (b & 15) + LZ_MIN_MATCH;
+        if((b & 15) == 15)
+        {
+            do
+            {
+                if(ip >= end)
+                    return -1;
+                n += *ip;
+            } while(*ip++ == 255);
+        }
+        if(n > (uint32_t)(oend - op))
+            return -1;
+        // overlapping copy: byte by byte
+        while(n--)
+        {
+            *op = *(op - off);
+            op++;
+        }
+    }
+    return (int32_t)(op - dst);
+}
+
+/******************************** endfile @ lz ******************************/
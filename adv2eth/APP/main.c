@@ -16,6 +16,8 @@
 #include "HAL.h"
 #include "observer.h"
 #include "eth.h"
+#include "trace.h"
+#include "stats.h"
 
 /*********************************************************************
  * GLOBAL TYPEDEFS
@@ -29,18 +31,20 @@ const uint8_t MacAddr[6] = {0x84, 0xC2, 0xE4, 0x03, 0x02, 0x02};
 /*********************************************************************
  * @fn      Main_Circulation
  *
- * @brief   Main loop
+ * @brief   Main loop. eth_process() takes the wake flags first, so an
+ *          interrupt that comes later keeps TMOS out of its idle
+ *          callback (HAL_IdleWFI) until the next pass.
  *
  * @return  none
  */
-__attribute__((section(".highcode")))
+__HIGH_CODE
 __attribute__((noinline))
 void Main_Circulation(void)
 {
     while(1)
     {
-        TMOS_SystemProcess();
         eth_process();
+        TMOS_SystemProcess();
     }
 }
 
@@ -53,14 +57,17 @@ void Main_Circulation(void)
  */
 int main(void)
 {
+    stats_stack_paint();
     SystemCoreClockUpdate();
     Delay_Init();
+    trace_init();
 #ifdef DEBUG
     USART_Printf_Init( 115200 );
 #endif
     PRINT("%s\r\n", VER_LIB);
     WCHBLE_Init();
     HAL_Init();
+    STATS_BOOT(BOOT_BLE);
 
     GAPRole_ObserverInit();
     Observer_Init();
@@ -20,6 +20,11 @@
 #include "observer.h"
 #include "wchnet.h"
 #include "eth.h"
+#include "trace.h"
+#include "stats.h"
+#include "advenc.h"
+#include "gwtime.h"
+#include "resume.h"
 
 /*********************************************************************
  * MACROS
@@ -29,6 +34,9 @@
 #else
   #define DEBUGPRINT(X...)
 #endif
+
+// No client: the adverts are dropped, with STREAM_RESUME recorded for the next one
+#define ADV_NO_CLIENT()         (!socket_connected && !STREAM_RESUME)
 /*********************************************************************
  * CONSTANTS
  */
@@ -95,12 +103,17 @@ adv_msg_t adv_msg;
 
 uint8_t app_tx_buffer[APP_TX_BUFFER_LENGTH];
 
+static uint8_t adv_enc_buf[ADV_ENC_OUT_MAX];
+
+// gwtime_now() at the observer event, with gwtime_stamp
+static uint64_t adv_rx_time;
+
 /*********************************************************************
  * LOCAL FUNCTIONS
  */
 static void ObserverEventCB(gapRoleEvent_t *pEvent);
 static void Observer_ProcessTMOSMsg(tmos_event_hdr_t *pMsg);
-static void ObserverAddDeviceInfo(uint8_t *pAddr, uint8_t addrType);
+static void ObserverSendMsg(uint16_t len);
 
 /*********************************************************************
  * PROFILE CALLBACKS
@@ -215,6 +228,59 @@ static void Observer_ProcessTMOSMsg(tmos_event_hdr_t *pMsg)
     }
 }
 
+/*********************************************************************
+ * @fn      ObserverSendMsg
+ *
+ * @brief   Queue adv_msg into the TX FIFO, as a compact record if the
+ *          client asked for it, after its receive time record if the
+ *          client asked for that. A frame that does not fit is dropped
+ *          whole, a partial write would break the stream.
+ *
+ * @param   len - frame length, header included
+ *
+ * @return  none
+ */
+__HIGH_CODE
+static void ObserverSendMsg(uint16_t len)
+{
+    uint8_t *p = (uint8_t *)&adv_msg;
+    uint16_t n = 0;
+
+    TRACE_BEGIN(TRACE_ADV_PUT, len, 0);
+    gw_stats.adv_count++;
+    STATS_BOOT(BOOT_SCAN);
+    if(gwtime_stamp)
+        n = gwtime_rec_put(adv_enc_buf, adv_rx_time);
+    if(advenc_mode == ADV_ENC_COMPACT)
+    {
+        len = n + advenc_encode(p, adv_enc_buf + n);
+        p = adv_enc_buf;
+    }
+    else if(n)
+    {
+        memcpy(adv_enc_buf + n, p, len);
+        len += n;
+        p = adv_enc_buf;
+    }
+    if(app_drv_fifo_length(&app_tx_fifo) + len > app_tx_fifo.size)
+    {
+        gw_stats.adv_drop++;
+        TRACE(TRACE_ADV_DROP, len, gw_stats.adv_drop);
+        TRACE_END(TRACE_ADV_PUT, app_drv_fifo_length(&app_tx_fifo), 0);
+        return;
+    }
+    app_drv_fifo_write(&app_tx_fifo, p, &len);
+    if(n)
+        gwtime_rec_commit(adv_rx_time);
+    if(advenc_mode == ADV_ENC_COMPACT)
+        advenc_commit((uint8_t *)&adv_msg);
+    len = app_drv_fifo_length(&app_tx_fifo);
+    STATS_FIFO_HWM(len);
+    if(len >= SEND_BUF_LEN)
+        tmos_set_event(eth_TaskID, ETH_SENG_DATA_EVENT);
+    TRACE_END(TRACE_ADV_PUT, len, 1);
+}
+
 /*********************************************************************
  * @fn      ObserverEventCB
  *
@@ -224,9 +290,13 @@ static void Observer_ProcessTMOSMsg(tmos_event_hdr_t *pMsg)
  *
  * @return  none
  */
+__HIGH_CODE
 static void ObserverEventCB(gapRoleEvent_t *pEvent)
 {
 	uint16_t len;
+    TRACE(TRACE_ADV_EVT, pEvent->gap.opcode, 0);
+    if(gwtime_stamp)
+        adv_rx_time = gwtime_now();
     switch(pEvent->gap.opcode)
     {
         case GAP_DEVICE_INIT_DONE_EVENT:
@@ -240,7 +310,7 @@ static void ObserverEventCB(gapRoleEvent_t *pEvent)
 
         case GAP_DEVICE_INFO_EVENT:
         {
-        	if(!socket_connected)
+        	if(ADV_NO_CLIENT())
         		break;
         	len = (uint8_t)pEvent->deviceInfo.dataLen;
        		adv_msg.len = (uint8_t)len;
@@ -250,10 +320,7 @@ static void ObserverEventCB(gapRoleEvent_t *pEvent)
            	memcpy(adv_msg.addr, pEvent->deviceInfo.addr, B_ADDR_LEN);
         	if(len)
         		memcpy(adv_msg.data, pEvent->deviceInfo.pEvtData, len);
-        	len += 10;
-        	app_drv_fifo_write(&app_tx_fifo, (uint8_t *)&adv_msg, &len);
-        	if(app_drv_fifo_length(&app_tx_fifo) >= RECE_BUF_LEN)
-        		tmos_set_event(eth_TaskID, ETH_SENG_DATA_EVENT);
+        	ObserverSendMsg(len + 10);
         }
         break;
 
@@ -270,7 +337,7 @@ static void ObserverEventCB(gapRoleEvent_t *pEvent)
 
         case GAP_EXT_ADV_DEVICE_INFO_EVENT:
         {
-        	if(socket_connected == 0)
+        	if(ADV_NO_CLIENT())
         		break;
         	len = (uint8_t)pEvent->deviceExtAdvInfo.dataLen;
        		adv_msg.len = (uint8_t)len;
@@ -280,10 +347,7 @@ static void ObserverEventCB(gapRoleEvent_t *pEvent)
            	memcpy(adv_msg.addr, pEvent->deviceExtAdvInfo.addr, B_ADDR_LEN);
            	if(len)
            		memcpy(adv_msg.data, pEvent->deviceExtAdvInfo.pEvtData, len);
-        	len += 10;
-           	app_drv_fifo_write(&app_tx_fifo, (uint8_t *)&adv_msg,  &len);
-        	if(app_drv_fifo_length(&app_tx_fifo) >= RECE_BUF_LEN)
-        		tmos_set_event(eth_TaskID, ETH_SENG_DATA_EVENT);
+        	ObserverSendMsg(len + 10);
         }
         break;
 
@@ -294,17 +358,14 @@ static void ObserverEventCB(gapRoleEvent_t *pEvent)
                 PRINT("%0x", pEvent->deviceDirectInfo.addr[i]);
             }
             PRINT("\r\n");
-        	if(socket_connected == 0)
+        	if(ADV_NO_CLIENT())
         		break;
        		adv_msg.len = 0;
            	adv_msg.adTypes = pEvent->deviceDirectInfo.eventType | (pEvent->deviceDirectInfo.addrType << 4);
            	adv_msg.phyTypes = GAP_PHY_BIT_LE_1M | (GAP_PHY_BIT_LE_1M << 4);
            	adv_msg.rssi = pEvent->deviceDirectInfo.rssi;
            	memcpy(adv_msg.addr, pEvent->deviceDirectInfo.addr, B_ADDR_LEN);
-        	len = 10;
-        	app_drv_fifo_write(&app_tx_fifo, (uint8_t *)&adv_msg, &len);
-        	if(app_drv_fifo_length(&app_tx_fifo) >= RECE_BUF_LEN)
-        		tmos_set_event(eth_TaskID, ETH_SENG_DATA_EVENT);
+        	ObserverSendMsg(10);
         }
         break;
 /*
@@ -321,7 +382,7 @@ static void ObserverEventCB(gapRoleEvent_t *pEvent)
            		memcpy(adv_msg.data, pEvent->devicePeriodicInfo.pEvtData, len);
         	len += 9;
            	app_drv_fifo_write(&app_tx_fifo, (uint8_t *)&adv_msg,  &len);
-        	if(app_drv_fifo_length(&app_tx_fifo) >= RECE_BUF_LEN)
+        	if(app_drv_fifo_length(&app_tx_fifo) >= SEND_BUF_LEN)
         		tmos_set_event(eth_TaskID, ETH_SENG_DATA_EVENT);
 */
         default:
@@ -0,0 +1,254 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : resume.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/28
+ * Description        : Retention ring of the last v2 blocks: recording
+ *                      without a client and the replay after a reconnect
+ *                      (CTRL_CMD_RESUME)
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "CONFIG.h"
+#include "string.h"
+#include "stddef.h"
+#include "stream.h"
+#include "stats.h"
+#include "trace.h"
+#include "wchnet.h"
+#include "resume.h"
+
+#if STREAM_RESUME
+
+/* the blocks in flight are lost with the connection: the ring holds the send window and the block behind it */
+#if (RESUME_BUF_LEN < NET_NUM_TCP_SEG * WCHNET_TCP_MSS + SEND_BUF_LEN) || RESUME_BUF_LEN > 0x7FFF || (RESUME_BUF_LEN & 3)
+  #error "RESUME_BUF_LEN Error, Please Config RESUME_BUF_LEN >= NET_NUM_TCP_SEG * WCHNET_TCP_MSS + SEND_BUF_LEN, <= 32764, 4 * N"
+#endif
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define RESUME_WRAP             (RESUME_BUF_LEN * 2)    // positions run 0..RESUME_WRAP-1, a full ring is not an empty one
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+__attribute__((aligned(4))) static uint8_t resume_buf[RESUME_BUF_LEN];
+// ring positions modulo RESUME_WRAP, the buffer index is the position modulo RESUME_BUF_LEN
+static uint16_t resume_begin;
+static uint16_t resume_end;
+static uint16_t resume_rd;                      // replay: the next block to send
+static uint16_t resume_num;                     // blocks held
+static uint32_t resume_next;                    // sequence number after the newest block
+static uint8_t  resume_run;
+
+/*********************************************************************
+ * @fn      resume_add
+ *
+ * @brief   Position n bytes after pos.
+ */
+static uint16_t resume_add(uint16_t pos, uint16_t n)
+{
+    pos += n;
+    return pos >= RESUME_WRAP ? pos - RESUME_WRAP : pos;
+}
+
+static uint16_t resume_idx(uint16_t pos)
+{
+    return pos >= RESUME_BUF_LEN ? pos - RESUME_BUF_LEN : pos;
+}
+
+/*
+ * Bytes held
+ */
+static uint16_t resume_held(void)
+{
+    return resume_end >= resume_begin ? resume_end - resume_begin : resume_end + RESUME_WRAP - resume_begin;
+}
+
+/*********************************************************************
+ * @fn      resume_get
+ *
+ * @brief   Little-endian header field of the block at pos.
+ */
+static uint32_t resume_get(uint16_t pos, uint16_t offset, uint8_t n)
+{
+    uint32_t v = 0;
+
+    pos = resume_add(pos, offset);
+    while(n--)
+        v = (v << 8) | resume_buf[resume_idx(resume_add(pos, n))];
+    return v;
+}
+
+/*********************************************************************
+ * @fn      resume_blk_len
+ *
+ * @brief   Length of the block at pos: header, padded payload, CRC.
+ */
+static uint16_t resume_blk_len(uint16_t pos)
+{
+    return sizeof(stream_blk_hdr_t) + ((resume_get(pos, offsetof(stream_blk_hdr_t, len), 2) + 3) & ~3)
+           + STREAM_CRC_LEN;
+}
+
+static uint32_t resume_blk_seq(uint16_t pos)
+{
+    return resume_get(pos, offsetof(stream_blk_hdr_t, seq), 4);
+}
+
+/*********************************************************************
+ * @fn      resume_init
+ *
+ * @brief   Empty ring.
+ *
+ * @return  none
+ */
+void resume_init(void)
+{
+    resume_begin = resume_end = resume_rd = 0;
+    resume_num = 0;
+    resume_run = 0;
+}
+
+/*********************************************************************
+ * @fn      resume_put
+ *
+ * @brief   Keep a block just made, the oldest ones are dropped until it
+ *          fits. A block of a running replay is skipped by it.
+ *
+ * @param   blk - v2 block
+ * @param   len - its length, <= SEND_BUF_LEN
+ *
+ * @return  1 - queued behind the replay, 0 - the caller sends it
+ */
+__HIGH_CODE
+uint8_t resume_put(const uint8_t *blk, uint16_t len)
+{
+    uint16_t n, i;
+
+    while(resume_num && resume_held() + len > RESUME_BUF_LEN)
+    {
+        n = resume_blk_len(resume_begin);
+        if(resume_rd == resume_begin)
+            resume_rd = resume_add(resume_rd, n);
+        resume_begin = resume_add(resume_begin, n);
+        resume_num--;
+        gw_stats.resume_drop++;
+    }
+    i = resume_idx(resume_end);
+    n = MIN(len, RESUME_BUF_LEN - i);
+    memcpy(&resume_buf[i], blk, n);
+    memcpy(resume_buf, blk + n, len - n);
+    resume_end = resume_add(resume_end, len);
+    resume_num++;
+    resume_next = ((const stream_blk_hdr_t *)blk)->seq + 1;
+    if(!resume_run)
+        resume_rd = resume_end;
+    return resume_run;
+}
+
+/*********************************************************************
+ * @fn      resume_start
+ *
+ * @brief   Client request: the replay starts at the first block held
+ *          with the sequence number seq or later. Nothing is sent if
+ *          the client has them all.
+ *
+ * @param   seq - the first block the client has not received
+ *
+ * @return  none
+ */
+void resume_start(uint32_t seq)
+{
+    uint16_t pos = resume_begin;
+    uint16_t i;
+
+    gw_stats.resume_req++;
+    for(i = 0; i < resume_num; i++)
+    {
+        if((int32_t)(resume_blk_seq(pos) - seq) >= 0)
+            break;
+        pos = resume_add(pos, resume_blk_len(pos));
+    }
+    resume_rd = pos;
+    resume_run = pos != resume_end;
+    TRACE(TRACE_RESUME, seq, resume_run ? resume_blk_seq(pos) : resume_next);
+}
+
+/*********************************************************************
+ * @fn      resume_stop
+ *
+ * @brief   Connection closed: the replay stops, the blocks stay.
+ *
+ * @return  none
+ */
+void resume_stop(void)
+{
+    resume_run = 0;
+    resume_rd = resume_end;
+}
+
+/*********************************************************************
+ * @fn      resume_busy
+ *
+ * @return  1 - a replay runs
+ */
+uint8_t resume_busy(void)
+{
+    return resume_run;
+}
+
+/*********************************************************************
+ * @fn      resume_fill
+ *
+ * @brief   Copy the next block of the replay.
+ *
+ * @param   buf - send buffer
+ * @param   size - its size, SEND_BUF_LEN
+ *
+ * @return  block length, 0 - the replay is done
+ */
+__HIGH_CODE
+uint16_t resume_fill(uint8_t *buf, uint16_t size)
+{
+    uint16_t len, i, n;
+
+    if(!resume_run)
+        return 0;
+    len = resume_blk_len(resume_rd);
+    if(len > size)
+    {
+        resume_stop();
+        return 0;
+    }
+    i = resume_idx(resume_rd);
+    n = MIN(len, RESUME_BUF_LEN - i);
+    memcpy(buf, &resume_buf[i], n);
+    memcpy(buf + n, resume_buf, len - n);
+    resume_rd = resume_add(resume_rd, len);
+    resume_run = resume_rd != resume_end;
+    gw_stats.resume_blocks++;
+    return len;
+}
+
+/*********************************************************************
+ * @fn      resume_info
+ *
+ * @brief   What is held.
+ *
+ * @return  none
+ */
+void resume_info(resume_info_t *info)
+{
+    info->len = resume_held();
+    info->blocks = resume_num;
+    info->next = resume_next;
+    info->first = resume_num ? resume_blk_seq(resume_begin) : resume_next;
+}
+
+#endif /* STREAM_RESUME */
+
+/******************************** endfile @ resume ******************************/
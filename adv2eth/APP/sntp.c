@@ -0,0 +1,276 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : sntp.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/18
+ * Description        : SNTP client (RFC 4330) on the UDP socket, feeds
+ *                      the gateway clock (gwtime.h)
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "CONFIG.h"
+#include "string.h"
+#include "debug.h"
+#include "wchnet.h"
+#include "gwtime.h"
+#include "sntp.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define SNTP_UNIX_OFFSET        2208988800u     // 1900-01-01 to 1970-01-01, s
+#define SNTP_MODE_CLIENT        3
+#define SNTP_MODE_SERVER        4
+#define SNTP_VERSION            4
+#define SNTP_LI_ALARM           3
+
+/*********************************************************************
+ * EXTERNAL VARIABLES
+ */
+extern uint32_t volatile LocalTime;
+extern u8 GWIPAddr[4];
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+uint8_t sntp_server[4];
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static uint8_t  sntp_socket = 0xFF;
+static uint8_t  sntp_rx_buf[SNTP_MSG_LEN * 2];
+static uint8_t  sntp_wait;                      // request sent, no reply yet
+static uint8_t  sntp_burst;                     // exchanges left in this poll
+static uint32_t sntp_sent;                      // LocalTime of the request
+static uint32_t sntp_next;                      // LocalTime of the next request
+static uint64_t sntp_t1;                        // local time the request was sent
+static uint64_t sntp_best[4];                   // t1..t4 of the best sample of the burst
+static uint32_t sntp_best_delay;                // its round trip, us
+
+/*********************************************************************
+ * @fn      sntp_get_ts
+ *
+ * @brief   NTP timestamp (s since 1900 . 2^-32 s, BE) -> UTC us.
+ */
+static uint64_t sntp_get_ts(const uint8_t *p)
+{
+    uint32_t sec = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    uint32_t frac = (p[4] << 24) | (p[5] << 16) | (p[6] << 8) | p[7];
+
+    return (uint64_t)(sec - SNTP_UNIX_OFFSET) * 1000000 + (((uint64_t)frac * 1000000) >> 32);
+}
+
+/*********************************************************************
+ * @fn      sntp_ip
+ *
+ * @return  server to poll, NULL - none known yet
+ */
+static uint8_t *sntp_ip(void)
+{
+    if(sntp_server[0] | sntp_server[1] | sntp_server[2] | sntp_server[3])
+        return sntp_server;
+    if(GWIPAddr[0] | GWIPAddr[1] | GWIPAddr[2] | GWIPAddr[3])
+        return GWIPAddr;
+    return NULL;
+}
+
+/*********************************************************************
+ * @fn      sntp_done
+ *
+ * @brief   An exchange of the burst is over (reply or timeout): the next
+ *          one goes at once, after the last one the sample with the
+ *          shortest round trip is applied - the least queued on the way,
+ *          its offset the least skewed by path asymmetry.
+ *
+ * @return  none
+ */
+static void sntp_done(void)
+{
+    sntp_wait = 0;
+    sntp_next = LocalTime;
+    if(--sntp_burst)
+        return;
+    sntp_next += gwtime_stat.syncs < SNTP_FAST_SAMPLES ? SNTP_POLL_FAST_MS : SNTP_POLL_MS;
+    if(sntp_best_delay == UINT32_MAX)
+        return;
+    gwtime_sync(sntp_best[0], sntp_best[1], sntp_best[2], sntp_best[3]);
+    PRINT("SNTP: offset %d us, delay %u us, rate %d ppb\r\n",
+          (int)gwtime_stat.offset, (unsigned)gwtime_stat.delay, (int)gwtime_stat.rate);
+}
+
+/*********************************************************************
+ * @fn      sntp_recv
+ *
+ * @brief   UDP socket receive callback (WCHNET_MainTask context).
+ *          The reply is checked against the outstanding request: the
+ *          transmit time we sent must come back as the originate time.
+ *
+ * @param   socinf - socket
+ * @param   ipaddr - source IP
+ * @param   port - source port
+ * @param   buf - datagram
+ * @param   len - datagram length
+ *
+ * @return  none
+ */
+static void sntp_recv(struct _SOCK_INF *socinf, uint32_t ipaddr, uint16_t port, uint8_t *buf, uint32_t len)
+{
+    uint64_t t4 = gwtime_local();
+    uint64_t t2, t3;
+    uint32_t delay;
+    uint8_t i;
+
+    (void)socinf;
+    (void)ipaddr;
+    if(!sntp_wait || port != SNTP_PORT || len < SNTP_MSG_LEN
+       || (buf[0] & 7) != SNTP_MODE_SERVER || (buf[0] >> 6) == SNTP_LI_ALARM
+       || buf[1] == 0)                          // stratum 0: kiss-o'-death
+        return;
+    for(i = 0; i < 8; i++)
+    {
+        if(buf[24 + i] != (uint8_t)(sntp_t1 >> (56 - i * 8)))
+            return;
+    }
+    t2 = sntp_get_ts(&buf[32]);
+    t3 = sntp_get_ts(&buf[40]);
+    delay = (uint32_t)MIN((t4 - sntp_t1) - (t3 - t2), UINT32_MAX);
+    if(delay < sntp_best_delay)
+    {
+        sntp_best_delay = delay;
+        sntp_best[0] = sntp_t1;
+        sntp_best[1] = t2;
+        sntp_best[2] = t3;
+        sntp_best[3] = t4;
+    }
+    sntp_done();
+}
+
+/*********************************************************************
+ * @fn      sntp_send
+ *
+ * @brief   Send a client request, the first one starts a burst. The
+ *          transmit time field carries the local send time, the server
+ *          echoes it as the originate time.
+ *
+ * @return  none
+ */
+static void sntp_send(void)
+{
+    uint8_t msg[SNTP_MSG_LEN];
+    uint8_t *ip = sntp_ip();
+    uint32_t len = SNTP_MSG_LEN;
+    uint8_t i;
+
+    if(!ip)
+    {
+        sntp_next = LocalTime + SNTP_POLL_FAST_MS;
+        return;
+    }
+    if(!sntp_burst)
+    {
+        sntp_burst = SNTP_BURST;
+        sntp_best_delay = UINT32_MAX;
+    }
+    memset(msg, 0, sizeof(msg));
+    msg[0] = (SNTP_VERSION << 3) | SNTP_MODE_CLIENT;
+    sntp_t1 = gwtime_local();
+    for(i = 0; i < 8; i++)
+        msg[40 + i] = (uint8_t)(sntp_t1 >> (56 - i * 8));
+    sntp_sent = LocalTime;
+    sntp_wait = 1;
+    if(WCHNET_SocketUdpSendTo(sntp_socket, msg, &len, ip, SNTP_PORT) != WCHNET_ERR_SUCCESS)
+        sntp_done();
+}
+
+/*********************************************************************
+ * @fn      sntp_start
+ *
+ * @brief   Create the UDP socket once the address is known (DHCP) and
+ *          poll at once.
+ *
+ * @return  none
+ */
+void sntp_start(void)
+{
+    SOCK_INF inf;
+    uint8_t *ip = sntp_ip();
+    uint8_t i;
+
+    if(sntp_socket == 0xFF)
+    {
+        memset(&inf, 0, sizeof(inf));
+        if(ip)
+            memcpy(inf.IPAddr, ip, sizeof(inf.IPAddr));
+        inf.DesPort = SNTP_PORT;
+        inf.SourPort = SNTP_LOCAL_PORT;
+        inf.ProtoType = PROTO_TYPE_UDP;
+        inf.RecvStartPoint = (uint32_t)sntp_rx_buf;
+        inf.RecvBufLen = sizeof(sntp_rx_buf);
+        inf.AppCallBack = sntp_recv;
+        i = WCHNET_SocketCreat(&sntp_socket, &inf);
+        if(i != WCHNET_ERR_SUCCESS)
+        {
+            PRINT("SNTP: socket error %02x\r\n", i);
+            sntp_socket = 0xFF;
+            return;
+        }
+        PRINT("UDP Socket %d Create, SNTP\r\n", sntp_socket);
+    }
+    if(!sntp_wait)
+        sntp_send();
+}
+
+/*********************************************************************
+ * @fn      sntp_set_server
+ *
+ * @brief   Client request: new server, a new burst at once.
+ *
+ * @param   ip - 4 bytes, 0.0.0.0 - back to the DHCP gateway
+ *
+ * @return  none
+ */
+void sntp_set_server(const uint8_t *ip)
+{
+    memcpy(sntp_server, ip, sizeof(sntp_server));
+    sntp_wait = 0;
+    sntp_burst = 0;
+    sntp_next = LocalTime;
+}
+
+/*********************************************************************
+ * @fn      sntp_due
+ *
+ * @brief   When sntp_process() has work next: the reply timeout or the
+ *          next request.
+ *
+ * @return  LocalTime, ms
+ */
+uint32_t sntp_due(void)
+{
+    if(sntp_socket == 0xFF)
+        return LocalTime + SNTP_POLL_MS;
+    return sntp_wait ? sntp_sent + SNTP_TIMEOUT_MS : sntp_next;
+}
+
+/*********************************************************************
+ * @fn      sntp_process
+ *
+ * @brief   Main loop: a burst every poll interval, a reply lost for
+ *          SNTP_TIMEOUT_MS ends its exchange.
+ *
+ * @return  none
+ */
+void sntp_process(void)
+{
+    if(sntp_socket == 0xFF)
+        return;
+    if(sntp_wait && LocalTime - sntp_sent >= SNTP_TIMEOUT_MS)
+        sntp_done();
+    if(!sntp_wait && (int32_t)(LocalTime - sntp_next) >= 0)
+        sntp_send();
+}
+
+/******************************** endfile @ sntp ******************************/
@@ -0,0 +1,180 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : stats.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/05
+ * Description        : Runtime statistics, RAM pool high-water marks
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "string.h"
+#include "wchnet.h"
+#include "observer.h"
+#include "gwtime.h"
+#include "stats.h"
+#include "idle.h"
+#include "eth_driver.h"
+#include "resume.h"
+#include "trace.h"
+
+/*********************************************************************
+ * EXTERNAL VARIABLES
+ */
+extern uint32_t _ebss[];                    // Link.ld
+extern uint32_t _eusrstack[];
+extern uint8_t __stack_size[];
+extern uint8_t Mem_Heap_Memory[WCHNET_RAM_HEAP_SIZE];
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+gw_stats_t gw_stats;
+
+/*********************************************************************
+ * @fn      stats_stack_paint
+ *
+ * @brief   Fill the unused RAM between .bss and the current stack
+ *          pointer with STATS_PAINT_WORD.
+ *
+ * @return  none
+ */
+__attribute__((noinline))
+void stats_stack_paint(void)
+{
+    uint32_t *p = _ebss;
+    uint32_t *sp = (uint32_t *)__builtin_frame_address(0) - 32;
+
+    while(p < sp)
+        *p++ = STATS_PAINT_WORD;
+}
+
+/*********************************************************************
+ * @fn      stats_stack_scan
+ *
+ * @brief   Find the deepest stack use. The heap (_sbrk) grows up from
+ *          _ebss, the stack grows down from _eusrstack, the painted gap
+ *          between them is the never used RAM.
+ *
+ * @param   pfree - never used RAM, bytes
+ *
+ * @return  stack high-water mark, bytes
+ */
+static uint32_t stats_stack_scan(uint32_t *pfree)
+{
+    uint32_t *p = _ebss;
+    uint32_t *gap;
+
+    while(p < _eusrstack && *p != STATS_PAINT_WORD)     // heap in use
+        p++;
+    gap = p;
+    while(p < _eusrstack && *p == STATS_PAINT_WORD)     // never touched
+        p++;
+    *pfree = (uint32_t)p - (uint32_t)gap;
+    return (uint32_t)_eusrstack - (uint32_t)p;
+}
+
+/*********************************************************************
+ * @fn      stats_heap_scan
+ *
+ * @brief   WCHNET heap watermark. ETH_LibInit() paints the heap before
+ *          WCHNET_Init(), the first fit allocator fills it from the
+ *          bottom, the highest overwritten byte is the high-water mark.
+ *
+ * @return  heap high-water mark, bytes or STATS_UNKNOWN
+ */
+static uint32_t stats_heap_scan(void)
+{
+    uint32_t i = sizeof(Mem_Heap_Memory) - HEAP_MEM_ALIGN_SIZE;    // skip the end marker
+    uint32_t painted = 0;
+
+    while(i && Mem_Heap_Memory[i - 1] == STATS_PAINT_BYTE)
+    {
+        i--;
+        painted++;
+    }
+    if(!painted)
+        return STATS_UNKNOWN;       // heap cleared by the library or really full
+    return i;
+}
+
+/*********************************************************************
+ * @fn      stats_boot
+ *
+ * @brief   Time of a boot phase, SysTick runs from reset (Delay_Init).
+ *
+ * @param   phase - BOOT_*
+ *
+ * @return  none
+ */
+void stats_boot(uint8_t phase)
+{
+    uint32_t ms = (uint32_t)(SysTick_GetCount64() / (SYSTICK_FREQ / 1000));
+
+    gw_stats.boot_ms[phase] = ms ? ms : 1;
+    TRACE(TRACE_BOOT, phase, ms);
+}
+
+/*********************************************************************
+ * @fn      stats_get
+ *
+ * @brief   Take a snapshot of all statistics.
+ *
+ * @param   rep - snapshot
+ *
+ * @return  none
+ */
+void stats_get(gw_stats_rep_t *rep)
+{
+    memset(rep, 0, sizeof(gw_stats_rep_t));
+    rep->version = STATS_VERSION;
+    rep->size = sizeof(gw_stats_rep_t);
+    rep->fifo_size = app_tx_fifo.size;
+    rep->fifo_hwm = gw_stats.fifo_hwm;
+    rep->stack_size = (uint32_t)__stack_size;
+    rep->stack_hwm = stats_stack_scan(&rep->stack_free);
+    rep->net_heap_size = sizeof(Mem_Heap_Memory);
+    rep->net_heap_hwm = stats_heap_scan();
+    rep->adv_count = gw_stats.adv_count;
+    rep->adv_drop = gw_stats.adv_drop;
+    rep->time_syncs = gwtime_stat.syncs;
+    rep->time_offset = gwtime_stat.offset;
+    rep->time_delay = gwtime_stat.delay;
+    rep->time_rate = gwtime_stat.rate;
+    rep->lz_in = gw_stats.lz_in;
+    rep->lz_out = gw_stats.lz_out;
+    rep->eth_tx_num = ETH_TXBUFNB;
+    rep->eth_tx_hwm = gw_stats.eth_tx_hwm;
+    rep->eth_tx_busy = gw_stats.eth_tx_busy;
+    rep->eth_tx_err = gw_stats.eth_tx_err;
+    rep->eth_rx_filtered = gw_stats.eth_rx_filtered;
+    rep->eth_rx_overflow = gw_stats.eth_rx_overflow;
+    rep->eth_rx_err = gw_stats.eth_rx_err;
+    rep->loop_num = idle_stat.loops;
+    rep->sleep_num = idle_stat.sleeps;
+    rep->idle_pm = idle_ratio();
+    rep->eth_link = ETH_LinkState();
+    rep->eth_mbps = (rep->eth_link & ETH_LINK_UP) ? ETH_LINK_MBPS : 0;
+    rep->eth_slow = gw_stats.eth_slow;
+    rep->eth_crc_err = gw_stats.eth_crc_err;
+    rep->eth_renego = gw_stats.eth_renego;
+    rep->eth_nego_ms = gw_stats.eth_nego_ms;
+#if STREAM_RESUME
+    {
+        resume_info_t ri;
+
+        resume_info(&ri);
+        rep->resume_size = RESUME_BUF_LEN;
+        rep->resume_len = ri.len;
+        rep->resume_first = ri.first;
+        rep->resume_next = ri.next;
+    }
+#endif
+    rep->resume_req = gw_stats.resume_req;
+    rep->resume_blocks = gw_stats.resume_blocks;
+    rep->resume_drop = gw_stats.resume_drop;
+    memcpy(rep->boot_ms, gw_stats.boot_ms, sizeof(rep->boot_ms));
+}
+
+/******************************** endfile @ stats ******************************/
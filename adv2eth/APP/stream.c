@@ -0,0 +1,568 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : stream.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/14
+ * Description        : TCP stream framing: v1 bare frames or v2 blocks with
+ *                      sync word, sequence number and CRC32
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "CONFIG.h"
+#include "string.h"
+#include "app_drv_fifo.h"
+#include "observer.h"
+#include "ctrl.h"
+#include "stream.h"
+#include "advenc.h"
+#include "gwtime.h"
+#include "stats.h"
+#include "trace.h"
+#include "wchnet.h"
+#include "fifo_dma.h"
+#include "resume.h"
+#if STREAM_LZ
+#include "lz.h"
+#endif
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define STREAM_CRC_CHUNK        32       // words fed to the CRC unit with interrupts masked
+
+/*********************************************************************
+ * EXTERNAL VARIABLES
+ */
+extern u8 MACAddr[6];
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static uint8_t  stream_ver = STREAM_DEFAULT;     // framing of the bytes being sent
+static uint8_t  stream_req = STREAM_DEFAULT;     // requested by the client
+static uint32_t stream_seq;
+static uint16_t stream_rest;                     // v1: bytes left of the frame being sent
+static uint64_t stream_ts;                       // receive time of the records taken out
+static uint8_t  stream_ts_flags;
+#if STREAM_LZ
+static uint8_t  stream_lz;                       // STREAM_LZ_ON - compress the blocks
+__attribute__((aligned(4))) static uint8_t stream_lz_buf[SEND_BUF_LEN];   // raw payload
+#endif
+#if FIFO_DMA
+static uint8_t *stream_dma_buf;                  // bytes being copied out of the FIFO by DMA
+static uint16_t stream_dma_len;                  // 0 - none
+static uint16_t stream_dma_count;
+#endif
+
+/*********************************************************************
+ * @fn      stream_set_version
+ *
+ * @brief   Request the framing, applied from the next block.
+ *
+ * @param   ver - STREAM_V1 or STREAM_V2, anything else is ignored
+ *
+ * @return  none
+ */
+void stream_set_version(uint8_t ver)
+{
+    if(ver == STREAM_V1 || ver == STREAM_V2)
+        stream_req = ver;
+}
+
+/*********************************************************************
+ * @fn      stream_set_compress
+ *
+ * @brief   Block payload compression, applied from the next block: the
+ *          blocks do not depend on each other.
+ *
+ * @param   mode - STREAM_LZ_OFF or STREAM_LZ_ON, ignored without STREAM_LZ
+ *
+ * @return  none
+ */
+void stream_set_compress(uint8_t mode)
+{
+#if STREAM_LZ
+    stream_lz = (mode == STREAM_LZ_ON);
+#endif
+}
+
+/*********************************************************************
+ * @fn      stream_reset
+ *
+ * @brief   New connection: default framing, a FIFO copy in flight is
+ *          stopped, call it before the FIFO flush. The block sequence
+ *          is not reset, so the client sees the blocks lost with the
+ *          old one.
+ *
+ * @return  none
+ */
+void stream_reset(void)
+{
+#if FIFO_DMA
+    fifo_dma_abort();
+    stream_dma_len = 0;
+#endif
+    stream_ver = STREAM_DEFAULT;
+    stream_req = STREAM_DEFAULT;
+    stream_rest = 0;
+    stream_ts = 0;
+    stream_ts_flags = 0;
+#if STREAM_LZ
+    stream_lz = STREAM_LZ_OFF;
+#endif
+}
+
+/*********************************************************************
+ * @fn      stream_crc_seed
+ *
+ * @brief   Word that takes the CRC unit from its reset value to crc:
+ *          the 32 shifts of a word step run backwards.
+ */
+__HIGH_CODE
+static uint32_t stream_crc_seed(uint32_t crc)
+{
+    for(int i = 0; i < 32; i++)
+        crc = (crc & 1) ? ((crc ^ 0x04C11DB7) >> 1) | 0x80000000 : crc >> 1;
+    return crc ^ 0xFFFFFFFF;
+}
+
+/*********************************************************************
+ * @fn      stream_crc
+ *
+ * @brief   CRC32 of a word buffer on the CRC unit (clocked in WCHBLE_Init).
+ *          The BLE library uses the unit too: the block is fed in
+ *          STREAM_CRC_CHUNK words with interrupts masked, open in
+ *          between. If the unit was used meanwhile, the running value
+ *          is loaded back by a reset and one seed word.
+ *
+ * @param   buf - data, 4-byte aligned
+ * @param   words - length in 32-bit words
+ *
+ * @return  CRC32
+ */
+__HIGH_CODE
+static uint32_t stream_crc(uint32_t *buf, uint32_t words)
+{
+    uint32_t crc = 0xFFFFFFFF, n;
+
+    __disable_irq();
+    CRC_ResetDR();
+    while(words)
+    {
+        if(CRC_GetCRC() != crc)
+        {
+            CRC_ResetDR();
+            CRC_CalcCRC(stream_crc_seed(crc));
+        }
+        n = words < STREAM_CRC_CHUNK ? words : STREAM_CRC_CHUNK;
+        crc = CRC_CalcBlockCRC(buf, n);
+        __enable_irq();
+        buf += n;
+        words -= n;
+        __disable_irq();
+    }
+    __enable_irq();
+    return crc;
+}
+
+/*********************************************************************
+ * @fn      stream_byte
+ *
+ * @brief   Byte i of the stream: taken into buf or still in the FIFO.
+ */
+__HIGH_CODE
+static uint8_t stream_byte(const uint8_t *buf, uint16_t len, uint16_t i)
+{
+    return i < len ? buf[i] : app_drv_fifo_peek(&app_tx_fifo, i - len);
+}
+
+/*********************************************************************
+ * @fn      stream_pack
+ *
+ * @brief   Make a v2 block of the records taken out of the FIFO: the
+ *          first time record as a TIME, LZ4 if it saves bytes, header
+ *          and CRC.
+ *
+ * @param   buf - block buffer, 4-byte aligned
+ * @param   raw - the records: in the block or in the scratch buffer
+ * @param   plen - their length
+ * @param   count - number of records
+ *
+ * @return  block length
+ */
+__HIGH_CODE
+static uint16_t stream_pack(uint8_t *buf, uint8_t *raw, uint16_t plen, uint16_t count)
+{
+    stream_blk_hdr_t *hdr = (stream_blk_hdr_t *)buf;
+    uint8_t *p = buf + sizeof(stream_blk_hdr_t);
+    uint16_t len, flen, pos;
+    uint8_t stamp = 0, ver = STREAM_V2;
+    uint32_t crc;
+#if STREAM_LZ
+    uint16_t clen;
+#endif
+
+    for(pos = 0; pos < plen; pos += flen)
+    {
+        flen = adv_rec_len(raw[pos], raw[pos + 1]);
+        if((raw[pos + 1] & ADV_REC_TIME_MASK) != ADV_REC_TIME)
+            continue;
+        gwtime_rec_parse(&raw[pos], &stream_ts, &stream_ts_flags);
+        if(!stamp && raw[pos + 1] == ADV_REC_TIME_DELTA)
+        {
+            memmove(&raw[pos + ADV_TIME_ABS_LEN], &raw[pos + flen], plen - pos - flen);
+            plen += ADV_TIME_ABS_LEN - flen;
+            flen = gwtime_rec_abs(&raw[pos], stream_ts, stream_ts_flags);
+        }
+        stamp = 1;
+    }
+#if STREAM_LZ
+    if(raw != p)
+    {
+        // must come out shorter than the raw payload
+        TRACE_BEGIN(TRACE_LZ_BLOCK, plen, 0);
+        clen = plen > LZ_MFLIMIT ? lz_compress(raw, plen, p + STREAM_LZ_HDR_LEN, plen - STREAM_LZ_HDR_LEN - 1) : 0;
+        TRACE_END(TRACE_LZ_BLOCK, plen, clen);
+        gw_stats.lz_in += plen;
+        if(clen)
+        {
+            p[0] = (uint8_t)plen;
+            p[1] = (uint8_t)(plen >> 8);
+            plen = clen + STREAM_LZ_HDR_LEN;
+            ver |= STREAM_BLK_LZ;
+        }
+        else
+            memcpy(p, raw, plen);
+        gw_stats.lz_out += plen;
+    }
+#endif
+    len = plen;
+    while(plen & 3)
+        p[plen++] = 0;
+    hdr->magic = STREAM_MAGIC;
+    hdr->ver = ver;
+    hdr->hdr_len = sizeof(stream_blk_hdr_t);
+    hdr->count = count;
+    hdr->seq = stream_seq++;
+    hdr->len = len;
+    memcpy(hdr->gw_id, MACAddr, sizeof(hdr->gw_id));
+    plen += sizeof(stream_blk_hdr_t);
+    crc = stream_crc((uint32_t *)buf, plen / 4);
+    buf[plen++] = (uint8_t)crc;
+    buf[plen++] = (uint8_t)(crc >> 8);
+    buf[plen++] = (uint8_t)(crc >> 16);
+    buf[plen++] = (uint8_t)(crc >> 24);
+#if STREAM_RESUME
+    if(resume_put(buf, plen))
+        return 0;                               // behind the replay, resume_fill() sends it
+#endif
+    return plen;
+}
+
+/*********************************************************************
+ * @fn      stream_block
+ *
+ * @brief   Pack whole records from the TX FIFO into a v2 block. A time
+ *          record is not parted from its advert and the first one of
+ *          the block is sent as a TIME, the block decodes on its own.
+ *          With compression on the records are taken into a scratch
+ *          buffer and go into the block as LZ4 when it saves bytes.
+ *          A large take is copied by DMA (FIFO_DMA): 0 is returned and
+ *          the block is made by the call after the copy completes.
+ *
+ * @param   buf - block buffer, 4-byte aligned
+ * @param   size - buffer size
+ * @param   dma - 0: copy with the CPU
+ *
+ * @return  block length, 0 - the FIFO is empty or the copy is running
+ */
+__HIGH_CODE
+static uint16_t stream_block(uint8_t *buf, uint16_t size, uint8_t dma)
+{
+    uint8_t *raw = buf + sizeof(stream_blk_hdr_t);
+    uint16_t avail = app_drv_fifo_length(&app_tx_fifo);
+    uint16_t max = (size - sizeof(stream_blk_hdr_t) - STREAM_CRC_LEN) & ~3;
+    uint16_t len = 0, count = 0, cut = 0, cut_count = 0, grow = 0, flen, plen;
+    uint8_t b1, stamp = 0, pend = 0;
+
+#if FIFO_DMA
+    if(stream_dma_len)
+    {
+        plen = stream_dma_len;
+        stream_dma_len = 0;
+        return stream_pack(buf, stream_dma_buf, plen, stream_dma_count);
+    }
+#endif
+#if STREAM_LZ
+    if(stream_lz)
+    {
+        raw = stream_lz_buf;
+        max = MIN(max, sizeof(stream_lz_buf));
+    }
+#endif
+
+    // the FIFO holds whole records only (ObserverSendMsg, ctrl_put_svc)
+    while(len + 2 <= avail)
+    {
+        b1 = app_drv_fifo_peek(&app_tx_fifo, len + 1);
+        flen = adv_rec_len(app_drv_fifo_peek(&app_tx_fifo, len), b1);
+        if((b1 & ADV_REC_TIME_MASK) == ADV_REC_TIME && !stamp)
+        {
+            stamp = 1;
+            grow = ADV_TIME_ABS_LEN - flen;
+        }
+        if(len + flen + grow > max)
+            break;
+        len += flen;
+        count++;
+        if((b1 & ADV_REC_TIME_MASK) == ADV_REC_TIME)
+            pend = 1;
+        else if(b1 != ADV_SVC_MARKER)
+            pend = 0;
+        if(!pend)
+        {
+            cut = len;
+            cut_count = count;
+        }
+    }
+    if(!cut_count)
+        return 0;
+    plen = cut;
+#if FIFO_DMA
+    if(dma && fifo_dma_read(&app_tx_fifo, raw, plen))
+    {
+        stream_dma_buf = raw;
+        stream_dma_len = plen;
+        stream_dma_count = cut_count;
+        return 0;
+    }
+#endif
+    app_drv_fifo_read(&app_tx_fifo, raw, &plen);
+    return stream_pack(buf, raw, plen, cut_count);
+}
+
+/*********************************************************************
+ * @fn      stream_v2
+ *
+ * @brief   Next v2 block. While a replay runs (CTRL_CMD_RESUME) the
+ *          retained blocks go first, records already copied out of the
+ *          FIFO are packed into a block queued behind them.
+ *
+ * @param   buf - block buffer, 4-byte aligned
+ * @param   size - buffer size
+ *
+ * @return  block length, 0 - none or a DMA copy is running
+ */
+__HIGH_CODE
+static uint16_t stream_v2(uint8_t *buf, uint16_t size)
+{
+#if STREAM_RESUME
+    if(resume_busy())
+    {
+#if FIFO_DMA
+        if(stream_dma_len)
+            stream_block(buf, size, 0);
+#endif
+        return resume_fill(buf, size);
+    }
+#endif
+    return stream_block(buf, size, FIFO_DMA);
+}
+
+/*********************************************************************
+ * @fn      stream_v1_scan
+ *
+ * @brief   v1: the record boundary after a chunk taken out of the FIFO
+ *          (stream_rest), the running receive time.
+ *
+ * @param   buf - the chunk
+ * @param   rlen - its length
+ *
+ * @return  none
+ */
+__HIGH_CODE
+static void stream_v1_scan(const uint8_t *buf, uint16_t rlen)
+{
+    uint8_t rec[ADV_TIME_REC_MAX];
+    uint16_t pos, flen, i;
+    uint8_t b1;
+
+    for(pos = stream_rest; pos < rlen; pos += flen)
+    {
+        b1 = stream_byte(buf, rlen, pos + 1);
+        flen = adv_rec_len(buf[pos], b1);
+        if((b1 & ADV_REC_TIME_MASK) == ADV_REC_TIME)
+        {
+            for(i = 0; i < flen && i < sizeof(rec); i++)
+                rec[i] = stream_byte(buf, rlen, pos + i);
+            gwtime_rec_parse(rec, &stream_ts, &stream_ts_flags);
+        }
+    }
+    stream_rest = pos - rlen;
+}
+
+/*********************************************************************
+ * @fn      stream_fill
+ *
+ * @brief   Take the next bytes to send out of the TX FIFO. A framing
+ *          change requested by the client takes effect here, on a
+ *          frame boundary.
+ *
+ * @param   buf - send buffer, 4-byte aligned
+ * @param   size - buffer size
+ *
+ * @return  bytes in buf, 0 - none or a DMA copy is running
+ */
+__HIGH_CODE
+uint16_t stream_fill(uint8_t *buf, uint16_t size)
+{
+    uint16_t rlen = 0;
+
+#if FIFO_DMA
+    if(fifo_dma_busy())
+        return 0;                               // the next bytes are still on the way
+    if(stream_dma_len && stream_ver == STREAM_V2)
+        return stream_v2(buf, size);
+    rlen = stream_dma_len;                      // v1: copied into buf since the previous call
+    stream_dma_len = 0;
+#endif
+    if(!rlen)
+    {
+        if(!stream_rest)
+            stream_ver = stream_req;
+        if(stream_ver == STREAM_V2)
+            return stream_v2(buf, size);
+        rlen = MIN(app_drv_fifo_length(&app_tx_fifo), size);
+        if(stream_req != STREAM_V1)
+            rlen = MIN(rlen, stream_rest);      // finish the frame, then switch
+#if FIFO_DMA
+        if(fifo_dma_read(&app_tx_fifo, buf, rlen))
+        {
+            stream_dma_buf = buf;
+            stream_dma_len = rlen;
+            return 0;
+        }
+#endif
+        if(rlen)
+            app_drv_fifo_read(&app_tx_fifo, buf, &rlen);
+    }
+    stream_v1_scan(buf, rlen);
+    return rlen;
+}
+
+/*********************************************************************
+ * @fn      stream_offline
+ *
+ * @brief   No client (boot, the connection closed): the records go on
+ *          into v2 blocks kept by the retention ring (resume.h), full
+ *          records with the receive time, compressed. The rest of a v1
+ *          frame cut by the closed connection leaves the FIFO.
+ *
+ * @return  none
+ */
+void stream_offline(void)
+{
+#if STREAM_RESUME
+    resume_stop();
+#if FIFO_DMA
+    if(fifo_dma_busy())
+    {
+        fifo_dma_abort();                       // the bytes stay in the FIFO
+        stream_dma_len = 0;
+    }
+    else if(stream_dma_len && stream_ver == STREAM_V1)
+    {
+        stream_v1_scan(stream_dma_buf, stream_dma_len);
+        stream_dma_len = 0;
+    }
+#endif
+    app_drv_fifo_skip(&app_tx_fifo, stream_rest);
+    stream_rest = 0;
+    stream_ver = STREAM_V2;
+    stream_req = STREAM_V2;
+#if STREAM_LZ
+    stream_lz = STREAM_LZ_ON;
+#endif
+    advenc_reset();
+    gwtime_stamp_enable(1);
+#endif
+}
+
+/*********************************************************************
+ * @fn      stream_close
+ *
+ * @brief   Before stream_reset() on a new connection: in v2 the records
+ *          left in the FIFO are packed into blocks for the retention
+ *          ring with the CPU, nothing is sent. Otherwise bare v1 frames
+ *          stay for the new client from the next frame on, records in
+ *          the encoding of the old client are dropped.
+ *
+ * @param   buf - block buffer, 4-byte aligned
+ * @param   size - buffer size
+ *
+ * @return  none
+ */
+void stream_close(uint8_t *buf, uint16_t size)
+{
+#if STREAM_RESUME
+    resume_stop();
+#endif
+#if FIFO_DMA
+    if(fifo_dma_busy())
+    {
+        fifo_dma_abort();
+        stream_dma_len = 0;
+    }
+#endif
+#if STREAM_RESUME
+    if(stream_ver == STREAM_V2)
+    {
+#if FIFO_DMA
+        if(stream_dma_len)
+            stream_block(buf, size, 0);
+#endif
+        while(stream_block(buf, size, 0))
+            ;
+        app_drv_fifo_flush(&app_tx_fifo);               // a time record with no advert after it
+        return;
+    }
+#endif
+    if(advenc_mode != ADV_ENC_FULL || gwtime_stamp)
+    {
+        app_drv_fifo_flush(&app_tx_fifo);
+        return;
+    }
+    if(stream_ver == STREAM_V1)
+    {
+#if FIFO_DMA
+        if(stream_dma_len)
+        {
+            stream_v1_scan(stream_dma_buf, stream_dma_len);
+            stream_dma_len = 0;
+        }
+#endif
+        app_drv_fifo_skip(&app_tx_fifo, stream_rest);
+    }
+}
+
+/*********************************************************************
+ * @fn      stream_resume
+ *
+ * @brief   Client request: v2 framing, the retained blocks from seq on
+ *          are sent before the new ones.
+ *
+ * @param   seq - the first block the client has not received
+ *
+ * @return  none
+ */
+void stream_resume(uint32_t seq)
+{
+#if STREAM_RESUME
+    stream_req = STREAM_V2;
+    resume_start(seq);
+#endif
+}
+
+/******************************** endfile @ stream ******************************/
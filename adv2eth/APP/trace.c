@@ -0,0 +1,51 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : trace.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/02
+ * Description        : Binary event trace into a RAM ring buffer
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "string.h"
+#include "trace.h"
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+__attribute__((aligned(4))) trace_ring_t trace_ring;
+
+/*********************************************************************
+ * @fn      trace_init
+ *
+ * @brief   Initialize the trace ring and start recording.
+ *
+ * @return  none
+ */
+void trace_init(void)
+{
+    memset(&trace_ring, 0, sizeof(trace_ring));
+    trace_ring.magic = TRACE_MAGIC;
+    trace_ring.num = TRACE_BUF_NUM;
+    trace_ring.rec_size = sizeof(trace_rec_t);
+    trace_ring.freq = SYSTICK_FREQ;
+    trace_ring.enable = TRACE_ENABLE;
+}
+
+/*********************************************************************
+ * @fn      trace_enable
+ *
+ * @brief   Pause or resume recording.
+ *
+ * @param   on - 0: pause, 1: resume
+ *
+ * @return  none
+ */
+void trace_enable(uint32_t on)
+{
+    trace_ring.enable = on && TRACE_ENABLE;
+}
+
+/******************************** endfile @ trace ******************************/
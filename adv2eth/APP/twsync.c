@@ -0,0 +1,266 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : twsync.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/19
+ * Description        : Two-way time transfer with a collector over UDP,
+ *                      probe receive and reply transmit time stamped in
+ *                      the ETH interrupt
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include "CONFIG.h"
+#include "string.h"
+#include "debug.h"
+#include "wchnet.h"
+#include "gwtime.h"
+#include "twsync.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define TWSYNC_ETH_HDR          14
+#define TWSYNC_IP_HDR_MIN       20
+#define TWSYNC_UDP_HDR          8
+
+/*********************************************************************
+ * EXTERNAL VARIABLES
+ */
+extern u8 MACAddr[6];
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static uint8_t twsync_socket = 0xFF;
+static uint8_t twsync_rx_buf[sizeof(twsync_msg_t) * 2];
+
+// probe receive stamps, written in the interrupt
+static volatile uint32_t twsync_rx_wr;
+static volatile uint32_t twsync_rx_seq[TWSYNC_RX_SLOTS];
+static volatile uint32_t twsync_rx_ip[TWSYNC_RX_SLOTS];
+static volatile uint64_t twsync_rx_ticks[TWSYNC_RX_SLOTS];
+
+// the reply handed to the MAC and the transmit start of the last one sent
+static volatile uint8_t  twsync_tx_pending;
+static volatile uint16_t twsync_tx_len;
+static volatile uint32_t twsync_tx_seq;
+static volatile uint32_t twsync_tx_ip;
+static volatile uint8_t  twsync_t3_valid;
+static volatile uint32_t twsync_t3_seq;
+static volatile uint32_t twsync_t3_ip;
+static volatile uint64_t twsync_t3_ticks;
+
+/*********************************************************************
+ * @fn      twsync_udp_payload
+ *
+ * @brief   Locate a twsync message in an Ethernet frame: IPv4, not
+ *          fragmented, UDP with the port TWSYNC_PORT on our side.
+ *
+ * @param   frame - Ethernet frame
+ * @param   len - frame length
+ * @param   dst - 1: the destination port (received), 0: the source one
+ *
+ * @return  message, NULL - not a twsync frame
+ */
+static const uint8_t *twsync_udp_payload(const uint8_t *frame, uint32_t len, uint8_t dst)
+{
+    const uint8_t *ip = frame + TWSYNC_ETH_HDR;
+    const uint8_t *udp, *port;
+
+    if(len < TWSYNC_ETH_HDR + TWSYNC_IP_HDR_MIN + TWSYNC_UDP_HDR + sizeof(twsync_msg_t)
+       || frame[12] != 0x08 || frame[13] != 0x00            // IPv4
+       || (ip[0] & 0xF0) != 0x40 || ip[9] != 17             // UDP
+       || (ip[6] & 0x3F) != 0 || ip[7] != 0)                // no fragments
+        return NULL;
+    udp = ip + (ip[0] & 0x0F) * 4;
+    if(udp + TWSYNC_UDP_HDR + sizeof(twsync_msg_t) > frame + len)
+        return NULL;
+    port = dst ? udp + 2 : udp;
+    if(port[0] != (TWSYNC_PORT >> 8) || port[1] != (TWSYNC_PORT & 0xFF))
+        return NULL;
+    udp += TWSYNC_UDP_HDR;
+    if(udp[0] != TWSYNC_MAGIC0 || udp[1] != TWSYNC_MAGIC1)
+        return NULL;
+    return udp;
+}
+
+/*********************************************************************
+ * @fn      twsync_eth_rx
+ *
+ * @brief   ETH interrupt, a frame received: keep the stamp of a probe
+ *          for the socket callback. The stamp is the interrupt entry,
+ *          i.e. the end of the frame plus the interrupt latency: the
+ *          stack processing delay does not enter the exchange.
+ *
+ * @param   frame - Ethernet frame in the MAC receive buffer
+ * @param   len - frame length
+ * @param   ticks - SysTick at the interrupt entry
+ *
+ * @return  none
+ */
+void twsync_eth_rx(const uint8_t *frame, uint32_t len, uint64_t ticks)
+{
+    const uint8_t *m;
+    uint32_t i;
+
+    if(twsync_socket == 0xFF)
+        return;
+    m = twsync_udp_payload(frame, len, 1);
+    if(!m || m[2] != TWSYNC_PROBE)
+        return;
+    i = twsync_rx_wr & (TWSYNC_RX_SLOTS - 1);
+    twsync_rx_seq[i] = m[4] | (m[5] << 8) | (m[6] << 16) | ((uint32_t)m[7] << 24);
+    memcpy((void *)&twsync_rx_ip[i], frame + TWSYNC_ETH_HDR + 12, 4);
+    twsync_rx_ticks[i] = ticks;
+    twsync_rx_wr++;
+}
+
+/*********************************************************************
+ * @fn      twsync_eth_tx
+ *
+ * @brief   ETH driver, a frame goes to the MAC: a reply is marked for
+ *          twsync_eth_txdone().
+ *
+ * @param   frame - Ethernet frame
+ * @param   len - frame length
+ *
+ * @return  none
+ */
+void twsync_eth_tx(const uint8_t *frame, uint32_t len)
+{
+    const uint8_t *m;
+
+    if(twsync_socket == 0xFF)
+        return;
+    m = twsync_udp_payload(frame, len, 0);
+    if(!m || m[2] != TWSYNC_REPLY)
+        return;
+    twsync_tx_seq = m[4] | (m[5] << 8) | (m[6] << 16) | ((uint32_t)m[7] << 24);
+    memcpy((void *)&twsync_tx_ip, frame + TWSYNC_ETH_HDR + 16, 4);
+    twsync_tx_len = (uint16_t)len;
+    twsync_tx_pending = 1;
+}
+
+/*********************************************************************
+ * @fn      twsync_eth_txdone
+ *
+ * @brief   ETH interrupt, transmit done: the reply went out at the
+ *          interrupt entry less its time on the wire.
+ *
+ * @param   ticks - SysTick at the interrupt entry
+ * @param   ok - sent, 0 - transmit error
+ *
+ * @return  none
+ */
+void twsync_eth_txdone(uint64_t ticks, uint8_t ok)
+{
+    if(!twsync_tx_pending)
+        return;
+    twsync_tx_pending = 0;
+    if(!ok)
+        return;
+    twsync_t3_ticks = ticks - TWSYNC_WIRE_TICKS(twsync_tx_len);
+    twsync_t3_seq = twsync_tx_seq;
+    twsync_t3_ip = twsync_tx_ip;
+    twsync_t3_valid = 1;
+}
+
+/*********************************************************************
+ * @fn      twsync_recv
+ *
+ * @brief   UDP socket receive callback (WCHNET_MainTask context):
+ *          answer a probe, apply a correction.
+ *
+ * @param   socinf - socket
+ * @param   ipaddr - source IP
+ * @param   port - source port
+ * @param   buf - datagram
+ * @param   len - datagram length
+ *
+ * @return  none
+ */
+static void twsync_recv(struct _SOCK_INF *socinf, uint32_t ipaddr, uint16_t port, uint8_t *buf, uint32_t len)
+{
+    uint64_t now = gwtime_local();
+    twsync_msg_t m;
+    twsync_set_t set;
+    uint32_t i, n;
+
+    if(len < sizeof(set) || buf[0] != TWSYNC_MAGIC0 || buf[1] != TWSYNC_MAGIC1)
+        return;
+    if(buf[2] == TWSYNC_SET)
+    {
+        memcpy(&set, buf, sizeof(set));
+        gwtime_set(set.ref_local, set.ref_utc, set.rate);
+        return;
+    }
+    if(buf[2] != TWSYNC_PROBE || len < sizeof(m))
+        return;
+    memcpy(&m, buf, sizeof(m));
+    m.type = TWSYNC_REPLY;
+    m.flags = 0;
+    m.t2 = now;
+    // the newest stamp of this probe, older slots may hold a retry
+    for(i = 0; i < TWSYNC_RX_SLOTS; i++)
+    {
+        n = (twsync_rx_wr - 1 - i) & (TWSYNC_RX_SLOTS - 1);
+        if(twsync_rx_seq[n] == m.seq && twsync_rx_ip[n] == ipaddr && twsync_rx_ticks[n])
+        {
+            m.t2 = gwtime_from_ticks(twsync_rx_ticks[n]);
+            twsync_rx_ticks[n] = 0;
+            m.flags |= TWSYNC_F_T2_HW;
+            break;
+        }
+    }
+    m.prev_t3 = 0;
+    m.prev_seq = 0;
+    if(twsync_t3_valid && twsync_t3_ip == ipaddr)
+    {
+        m.prev_t3 = gwtime_from_ticks(twsync_t3_ticks);
+        m.prev_seq = twsync_t3_seq;
+        m.flags |= TWSYNC_F_T3_HW;
+    }
+    if(gwtime_flags() & GWTIME_TWSYNC)
+        m.flags |= TWSYNC_F_SET;
+    memcpy(m.gw_id, MACAddr, sizeof(m.gw_id));
+    memset(m.res, 0, sizeof(m.res));
+    len = sizeof(m);
+    WCHNET_SocketUdpSendTo(socinf->SockIndex, (uint8_t *)&m, &len, (uint8_t *)&ipaddr, port);
+}
+
+/*********************************************************************
+ * @fn      twsync_start
+ *
+ * @brief   Create the UDP socket once the address is known (DHCP): any
+ *          collector may send probes.
+ *
+ * @return  none
+ */
+void twsync_start(void)
+{
+    SOCK_INF inf;
+    uint8_t i;
+
+    if(twsync_socket != 0xFF)
+        return;
+    memset(&inf, 0, sizeof(inf));
+    memset(inf.IPAddr, 0xFF, sizeof(inf.IPAddr));
+    inf.DesPort = TWSYNC_PORT;
+    inf.SourPort = TWSYNC_PORT;
+    inf.ProtoType = PROTO_TYPE_UDP;
+    inf.RecvStartPoint = (uint32_t)twsync_rx_buf;
+    inf.RecvBufLen = sizeof(twsync_rx_buf);
+    inf.AppCallBack = twsync_recv;
+    i = WCHNET_SocketCreat(&twsync_socket, &inf);
+    if(i != WCHNET_ERR_SUCCESS)
+    {
+        PRINT("TWSYNC: socket error %02x\r\n", i);
+        twsync_socket = 0xFF;
+        return;
+    }
+    PRINT("UDP Socket %d Create, TWSYNC\r\n", twsync_socket);
+}
+
+/******************************** endfile @ twsync ******************************/
@@ -128,6 +128,8 @@ void WCHBLE_Init(void)
 #endif
 #if(defined(HAL_SLEEP)) && (HAL_SLEEP == TRUE)
     cfg.idleCB = BLE_LowPower; // Enable sleep
+#elif(defined(HAL_WFI)) && (HAL_WFI == TRUE)
+    cfg.idleCB = HAL_IdleWFI; // WFI between interrupts
 #endif
 #if(defined(BLE_MAC)) && (BLE_MAC == TRUE)
     for(i = 0; i < 6; i++)
@@ -236,7 +238,7 @@ void HAL_Init()
 {
     halTaskID = TMOS_ProcessEventRegister(HAL_ProcessEvent);
     HAL_TimeInit();
-#if(defined HAL_SLEEP) && (HAL_SLEEP == TRUE)
+#if((defined HAL_SLEEP) && (HAL_SLEEP == TRUE)) || ((defined HAL_WFI) && (HAL_WFI == TRUE))
     HAL_SleepInit();
 #endif
 #if(defined HAL_LED) && (HAL_LED == TRUE)
@@ -13,6 +13,7 @@
 /******************************************************************************/
 /* Header file contains */
 #include "HAL.h"
+#include "idle.h"
 
 #define US_TO_TICK(us)        (uint32_t)((us) / (1000000 / ((CAB_LSIFQ / 2))))
 
@@ -21,6 +22,8 @@
 #define SLEEP_PERIOD_MIN_TICK US_TO_TICK(SLEEP_PERIOD_MIN_US)
 #define HESREADY_TICK         US_TO_TICK(WAKE_UP_MAX_TIME_US)
 
+#define WFI_PERIOD_MIN_TICK   2
+
 /*******************************************************************************
  * @fn          BLE_LowPower
  *
@@ -73,6 +76,46 @@ uint32_t BLE_LowPower(uint32_t time)
     return 0;
 }
 
+/*******************************************************************************
+ * @fn          HAL_IdleWFI
+ *
+ * @brief       TMOS idle callback without STOP mode: WFI until the next
+ *              interrupt, the RTC alarm set for the next TMOS timer (the
+ *              network deadlines have TIM2). Interrupts are off from the
+ *              wake flags check to WFI: one pending in between ends WFI
+ *              at once.
+ *
+ * @param   time    - wake-up time (RTC count)
+ *
+ * @return      state.
+ */
+uint32_t HAL_IdleWFI(uint32_t time)
+{
+#if(defined(HAL_WFI)) && (HAL_WFI == TRUE)
+    static uint32_t alarm_time;
+    uint32_t sleep_period;
+    uint64_t t0;
+
+    __disable_irq();
+    sleep_period = time - RTC_GetCounter();
+    if(idle_wake || sleep_period < WFI_PERIOD_MIN_TICK || sleep_period > SLEEP_PERIOD_MAX_TICK)
+    {
+        __enable_irq();
+        return 2;
+    }
+    if(time != alarm_time || RTCTigFlag)
+    {
+        RTC_SetTignTime(time);
+        alarm_time = time;
+    }
+    t0 = SysTick_GetCount64();
+    __WFI();
+    idle_slept(t0);
+    __enable_irq();
+#endif
+    return 0;
+}
+
 /*******************************************************************************
  * @fn      HAL_SleepInit
  *
@@ -84,7 +127,7 @@ uint32_t BLE_LowPower(uint32_t time)
  */
 void HAL_SleepInit(void)
 {
-#if(defined(HAL_SLEEP)) && (HAL_SLEEP == TRUE)
+#if((defined HAL_SLEEP) && (HAL_SLEEP == TRUE)) || ((defined HAL_WFI) && (HAL_WFI == TRUE))
     RCC_APB1PeriphClockCmd(RCC_APB1Periph_PWR, ENABLE);
     RTC_WaitForLastTask();
 
@@ -40,6 +40,15 @@ extern void HAL_SleepInit(void);
  */
 extern uint32_t BLE_LowPower(uint32_t time);
 
+/**
+ * @brief   Wait for an interrupt, the clocks and the MAC keep running
+ *
+ * @param   time    - Wake-up time (RTC absolute value)
+ *
+ * @return  state.
+ */
+extern uint32_t HAL_IdleWFI(uint32_t time);
+
 /*********************************************************************
 *********************************************************************/
 
@@ -34,10 +34,14 @@
 
  SLEEP
  HAL_SLEEP                                  - Ƿ˯߹ ( Ĭ:FALSE )
+ HAL_WFI                                    - WFI in the TMOS idle callback while HAL_SLEEP is off, ETH keeps running ( default:TRUE )
  WAKE_UP_MAX_TIME_US                        - ǰʱ䣬ϵͳʱȶҪʱ
                                                                                                                                         ͣģʽ    - 45
                                                                                                                                        ģʽ    - 5
  
+ CODE
+ HAL_HIGHCODE                               - hot paths (__HIGH_CODE) in .highcode, the zero-wait flash, Link.ld ( default:TRUE )
+
  TEMPERATION
  TEM_SAMPLE                                 - Ƿ򿪸¶ȱ仯У׼ĹܣУ׼ʱС10ms( Ĭ:TRUE )
  
@@ -78,6 +82,12 @@
 #ifndef HAL_SLEEP
 #define HAL_SLEEP                           FALSE
 #endif
+#ifndef HAL_WFI
+#define HAL_WFI                             TRUE
+#endif
+#ifndef HAL_HIGHCODE
+#define HAL_HIGHCODE                        TRUE
+#endif
 #ifndef WAKE_UP_MAX_TIME_US
 #define WAKE_UP_MAX_TIME_US                 2400
 #endif
@@ -130,6 +140,12 @@
 #define CENTRAL_MAX_CONNECTION              3
 #endif
 
+#if HAL_HIGHCODE
+#define __HIGH_CODE                         __attribute__((section(".highcode")))
+#else
+#define __HIGH_CODE
+#endif
+
 extern uint32_t MEM_BUF[BLE_MEMHEAP_SIZE / 4];
 extern const uint8_t MacAddr[6];
 
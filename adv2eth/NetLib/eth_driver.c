@@ -10,7 +10,12 @@
 * microcontroller manufactured by Nanjing Qinheng Microelectronics.
 *******************************************************************************/
 #include "string.h"
+#include "CONFIG.h"
 #include "eth_driver.h"
+#include "trace.h"
+#include "stats.h"
+#include "twsync.h"
+#include "ipcfg.h"
 
  __attribute__((__aligned__(4))) ETH_DMADESCTypeDef DMARxDscrTab[ETH_RXBUFNB];      /* MAC receive descriptor, 4-byte aligned*/
  __attribute__((__aligned__(4))) ETH_DMADESCTypeDef DMATxDscrTab[ETH_TXBUFNB];      /* MAC send descriptor, 4-byte aligned */
@@ -42,7 +47,10 @@ const uint16_t MemSize[8] = {WCHNET_MEM_ALIGN_SIZE(WCHNET_SIZE_IPRAW_PCB),
  __attribute__((__aligned__(4)))uint8_t Mem_ArpTable[WCHNET_RAM_ARP_TABLE_SIZE];
 
 uint32_t volatile LocalTime;
-ETH_DMADESCTypeDef *DMATxDescToSet;
+ETH_DMADESCTypeDef *DMATxDescToSet;                 /* next free Tx descriptor, filled by ETH_TxPktChainMode */
+ETH_DMADESCTypeDef *volatile DMATxDescToGet;        /* oldest queued one: on the wire while ethTxBusy */
+volatile uint8_t ethTxBusy;
+volatile uint8_t ethTxQueued;                       /* descriptors owned by the MAC */
 ETH_DMADESCTypeDef *DMARxDescToGet;
 ETH_DMADESCTypeDef *pDMARxSet;
 
@@ -57,6 +65,15 @@ uint8_t CRCErrPktCnt = 0;
 uint8_t phyLinkStatus = 0;
 uint8_t phyPNChangeCnt = 0;
 uint8_t PhyPolarityDetect = 0;
+static uint8_t ethLinkClean = ETH_LINK_HOLD;        /* ETH_LINK_WIN_MS windows without errors in a row */
+static uint32_t ethNegoStart;                       /* LocalTime the link went down */
+
+#if ETH_RX_FILTER
+extern uint8_t IPAddr[4];                           /* eth.c, 0.0.0.0 until DHCP */
+extern uint8_t GWIPAddr[4];
+#endif
+uint8_t ethMcast[ETH_MCAST_MAX][6];
+uint8_t ethMcastNum;
 /*********************************************************************
  * @fn      WCHNET_GetMacAddr
  *
@@ -89,6 +106,57 @@ void WCHNET_TimeIsr( uint16_t timperiod )
     LocalTime += timperiod;
 }
 
+/*********************************************************************
+ * @fn      WCHNET_TimeUpdate
+ *
+ * @brief   Tickless time base: move LocalTime by the whole ms the free
+ *          running SysTick has counted since the previous call. Main
+ *          loop, before WCHNET_MainTask.
+ *
+ * @return  ms added.
+ */
+uint32_t WCHNET_TimeUpdate( void )
+{
+    static uint64_t last;
+    uint64_t dt = SysTick_GetCount64() - last;
+    uint32_t per_ms = SYSTICK_FREQ / 1000;
+    uint32_t ms;
+
+    if( dt > 0xFFFFFFFF )
+        dt = 0xFFFFFFFF;
+    ms = (uint32_t)dt / per_ms;
+    if( ms )
+    {
+        last += (uint64_t)ms * per_ms;
+        LocalTime += ms;
+    }
+    return ms;
+}
+
+/*********************************************************************
+ * @fn      WCHNET_TimePeriod
+ *
+ * @brief   How soon the driver and the library need the time to move:
+ *          the PHY negotiation polls every PHY_LINK_TASK_PERIOD, a TCP
+ *          connection past LISTEN runs the protocol timers.
+ *
+ * @return  ms.
+ */
+uint32_t WCHNET_TimePeriod( void )
+{
+    uint8_t i;
+
+    if( phyLinkReset || !phyStatus || PhyPolarityDetect )
+        return PHY_LINK_TASK_PERIOD;
+    for( i = 0; i < WCHNET_MAX_SOCKET_NUM; i++ )
+    {
+        if( SocketInf[i].ProtoType == PROTO_TYPE_TCP && (SocketInf[i].SockStatus & 0xFF) == SOCK_STAT_OPEN
+            && ((SocketInf[i].SockStatus >> 8) & 0xFF) > TCP_LISTEN )
+            return WCHNET_TICK_FAST_MS;
+    }
+    return WCHNET_TICK_SLOW_MS;
+}
+
 /*********************************************************************
  * @fn      WritePHYReg
  *
@@ -156,6 +224,7 @@ void WCHNET_LinkProcess( void )
                     phy_bmcr |= 1<<9;
                     WritePHYReg(PHY_BMCR, phy_bmcr);
                     WritePHYReg(PHY_MDIX, phyPN);
+                    gw_stats.eth_renego++;
                 }
                 else
                 {
@@ -175,6 +244,7 @@ void WCHNET_LinkProcess( void )
                 phy_bmcr = ReadPHYReg(PHY_BMCR);
                 phy_bmcr |= 1<<9;
                 WritePHYReg(PHY_BMCR, phy_bmcr);
+                gw_stats.eth_renego++;
                 if((phyPN&0x0C) == PHY_PN_SWITCH_P)
                 {
                     phyPN |= PHY_PN_SWITCH_N;
@@ -227,6 +297,7 @@ void WCHNET_LinkProcess( void )
                 phy_bmcr = ReadPHYReg(PHY_BMCR);
                 phy_bmcr |= 1<<9;
                 WritePHYReg(PHY_BMCR, phy_bmcr);
+                gw_stats.eth_renego++;
                 Delay_Us(10);
                 WritePHYReg(PHY_MDIX, phyPN);
             }
@@ -265,6 +336,7 @@ void WCHNET_PhyPNProcess(void)
             PhyVal |= 1 << 2;                   //change PHY PN Polarity to reverse
         WritePHYReg(PHY_MDIX, PhyVal);
         CRCErrPktCnt = 0;
+        gw_stats.eth_renego++;
     }
 }
 
@@ -287,6 +359,7 @@ void WCHNET_HandlePhyNegotiation(void)
             EXTEN->EXTEN_CTR |= EXTEN_ETH_10M_EN;
             WritePHYReg(PHY_BMCR, PHY_Reset);
             PHY_NEGOTIATION_PARAM_INIT();
+            gw_stats.eth_renego++;
         }
     }
     else
@@ -311,6 +384,58 @@ void WCHNET_HandlePhyNegotiation(void)
     }
 }
 
+/*********************************************************************
+ * @fn      ETH_LinkCheck
+ *
+ * @brief   Once per ETH_LINK_WIN_MS: receive and transmit errors of the
+ *          window against ETH_LINK_ERR_MAX. An error-prone link is slow
+ *          until ETH_LINK_HOLD clean windows in a row.
+ *
+ * @return  none
+ */
+static void ETH_LinkCheck( void )
+{
+    static uint32_t win, errs;
+    uint32_t e;
+
+    if( LocalTime - win < ETH_LINK_WIN_MS )
+        return;
+    win = LocalTime;
+    e = gw_stats.eth_crc_err + gw_stats.eth_rx_err + gw_stats.eth_tx_err;
+    if( e - errs >= ETH_LINK_ERR_MAX )
+    {
+        if( ethLinkClean >= ETH_LINK_HOLD && (gw_stats.eth_link & ETH_LINK_FDX) )
+        {
+            gw_stats.eth_slow++;                /* a half duplex link is slow already */
+            TRACE(TRACE_ETH_LINK, gw_stats.eth_link | ETH_LINK_SLOW, e - errs);
+        }
+        ethLinkClean = 0;
+    }
+    else if( ethLinkClean < ETH_LINK_HOLD )
+    {
+        if( ++ethLinkClean == ETH_LINK_HOLD )
+            TRACE(TRACE_ETH_LINK, ETH_LinkState(), 0);
+    }
+    errs = e;
+}
+
+/*********************************************************************
+ * @fn      ETH_LinkState
+ *
+ * @brief   Link as the sender sees it: up, duplex and the slow mode
+ *          for a half duplex or error-prone link.
+ *
+ * @return  ETH_LINK_UP, ETH_LINK_FDX, ETH_LINK_SLOW
+ */
+uint8_t ETH_LinkState( void )
+{
+    uint8_t st = gw_stats.eth_link;
+
+    if( (st & ETH_LINK_UP) && (!(st & ETH_LINK_FDX) || ethLinkClean < ETH_LINK_HOLD) )
+        st |= ETH_LINK_SLOW;
+    return st;
+}
+
 /*********************************************************************
  * @fn      WCHNET_MainTask
  *
@@ -323,6 +448,7 @@ void WCHNET_MainTask(void)
     WCHNET_NetInput( );         /* Ethernet data input */
     WCHNET_PeriodicHandle( );   /* Protocol stack time-related task processing */
     WCHNET_HandlePhyNegotiation( );
+    ETH_LinkCheck( );
 }
 
 /*********************************************************************
@@ -396,13 +522,29 @@ void ETH_LedConfiguration(void)
  */
 void ETH_DMATxDescChainInit(ETH_DMADESCTypeDef *DMATxDescTab, uint8_t *TxBuff, uint32_t TxBuffCount)
 {
+    uint8_t i = 0;
     ETH_DMADESCTypeDef *DMATxDesc;
 
     DMATxDescToSet = DMATxDescTab;
-    DMATxDesc = DMATxDescTab;
-    DMATxDesc->Status = 0;
-    DMATxDesc->Buffer1Addr = (uint32_t)TxBuff;
-    DMATxDesc->Buffer2NextDescAddr = (uint32_t)DMATxDescTab;
+    DMATxDescToGet = DMATxDescTab;
+    ethTxBusy = 0;
+    ethTxQueued = 0;
+    for(i = 0; i < TxBuffCount; i++)
+    {
+        DMATxDesc = DMATxDescTab + i;
+        DMATxDesc->Status = 0;
+        DMATxDesc->ControlBufferSize = 0;
+        DMATxDesc->Buffer1Addr = (uint32_t)(&TxBuff[i * ETH_TX_BUF_SZE]);
+
+        if(i < (TxBuffCount - 1))
+        {
+            DMATxDesc->Buffer2NextDescAddr = (uint32_t)(DMATxDescTab + i + 1);
+        }
+        else
+        {
+            DMATxDesc->Buffer2NextDescAddr = (uint32_t)(DMATxDescTab);
+        }
+    }
 }
 
 /*********************************************************************
@@ -492,7 +634,12 @@ void ETH_Configuration( uint8_t *macAddr )
     R8_ETH_ECON1 &= ~(RB_ETH_ECON1_TXRST|RB_ETH_ECON1_RXRST);
 
     //Filter mode, received packet type
+#if ETH_RX_FILTER
+    /* unicast to our MAC, broadcast, multicast of the hash table, ETH_RxAccept() takes it further */
+    R8_ETH_ERXFCON = RB_ETH_ERXFCON_EN | RB_ETH_ERXFCON_UCEN | RB_ETH_ERXFCON_BCEN | RB_ETH_ERXFCON_HTEN;
+#else
     R8_ETH_ERXFCON = 0;
+#endif
     R8_ETH_MAADRL1 = macAddr[5];                                        // MAC assignment
     R8_ETH_MAADRL2 = macAddr[4];
     R8_ETH_MAADRL3 = macAddr[3];
@@ -513,28 +660,154 @@ void ETH_Configuration( uint8_t *macAddr )
     EXTEN->EXTEN_CTR |= EXTEN_ETH_10M_EN;
 }
 
+/*********************************************************************
+ * @fn      ETH_MulticastAdd
+ *
+ * @brief   Receive a multicast group: a bit of the MAC hash table
+ *          (CRC32 of the address, bits 28:23) and an exact match entry
+ *          for ETH_RxAccept().
+ *
+ * @param   mac - group address
+ *
+ * @return  0 - done, 1 - no room
+ */
+uint8_t ETH_MulticastAdd( const uint8_t *mac )
+{
+    uint32_t crc = 0xFFFFFFFF;
+    uint8_t i, j;
+
+    for(i = 0; i < ethMcastNum; i++)
+    {
+        if(!memcmp(ethMcast[i], mac, 6))
+            return 0;
+    }
+    if(ethMcastNum >= ETH_MCAST_MAX)
+        return 1;
+    for(i = 0; i < 6; i++)
+    {
+        crc ^= mac[i];
+        for(j = 0; j < 8; j++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    crc = (~crc >> 23) & 0x3F;
+    if(crc < 32)
+        R32_ETH_HTL |= 1u << crc;
+    else
+        R32_ETH_HTH |= 1u << (crc - 32);
+    memcpy(ethMcast[ethMcastNum++], mac, 6);
+    return 0;
+}
+
+#if ETH_RX_FILTER
+/*********************************************************************
+ * @fn      ETH_RxAccept
+ *
+ * @brief   Interrupt: is a received frame for the stack. The MAC lets
+ *          through every broadcast and any multicast of a hash bit, here
+ *          only ARP that concerns us or the router, DHCP replies and the
+ *          joined groups remain. A dropped frame leaves its descriptor
+ *          with the MAC, storms do not take the buffers of our ACKs.
+ *
+ * @param   f - Ethernet frame
+ *          len - frame length
+ *
+ * @return  1 - to WCHNET_NetInput, 0 - drop
+ */
+__HIGH_CODE
+static uint8_t ETH_RxAccept( const uint8_t *f, uint16_t len )
+{
+    const uint8_t *p = f + ETH_HEADER;
+    uint8_t i;
+
+    if( len < ETH_HEADER )
+        return 0;
+    if( !(f[0] & 0x01) )
+        return 1;                                               /* unicast: the MAC matched our address */
+    if( (f[0] & f[1] & f[2] & f[3] & f[4] & f[5]) != 0xFF )
+    {
+        for(i = 0; i < ethMcastNum; i++)
+        {
+            if(!memcmp(ethMcast[i], f, 6))
+                return 1;
+        }
+        return 0;
+    }
+    if( f[12] == 0x08 && f[13] == 0x06 )                        /* ARP: target or sender is us, or the router */
+    {
+        if( len < ETH_HEADER + 28 )
+            return 0;
+        if( !(IPAddr[0] | IPAddr[1] | IPAddr[2] | IPAddr[3]) )
+            return 1;
+        return !memcmp(p + 24, IPAddr, 4) || !memcmp(p + 14, IPAddr, 4) || !memcmp(p + 14, GWIPAddr, 4);
+    }
+    if( f[12] == 0x08 && f[13] == 0x00 )                        /* IPv4: UDP to the DHCP client port */
+    {
+        if( len < ETH_HEADER + 20 + 8 || (p[0] & 0xF0) != 0x40 || p[9] != 17 )
+            return 0;
+        p += (p[0] & 0x0F) * 4;
+        return p + 4 <= f + len && p[2] == 0 && p[3] == 68;
+    }
+    return 0;
+}
+#endif
+
+/*********************************************************************
+ * @fn      ETH_TxStart
+ *
+ * @brief   Put the oldest queued descriptor on the wire. The MAC has one
+ *          transmit engine, the ring is walked by WCHNET_ETHIsr().
+ *
+ * @return  none
+ */
+__HIGH_CODE
+static void ETH_TxStart(void)
+{
+    ETH_DMADESCTypeDef *desc = DMATxDescToGet;
+
+    ethTxBusy = 1;
+    twsync_eth_tx((uint8_t *)desc->Buffer1Addr, desc->ControlBufferSize);
+    R16_ETH_ETXLN = desc->ControlBufferSize;
+    R16_ETH_ETXST = desc->Buffer1Addr;
+    R8_ETH_ECON1 |= RB_ETH_ECON1_TXRTS;                               //start sending
+}
+
 /*********************************************************************
  * @fn      ETH_TxPktChainMode
  *
- * @brief   Ethernet sends data frames in chain mode.
+ * @brief   Ethernet sends data frames in chain mode. The frame is copied
+ *          into the next free descriptor of the ring, so the library
+ *          can build the next segment while this one waits or goes out.
  *
  * @param   len     Send data length
  *          pBuff   send buffer pointer
  *
  * @return  Send status.
  */
+__HIGH_CODE
 uint32_t ETH_TxPktChainMode(uint16_t len, uint32_t *pBuff )
 {
+#if IPCFG_CHECK
+    if( ipcfg_guard && !ipcfg_eth_tx((uint8_t *)pBuff, len) )
+        return ETH_SUCCESS;                                     /* from the unconfirmed address: dropped (ipcfg.c) */
+#endif
      /* Check if the descriptor is owned by the ETHERNET DMA (when set) or CPU (when reset) */
     if( DMATxDescToSet->Status & ETH_DMATxDesc_OWN )
     {
-        /* Return ERROR: OWN bit set */
+        /* Return ERROR: ring full, the library retries */
+        gw_stats.eth_tx_busy++;
+        TRACE(TRACE_ETH_TX_BUSY, len, ethTxQueued);
         return ETH_ERROR;
     }
+    memcpy((void *)DMATxDescToSet->Buffer1Addr, pBuff, len);
+    DMATxDescToSet->ControlBufferSize = len;
+    NVIC_DisableIRQ(ETH_IRQn);
     DMATxDescToSet->Status |= ETH_DMATxDesc_OWN;
-    R16_ETH_ETXLN = len;
-    R16_ETH_ETXST = (uint32_t)pBuff;
-    R8_ETH_ECON1 |= RB_ETH_ECON1_TXRTS;                               //start sending
+    ethTxQueued++;
+    if( ethTxQueued > gw_stats.eth_tx_hwm )
+        gw_stats.eth_tx_hwm = ethTxQueued;
+    if( !ethTxBusy )
+        ETH_TxStart();
+    NVIC_EnableIRQ(ETH_IRQn);
     /* Update the ETHERNET DMA global Tx descriptor with next Tx descriptor */
     /* Chained Mode */
     /* Selects the next DMA Tx descriptor list for next buffer to send */
@@ -543,10 +816,56 @@ uint32_t ETH_TxPktChainMode(uint16_t len, uint32_t *pBuff )
     return ETH_SUCCESS;
 }
 
+/*********************************************************************
+ * @fn      ETH_TxDone
+ *
+ * @brief   Interrupt: the frame on the wire is done, free its descriptor
+ *          and start the next queued one.
+ *
+ * @param   ticks - SysTick at the interrupt entry
+ *          ok - sent, 0 - transmit error
+ *
+ * @return  none
+ */
+__HIGH_CODE
+static void ETH_TxDone(uint64_t ticks, uint8_t ok)
+{
+    if( !ethTxBusy )
+        return;
+    twsync_eth_txdone(ticks, ok);
+    if( !ok )
+        gw_stats.eth_tx_err++;
+    DMATxDescToGet->Status &= ~ETH_DMATxDesc_OWN;
+    DMATxDescToGet = (ETH_DMADESCTypeDef*) (DMATxDescToGet->Buffer2NextDescAddr);
+    ethTxQueued--;
+    ethTxBusy = 0;
+    if( DMATxDescToGet->Status & ETH_DMATxDesc_OWN )
+        ETH_TxStart();
+}
+
+/*********************************************************************
+ * @fn      ETH_LinkDown
+ *
+ * @brief   Interrupt: the link is lost or renegotiated, the time to the
+ *          next link up goes to eth_nego_ms.
+ *
+ * @return  none
+ */
+static void ETH_LinkDown( void )
+{
+    if( gw_stats.eth_link & ETH_LINK_UP )
+    {
+        ethNegoStart = LocalTime;
+        TRACE(TRACE_ETH_LINK, 0, 0);
+    }
+    gw_stats.eth_link = 0;
+}
+
 /*********************************************************************
  * @fn      ETH_PHYLink
  *
- * @brief
+ * @brief   Interrupt: link change. Duplex from the partner abilities,
+ *          link state and negotiation time for the statistics.
  *
  * @return  none
  */
@@ -558,6 +877,8 @@ void ETH_PHYLink( void )
     phy_stat = ReadPHYReg(PHY_BMSR);                            //Read PHY Status Register
 
     if((phy_stat&(PHY_Linked_Status))&&(phy_anlpar == 0)){      //restart negotiation
+        gw_stats.eth_renego++;
+        ETH_LinkDown();
         EXTEN->EXTEN_CTR &= ~EXTEN_ETH_10M_EN;
         phyLinkReset = 1;
         phyLinkTime = LocalTime;
@@ -567,14 +888,21 @@ void ETH_PHYLink( void )
 
     if( (phy_stat&(PHY_Linked_Status)) && (phy_stat&PHY_AutoNego_Complete) )
     {
+        if( !(gw_stats.eth_link & ETH_LINK_UP) )
+            gw_stats.eth_nego_ms += LocalTime - ethNegoStart;
         if( phy_anlpar&(1<<6) )
         {
             R8_ETH_MACON2 |= RB_ETH_MACON2_FULDPX;
+            gw_stats.eth_link = ETH_LINK_UP | ETH_LINK_FDX;
         }
         else
         {
             R8_ETH_MACON2 &= ~RB_ETH_MACON2_FULDPX;
+            gw_stats.eth_link = ETH_LINK_UP;
+            gw_stats.eth_slow++;                                /* half duplex: slow send mode */
         }
+        TRACE(TRACE_ETH_LINK, ETH_LinkState(), phy_anlpar);
+        STATS_BOOT(BOOT_LINK);
         /* Receive CRC error packets */
         R8_ETH_ERXFCON |= RB_ETH_ERXFCON_CRCEN;
         CRCErrPktCnt = 0;
@@ -585,6 +913,7 @@ void ETH_PHYLink( void )
     }
     else
     {
+        ETH_LinkDown();
         EXTEN->EXTEN_CTR &= ~EXTEN_ETH_10M_EN;
         phyLinkReset = 1;
         phyLinkTime = LocalTime;
@@ -598,11 +927,14 @@ void ETH_PHYLink( void )
  *
  * @return  none
  */
+__HIGH_CODE
 void WCHNET_ETHIsr( void )
 {
     uint8_t eth_irq_flag, estat_regval;
+    uint64_t ticks = SysTick_GetCount64();                          //twsync stamp, the earliest point
 
     eth_irq_flag = R8_ETH_EIR;
+    TRACE_BEGIN(TRACE_ETH_ISR, eth_irq_flag, R16_ETH_ERXLN);
     if(eth_irq_flag&RB_ETH_EIR_RXIF)                                //Receive complete
     {
         R8_ETH_EIR = RB_ETH_EIR_RXIF;
@@ -613,10 +945,30 @@ void WCHNET_ETHIsr( void )
             if(estat_regval & \
                     (RB_ETH_ESTAT_BUFER | RB_ETH_ESTAT_RXCRCER | RB_ETH_ESTAT_RXNIBBLE | RB_ETH_ESTAT_RXMORE))
             {
+                gw_stats.eth_rx_err++;
+                TRACE(TRACE_ETH_RX_DROP, estat_regval, DMARxDescToGet->Status);
+                TRACE_END(TRACE_ETH_ISR, eth_irq_flag, 0);
                 return;
             }
+#if IPCFG_CHECK
+            if( ipcfg_guard && !ipcfg_eth_rx((uint8_t *)DMARxDescToGet->Buffer1Addr, R16_ETH_ERXLN) )
+            {
+                /* the remembered address is not confirmed yet: the stack does not answer for it (ipcfg.c) */
+                gw_stats.eth_rx_filtered++;
+            }
+            else
+#endif
+#if ETH_RX_FILTER
+            if( !ETH_RxAccept((uint8_t *)DMARxDescToGet->Buffer1Addr, R16_ETH_ERXLN) )
+            {
+                /* the buffer stays with the MAC for the next frame */
+                gw_stats.eth_rx_filtered++;
+            }
+            else
+#endif
             if( ((ETH_DMADESCTypeDef*)(DMARxDescToGet->Buffer2NextDescAddr))->Status& ETH_DMARxDesc_OWN )
             {
+                twsync_eth_rx((uint8_t *)DMARxDescToGet->Buffer1Addr, R16_ETH_ERXLN, ticks);
                 DMARxDescToGet->Status &= ~ETH_DMARxDesc_OWN;
                 DMARxDescToGet->Status &= ~ETH_DMARxDesc_ES;
                 DMARxDescToGet->Status |= (ETH_DMARxDesc_FS|ETH_DMARxDesc_LS);
@@ -627,6 +979,12 @@ void WCHNET_ETHIsr( void )
                 DMARxDescToGet = (ETH_DMADESCTypeDef*) (DMARxDescToGet->Buffer2NextDescAddr);
                 R16_ETH_ERXST = DMARxDescToGet->Buffer1Addr;
             }
+            else
+            {
+                /* all other buffers wait for WCHNET_NetInput: the frame is overwritten by the next one */
+                gw_stats.eth_rx_overflow++;
+                TRACE(TRACE_ETH_RX_DROP, estat_regval, DMARxDescToGet->Status);
+            }
         }
         if(PhyPolarityDetect)
 		{
@@ -635,39 +993,38 @@ void WCHNET_ETHIsr( void )
 			R8_ETH_ERXFCON &= ~RB_ETH_ERXFCON_CRCEN;
 		}
     }
-    if(eth_irq_flag&RB_ETH_EIR_TXIF)                                //send completed
+    if(eth_irq_flag&(RB_ETH_EIR_TXIF|RB_ETH_EIR_TXERIF))            //send completed or error, one frame
     {
-        DMATxDescToSet->Status &= ~ETH_DMATxDesc_OWN;
-        R8_ETH_EIR = RB_ETH_EIR_TXIF;
+        R8_ETH_EIR = eth_irq_flag&(RB_ETH_EIR_TXIF|RB_ETH_EIR_TXERIF);
+        ETH_TxDone(ticks, !(eth_irq_flag&RB_ETH_EIR_TXERIF));
     }
     if(eth_irq_flag&RB_ETH_EIR_LINKIF)                              //Link change
     {
         ETH_PHYLink();
         R8_ETH_EIR = RB_ETH_EIR_LINKIF;
     }
-    if(eth_irq_flag&RB_ETH_EIR_TXERIF)                              //send error
-    {
-        DMATxDescToSet->Status &= ~ETH_DMATxDesc_OWN;
-        R8_ETH_EIR = RB_ETH_EIR_TXERIF;
-    }
     if(eth_irq_flag&RB_ETH_EIR_RXERIF)                              //receive error
     {
+        gw_stats.eth_crc_err++;
         if(PhyPolarityDetect) CRCErrPktCnt++;
         R8_ETH_EIR = RB_ETH_EIR_RXERIF;
     }
+    TRACE_END(TRACE_ETH_ISR, eth_irq_flag, 0);
 }
 
 /*********************************************************************
  * @fn      ETH_Init
  *
- * @brief   Ethernet initialization.
+ * @brief   Ethernet initialization. The PHY starts ETH_PHY_SETTLE_MS
+ *          after reset (SysTick runs from Delay_Init), not that long
+ *          after this call: the negotiation begins as soon as allowed.
  *
  * @return  none
  */
 void ETH_Init( uint8_t *macAddr )
 {
     ETH_LedConfiguration( );
-    Delay_Ms(100);
+    while( SysTick_GetCount64() < (uint64_t)ETH_PHY_SETTLE_MS * (SYSTICK_FREQ / 1000) );
     ETH_Configuration( macAddr );
     ETH_DMATxDescChainInit(DMATxDscrTab, MACTxBuf, ETH_TXBUFNB);
     ETH_DMARxDescChainInit(DMARxDscrTab, MACRxBuf, ETH_RXBUFNB);
@@ -687,6 +1044,7 @@ uint8_t ETH_LibInit( uint8_t *ip, uint8_t *gwip, uint8_t *mask, uint8_t *macaddr
     uint8_t s;
     struct _WCH_CFG  cfg;
 
+    memset(Mem_Heap_Memory, STATS_PAINT_BYTE, sizeof(Mem_Heap_Memory));  /* heap watermark, see stats.c */
     memset(&cfg,0,sizeof(cfg));
     cfg.TxBufSize = ETH_TX_BUF_SZE;
     cfg.TCPMss   = WCHNET_TCP_MSS;
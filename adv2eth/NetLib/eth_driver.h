@@ -38,6 +38,15 @@
 #define WCHNETTIMERPERIOD                       10   /* Timer period, in Ms. */
 #endif
 
+/* Tickless time base: LocalTime follows SysTick (WCHNET_TimeUpdate), the main loop is woken
+ * only when the protocol needs the time to move (WCHNET_TimePeriod) */
+#define WCHNET_TICK_FAST_MS                     50   /* TCP connection open: retransmit unit, delayed ACK */
+#define WCHNET_TICK_SLOW_MS                     500  /* listening only: ARP ageing, DHCP lease */
+
+#ifndef ETH_PHY_SETTLE_MS
+#define ETH_PHY_SETTLE_MS                       100  /* PHY start after reset, the BLE init takes part of it */
+#endif
+
 #define PHY_NEGOTIATION_PARAM_INIT()      do{\
         phySucCnt = 0;\
         phyStatus = 0;\
@@ -56,6 +65,25 @@
 #define MIN_ETH_PAYLOAD          46    /* Minimum Ethernet payload size */
 #define MAX_ETH_PAYLOAD        1500    /* Maximum Ethernet payload size */
 
+/* Receive filter: unicast to us, ARP and DHCP broadcasts for us, joined multicast groups (ETH_MulticastAdd).
+ * 0 - everything goes to WCHNET_NetInput */
+#ifndef ETH_RX_FILTER
+#define ETH_RX_FILTER             1
+#endif
+#define ETH_MCAST_MAX             4    /* multicast groups */
+
+/* Link quality (ETH_LinkState): a half duplex link, or ETH_LINK_ERR_MAX receive/transmit errors in an
+ * ETH_LINK_WIN_MS window, make the link slow until ETH_LINK_HOLD clean windows pass. The sender (eth.c)
+ * then hands the library shorter segments and paces them, collisions and retransmits stay rare */
+#define ETH_LINK_WIN_MS           1000
+#define ETH_LINK_ERR_MAX          4
+#define ETH_LINK_HOLD             5
+#define ETH_LINK_MBPS             10   /* the only rate of the built-in PHY */
+
+#define ETH_LINK_UP               0x01 /* ETH_LinkState() bits, stats eth_link */
+#define ETH_LINK_FDX              0x02 /* full duplex */
+#define ETH_LINK_SLOW             0x04 /* half duplex or errors: slow send mode */
+
 /* Bit or field definition of TDES0 register (DMA Tx descriptor status register)*/
 #define ETH_DMATxDesc_OWN         ((uint32_t)0x80000000)  /* OWN bit: descriptor is owned by DMA engine */
 
@@ -93,7 +121,12 @@ void ETH_Init( uint8_t *macAddr );
 void ETH_LedLinkSet( uint8_t mode );
 void ETH_LedDataSet( uint8_t mode );
 void WCHNET_TimeIsr( uint16_t timperiod );
+uint32_t WCHNET_TimeUpdate( void );
+uint32_t WCHNET_TimePeriod( void );
 void ETH_Configuration( uint8_t *macAddr );
+uint8_t ETH_MulticastAdd( const uint8_t *mac );
+uint8_t ETH_LinkState( void );
+uint32_t ETH_TxPktChainMode( uint16_t len, uint32_t *pBuff );
 uint8_t ETH_LibInit( uint8_t *ip, uint8_t *gwip, uint8_t *mask, uint8_t *macaddr);
 
 #ifdef __cplusplus
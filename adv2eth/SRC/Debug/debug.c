@@ -29,6 +29,12 @@ void Delay_Init(void)
 {
     p_us = SystemCoreClock / 8000000;
     p_ms = (uint16_t)p_us * 1000;
+    /* SysTick is left free-running (count up, HCLK/8, no reload),
+     * it is also used as the system timestamp counter */
+    SysTick->CTLR = 0;
+    SysTick->SR = 0;
+    SysTick->CNT = 0;
+    SysTick->CTLR = (1 << 0);
 }
 
 /*********************************************************************
@@ -42,17 +48,12 @@ void Delay_Init(void)
  */
 void Delay_Us(uint32_t n)
 {
-    uint32_t i;
+    uint32_t i, t;
 
-    SysTick->SR &= ~(1 << 0);
+    t = SysTick_GetCount();
     i = (uint32_t)n * p_us;
 
-    SysTick->CMP = i;
-    SysTick->CTLR |= (1 << 4);
-    SysTick->CTLR |= (1 << 5) | (1 << 0);
-
-    while((SysTick->SR & (1 << 0)) != (1 << 0));
-    SysTick->CTLR &= ~(1 << 0);
+    while((SysTick_GetCount() - t) < i);
 }
 
 /*********************************************************************
@@ -66,17 +67,13 @@ void Delay_Us(uint32_t n)
  */
 void Delay_Ms(uint32_t n)
 {
-    uint32_t i;
-
-    SysTick->SR &= ~(1 << 0);
-    i = (uint32_t)n * p_ms;
-
-    SysTick->CMP = i;
-    SysTick->CTLR |= (1 << 4);
-    SysTick->CTLR |= (1 << 5) | (1 << 0);
+    uint32_t t;
 
-    while((SysTick->SR & (1 << 0)) != (1 << 0));
-    SysTick->CTLR &= ~(1 << 0);
+    while(n--)
+    {
+        t = SysTick_GetCount();
+        while((SysTick_GetCount() - t) < p_ms);
+    }
 }
 
 /*********************************************************************
@@ -45,6 +45,42 @@ void Delay_Ms(uint32_t n);
 void USART_Printf_Init(uint32_t baudrate);
 void SDI_Printf_Enable(void);
 
+/* SysTick runs free at HCLK/8 after Delay_Init() */
+#define SYSTICK_FREQ   (SystemCoreClock / 8)
+
+/*********************************************************************
+ * @fn      SysTick_GetCount
+ *
+ * @brief   Get the low 32 bits of the free-running SysTick counter.
+ *
+ * @return  SysTick counter, HCLK/8 ticks
+ */
+__attribute__((always_inline)) RV_STATIC_INLINE uint32_t SysTick_GetCount(void)
+{
+    return *((volatile uint32_t *)&SysTick->CNT);
+}
+
+/*********************************************************************
+ * @fn      SysTick_GetCount64
+ *
+ * @brief   Get the whole 64-bit SysTick counter, the high word is
+ *          read again if the low one wrapped in between.
+ *
+ * @return  SysTick counter, HCLK/8 ticks
+ */
+__attribute__((always_inline)) RV_STATIC_INLINE uint64_t SysTick_GetCount64(void)
+{
+    volatile uint32_t *cnt = (volatile uint32_t *)&SysTick->CNT;
+    uint32_t hi, lo;
+
+    do
+    {
+        hi = cnt[1];
+        lo = cnt[0];
+    } while(hi != cnt[1]);
+    return ((uint64_t)hi << 32) | lo;
+}
+
 #if(DEBUG)
   #define PRINT(format, ...)    printf(format, ##__VA_ARGS__)
 #else
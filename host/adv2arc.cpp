@@ -0,0 +1,497 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : adv2arc.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/24
+ * Description        : Columnar advert archive: captures (.advc), saved
+ *                      gateway streams, live gateways or a synthetic day
+ *                      into partition files, MAC queries and file info
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <vector>
+#include "advcap.h"
+#include "advarc.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define AA_CHUNK                (64 * 1024) // stream file read size
+#define AA_SYNTH_DAY            1709251200  // 2024-03-01 00:00 UTC
+#define AA_SYNTH_PASSING        64          // passing devices at a time
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static volatile sig_atomic_t stop_req;
+static uint32_t rnd_state = 1;
+
+static uint32_t rnd()
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static uint64_t unix_us()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static double host_time()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop_req = 1;
+}
+
+/*
+ * "a4:c1:38:01:02:03" or "a4c138010203" -> Frame::mac48(), -1 - bad
+ */
+static int64_t parse_mac(const char *s)
+{
+    uint64_t mac = 0;
+    int n = 0;
+
+    for(; *s && n < 12; s++)
+    {
+        if(*s == ':' || *s == '-')
+            continue;
+        if(*s >= '0' && *s <= '9')
+            mac = (mac << 4) | (*s - '0');
+        else if((*s | 0x20) >= 'a' && (*s | 0x20) <= 'f')
+            mac = (mac << 4) | ((*s | 0x20) - 'a' + 10);
+        else
+            return -1;
+        n++;
+    }
+    return n == 12 && !*s ? (int64_t)mac : -1;
+}
+
+/*********************************************************************
+ * @fn      put_advc
+ *
+ * @brief   Capture file records as frames of gateway gw.
+ *
+ * @return  0 - ok, -1 - read or write error
+ */
+static int put_advc(advcol::ArchiveWriter &w, advcap_t *cap, uint32_t gw)
+{
+    uint8_t frame[ADV_HDR_LEN + 255];
+    advcap_rec_t rec;
+    advcol::Frame f = advcol::Frame();
+    int r;
+
+    f.data = frame;
+    f.gw = gw;
+    while((r = advcap_read(cap, &rec, frame + ADV_HDR_LEN)) > 0)
+    {
+        frame[0] = rec.dataLen;
+        frame[1] = rec.eventType | (rec.addrType << 4);
+        frame[2] = rec.type == ADVCAP_EXT_ADV_INFO ? rec.primaryPHY | (rec.secondaryPHY << 4) : 0x11;
+        frame[3] = (uint8_t)rec.rssi;
+        memcpy(&frame[4], rec.addr, 6);
+        f.len = ADV_HDR_LEN + rec.dataLen;
+        if(!w.add(f, advcap_ts_us(cap, rec.ts)))
+            return -1;
+    }
+    return r;
+}
+
+/*********************************************************************
+ * @fn      put_stream
+ *
+ * @brief   Gateway stream as sent on the socket. Unstamped adverts take
+ *          the time of the last stamp.
+ *
+ * @return  0 - ok, -1 - read or write error
+ */
+static int put_stream(advcol::ArchiveWriter &w, FILE *in, uint32_t gw)
+{
+    std::vector<uint8_t> buf(2 * AA_CHUNK);
+    advcol::Parser parser(gw);
+    size_t len = 0, n;
+    uint64_t ts = 0;
+    bool ok = true;
+
+    while(ok && (n = fread(&buf[len], 1, buf.size() - len, in)) > 0)
+    {
+        len += n;
+        n = parser.parse(buf.data(), len, [&](const advcol::Frame &f)
+        {
+            if(f.has_ts)
+                ts = f.ts;
+            ok = ok && w.add(f, ts);
+        });
+        memmove(buf.data(), &buf[n], len - n);
+        len -= n;
+    }
+    return ferror(in) || !ok ? -1 : 0;
+}
+
+/*********************************************************************
+ * @fn      put_synth
+ *
+ * @brief   A day of a sensor population: fixed devices with data
+ *          changing every few adverts, and passing devices (phones, ...)
+ *          with rotating random addresses making up a third of the rows.
+ */
+static int put_synth(advcol::ArchiveWriter &w, uint32_t devices, uint64_t rows)
+{
+    struct Dev
+    {
+        uint8_t  mac[6];
+        uint16_t count;
+        int8_t   rssi;
+        uint64_t until_ms;      // passing devices: MAC rotation
+    };
+    std::vector<Dev> dev(devices), pass(AA_SYNTH_PASSING);
+    uint8_t frame[ADV_HDR_LEN + 31];
+    advcol::Frame f = advcol::Frame();
+    uint64_t t_ms = 0, step_ms, i;
+    uint32_t d;
+
+    for(d = 0; d < devices; d++)
+    {
+        for(int j = 0; j < 6; j++)
+            dev[d].mac[j] = (uint8_t)rnd();
+        dev[d].count = 0;
+        dev[d].rssi = (int8_t)(-40 - rnd() % 50);
+    }
+    for(d = 0; d < AA_SYNTH_PASSING; d++)
+        pass[d].until_ms = 0;
+    // rows spread over the day
+    step_ms = 86400000ull / (rows ? rows : 1);
+    if(!step_ms)
+        step_ms = 1;
+    f.data = frame;
+    for(i = 0; i < rows; i++, t_ms += step_ms)
+    {
+        if(!devices || rnd() % 3 == 0)
+        {
+            Dev &v = pass[rnd() % AA_SYNTH_PASSING];
+
+            if(t_ms >= v.until_ms)
+            {
+                // new resolvable private address every 1..15 min
+                for(int j = 0; j < 6; j++)
+                    v.mac[j] = (uint8_t)rnd();
+                v.mac[5] = (v.mac[5] & 0x3F) | 0x40;
+                v.until_ms = t_ms + 60000 + rnd() % 840000;
+                v.rssi = (int8_t)(-70 - rnd() % 30);
+                v.count = (uint16_t)rnd();
+            }
+            memcpy(frame + 4, v.mac, 6);
+            v.rssi = (int8_t)(v.rssi + (int)(rnd() % 7) - 3);
+            frame[3] = (uint8_t)v.rssi;
+            v.count++;
+            // Apple nearby info, the state changes every 16th advert
+            frame[0] = 16;
+            frame[1] = 0x00 | (3 << 4);         // ADV_IND, RPA
+            frame[2] = 0x11;
+            memcpy(frame + ADV_HDR_LEN, "\x02\x01\x1A\x0B\xFF\x4C\x00\x10\x06", 9);
+            memset(frame + ADV_HDR_LEN + 9, (uint8_t)(v.count / 16), 7);
+        }
+        else
+        {
+            Dev &v = dev[rnd() % devices];
+
+            memcpy(frame + 4, v.mac, 6);
+            v.rssi = (int8_t)(v.rssi + (int)(rnd() % 5) - 2);
+            frame[3] = (uint8_t)v.rssi;
+            v.count++;
+            // pvvx custom format, the measurement changes every 4th advert
+            frame[0] = 18;
+            frame[1] = 0x03 | (1 << 4);         // ADV_NONCONN_IND, static address
+            frame[2] = 0x11;
+            frame[ADV_HDR_LEN] = 17;
+            frame[ADV_HDR_LEN + 1] = 0x16;
+            frame[ADV_HDR_LEN + 2] = 0x1A;
+            frame[ADV_HDR_LEN + 3] = 0x18;
+            memcpy(frame + ADV_HDR_LEN + 4, v.mac, 6);
+            frame[ADV_HDR_LEN + 10] = (uint8_t)(2100 + v.count / 4 % 50);
+            frame[ADV_HDR_LEN + 11] = 0x08;
+            memset(frame + ADV_HDR_LEN + 12, 0x5A, 5);
+            frame[ADV_HDR_LEN + 17] = (uint8_t)(v.count / 4);
+        }
+        f.len = ADV_HDR_LEN + frame[0];
+        if(!w.add(f, (AA_SYNTH_DAY * 1000ull + t_ms) * 1000))
+            return -1;
+    }
+    if(devices)
+    {
+        printf("devices            %u, e.g. %02x:%02x:%02x:%02x:%02x:%02x\n", devices, dev[0].mac[5],
+               dev[0].mac[4], dev[0].mac[3], dev[0].mac[2], dev[0].mac[1], dev[0].mac[0]);
+    }
+    return 0;
+}
+
+static void print_row(const advcol::ArcRow &r)
+{
+    char tbuf[32];
+    time_t t = (time_t)(r.ts / 1000000);
+    struct tm tm;
+
+    gmtime_r(&t, &tm);
+    strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%06u %012llx %u %4d %02x %02x ", tbuf, (unsigned)(r.ts % 1000000), (unsigned long long)r.mac,
+           r.gw, r.rssi, r.adv_types, r.phy_types);
+    for(uint32_t i = 0; i < r.len; i++)
+        printf("%02x", r.data[i]);
+    printf("\n");
+}
+
+static int info(const char *name)
+{
+    advcol::ArchiveReader rd;
+    uint64_t rows = 0, macs = 0, pays = 0, bytes;
+    size_t bad;
+
+    if(!rd.open(name))
+    {
+        perror(name);
+        return 1;
+    }
+    bytes = rd.header().hdr_size + rd.tail();
+    for(size_t i = 0; i < rd.blocks(); i++)
+    {
+        bytes += rd.block(i).size;
+        rows += rd.block(i).rows;
+        macs += rd.block(i).macs;
+        pays += rd.block(i).payloads;
+    }
+    bad = rd.verify();
+    printf("%s: part %llu +%u s, %zu blocks, %llu rows, %llu MAC runs, %llu payloads, %.1f bytes/row, "
+           "%zu bad CRC, %zu bytes cut\n", name, (unsigned long long)rd.header().part_start,
+           rd.header().part_sec, rd.blocks(), (unsigned long long)rows, (unsigned long long)macs,
+           (unsigned long long)pays, rows ? 1.0 * bytes / rows : 0.0, bad, rd.tail());
+    return bad ? 1 : 0;
+}
+
+static void usage()
+{
+    printf("Usage: adv2arc [options] -o DIR input ...\n"
+           "       adv2arc -q MAC [-s FROM] [-e TO] [-c] file.ava ...\n"
+           "       adv2arc -i file.ava ...\n"
+           "write:\n"
+           "  input    capture (.advc) or saved gateway stream\n"
+           "  -o DIR   archive directory\n"
+           "  -P SEC   partition length (default 86400, a UTC day)\n"
+           "  -B N     rows per block (default %u)\n"
+           "  -S N     no input: a synthetic day of N devices\n"
+           "  -n N     synthetic rows (default 10000000)\n"
+           "  -g       inputs are live gateways (IP address or name)\n"
+           "  -p PORT  gateway TCP port (default 1000)\n"
+           "  -1       v1 framing (default v2)\n"
+           "  -D       compact records\n"
+           "  -Z       receive time records\n"
+           "  -L       compressed v2 blocks\n"
+           "  -t SEC   stop after SEC seconds (default: Ctrl+C)\n"
+           "query:\n"
+           "  -q MAC   rows of one device, aa:bb:cc:dd:ee:ff\n"
+           "  -s FROM  from UNIX time, s\n"
+           "  -e TO    to UNIX time, s\n"
+           "  -c       count only\n"
+           "  -i       file info, block CRC check\n", advcol::ARC_BLOCK_ROWS);
+}
+
+int main(int argc, char **argv)
+{
+    advcol::GatewayOptions opt;
+    const char *dir = nullptr;
+    uint32_t part_sec = advcol::ARC_PART_SEC, block_rows = advcol::ARC_BLOCK_ROWS, synth = 0;
+    uint64_t synth_rows = 10000000, from = 0, to = UINT64_MAX;
+    int64_t mac = -1;
+    bool gw_live = false, count_only = false, do_info = false, synth_on = false;
+    double t, t_stop = 0;
+    int c, r = 0;
+
+    while((c = getopt(argc, argv, "o:P:B:S:n:gp:1DZLt:q:s:e:cih")) != -1)
+    {
+        switch(c)
+        {
+            case 'o': dir = optarg; break;
+            case 'P': part_sec = strtoul(optarg, NULL, 0); break;
+            case 'B': block_rows = strtoul(optarg, NULL, 0); break;
+            case 'S': synth = strtoul(optarg, NULL, 0); synth_on = true; break;
+            case 'n': synth_rows = strtoull(optarg, NULL, 0); break;
+            case 'g': gw_live = true; break;
+            case 'p': opt.port = (uint16_t)strtoul(optarg, NULL, 0); break;
+            case '1': opt.framing = STREAM_V1; break;
+            case 'D': opt.compact = true; break;
+            case 'Z': opt.stamp = true; break;
+            case 'L': opt.lz = true; break;
+            case 't': t_stop = strtod(optarg, NULL); break;
+            case 'q':
+                mac = parse_mac(optarg);
+                if(mac < 0)
+                {
+                    fprintf(stderr, "%s: bad MAC\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's': from = (uint64_t)(strtod(optarg, NULL) * 1e6); break;
+            case 'e': to = (uint64_t)(strtod(optarg, NULL) * 1e6); break;
+            case 'c': count_only = true; break;
+            case 'i': do_info = true; break;
+            default: usage(); return 1;
+        }
+    }
+    if(do_info || mac >= 0)
+    {
+        advcol::ArcReaderStats st = advcol::ArcReaderStats();
+        uint64_t n = 0;
+
+        if(optind >= argc)
+        {
+            usage();
+            return 1;
+        }
+        t = host_time();
+        for(int i = optind; i < argc; i++)
+        {
+            advcol::ArchiveReader rd;
+
+            if(do_info)
+            {
+                r |= info(argv[i]);
+                continue;
+            }
+            if(!rd.open(argv[i]))
+            {
+                perror(argv[i]);
+                return 1;
+            }
+            n += rd.scan((uint64_t)mac, from, to, [&](const advcol::ArcRow &row)
+            {
+                if(!count_only)
+                    print_row(row);
+            });
+            st.blocks += rd.stats().blocks;
+            st.skip_ts += rd.stats().skip_ts;
+            st.skip_range += rd.stats().skip_range;
+            st.skip_bloom += rd.stats().skip_bloom;
+            st.dict_miss += rd.stats().dict_miss;
+            st.rows += rd.stats().rows;
+        }
+        t = host_time() - t;
+        if(!do_info)
+        {
+            fprintf(stderr, "%llu rows, %.3f ms; blocks %llu: skipped by time %llu, MAC range %llu, "
+                    "bloom %llu, dictionary %llu; %llu rows decoded\n", (unsigned long long)n, t * 1e3,
+                    (unsigned long long)st.blocks, (unsigned long long)st.skip_ts,
+                    (unsigned long long)st.skip_range, (unsigned long long)st.skip_bloom,
+                    (unsigned long long)st.dict_miss, (unsigned long long)st.rows);
+        }
+        return r;
+    }
+    if(!dir || (optind >= argc && !synth_on))
+    {
+        usage();
+        return 1;
+    }
+
+    advcol::ArchiveWriter w(dir, part_sec, block_rows);
+
+    t = host_time();
+    if(synth_on)
+    {
+        rnd_state = 1;
+        r = put_synth(w, synth, synth_rows);
+    }
+    else if(gw_live)
+    {
+        advcol::Collector col;
+
+        for(int i = optind; i < argc; i++)
+        {
+            if(col.add(argv[i], opt) < 0)
+            {
+                fprintf(stderr, "%s: bad address\n", argv[i]);
+                return 1;
+            }
+        }
+        // stamps in UTC as they are, else the time of reception here
+        col.on_frame([&](const advcol::Frame &f)
+        {
+            if(!w.add(f, f.has_ts && (f.ts_flags & GWTIME_SYNCED) ? f.ts : unix_us()))
+                r = -1;
+        });
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        while(!stop_req && !r && col.poll(100) >= 0)
+        {
+            if(t_stop && host_time() - t >= t_stop)
+                break;
+        }
+    }
+    else
+    {
+        for(int i = optind; i < argc && !r; i++)
+        {
+            uint32_t magic = 0;
+            advcap_t cap;
+            FILE *in;
+
+            in = fopen(argv[i], "rb");
+            if(!in)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+            if(fread(&magic, sizeof(magic), 1, in) != 1)
+                magic = 0;
+            if(magic == ADVCAP_MAGIC)
+            {
+                fclose(in);
+                if(advcap_open(&cap, argv[i]))
+                {
+                    perror(argv[i]);
+                    return 1;
+                }
+                r = put_advc(w, &cap, i - optind);
+                advcap_close(&cap);
+            }
+            else
+            {
+                rewind(in);
+                r = put_stream(w, in, i - optind);
+                fclose(in);
+            }
+        }
+    }
+    if(!w.close() || r)
+    {
+        fprintf(stderr, "%s: %s\n", dir, r ? "input or write error" : "write error");
+        return 1;
+    }
+    t = host_time() - t;
+    printf("rows               %llu in %llu blocks, %llu files (last %s)\n", (unsigned long long)w.stats().rows,
+           (unsigned long long)w.stats().blocks, (unsigned long long)w.stats().files, w.file().c_str());
+    printf("size               %llu bytes, %.2f bytes/row, frames %llu bytes (%.1fx), %llu distinct payloads\n",
+           (unsigned long long)w.stats().bytes, w.stats().rows ? 1.0 * w.stats().bytes / w.stats().rows : 0.0,
+           (unsigned long long)w.stats().raw_bytes,
+           w.stats().bytes ? 1.0 * w.stats().raw_bytes / w.stats().bytes : 0.0,
+           (unsigned long long)w.stats().payloads);
+    printf("write              %.2f s, %.2f M rows/s\n", t, t > 0 ? w.stats().rows / t * 1e-6 : 0.0);
+    return 0;
+}
@@ -0,0 +1,262 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : adv2pcap.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/23
+ * Description        : Advert stream to pcapng (BLE LL with the RF pseudo
+ *                      header) for Wireshark: captures (.advc), saved
+ *                      gateway streams or live gateways
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <vector>
+#include "advcap.h"
+#include "advpcap.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define AP_CHUNK                (64 * 1024) // stream file read size
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static volatile sig_atomic_t stop_req;
+
+static uint64_t unix_us()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static double host_time()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop_req = 1;
+}
+
+/*********************************************************************
+ * @fn      put_advc
+ *
+ * @brief   Capture file records as frames of gateway gw.
+ *
+ * @return  0 - ok, -1 - read error
+ */
+static int put_advc(advcol::PcapWriter &w, advcap_t *cap, uint32_t gw)
+{
+    uint8_t frame[ADV_HDR_LEN + 255];
+    advcap_rec_t rec;
+    advcol::Frame f = advcol::Frame();
+    int r;
+
+    f.data = frame;
+    f.gw = gw;
+    while((r = advcap_read(cap, &rec, frame + ADV_HDR_LEN)) > 0)
+    {
+        frame[0] = rec.dataLen;
+        frame[1] = rec.eventType | (rec.addrType << 4);
+        frame[2] = rec.type == ADVCAP_EXT_ADV_INFO ? rec.primaryPHY | (rec.secondaryPHY << 4) : 0x11;
+        frame[3] = (uint8_t)rec.rssi;
+        memcpy(&frame[4], rec.addr, 6);
+        f.len = ADV_HDR_LEN + rec.dataLen;
+        w.write(f, advcap_ts_us(cap, rec.ts));
+    }
+    return r;
+}
+
+/*********************************************************************
+ * @fn      put_stream
+ *
+ * @brief   Gateway stream as sent on the socket (colbench -o, a raw TCP
+ *          dump): v1, v2, compact, time and LZ records. Unstamped
+ *          adverts take the time of the last stamp.
+ *
+ * @return  0 - ok, -1 - read error
+ */
+static int put_stream(advcol::PcapWriter &w, FILE *in, uint32_t gw, advcol::ParserStats &st)
+{
+    std::vector<uint8_t> buf(2 * AP_CHUNK);
+    advcol::Parser parser(gw);
+    size_t len = 0, n;
+    uint64_t ts = 0;
+
+    while((n = fread(&buf[len], 1, buf.size() - len, in)) > 0)
+    {
+        len += n;
+        n = parser.parse(buf.data(), len, [&](const advcol::Frame &f)
+        {
+            if(f.has_ts)
+                ts = f.ts;
+            w.write(f, ts);
+        });
+        memmove(buf.data(), &buf[n], len - n);
+        len -= n;
+    }
+    st = parser.stats();
+    return ferror(in) ? -1 : 0;
+}
+
+static void usage()
+{
+    printf("Usage: adv2pcap [options] -w out.pcapng input ...\n"
+           "  input    capture (.advc) or saved gateway stream, one interface each\n"
+           "  -g       inputs are live gateways (IP address or name)\n"
+           "  -w FILE  output, - - stdout (adv2pcap -g -w - 192.168.2.134 | wireshark -k -i -)\n"
+           "live:\n"
+           "  -p PORT  gateway TCP port (default 1000)\n"
+           "  -1       v1 framing (default v2)\n"
+           "  -D       compact records\n"
+           "  -Z       receive time records\n"
+           "  -L       compressed v2 blocks\n"
+           "  -t SEC   stop after SEC seconds (default: Ctrl+C)\n");
+}
+
+int main(int argc, char **argv)
+{
+    advcol::GatewayOptions opt;
+    advcol::PcapWriter w;
+    const char *out = nullptr;
+    bool gw_live = false;
+    double t, t_stop = 0;
+    int c;
+
+    while((c = getopt(argc, argv, "gw:p:1DZLt:h")) != -1)
+    {
+        switch(c)
+        {
+            case 'g': gw_live = true; break;
+            case 'w': out = optarg; break;
+            case 'p': opt.port = (uint16_t)strtoul(optarg, NULL, 0); break;
+            case '1': opt.framing = STREAM_V1; break;
+            case 'D': opt.compact = true; break;
+            case 'Z': opt.stamp = true; break;
+            case 'L': opt.lz = true; break;
+            case 't': t_stop = strtod(optarg, NULL); break;
+            default: usage(); return 1;
+        }
+    }
+    if(!out || optind >= argc)
+    {
+        usage();
+        return 1;
+    }
+    if(!w.open(out))
+    {
+        perror(out);
+        return 1;
+    }
+    t = host_time();
+    if(gw_live)
+    {
+        advcol::Collector col;
+
+        for(int i = optind; i < argc; i++)
+        {
+            if(col.add(argv[i], opt) < 0)
+            {
+                fprintf(stderr, "%s: bad address\n", argv[i]);
+                return 1;
+            }
+            w.add_interface(i - optind, argv[i]);
+        }
+        // stamps in UTC as they are, else the time of reception here
+        col.on_frame([&](const advcol::Frame &f)
+        {
+            w.write(f, f.has_ts && (f.ts_flags & GWTIME_SYNCED) ? f.ts : unix_us());
+        });
+        signal(SIGINT, on_signal);
+        signal(SIGTERM, on_signal);
+        signal(SIGPIPE, SIG_IGN);
+        while(!stop_req && col.poll(100) >= 0)
+        {
+            // a live reader sees the packets within a poll period
+            if(!w.flush())
+                break;
+            if(t_stop && host_time() - t >= t_stop)
+                break;
+        }
+        for(size_t i = 0; i < col.size(); i++)
+        {
+            advcol::GatewayInfo gi = col.info((int)i);
+
+            fprintf(stderr, "%s: %llu frames, %llu bytes, %u connects, %llu blocks lost\n", gi.host.c_str(),
+                    (unsigned long long)gi.stats->frames, (unsigned long long)gi.stats->bytes, gi.connects,
+                    (unsigned long long)(gi.stats->block_err + gi.stats->block_lost));
+        }
+    }
+    else
+    {
+        for(int i = optind; i < argc; i++)
+        {
+            advcol::ParserStats st = advcol::ParserStats();
+            uint32_t magic = 0;
+            advcap_t cap;
+            FILE *in;
+            int r;
+
+            in = fopen(argv[i], "rb");
+            if(!in)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+            if(fread(&magic, sizeof(magic), 1, in) != 1)
+                magic = 0;
+            w.add_interface(i - optind, argv[i]);
+            if(magic == ADVCAP_MAGIC)
+            {
+                fclose(in);
+                if(advcap_open(&cap, argv[i]))
+                {
+                    perror(argv[i]);
+                    return 1;
+                }
+                r = put_advc(w, &cap, i - optind);
+                advcap_close(&cap);
+            }
+            else
+            {
+                rewind(in);
+                r = put_stream(w, in, i - optind, st);
+                fclose(in);
+                if(st.block_err + st.block_lost + st.skipped)
+                    fprintf(stderr, "%s: %llu bad blocks, %llu lost, %llu bytes skipped\n", argv[i],
+                            (unsigned long long)st.block_err, (unsigned long long)st.block_lost,
+                            (unsigned long long)st.skipped);
+            }
+            if(r < 0)
+            {
+                fprintf(stderr, "%s: read error\n", argv[i]);
+                return 1;
+            }
+        }
+    }
+    t = host_time() - t;
+    if(!w.close())
+    {
+        fprintf(stderr, "%s: write error\n", out);
+        return 1;
+    }
+    fprintf(stderr, "%llu adverts, %llu packets, %llu bytes, %.1f s (%.0f adverts/s)\n",
+            (unsigned long long)w.stats().adverts, (unsigned long long)w.stats().packets,
+            (unsigned long long)w.stats().bytes, t, t > 0 ? w.stats().adverts / t : 0.0);
+    return 0;
+}
@@ -0,0 +1,418 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advbench.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/14
+ * Description        : Soak/load benchmark: a synthetic dense-environment
+ *                      advert population through observer -> FIFO -> send,
+ *                      results in JSON
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "sim.h"
+#include "wchnet.h"
+#include "observer.h"
+#include "stats.h"
+#include "ctrl.h"
+#include "advenc.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define BENCH_FRAG_MAX          229         // data in one extended report fragment
+#define BENCH_LAT_QUEUE         0x10000     // power of 2, > FIFO size / min frame
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+    uint32_t devices;
+    uint32_t interval;          // mean per-device advertising interval, ms
+    uint32_t jitter;            // per-device interval spread, %
+    uint32_t change;            // payload change probability, %
+    uint32_t ext;               // extended advertisers, %
+    uint32_t frag;              // fragmented, % of extended
+    uint32_t phy[3];            // extended PHY mix 1M:2M:Coded, weights
+    uint32_t len;               // legacy data length
+    uint32_t ext_len;           // extended data length (fragmented: total)
+    double   seconds;
+    double   warmup;
+    uint32_t seed;
+    uint32_t encoding;          // ADV_ENC_FULL/ADV_ENC_COMPACT
+    const char *out;
+} bench_cfg_t;
+
+typedef struct
+{
+    uint64_t next;              // next advert time, ns
+    uint64_t period;            // ns
+    uint8_t  addr[B_ADDR_LEN];
+    uint8_t  ext;
+    uint8_t  frag;
+    uint8_t  phy;
+    uint16_t len;
+    uint8_t  data[B_MAX_ADV_EXT_LEN];
+} bench_dev_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static bench_dev_t *devs;
+static uint32_t *heap;          // device indexes, min-heap on next
+static uint32_t heap_len;
+static uint32_t rnd_state;
+
+// inject time of every queued advert, in stream order
+static uint64_t lat_ts[BENCH_LAT_QUEUE];
+static uint32_t lat_wr, lat_rd;
+static uint32_t *lat;           // measured latencies, us
+static uint32_t lat_num, lat_size;
+static uint64_t t_measure;      // warmup end
+static uint32_t rx_adverts;
+
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+/*********************************************************************
+ * Device schedule: binary min-heap on bench_dev_t.next
+ */
+
+static void heap_down(uint32_t i)
+{
+    for(;;)
+    {
+        uint32_t l = 2 * i + 1, m = i;
+
+        if(l < heap_len && devs[heap[l]].next < devs[heap[m]].next)
+            m = l;
+        if(l + 1 < heap_len && devs[heap[l + 1]].next < devs[heap[m]].next)
+            m = l + 1;
+        if(m == i)
+            return;
+        uint32_t t = heap[i];
+        heap[i] = heap[m];
+        heap[m] = t;
+        i = m;
+    }
+}
+
+/*********************************************************************
+ * @fn      population_init
+ *
+ * @brief   Create the devices: address, PHY, type, interval, payload.
+ */
+static void population_init(const bench_cfg_t *cfg)
+{
+    uint32_t wsum = cfg->phy[0] + cfg->phy[1] + cfg->phy[2];
+
+    devs = calloc(cfg->devices, sizeof(bench_dev_t));
+    heap = calloc(cfg->devices, sizeof(uint32_t));
+    for(uint32_t i = 0; i < cfg->devices; i++)
+    {
+        bench_dev_t *d = &devs[i];
+        uint64_t mean = (uint64_t)cfg->interval * SIM_NS_PER_MS;
+        uint64_t spread = mean * cfg->jitter / 100;
+        uint32_t w;
+
+        d->period = mean - spread + (spread ? (rnd() % (2 * spread + 1)) : 0);
+        if(d->period < 20 * SIM_NS_PER_MS)
+            d->period = 20 * SIM_NS_PER_MS;
+        d->next = rnd() % d->period;
+        d->addr[0] = (uint8_t)i;
+        d->addr[1] = (uint8_t)(i >> 8);
+        d->addr[2] = (uint8_t)(i >> 16);
+        d->addr[3] = 0x38;
+        d->addr[4] = 0xC1;
+        d->addr[5] = 0xA4;
+        d->ext = (rnd() % 100) < cfg->ext;
+        d->frag = d->ext && (rnd() % 100) < cfg->frag;
+        d->phy = GAP_PHY_BIT_LE_1M;
+        if(d->ext && wsum)
+        {
+            w = rnd() % wsum;
+            if(w >= cfg->phy[0] + cfg->phy[1])
+                d->phy = GAP_PHY_BIT_LE_CODED;
+            else if(w >= cfg->phy[0])
+                d->phy = GAP_PHY_BIT_LE_2M;
+        }
+        d->len = d->ext ? cfg->ext_len : cfg->len;
+        if(!d->frag && d->len > 255)
+            d->len = 255;
+        for(uint32_t j = 0; j < d->len; j++)
+            d->data[j] = (uint8_t)rnd();
+        heap[i] = i;
+    }
+    heap_len = cfg->devices;
+    for(int32_t i = heap_len / 2 - 1; i >= 0; i--)
+        heap_down(i);
+}
+
+/*********************************************************************
+ * @fn      bench_frame
+ *
+ * @brief   Client received a frame: queue latency of the oldest
+ *          queued advert.
+ */
+static void bench_frame(const uint8_t *frame, uint32_t len)
+{
+    uint64_t ts;
+
+    (void)len;
+    if(frame[1] == 0xFF || lat_rd == lat_wr)       // service frame
+        return;
+    ts = lat_ts[lat_rd++ & (BENCH_LAT_QUEUE - 1)];
+    if(ts < t_measure)
+        return;
+    rx_adverts++;
+    if(lat_num == lat_size)
+    {
+        lat_size = lat_size ? lat_size * 2 : 65536;
+        lat = realloc(lat, lat_size * sizeof(uint32_t));
+    }
+    lat[lat_num++] = (uint32_t)((sim_now() - ts) / SIM_NS_PER_US);
+}
+
+/*********************************************************************
+ * @fn      inject
+ *
+ * @brief   One report into the observer, remember the time if queued.
+ */
+static void inject(const sim_adv_t *adv)
+{
+    uint32_t count = gw_stats.adv_count, drop = gw_stats.adv_drop;
+
+    sim_ble_inject(adv);
+    if(gw_stats.adv_count != count && gw_stats.adv_drop == drop)
+        lat_ts[lat_wr++ & (BENCH_LAT_QUEUE - 1)] = sim_now();
+}
+
+/*********************************************************************
+ * @fn      device_advert
+ *
+ * @brief   Send the advertising event of a device: one report, or a
+ *          chain of fragments for a fragmented extended advert.
+ *
+ * @return  reports sent
+ */
+static uint32_t device_advert(const bench_cfg_t *cfg, bench_dev_t *d)
+{
+    sim_adv_t adv;
+    uint32_t off = 0, n = 0;
+
+    if((rnd() % 100) < cfg->change)
+    {
+        // measurement changed: a few bytes at the end of the service data
+        for(uint32_t j = d->len > 4 ? d->len - 4 : 0; j < d->len; j++)
+            d->data[j] = (uint8_t)rnd();
+    }
+    memset(&adv, 0, sizeof(adv));
+    adv.ext = d->ext;
+    adv.addrType = ADDRTYPE_PUBLIC;
+    adv.primaryPHY = d->phy == GAP_PHY_BIT_LE_2M ? GAP_PHY_BIT_LE_1M : d->phy;
+    adv.secondaryPHY = d->phy;
+    adv.rssi = -40 - (int8_t)(rnd() % 50);
+    memcpy(adv.addr, d->addr, B_ADDR_LEN);
+    do
+    {
+        uint32_t len = d->len - off;
+
+        if(d->frag && len > BENCH_FRAG_MAX)
+            len = BENCH_FRAG_MAX;
+        if(!d->ext)
+            adv.eventType = GAP_ADRPT_ADV_NONCONN_IND;
+        else
+            adv.eventType = GAP_ADRPT_EXT_NONCONN_NONSCAN_UNDIRECT
+                | (off + len < d->len ? GAP_ADRPT_EXT_DATA_INCOMPLETE : GAP_ADRPT_EXT_DATA_COMPLETE);
+        adv.dataLen = (uint8_t)len;
+        memcpy(adv.data, &d->data[off], len);
+        inject(&adv);
+        off += len;
+        n++;
+    } while(off < d->len);
+    return n;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(uint32_t p)
+{
+    if(!lat_num)
+        return 0;
+    return lat[(uint64_t)(lat_num - 1) * p / 100];
+}
+
+static void usage(void)
+{
+    printf("Usage: advbench [options]\n"
+           "  -n N       devices (default 500)\n"
+           "  -i MS      mean advertising interval per device, ms (default 1000)\n"
+           "  -j PCT     interval spread between devices, %% (default 50)\n"
+           "  -c PCT     payload change probability, %% (default 20)\n"
+           "  -x PCT     extended advertisers, %% (default 10)\n"
+           "  -f PCT     fragmented, %% of extended (default 20)\n"
+           "  -P A:B:C   extended PHY mix 1M:2M:Coded (default 40:20:40)\n"
+           "  -l N       legacy data length (default 31)\n"
+           "  -L N       extended data length, fragmented up to %u (default 120)\n"
+           "  -t SEC     measured time, s (default 30)\n"
+           "  -u SEC     warmup, s (default 2)\n"
+           "  -b N       sink bandwidth, bytes/s, 0 - unlimited (default 1000000)\n"
+           "  -w N       TCP send window, bytes (default %u)\n"
+           "  -s MS      client stall period, ms (default 0 - no stalls)\n"
+           "  -S MS      client stall length, ms (default 100)\n"
+           "  -D         compact records (device dictionary)\n"
+           "  -R N       random seed (default 1)\n"
+           "  -o FILE    JSON result file (default stdout)\n",
+           B_MAX_ADV_EXT_LEN, WCHNET_TCP_MSS * WCHNET_NUM_TCP_SEG);
+}
+
+int main(int argc, char **argv)
+{
+    bench_cfg_t cfg = { 500, 1000, 50, 20, 10, 20, {40, 20, 40}, 31, 120, 30.0, 2.0, 1, ADV_ENC_FULL, NULL };
+    sim_sink_cfg_t sink = { 1000000, WCHNET_TCP_MSS * WCHNET_NUM_TCP_SEG, 0, 100, 100 };
+    uint64_t end, bytes0 = 0;
+    uint32_t events = 0, reports = 0;
+    uint32_t count0 = 0, drop0 = 0;
+    int measure = 0;
+    const sim_sink_stats_t *ss;
+    gw_stats_rep_t st;
+    struct timespec h0, h1;
+    double wall;
+    FILE *out = stdout;
+    int c;
+
+    while((c = getopt(argc, argv, "n:i:j:c:x:f:P:l:L:t:u:b:w:s:S:DR:o:h")) != -1)
+    {
+        switch(c)
+        {
+            case 'n': cfg.devices = strtoul(optarg, NULL, 0); break;
+            case 'i': cfg.interval = strtoul(optarg, NULL, 0); break;
+            case 'j': cfg.jitter = strtoul(optarg, NULL, 0); break;
+            case 'c': cfg.change = strtoul(optarg, NULL, 0); break;
+            case 'x': cfg.ext = strtoul(optarg, NULL, 0); break;
+            case 'f': cfg.frag = strtoul(optarg, NULL, 0); break;
+            case 'P':
+                if(sscanf(optarg, "%u:%u:%u", &cfg.phy[0], &cfg.phy[1], &cfg.phy[2]) != 3)
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'l': cfg.len = strtoul(optarg, NULL, 0); break;
+            case 'L': cfg.ext_len = strtoul(optarg, NULL, 0); break;
+            case 't': cfg.seconds = atof(optarg); break;
+            case 'u': cfg.warmup = atof(optarg); break;
+            case 'b': sink.bandwidth = strtoul(optarg, NULL, 0); break;
+            case 'w': sink.window = strtoul(optarg, NULL, 0); break;
+            case 's': sink.stall_period = strtoul(optarg, NULL, 0); break;
+            case 'S': sink.stall_len = strtoul(optarg, NULL, 0); break;
+            case 'D': cfg.encoding = ADV_ENC_COMPACT; break;
+            case 'R': cfg.seed = strtoul(optarg, NULL, 0); break;
+            case 'o': cfg.out = optarg; break;
+            default: usage(); return 1;
+        }
+    }
+    if(!cfg.devices || !cfg.interval || cfg.len > 31 || cfg.ext_len > B_MAX_ADV_EXT_LEN
+       || cfg.seconds <= 0 || cfg.jitter > 100)
+    {
+        usage();
+        return 1;
+    }
+    rnd_state = cfg.seed ? cfg.seed : 1;
+
+    sim_net_config(&sink, sim_client_input);
+    sim_client_reset(bench_frame);
+    sim_gw_init();
+    while(!sim_net_connected())
+        sim_gw_run_until(sim_now() + SIM_NS_PER_MS);
+    if(cfg.encoding != ADV_ENC_FULL)
+    {
+        uint8_t cmd[3] = { CTRL_CMD_ENCODING, 1, (uint8_t)cfg.encoding };
+
+        sim_net_client_send(cmd, sizeof(cmd));
+        sim_gw_run_until(sim_now() + SIM_NS_PER_MS);
+    }
+    population_init(&cfg);
+    for(uint32_t i = 0; i < cfg.devices; i++)
+        devs[i].next += sim_now();
+
+    t_measure = sim_now() + (uint64_t)(cfg.warmup * SIM_NS_PER_SEC);
+    end = t_measure + (uint64_t)(cfg.seconds * SIM_NS_PER_SEC);
+    clock_gettime(CLOCK_MONOTONIC, &h0);
+    while(devs[heap[0]].next < end)
+    {
+        bench_dev_t *d = &devs[heap[0]];
+
+        sim_gw_run_until(d->next);
+        if(!measure && sim_now() >= t_measure)
+        {
+            measure = 1;
+            bytes0 = sim_net_stats()->bytes;
+            count0 = gw_stats.adv_count;
+            drop0 = gw_stats.adv_drop;
+            events = reports = 0;
+        }
+        reports += device_advert(&cfg, d);
+        events++;
+        d->next += d->period;
+        heap_down(0);
+    }
+    sim_gw_run_until(end);
+    clock_gettime(CLOCK_MONOTONIC, &h1);
+    wall = (h1.tv_sec - h0.tv_sec) + (h1.tv_nsec - h0.tv_nsec) * 1e-9;
+
+    qsort(lat, lat_num, sizeof(uint32_t), cmp_u32);
+    ss = sim_net_stats();
+    stats_get(&st);
+    if(cfg.out && !(out = fopen(cfg.out, "w")))
+    {
+        perror(cfg.out);
+        return 1;
+    }
+    fprintf(out, "{\n");
+    fprintf(out, "  \"config\": {\"devices\": %u, \"interval_ms\": %u, \"jitter_pct\": %u, \"change_pct\": %u,"
+                 " \"ext_pct\": %u, \"frag_pct\": %u, \"phy_mix\": [%u, %u, %u], \"len\": %u, \"ext_len\": %u,"
+                 " \"seconds\": %.3f, \"warmup\": %.3f, \"seed\": %u, \"encoding\": \"%s\","
+                 " \"sink_bandwidth\": %u, \"sink_window\": %u, \"stall_period_ms\": %u, \"stall_len_ms\": %u},\n",
+            cfg.devices, cfg.interval, cfg.jitter, cfg.change, cfg.ext, cfg.frag,
+            cfg.phy[0], cfg.phy[1], cfg.phy[2], cfg.len, cfg.ext_len, cfg.seconds, cfg.warmup, cfg.seed,
+            cfg.encoding == ADV_ENC_COMPACT ? "compact" : "full", sink.bandwidth, sink.window, sink.stall_period, sink.stall_len);
+    fprintf(out, "  \"offered_events_per_s\": %.1f,\n", events / cfg.seconds);
+    fprintf(out, "  \"offered_reports_per_s\": %.1f,\n", reports / cfg.seconds);
+    fprintf(out, "  \"reports_per_s\": %.1f,\n", rx_adverts / cfg.seconds);
+    fprintf(out, "  \"latency_us\": {\"p50\": %u, \"p99\": %u, \"max\": %u, \"samples\": %u},\n",
+            percentile(50), percentile(99), lat_num ? lat[lat_num - 1] : 0, lat_num);
+    fprintf(out, "  \"drops\": %u,\n", gw_stats.adv_drop - drop0);
+    fprintf(out, "  \"drop_pct\": %.3f,\n", gw_stats.adv_count != count0 ?
+            (gw_stats.adv_drop - drop0) * 100.0 / (gw_stats.adv_count - count0) : 0.0);
+    fprintf(out, "  \"bytes_per_s\": %.1f,\n", (ss->bytes - bytes0) / cfg.seconds);
+    fprintf(out, "  \"bytes_per_advert\": %.2f,\n", rx_adverts ? (double)(ss->bytes - bytes0) / rx_adverts : 0.0);
+    fprintf(out, "  \"fifo_hwm\": %u,\n", st.fifo_hwm);
+    fprintf(out, "  \"fifo_size\": %u,\n", st.fifo_size);
+    fprintf(out, "  \"send_calls\": %u,\n", ss->send_calls);
+    fprintf(out, "  \"send_short\": %u,\n", ss->send_short);
+    fprintf(out, "  \"host_seconds\": %.3f\n", wall);
+    fprintf(out, "}\n");
+    if(out != stdout)
+        fclose(out);
+    return 0;
+}
+
+/******************************** endfile @ advbench ******************************/
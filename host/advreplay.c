@@ -0,0 +1,276 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advreplay.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/12
+ * Description        : Deterministic replay of an advert capture (.advc)
+ *                      into ObserverEventCB on the host build
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "sim.h"
+#include "advcap.h"
+#include "wchnet.h"
+#include "observer.h"
+#include "stats.h"
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+    uint32_t speed;             // replay speed multiplier, 0 - max
+    uint32_t loops;
+    uint32_t interval;          // queue depth sampling, ms
+    const char *qlog;           // queue depth CSV
+} replay_cfg_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static FILE *qlog;
+static uint64_t q_next, q_step;
+static uint64_t q_sum;
+static uint32_t q_cnt, q_max;
+
+/*********************************************************************
+ * @fn      host_cycles
+ *
+ * @brief   Host cycle counter (TSC), ns where there is none.
+ */
+static inline uint64_t host_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * SIM_NS_PER_SEC + t.tv_nsec;
+#endif
+}
+
+static double host_time(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*********************************************************************
+ * @fn      queue_sample
+ *
+ * @brief   Record the FIFO depth for every sampling point passed.
+ */
+static void queue_sample(void)
+{
+    while(sim_now() >= q_next)
+    {
+        uint32_t len = app_drv_fifo_length(&app_tx_fifo);
+
+        q_sum += len;
+        q_cnt++;
+        if(len > q_max)
+            q_max = len;
+        if(qlog)
+            fprintf(qlog, "%.3f,%u,%u\n", q_next / 1e6, len, gw_stats.adv_drop);
+        q_next += q_step;
+    }
+}
+
+/*********************************************************************
+ * @fn      run_until
+ *
+ * @brief   Run the gateway up to t, sampling the queue on the way.
+ */
+static void run_until(uint64_t t)
+{
+    while(sim_now() < t)
+    {
+        sim_gw_run_until(MIN(t, q_next));
+        queue_sample();
+    }
+}
+
+static void to_sim_adv(const advcap_rec_t *rec, const uint8_t *data, sim_adv_t *adv)
+{
+    adv->ext = rec->type == ADVCAP_EXT_ADV_INFO;
+    adv->eventType = rec->eventType;
+    adv->addrType = rec->addrType;
+    adv->primaryPHY = rec->primaryPHY;
+    adv->secondaryPHY = rec->secondaryPHY;
+    adv->rssi = rec->rssi;
+    memcpy(adv->addr, rec->addr, sizeof(adv->addr));
+    adv->dataLen = rec->dataLen;
+    memcpy(adv->data, data, rec->dataLen);
+}
+
+static void usage(void)
+{
+    printf("Usage: advreplay [options] capture.advc\n"
+           "  -m N     replay speed, N x real time, 0 - max (default 1)\n"
+           "  -L N     replay the capture N times (default 1)\n"
+           "  -i MS    queue depth sampling interval, ms (default 10)\n"
+           "  -q FILE  queue depth log, CSV: time ms, FIFO bytes, drops\n"
+           "  -b N     sink bandwidth, bytes/s, 0 - unlimited (default 1000000)\n"
+           "  -w N     TCP send window, bytes (default %u)\n"
+           "  -s MS    client stall period, ms (default 0 - no stalls)\n"
+           "  -S MS    client stall length, ms (default 100)\n"
+           "  -v       firmware debug output\n",
+           WCHNET_TCP_MSS * WCHNET_NUM_TCP_SEG);
+}
+
+int main(int argc, char **argv)
+{
+    replay_cfg_t cfg = { 1, 1, 10, NULL };
+    sim_sink_cfg_t sink = { 1000000, WCHNET_TCP_MSS * WCHNET_NUM_TCP_SEG, 0, 100, 100 };
+    advcap_t cap;
+    advcap_rec_t rec;
+    uint8_t data[255];
+    sim_adv_t adv;
+    uint64_t t_start, t_first = 0, t_loop = 0, t_last = 0;
+    uint64_t cyc, cyc_sum = 0, cyc_max = 0;
+    uint32_t records = 0, injected = 0, missed = 0;
+    const sim_client_stats_t *cs;
+    const sim_sink_stats_t *ss;
+    gw_stats_rep_t st;
+    double wall, sec;
+    int c, r;
+
+    while((c = getopt(argc, argv, "m:L:i:q:b:w:s:S:vh")) != -1)
+    {
+        switch(c)
+        {
+            case 'm': cfg.speed = strtoul(optarg, NULL, 0); break;
+            case 'L': cfg.loops = strtoul(optarg, NULL, 0); break;
+            case 'i': cfg.interval = strtoul(optarg, NULL, 0); break;
+            case 'q': cfg.qlog = optarg; break;
+            case 'b': sink.bandwidth = strtoul(optarg, NULL, 0); break;
+            case 'w': sink.window = strtoul(optarg, NULL, 0); break;
+            case 's': sink.stall_period = strtoul(optarg, NULL, 0); break;
+            case 'S': sink.stall_len = strtoul(optarg, NULL, 0); break;
+            case 'v': sim_verbose = 1; break;
+            default: usage(); return 1;
+        }
+    }
+    if(optind >= argc || !cfg.interval || !cfg.loops)
+    {
+        usage();
+        return 1;
+    }
+    if(advcap_open(&cap, argv[optind]))
+    {
+        fprintf(stderr, "%s: not an advert capture\n", argv[optind]);
+        return 1;
+    }
+    if(cfg.qlog)
+    {
+        qlog = fopen(cfg.qlog, "w");
+        if(!qlog)
+        {
+            perror(cfg.qlog);
+            return 1;
+        }
+        fprintf(qlog, "time_ms,fifo_bytes,drops\n");
+    }
+
+    sim_net_config(&sink, sim_client_input);
+    sim_client_reset(NULL);
+    sim_gw_init();
+    q_step = cfg.interval * SIM_NS_PER_MS;
+    q_next = SIM_TIME_NEVER;
+    // DHCP, listen and the client connection come first
+    while(!sim_net_connected())
+        sim_gw_run_until(sim_now() + SIM_NS_PER_MS);
+    sim_gw_run_until(sim_now() + SIM_NS_PER_MS);
+    t_start = sim_now();
+    q_next = t_start;
+
+    wall = host_time();
+    for(uint32_t loop = 0; loop < cfg.loops; loop++)
+    {
+        advcap_rewind(&cap);
+        while((r = advcap_read(&cap, &rec, data)) > 0)
+        {
+            uint64_t ts = rec.ts * SIM_NS_PER_SEC / cap.ts_freq;
+
+            if(!records)
+                t_first = ts;
+            if(ts < t_first)
+                ts = t_first;
+            ts = ts - t_first + t_loop;
+            t_last = ts;
+            if(cfg.speed)
+                run_until(t_start + ts / cfg.speed);
+            else
+            {
+                sim_gw_step();
+                queue_sample();
+            }
+            to_sim_adv(&rec, data, &adv);
+            cyc = host_cycles();
+            r = sim_ble_inject(&adv);
+            cyc = host_cycles() - cyc;
+            cyc_sum += cyc;
+            if(cyc > cyc_max)
+                cyc_max = cyc;
+            records++;
+            if(r)
+                injected++;
+            else
+                missed++;
+        }
+        if(r < 0)
+        {
+            fprintf(stderr, "%s: read error\n", argv[optind]);
+            return 1;
+        }
+        // next loop starts one mean interval after the last record
+        t_loop = t_last + (records > 1 ? t_last / (records - 1) : SIM_NS_PER_MS);
+    }
+    // drain what is left in the FIFO
+    run_until(sim_now() + SIM_NS_PER_SEC);
+    wall = host_time() - wall;
+    advcap_close(&cap);
+    if(qlog)
+        fclose(qlog);
+
+    cs = sim_client_stats();
+    ss = sim_net_stats();
+    stats_get(&st);
+    sec = (sim_now() - t_start) / 1e9;
+    if(cfg.speed)
+        printf("records            %u x %u, speed %ux\n", cap.count / cfg.loops, cfg.loops, cfg.speed);
+    else
+        printf("records            %u x %u, speed max\n", cap.count / cfg.loops, cfg.loops);
+    printf("simulated time     %.3f s (%.3f s host, %.0f reports/s host)\n", sec, wall,
+           wall > 0 ? records / wall : 0.0);
+    printf("adverts injected   %u, not scanning %u\n", injected, missed);
+    printf("adverts queued     %u, dropped %u (%.2f%%)\n", st.adv_count - st.adv_drop, st.adv_drop,
+           st.adv_count ? st.adv_drop * 100.0 / st.adv_count : 0.0);
+    printf("adverts received   %u, %.1f bytes/advert\n", cs->adverts,
+           cs->adverts ? (double)cs->bytes / cs->adverts : 0.0);
+#if defined(__x86_64__) || defined(__i386__)
+    printf("ingest             %.0f cycles/report (TSC), max %llu\n",
+#else
+    printf("ingest             %.0f ns/report, max %llu\n",
+#endif
+           injected ? (double)cyc_sum / injected : 0.0, (unsigned long long)cyc_max);
+    printf("queue depth        mean %.0f, max %u of %u bytes (%u samples, %u ms)\n",
+           q_cnt ? (double)q_sum / q_cnt : 0.0, q_max, st.fifo_size, q_cnt, cfg.interval);
+    printf("socket send        %u calls, %u short, %u busy\n", ss->send_calls, ss->send_short, ss->send_busy);
+    return 0;
+}
+
+/******************************** endfile @ advreplay ******************************/
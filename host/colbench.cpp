@@ -0,0 +1,385 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : colbench.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/21
+ * Description        : Collector library benchmark: a synthetic gateway
+ *                      stream (v1, v2 blocks, compact, time and LZ
+ *                      records) parsed in memory or through a socket
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <vector>
+#include "advcol.h"
+#include "lz.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define CB_CHUNK                2920        // TCP MSS * 2, as adv2eth.py reads
+#define CB_PAYLOAD_MAX          1460        // block payload, as the firmware sends at 10 Mbit/s
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+struct CbCfg
+{
+    uint8_t  framing = STREAM_V1;
+    bool     compact = false;
+    bool     stamp = false;
+    bool     lz = false;
+    bool     sock = false;
+    uint32_t devices = 300;
+    uint32_t count = 1000000;
+    uint32_t loops = 10;
+    uint32_t seed = 1;
+    const char *out = nullptr;
+};
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static uint32_t rnd_state;
+static std::vector<uint8_t> stream;
+static uint32_t records;
+
+static uint32_t rnd()
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static double host_time()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*
+ * v2 block builder, the stream_block() layout
+ */
+class BlockOut
+{
+public:
+    explicit BlockOut(const CbCfg &cfg) : cfg_(cfg), seq_(0), count_(0), last_ts_(0) {}
+
+    // one advert report: time record and the frame or compact record
+    void put(const uint8_t *rec, uint32_t len, uint64_t ts)
+    {
+        uint8_t t[ADV_TIME_REC_MAX];
+        uint32_t tl = 0;
+
+        if(cfg_.stamp)
+            tl = time_rec(t, ts, raw_.empty() && cfg_.framing == STREAM_V2);
+        if(cfg_.framing == STREAM_V1)
+        {
+            stream.insert(stream.end(), t, t + tl);
+            stream.insert(stream.end(), rec, rec + len);
+            return;
+        }
+        if(raw_.size() + tl + len > CB_PAYLOAD_MAX)
+        {
+            flush();
+            if(cfg_.stamp)
+                tl = time_rec(t, ts, true);
+        }
+        raw_.insert(raw_.end(), t, t + tl);
+        raw_.insert(raw_.end(), rec, rec + len);
+        count_ += (tl != 0);
+        // advenc_encode() may put an ADV_SVC_DICT frame before the record
+        for(uint32_t i = 0; i < len; i += adv_rec_len(rec[i], rec[i + 1]))
+            count_++;
+    }
+
+    void flush()
+    {
+        uint8_t hdr[sizeof(stream_blk_hdr_t)], lz[CB_PAYLOAD_MAX + STREAM_LZ_HDR_LEN];
+        const uint8_t *pl = raw_.data();
+        uint32_t plen = raw_.size(), clen = 0, crc, i;
+        size_t start;
+
+        if(raw_.empty())
+            return;
+        if(cfg_.lz && plen > LZ_MFLIMIT)
+            clen = lz_compress(raw_.data(), plen, lz + STREAM_LZ_HDR_LEN, plen - STREAM_LZ_HDR_LEN - 1);
+        if(clen)
+        {
+            lz[0] = (uint8_t)plen;
+            lz[1] = (uint8_t)(plen >> 8);
+            pl = lz;
+            plen = clen + STREAM_LZ_HDR_LEN;
+        }
+        hdr[0] = 0xA5; hdr[1] = 0xFE; hdr[2] = 0x42; hdr[3] = 0x32;
+        hdr[4] = STREAM_V2 | (clen ? STREAM_BLK_LZ : 0);
+        hdr[5] = sizeof(stream_blk_hdr_t);
+        hdr[6] = (uint8_t)count_;
+        hdr[7] = (uint8_t)(count_ >> 8);
+        for(i = 0; i < 4; i++)
+            hdr[8 + i] = (uint8_t)(seq_ >> (i * 8));
+        hdr[12] = (uint8_t)plen;
+        hdr[13] = (uint8_t)(plen >> 8);
+        memcpy(&hdr[14], "\x01\x02\x03\x04\x05\x06", 6);
+        start = stream.size();
+        stream.insert(stream.end(), hdr, hdr + sizeof(hdr));
+        stream.insert(stream.end(), pl, pl + plen);
+        stream.resize(stream.size() + ((4 - (plen & 3)) & 3), 0);
+        crc = advcol::stream_crc32(&stream[start], stream.size() - start);
+        for(i = 0; i < 4; i++)
+            stream.push_back((uint8_t)(crc >> (i * 8)));
+        seq_++;
+        count_ = 0;
+        raw_.clear();
+    }
+
+private:
+    // gwtime_rec_put(): TIME at a block start, else TIME_DELTA
+    uint32_t time_rec(uint8_t *out, uint64_t ts, bool abs)
+    {
+        uint64_t z;
+        int64_t d = (int64_t)(ts - last_ts_);
+        uint32_t n = 0, i;
+
+        last_ts_ = ts;
+        if(abs)
+        {
+            out[0] = ADV_TIME_ABS_LEN - 2;
+            out[1] = ADV_REC_TIME;
+            out[2] = GWTIME_SYNCED;
+            for(i = 0; i < 8; i++)
+                out[3 + i] = (uint8_t)(ts >> (i * 8));
+            return ADV_TIME_ABS_LEN;
+        }
+        z = ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+        do
+        {
+            out[2 + n++] = (uint8_t)((z & 0x7F) | (z > 0x7F ? 0x80 : 0));
+            z >>= 7;
+        } while(z);
+        out[0] = (uint8_t)n;
+        out[1] = ADV_REC_TIME_DELTA;
+        return 2 + n;
+    }
+
+    const CbCfg &cfg_;
+    std::vector<uint8_t> raw_;
+    uint32_t seq_;
+    uint32_t count_;
+    uint64_t last_ts_;
+};
+
+/*********************************************************************
+ * @fn      build_stream
+ *
+ * @brief   Devices with a fixed service data prefix and a few changing
+ *          bytes, reported in random order every ~0.3 ms.
+ */
+static void build_stream(const CbCfg &cfg)
+{
+    uint8_t frame[ADV_HDR_LEN + 31], out[ADV_ENC_OUT_MAX];
+    uint64_t ts = 1710979200000000ull;
+    uint32_t dev, len, n, i;
+    BlockOut blk(cfg);
+
+    advenc_set_mode(cfg.compact ? ADV_ENC_COMPACT : ADV_ENC_FULL);
+    for(i = 0; i < cfg.count; i++)
+    {
+        dev = rnd() % cfg.devices;
+        n = 14 + dev % 18;
+        frame[0] = (uint8_t)n;
+        frame[1] = 0x03;                        // ADV_NONCONN_IND, public
+        frame[2] = 0x11;                        // 1M/1M
+        frame[3] = (uint8_t)(-40 - (int)(rnd() % 50));
+        frame[4] = (uint8_t)dev; frame[5] = (uint8_t)(dev >> 8);
+        frame[6] = 0x38; frame[7] = 0xC1; frame[8] = 0xA4; frame[9] = 0x00;
+        frame[10] = 0x02; frame[11] = 0x01; frame[12] = 0x06;
+        frame[13] = (uint8_t)(n - 4); frame[14] = 0x16; frame[15] = 0xD2; frame[16] = 0xFC;
+        for(uint32_t k = 17; k < ADV_HDR_LEN + n; k++)
+            frame[k] = (uint8_t)(k & 1 ? dev * k : rnd() & 7);
+        ts += 200 + rnd() % 200;
+        len = ADV_HDR_LEN + n;
+        if(cfg.compact)
+        {
+            len = advenc_encode(frame, out);
+            advenc_commit(frame);
+            blk.put(out, len, ts);
+        }
+        else
+            blk.put(frame, len, ts);
+        records++;
+    }
+    blk.flush();
+}
+
+/*********************************************************************
+ * @fn      bench_mem
+ *
+ * @brief   Stream copied into a RingBuf by CB_CHUNK, parsed in place.
+ */
+static int bench_mem(const CbCfg &cfg)
+{
+    advcol::RingBuf ring;
+    advcol::Parser parser;
+    advcol::Frame f;
+    uint64_t frames = 0, rssi = 0;
+    size_t pos, n;
+    double t;
+
+    if(!ring.init(advcol::RING_SIZE))
+        return 1;
+    t = host_time();
+    for(uint32_t loop = 0; loop < cfg.loops; loop++)
+    {
+        parser.reset();
+        ring.clear();
+        for(pos = 0; pos < stream.size(); pos += n)
+        {
+            n = stream.size() - pos < CB_CHUNK ? stream.size() - pos : CB_CHUNK;
+            memcpy(ring.wptr(), &stream[pos], n);
+            ring.produce(n);
+            parser.input(ring.rptr(), ring.ravail());
+            while(parser.next(f))
+            {
+                frames++;
+                rssi += f.data[3];
+            }
+            ring.consume(parser.consumed());
+        }
+    }
+    t = host_time() - t;
+    if(parser.stats().adverts != (uint64_t)records * cfg.loops || parser.stats().block_err
+       || parser.stats().dict_miss)
+    {
+        fprintf(stderr, "parse check failed: %llu of %llu adverts, %llu bad blocks, %llu dictionary misses\n",
+                (unsigned long long)parser.stats().adverts, (unsigned long long)records * cfg.loops,
+                (unsigned long long)parser.stats().block_err, (unsigned long long)parser.stats().dict_miss);
+        return 1;
+    }
+    printf("parse              %.2f M frames/s, %.1f MB/s, %.1f ns/frame (rssi sum %llu)\n",
+           frames / t / 1e6, (double)stream.size() * cfg.loops / t / 1e6, t * 1e9 / frames,
+           (unsigned long long)rssi);
+    return 0;
+}
+
+/*********************************************************************
+ * @fn      bench_sock
+ *
+ * @brief   Stream written by a thread into a socket pair, read by the
+ *          Collector epoll loop.
+ */
+static int bench_sock(const CbCfg &cfg)
+{
+    advcol::Collector col;
+    advcol::GatewayOptions opt;
+    uint64_t frames = 0;
+    int sv[2];
+    double t;
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+    {
+        perror("socketpair");
+        return 1;
+    }
+    opt.framing = cfg.framing;
+    col.on_frame([&frames](const advcol::Frame &) { frames++; });
+    if(col.add_fd(sv[0], opt) < 0)
+        return 1;
+    t = host_time();
+    std::thread wr([&cfg, &sv]()
+    {
+        for(uint32_t loop = 0; loop < cfg.loops; loop++)
+        {
+            for(size_t pos = 0; pos < stream.size();)
+            {
+                ssize_t n = write(sv[1], &stream[pos], stream.size() - pos);
+
+                if(n <= 0)
+                    return;
+                pos += n;
+            }
+        }
+        shutdown(sv[1], SHUT_WR);
+    });
+    while(col.info(0).connected)
+        col.poll(100);
+    t = host_time() - t;
+    wr.join();
+    close(sv[1]);
+    printf("socket             %.2f M frames/s, %.1f MB/s, %llu frames\n",
+           frames / t / 1e6, (double)stream.size() * cfg.loops / t / 1e6, (unsigned long long)frames);
+    return 0;
+}
+
+static void usage()
+{
+    printf("Usage: colbench [options]\n"
+           "  -2       v2 block framing\n"
+           "  -D       compact records (device dictionary), v2\n"
+           "  -Z       receive time records\n"
+           "  -L       compressed v2 blocks\n"
+           "  -s       through a socket pair and the Collector loop\n"
+           "  -S N     devices (default 300)\n"
+           "  -n N     reports (default 1000000)\n"
+           "  -l N     loops (default 10)\n"
+           "  -R N     random seed (default 1)\n"
+           "  -o FILE  write the stream (tools/advstream.py, advcol.Parser)\n");
+}
+
+int main(int argc, char **argv)
+{
+    CbCfg cfg;
+    int c;
+
+    while((c = getopt(argc, argv, "2DZLsS:n:l:R:o:h")) != -1)
+    {
+        switch(c)
+        {
+            case '2': cfg.framing = STREAM_V2; break;
+            case 'D': cfg.compact = true; cfg.framing = STREAM_V2; break;
+            case 'Z': cfg.stamp = true; break;
+            case 'L': cfg.lz = true; cfg.framing = STREAM_V2; break;
+            case 's': cfg.sock = true; break;
+            case 'S': cfg.devices = strtoul(optarg, NULL, 0); break;
+            case 'n': cfg.count = strtoul(optarg, NULL, 0); break;
+            case 'l': cfg.loops = strtoul(optarg, NULL, 0); break;
+            case 'R': cfg.seed = strtoul(optarg, NULL, 0); break;
+            case 'o': cfg.out = optarg; break;
+            default: usage(); return 1;
+        }
+    }
+    if(!cfg.devices || !cfg.count || !cfg.loops)
+    {
+        usage();
+        return 1;
+    }
+    rnd_state = cfg.seed ? cfg.seed : 1;
+    build_stream(cfg);
+    printf("stream             %u reports, %zu bytes, v%u%s%s%s\n", records, stream.size(), cfg.framing,
+           cfg.compact ? " compact" : "", cfg.stamp ? " stamped" : "", cfg.lz ? " lz" : "");
+    if(cfg.out)
+    {
+        FILE *f = fopen(cfg.out, "wb");
+
+        if(!f || fwrite(stream.data(), 1, stream.size(), f) != stream.size() || fclose(f))
+        {
+            perror(cfg.out);
+            return 1;
+        }
+    }
+    return cfg.sock ? bench_sock(cfg) : bench_mem(cfg);
+}
+
+/******************************** endfile @ colbench ******************************/
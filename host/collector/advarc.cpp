@@ -0,0 +1,570 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advarc.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/24
+ * Description        : Collector library: columnar advert archive writer
+ *                      and mmap reader
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "advarc.h"
+
+namespace advcol
+{
+
+static_assert(sizeof(ArcFileHdr) == 32, "ArcFileHdr layout");
+static_assert(sizeof(ArcBlockHdr) % 8 == 0, "ArcBlockHdr layout");
+static_assert(sizeof(ArcDictEnt) == 32, "ArcDictEnt layout");
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define ARC_PAY_HDR             3           // [adTypes][phyTypes][len]
+#define ARC_BLOCK_ROWS_MAX      (1u << 20)
+
+static inline size_t align8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+static inline uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDull;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ull;
+    return x ^ (x >> 33);
+}
+
+static void bloom_set(uint8_t *bloom, uint64_t mac)
+{
+    uint64_t h = mix64(mac);
+
+    for(int i = 0; i < 3; i++, h >>= 11)
+        bloom[(h & 2047) >> 3] |= 1 << (h & 7);
+}
+
+bool arc_bloom_test(const uint8_t bloom[ARC_BLOOM_BYTES], uint64_t mac)
+{
+    uint64_t h = mix64(mac);
+
+    for(int i = 0; i < 3; i++, h >>= 11)
+    {
+        if(!(bloom[(h & 2047) >> 3] & (1 << (h & 7))))
+            return false;
+    }
+    return true;
+}
+
+static inline void put_uv(std::vector<uint8_t> &v, uint64_t x)
+{
+    while(x >= 0x80)
+    {
+        v.push_back((uint8_t)x | 0x80);
+        x >>= 7;
+    }
+    v.push_back((uint8_t)x);
+}
+
+static inline bool get_uv(const uint8_t *&p, const uint8_t *end, uint64_t &x)
+{
+    x = 0;
+    for(int s = 0; p < end && s < 64; s += 7)
+    {
+        uint8_t b = *p++;
+
+        x |= (uint64_t)(b & 0x7F) << s;
+        if(!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static inline uint32_t zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint64_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/*
+ * FNV-1a of a payload in the block layout
+ */
+static uint32_t pay_hash(const uint8_t *p, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    while(len--)
+        h = (h ^ *p++) * 16777619u;
+    return h;
+}
+
+ArchiveWriter::ArchiveWriter(const std::string &dir, uint32_t part_sec, uint32_t block_rows)
+    : dir_(dir), part_sec_(part_sec ? part_sec : ARC_PART_SEC), block_rows_(block_rows), f_(nullptr),
+      part_(0), st_()
+{
+    size_t n = 16;
+
+    if(!block_rows_)
+        block_rows_ = ARC_BLOCK_ROWS;
+    if(block_rows_ > ARC_BLOCK_ROWS_MAX)
+        block_rows_ = ARC_BLOCK_ROWS_MAX;
+    while(n < 2 * (size_t)block_rows_)
+        n <<= 1;
+    pay_hash_.assign(n, 0);
+    rows_.reserve(block_rows_);
+}
+
+ArchiveWriter::~ArchiveWriter()
+{
+    close();
+}
+
+/*********************************************************************
+ * @fn      ArchiveWriter::open_part
+ *
+ * @brief   Open the file of a partition for appending. A new file gets
+ *          the header, an existing one is cut after its last whole block.
+ *
+ * @param   part - partition start, UNIX s
+ *
+ * @return  false - open error or not an archive of this layout
+ */
+bool ArchiveWriter::open_part(uint64_t part)
+{
+    ArcFileHdr fh = ArcFileHdr();
+    ArcBlockHdr bh;
+    char name[32];
+    time_t t = (time_t)part;
+    struct tm tm;
+    struct stat sb;
+    off_t pos;
+
+    if(f_)
+    {
+        fclose(f_);
+        f_ = nullptr;
+    }
+    gmtime_r(&t, &tm);
+    strftime(name, sizeof(name), part_sec_ % 86400 ? "%Y%m%d-%H%M.ava" : "%Y%m%d.ava", &tm);
+    if(mkdir(dir_.c_str(), 0755) && errno != EEXIST)
+        return false;
+    name_ = dir_ + "/" + name;
+    f_ = fopen(name_.c_str(), "a+b");
+    if(!f_)
+        return false;
+    part_ = part;
+    st_.files++;
+    if(fstat(fileno(f_), &sb))
+        return false;
+    if(!sb.st_size)
+    {
+        fh.magic = ARC_MAGIC;
+        fh.version = ARC_VERSION;
+        fh.hdr_size = sizeof(fh);
+        fh.part_start = part;
+        fh.part_sec = part_sec_;
+        fh.block_hdr_size = sizeof(ArcBlockHdr);
+        if(fwrite(&fh, sizeof(fh), 1, f_) != 1 || fflush(f_))
+            return false;
+        st_.bytes += sizeof(fh);
+        return true;
+    }
+    if(fread(&fh, sizeof(fh), 1, f_) != 1 || fh.magic != ARC_MAGIC || fh.version != ARC_VERSION
+       || fh.block_hdr_size != sizeof(ArcBlockHdr))
+    {
+        fclose(f_);
+        f_ = nullptr;
+        errno = EINVAL;
+        return false;
+    }
+    for(pos = fh.hdr_size; pos + (off_t)sizeof(bh) <= sb.st_size; pos += bh.size)
+    {
+        if(fseeko(f_, pos, SEEK_SET) || fread(&bh, sizeof(bh), 1, f_) != 1 || bh.magic != ARC_BLOCK_MAGIC
+           || bh.size < sizeof(bh) || pos + (off_t)bh.size > sb.st_size)
+            break;
+    }
+    if(pos < sb.st_size && ftruncate(fileno(f_), pos))
+        return false;
+    return true;
+}
+
+/*
+ * Index of the payload of f in the block, added if new
+ */
+uint32_t ArchiveWriter::payload(const Frame &f)
+{
+    uint8_t key[ARC_PAY_HDR + 255];
+    uint32_t len = ARC_PAY_HDR + f.payload_len(), mask = (uint32_t)pay_hash_.size() - 1, i, idx;
+
+    key[0] = f.adv_types();
+    key[1] = f.phy_types();
+    key[2] = (uint8_t)f.payload_len();
+    memcpy(key + ARC_PAY_HDR, f.payload(), f.payload_len());
+    for(i = pay_hash(key, len) & mask; pay_hash_[i]; i = (i + 1) & mask)
+    {
+        idx = pay_hash_[i] - 1;
+        if(pay_[pay_tab_[idx] + 2] == key[2] && !memcmp(&pay_[pay_tab_[idx]], key, len))
+            return idx;
+    }
+    idx = (uint32_t)pay_tab_.size();
+    pay_hash_[i] = idx + 1;
+    pay_tab_.push_back((uint32_t)pay_.size());
+    pay_.insert(pay_.end(), key, key + len);
+    return idx;
+}
+
+bool ArchiveWriter::add(const Frame &f, uint64_t ts_us)
+{
+    uint64_t part = ts_us / 1000000 / part_sec_ * part_sec_;
+    Row r;
+
+    if(f.is_svc())
+        return true;
+    if(!f_ || part > part_)
+    {
+        if(!flush() || !open_part(part))
+            return false;
+    }
+    r.ts = ts_us;
+    r.mac = f.mac48();
+    r.gw = f.gw;
+    r.rssi = f.rssi();
+    r.pay = payload(f);
+    rows_.push_back(r);
+    st_.rows++;
+    st_.raw_bytes += f.len;
+    if(rows_.size() >= block_rows_)
+        return flush();
+    return true;
+}
+
+/*********************************************************************
+ * @fn      ArchiveWriter::flush
+ *
+ * @brief   Write the gathered rows as one block: sorted by MAC and
+ *          time, one dictionary entry and column run per MAC.
+ *
+ * @return  false - write error
+ */
+bool ArchiveWriter::flush()
+{
+    std::vector<uint8_t> col[4];        // ts, rssi, gw, pay_idx
+    std::vector<ArcDictEnt> dict;
+    ArcBlockHdr bh = ArcBlockHdr();
+    ArcDictEnt e = ArcDictEnt();
+    size_t i, pos;
+    uint64_t ts_prev = 0;
+    int8_t rssi_prev = 0;
+
+    if(rows_.empty())
+        return true;
+    if(!f_)
+        return false;
+    std::stable_sort(rows_.begin(), rows_.end(), [](const Row &a, const Row &b)
+    {
+        return a.mac < b.mac || (a.mac == b.mac && a.ts < b.ts);
+    });
+    bh.magic = ARC_BLOCK_MAGIC;
+    bh.rows = (uint32_t)rows_.size();
+    bh.payloads = (uint32_t)pay_tab_.size();
+    bh.ts_min = UINT64_MAX;
+    bh.mac_min = rows_.front().mac;
+    bh.mac_max = rows_.back().mac;
+    for(i = 0; i < rows_.size(); i++)
+    {
+        if(rows_[i].ts < bh.ts_min)
+            bh.ts_min = rows_[i].ts;
+        if(rows_[i].ts > bh.ts_max)
+            bh.ts_max = rows_[i].ts;
+    }
+    for(i = 0; i < rows_.size(); i++)
+    {
+        const Row &r = rows_[i];
+
+        if(!i || r.mac != e.mac)
+        {
+            if(i)
+                dict.push_back(e);
+            e.mac = r.mac;
+            e.rows = 0;
+            e.ts_off = (uint32_t)col[0].size();
+            e.rssi_off = (uint32_t)col[1].size();
+            e.gw_off = (uint32_t)col[2].size();
+            e.pay_off = (uint32_t)col[3].size();
+            ts_prev = bh.ts_min;
+            rssi_prev = 0;
+            bloom_set(bh.bloom, r.mac);
+        }
+        put_uv(col[0], r.ts - ts_prev);
+        put_uv(col[1], zigzag(r.rssi - rssi_prev));
+        put_uv(col[2], r.gw);
+        put_uv(col[3], r.pay);
+        ts_prev = r.ts;
+        rssi_prev = r.rssi;
+        e.rows++;
+    }
+    dict.push_back(e);
+    bh.macs = (uint32_t)dict.size();
+    // layout
+    pos = sizeof(bh);
+    bh.col[ARC_COL_DICT] = (uint32_t)pos;
+    pos += dict.size() * sizeof(ArcDictEnt);
+    bh.col[ARC_COL_PAY_TAB] = (uint32_t)pos;
+    pos = align8(pos + pay_tab_.size() * 4);
+    bh.col[ARC_COL_PAY] = (uint32_t)pos;
+    pos = align8(pos + pay_.size());
+    for(i = 0; i < 4; i++)
+    {
+        bh.col[ARC_COL_TS + i] = (uint32_t)pos;
+        pos = align8(pos + col[i].size());
+    }
+    bh.size = (uint32_t)pos;
+    out_.assign(pos, 0);
+    memcpy(&out_[bh.col[ARC_COL_DICT]], dict.data(), dict.size() * sizeof(ArcDictEnt));
+    memcpy(&out_[bh.col[ARC_COL_PAY_TAB]], pay_tab_.data(), pay_tab_.size() * 4);
+    memcpy(&out_[bh.col[ARC_COL_PAY]], pay_.data(), pay_.size());
+    for(i = 0; i < 4; i++)
+        memcpy(&out_[bh.col[ARC_COL_TS + i]], col[i].data(), col[i].size());
+    bh.crc = stream_crc32(&out_[sizeof(bh)], pos - sizeof(bh));
+    memcpy(out_.data(), &bh, sizeof(bh));
+    st_.blocks++;
+    st_.payloads += pay_tab_.size();
+    st_.bytes += pos;
+    rows_.clear();
+    pay_.clear();
+    pay_tab_.clear();
+    std::fill(pay_hash_.begin(), pay_hash_.end(), 0);
+    return fwrite(out_.data(), 1, pos, f_) == pos && !fflush(f_);
+}
+
+bool ArchiveWriter::close()
+{
+    bool ok = flush();
+
+    if(f_ && fclose(f_))
+        ok = false;
+    f_ = nullptr;
+    return ok;
+}
+
+bool ArchiveReader::open(const std::string &name)
+{
+    const ArcFileHdr *fh;
+    struct stat sb;
+    size_t pos;
+    void *p;
+    int fd;
+
+    close();
+    fd = ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+    if(fstat(fd, &sb) || sb.st_size < (off_t)sizeof(ArcFileHdr))
+    {
+        ::close(fd);
+        errno = EINVAL;
+        return false;
+    }
+    p = mmap(nullptr, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED)
+        return false;
+    map_ = (const uint8_t *)p;
+    size_ = sb.st_size;
+    fh = (const ArcFileHdr *)map_;
+    if(fh->magic != ARC_MAGIC || fh->version != ARC_VERSION || fh->hdr_size < sizeof(ArcFileHdr)
+       || fh->hdr_size & 7 || fh->block_hdr_size != sizeof(ArcBlockHdr))
+    {
+        close();
+        errno = EINVAL;
+        return false;
+    }
+    pos = fh->hdr_size;
+    while(pos + sizeof(ArcBlockHdr) <= size_)
+    {
+        const ArcBlockHdr &b = *(const ArcBlockHdr *)(map_ + pos);
+
+        if(b.magic != ARC_BLOCK_MAGIC || b.size < sizeof(ArcBlockHdr) || b.size & 7 || b.size > size_ - pos
+           || bad(b))
+            break;
+        blocks_.push_back(pos);
+        pos += b.size;
+    }
+    tail_ = size_ - pos;
+    return true;
+}
+
+void ArchiveReader::close()
+{
+    if(map_)
+        munmap((void *)map_, size_);
+    map_ = nullptr;
+    size_ = 0;
+    tail_ = 0;
+    blocks_.clear();
+}
+
+/*
+ * Column offsets in order and inside the block, the fixed size tables
+ * aligned and fit
+ */
+bool ArchiveReader::bad(const ArcBlockHdr &b) const
+{
+    if(b.col[ARC_COL_DICT] < sizeof(ArcBlockHdr) || b.col[ARC_COL_DICT] & 7 || b.col[ARC_COL_PAY_TAB] & 3)
+        return true;
+    for(int i = 1; i < ARC_COL_NUM; i++)
+    {
+        if(b.col[i] < b.col[i - 1] || b.col[i] > b.size)
+            return true;
+    }
+    return (uint64_t)b.macs * sizeof(ArcDictEnt) > b.col[ARC_COL_PAY_TAB] - b.col[ARC_COL_DICT]
+           || (uint64_t)b.payloads * 4 > b.col[ARC_COL_PAY] - b.col[ARC_COL_PAY_TAB];
+}
+
+/*********************************************************************
+ * @fn      ArchiveReader::run
+ *
+ * @brief   Decode the rows of one dictionary entry, stop at the first
+ *          row at or after to (the run is in time order).
+ *
+ * @return  rows handed to cb
+ */
+size_t ArchiveReader::run(const uint8_t *blk, const ArcDictEnt &e, uint64_t from, uint64_t to, const RowCb &cb)
+{
+    const ArcBlockHdr &b = *(const ArcBlockHdr *)blk;
+    const uint8_t *ts = blk + b.col[ARC_COL_TS] + e.ts_off, *ts_end = blk + b.col[ARC_COL_RSSI];
+    const uint8_t *rs = blk + b.col[ARC_COL_RSSI] + e.rssi_off, *rs_end = blk + b.col[ARC_COL_GW];
+    const uint8_t *gw = blk + b.col[ARC_COL_GW] + e.gw_off, *gw_end = blk + b.col[ARC_COL_PAY_IDX];
+    const uint8_t *pi = blk + b.col[ARC_COL_PAY_IDX] + e.pay_off, *pi_end = blk + b.size;
+    const uint32_t *pay_tab = (const uint32_t *)(blk + b.col[ARC_COL_PAY_TAB]);
+    uint32_t pay_len = b.col[ARC_COL_TS] - b.col[ARC_COL_PAY];
+    uint64_t v_ts, v_rs, v_gw, v_pi;
+    size_t n = 0;
+    ArcRow r;
+
+    r.ts = b.ts_min;
+    r.mac = e.mac;
+    r.rssi = 0;
+    for(uint32_t i = 0; i < e.rows; i++)
+    {
+        if(!get_uv(ts, ts_end, v_ts) || !get_uv(rs, rs_end, v_rs) || !get_uv(gw, gw_end, v_gw)
+           || !get_uv(pi, pi_end, v_pi) || v_pi >= b.payloads || pay_tab[v_pi] + ARC_PAY_HDR > pay_len)
+            break;
+        st_.rows++;
+        r.ts += v_ts;
+        r.rssi = (int8_t)(r.rssi + unzigzag(v_rs));
+        if(r.ts >= to)
+            break;
+        if(r.ts < from)
+            continue;
+        const uint8_t *p = blk + b.col[ARC_COL_PAY] + pay_tab[v_pi];
+
+        if(pay_tab[v_pi] + ARC_PAY_HDR + p[2] > pay_len)
+            break;
+        r.gw = (uint32_t)v_gw;
+        r.adv_types = p[0];
+        r.phy_types = p[1];
+        r.len = p[2];
+        r.data = p + ARC_PAY_HDR;
+        cb(r);
+        n++;
+    }
+    return n;
+}
+
+/*********************************************************************
+ * @fn      ArchiveReader::scan
+ *
+ * @brief   Rows of one MAC: a block is skipped by its time range, MAC
+ *          range and bloom filter, the MAC is looked up in the sorted
+ *          dictionary, only its run is decoded.
+ */
+size_t ArchiveReader::scan(uint64_t mac, uint64_t from, uint64_t to, const RowCb &cb)
+{
+    size_t n = 0;
+
+    for(size_t i = 0; i < blocks_.size(); i++)
+    {
+        const uint8_t *blk = map_ + blocks_[i];
+        const ArcBlockHdr &b = *(const ArcBlockHdr *)blk;
+        const ArcDictEnt *d = (const ArcDictEnt *)(blk + b.col[ARC_COL_DICT]), *e;
+
+        st_.blocks++;
+        if(b.ts_max < from || b.ts_min >= to)
+        {
+            st_.skip_ts++;
+            continue;
+        }
+        if(mac < b.mac_min || mac > b.mac_max)
+        {
+            st_.skip_range++;
+            continue;
+        }
+        if(!arc_bloom_test(b.bloom, mac))
+        {
+            st_.skip_bloom++;
+            continue;
+        }
+        e = std::lower_bound(d, d + b.macs, mac, [](const ArcDictEnt &a, uint64_t m) { return a.mac < m; });
+        if(e == d + b.macs || e->mac != mac)
+        {
+            st_.dict_miss++;
+            continue;
+        }
+        n += run(blk, *e, from, to, cb);
+    }
+    return n;
+}
+
+size_t ArchiveReader::scan(uint64_t from, uint64_t to, const RowCb &cb)
+{
+    size_t n = 0;
+
+    for(size_t i = 0; i < blocks_.size(); i++)
+    {
+        const uint8_t *blk = map_ + blocks_[i];
+        const ArcBlockHdr &b = *(const ArcBlockHdr *)blk;
+        const ArcDictEnt *d = (const ArcDictEnt *)(blk + b.col[ARC_COL_DICT]);
+
+        st_.blocks++;
+        if(b.ts_max < from || b.ts_min >= to)
+        {
+            st_.skip_ts++;
+            continue;
+        }
+        for(uint32_t j = 0; j < b.macs; j++)
+            n += run(blk, d[j], from, to, cb);
+    }
+    return n;
+}
+
+size_t ArchiveReader::verify() const
+{
+    size_t bad_blocks = 0;
+
+    for(size_t i = 0; i < blocks_.size(); i++)
+    {
+        const ArcBlockHdr &b = block(i);
+
+        if(stream_crc32((const uint8_t *)&b + sizeof(b), b.size - sizeof(b)) != b.crc)
+            bad_blocks++;
+    }
+    return bad_blocks;
+}
+
+} // namespace advcol
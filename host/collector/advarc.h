@@ -0,0 +1,247 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advarc.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/24
+ * Description        : Collector library: columnar advert archive,
+ *                      time partitioned files of self-contained blocks
+ *                      with MAC range and bloom indexes, mmap reader
+ *********************************************************************************/
+
+#ifndef ADVARC_H
+#define ADVARC_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include "advcol.h"
+
+namespace advcol
+{
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+const uint32_t ARC_MAGIC = 0x41564441;          // "ADVA", file header
+const uint32_t ARC_BLOCK_MAGIC = 0x42564441;    // "ADVB"
+const uint16_t ARC_VERSION = 1;
+
+const uint32_t ARC_PART_SEC = 86400;            // default partition: UTC day
+const uint32_t ARC_BLOCK_ROWS = 32768;          // default rows per block
+const uint32_t ARC_BLOOM_BYTES = 256;           // 2048 bits, 3 probes per MAC
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * File layout: ArcFileHdr, then blocks back to back, each one
+ * ArcBlockHdr and its columns (offsets from the block start, 8 byte
+ * aligned). All fields little-endian. Inside a block the rows are sorted
+ * by MAC and time, the dictionary has one ArcDictEnt per MAC with the
+ * offsets of its run in the row columns:
+ *   dict     ArcDictEnt[macs], sorted by MAC
+ *   pay_tab  u32[payloads] - offsets in pay
+ *   pay      [adTypes][phyTypes][len][data], distinct payloads of the block
+ *   ts       LEB128: first row - ts - ts_min, then the delta to the row before
+ *   rssi     LEB128 zigzag: first row - RSSI, then the delta
+ *   gw       LEB128
+ *   pay_idx  LEB128 index in pay_tab
+ * A block is written with one write: a cut block at the end of the file
+ * (power loss) is ignored by the reader.
+ */
+struct ArcFileHdr
+{
+    uint32_t magic;             // ARC_MAGIC
+    uint16_t version;           // ARC_VERSION
+    uint16_t hdr_size;          // sizeof(ArcFileHdr)
+    uint64_t part_start;        // UNIX s
+    uint32_t part_sec;
+    uint32_t block_hdr_size;    // sizeof(ArcBlockHdr)
+    uint64_t rsv;
+};
+
+enum ArcCol
+{
+    ARC_COL_DICT,
+    ARC_COL_PAY_TAB,
+    ARC_COL_PAY,
+    ARC_COL_TS,
+    ARC_COL_RSSI,
+    ARC_COL_GW,
+    ARC_COL_PAY_IDX,
+    ARC_COL_NUM
+};
+
+struct ArcBlockHdr
+{
+    uint32_t magic;             // ARC_BLOCK_MAGIC
+    uint32_t size;              // header and columns
+    uint32_t crc;               // stream_crc32() of the columns
+    uint32_t rows;
+    uint32_t macs;
+    uint32_t payloads;
+    uint64_t ts_min;            // us
+    uint64_t ts_max;
+    uint64_t mac_min;           // Frame::mac48()
+    uint64_t mac_max;
+    uint32_t col[ARC_COL_NUM];  // column offsets
+    uint32_t rsv;
+    uint8_t  bloom[ARC_BLOOM_BYTES];
+};
+
+struct ArcDictEnt
+{
+    uint64_t mac;
+    uint32_t rows;
+    uint32_t ts_off;            // run start in the ts, rssi, gw, pay_idx columns
+    uint32_t rssi_off;
+    uint32_t gw_off;
+    uint32_t pay_off;
+    uint32_t rsv;
+};
+
+struct ArcRow
+{
+    uint64_t ts;                // us
+    uint64_t mac;
+    uint32_t gw;
+    int8_t   rssi;
+    uint8_t  adv_types;
+    uint8_t  phy_types;
+    uint8_t  len;
+    const uint8_t *data;        // in the mapped file
+};
+
+struct ArcWriterStats
+{
+    uint64_t rows;
+    uint64_t blocks;
+    uint64_t files;             // opened, new or appended
+    uint64_t payloads;          // distinct per block
+    uint64_t bytes;             // written
+    uint64_t raw_bytes;         // v1 frames of the rows
+};
+
+struct ArcReaderStats
+{
+    uint64_t blocks;            // looked at
+    uint64_t skip_ts;           // skipped by ts_min/ts_max
+    uint64_t skip_range;        // by mac_min/mac_max
+    uint64_t skip_bloom;
+    uint64_t dict_miss;         // bloom false positives
+    uint64_t rows;              // decoded
+};
+
+/*
+ * Archive sink: adverts to DIR/YYYYMMDD.ava (day partitions) or
+ * DIR/YYYYMMDD-HHMM.ava. Rows are gathered per block in memory and
+ * written out when block_rows are collected, on a partition change and by
+ * flush(). A partition file that exists is appended to. A row stamped
+ * before the current partition (a late gateway) stays in it, the block
+ * time range covers it.
+ */
+class ArchiveWriter
+{
+public:
+    explicit ArchiveWriter(const std::string &dir, uint32_t part_sec = ARC_PART_SEC,
+                           uint32_t block_rows = ARC_BLOCK_ROWS);
+    ~ArchiveWriter();
+    ArchiveWriter(const ArchiveWriter &) = delete;
+    ArchiveWriter &operator=(const ArchiveWriter &) = delete;
+
+    // Advert frame received at ts_us (UNIX us), service frames are skipped.
+    // false - write error
+    bool add(const Frame &f, uint64_t ts_us);
+    bool flush();
+    bool close();
+
+    const ArcWriterStats &stats() const { return st_; }
+    const std::string &file() const { return name_; }
+
+private:
+    struct Row
+    {
+        uint64_t ts;
+        uint64_t mac;
+        uint32_t gw;
+        uint32_t pay;
+        int8_t   rssi;
+    };
+
+    bool open_part(uint64_t part);
+    uint32_t payload(const Frame &f);
+
+    std::string dir_;
+    uint32_t part_sec_;
+    uint32_t block_rows_;
+    FILE *f_;
+    std::string name_;
+    uint64_t part_;
+    std::vector<Row> rows_;
+    std::vector<uint8_t> pay_;          // distinct payloads, ArcBlockHdr layout
+    std::vector<uint32_t> pay_tab_;
+    std::vector<uint32_t> pay_hash_;    // open addressing: pay_tab_ index + 1
+    std::vector<uint8_t> out_;
+    ArcWriterStats st_;
+};
+
+/*
+ * Archive file reader over a read-only mapping. open() walks the block
+ * headers once; a scan for one MAC looks only at the block headers, the
+ * dictionary and the run of that MAC.
+ */
+class ArchiveReader
+{
+public:
+    using RowCb = std::function<void(const ArcRow &)>;
+
+    ArchiveReader() : map_(nullptr), size_(0), st_() {}
+    ~ArchiveReader() { close(); }
+    ArchiveReader(const ArchiveReader &) = delete;
+    ArchiveReader &operator=(const ArchiveReader &) = delete;
+
+    // false - no file or not an archive
+    bool open(const std::string &name);
+    void close();
+
+    const ArcFileHdr &header() const { return *(const ArcFileHdr *)map_; }
+    size_t blocks() const { return blocks_.size(); }
+    const ArcBlockHdr &block(size_t i) const { return *(const ArcBlockHdr *)(map_ + blocks_[i]); }
+    // Bytes after the last whole block: a cut write
+    size_t tail() const { return tail_; }
+
+    // Rows of one MAC with from <= ts < to, time order. Returns the row count
+    size_t scan(uint64_t mac, uint64_t from, uint64_t to, const RowCb &cb);
+    // All rows with from <= ts < to, MAC and time order inside a block
+    size_t scan(uint64_t from, uint64_t to, const RowCb &cb);
+    // Block CRCs, returns the number of bad blocks
+    size_t verify() const;
+
+    const ArcReaderStats &stats() const { return st_; }
+
+private:
+    bool bad(const ArcBlockHdr &b) const;
+    size_t run(const uint8_t *blk, const ArcDictEnt &e, uint64_t from, uint64_t to, const RowCb &cb);
+
+    const uint8_t *map_;
+    size_t size_;
+    size_t tail_;
+    std::vector<size_t> blocks_;
+    ArcReaderStats st_;
+};
+
+/*
+ * Bloom filter probe of a MAC
+ */
+bool arc_bloom_test(const uint8_t bloom[ARC_BLOOM_BYTES], uint64_t mac);
+
+} // namespace advcol
+
+#endif /* ADVARC_H */
@@ -0,0 +1,428 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advcol.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/21
+ * Description        : Collector library: mirrored receive ring, gateway
+ *                      connections on one epoll loop
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include "advcol.h"
+
+namespace advcol
+{
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define COL_EVENTS_MAX          64
+
+static uint64_t now_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*********************************************************************
+ * @fn      RingBuf::init
+ *
+ * @brief   One memfd mapped twice back to back into a reserved range:
+ *          byte size + i is byte i.
+ *
+ * @param   size - minimum size, rounded up to a power of 2 of pages
+ *
+ * @return  false - no memory
+ */
+bool RingBuf::init(size_t size)
+{
+    size_t sz = (size_t)sysconf(_SC_PAGESIZE);
+    uint8_t *p;
+    int fd;
+
+    while(sz < size)
+        sz <<= 1;
+    fd = memfd_create("advcol_ring", MFD_CLOEXEC);
+    if(fd < 0)
+        return false;
+    if(ftruncate(fd, sz) < 0)
+    {
+        close(fd);
+        return false;
+    }
+    p = (uint8_t *)mmap(nullptr, sz * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    if(mmap(p, sz, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, 0) == MAP_FAILED
+       || mmap(p + sz, sz, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, 0) == MAP_FAILED)
+    {
+        munmap(p, sz * 2);
+        close(fd);
+        return false;
+    }
+    close(fd);
+    if(base_)
+        munmap(base_, size_ * 2);
+    base_ = p;
+    size_ = sz;
+    rd_ = wr_ = 0;
+    return true;
+}
+
+RingBuf::~RingBuf()
+{
+    if(base_)
+        munmap(base_, size_ * 2);
+}
+
+Collector::Collector(size_t ring_size) : ring_size_(ring_size), stop_(false)
+{
+    ep_ = epoll_create1(EPOLL_CLOEXEC);
+}
+
+Collector::~Collector()
+{
+    for(auto g : gws_)
+    {
+        if(g->fd >= 0)
+            close(g->fd);
+        delete g;
+    }
+    if(ep_ >= 0)
+        close(ep_);
+}
+
+/*********************************************************************
+ * @fn      Collector::add
+ *
+ * @brief   New gateway, the connection is opened on the next poll().
+ *
+ * @param   host - IPv4 address or name
+ * @param   opt - port and stream options
+ *
+ * @return  gateway index, -1 - unknown host or no memory
+ */
+int Collector::add(const std::string &host, const GatewayOptions &opt)
+{
+    struct addrinfo hints, *res;
+    Gateway *g;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), nullptr, &hints, &res) || !res)
+        return -1;
+    g = new Gateway(gws_.size());
+    memcpy(&g->addr, res->ai_addr, sizeof(g->addr));
+    freeaddrinfo(res);
+    g->addr.sin_port = htons(opt.port);
+    g->host = host;
+    g->opt = opt;
+    if(!g->ring.init(ring_size_))
+    {
+        delete g;
+        return -1;
+    }
+    gws_.push_back(g);
+    return gws_.size() - 1;
+}
+
+/*********************************************************************
+ * @fn      Collector::add_fd
+ *
+ * @brief   Gateway on a connected socket: the commands are sent now,
+ *          the socket is not reopened.
+ *
+ * @return  gateway index, -1 - no memory or epoll error
+ */
+int Collector::add_fd(int fd, const GatewayOptions &opt)
+{
+    Gateway *g = new Gateway(gws_.size());
+    struct epoll_event ev;
+
+    g->host = "fd:" + std::to_string(fd);
+    g->opt = opt;
+    g->own = false;
+    g->fd = fd;
+    if(!g->ring.init(ring_size_))
+    {
+        delete g;
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    ev.events = EPOLLIN;
+    ev.data.u32 = gws_.size();
+    if(epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        delete g;
+        return -1;
+    }
+    gws_.push_back(g);
+    up(gws_.size() - 1);
+    return gws_.size() - 1;
+}
+
+GatewayInfo Collector::info(int gw) const
+{
+    const Gateway *g = gws_[gw];
+    GatewayInfo r;
+
+    r.host = g->host;
+    r.connected = g->state == UP;
+    r.connects = g->connects;
+    r.disconnects = g->disconnects;
+    r.stats = &g->parser.stats();
+    return r;
+}
+
+/*********************************************************************
+ * @fn      Collector::open
+ *
+ * @brief   Non-blocking connect, EPOLLOUT reports the result.
+ */
+void Collector::open(uint32_t i)
+{
+    Gateway *g = gws_[i];
+    struct epoll_event ev;
+    int fd, on = 1;
+
+    g->retry_ms = now_ms() + g->opt.reconnect_ms;
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if(connect(fd, (struct sockaddr *)&g->addr, sizeof(g->addr)) < 0 && errno != EINPROGRESS)
+    {
+        close(fd);
+        return;
+    }
+    ev.events = EPOLLOUT;
+    ev.data.u32 = i;
+    if(epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        close(fd);
+        return;
+    }
+    g->fd = fd;
+    g->state = CONNECTING;
+}
+
+/*********************************************************************
+ * @fn      Collector::command
+ *
+ * @brief   Control command [cmd][len][data] (ctrl.h).
+ */
+void Collector::command(uint32_t i, uint8_t cmd, const uint8_t *data, uint8_t len)
+{
+    uint8_t buf[2 + 255];
+
+    buf[0] = cmd;
+    buf[1] = len;
+    memcpy(buf + 2, data, len);
+    if(send(gws_[i]->fd, buf, 2 + len, MSG_NOSIGNAL) < 0)
+        return;
+}
+
+void Collector::command(uint32_t i, uint8_t cmd, uint8_t arg)
+{
+    command(i, cmd, &arg, 1);
+}
+
+/*********************************************************************
+ * @fn      Collector::up
+ *
+ * @brief   Connected: the gateway starts with v1 full frames and no
+ *          stamps, the options are sent again. With resume the blocks
+ *          from the next one expected on come first, at the first
+ *          connect all the gateway holds.
+ */
+void Collector::up(uint32_t i)
+{
+    Gateway *g = gws_[i];
+    bool resume = g->opt.resume && g->opt.framing != STREAM_V1;
+    uint32_t seq;
+
+    g->state = UP;
+    g->connects++;
+    g->parser.reset(resume);
+    g->ring.clear();
+    g->losses = g->parser.losses();
+    if(g->opt.framing != STREAM_V1)
+        command(i, CTRL_CMD_FRAMING, g->opt.framing);
+    if(resume)
+    {
+        uint8_t arg[4];
+
+        if(!g->parser.seq_next(seq))
+            seq = 0;
+        arg[0] = (uint8_t)seq;
+        arg[1] = (uint8_t)(seq >> 8);
+        arg[2] = (uint8_t)(seq >> 16);
+        arg[3] = (uint8_t)(seq >> 24);
+        command(i, CTRL_CMD_RESUME, arg, sizeof(arg));
+    }
+    if(g->opt.lz)
+        command(i, CTRL_CMD_COMPRESS, STREAM_LZ_ON);
+    if(g->opt.compact)
+        command(i, CTRL_CMD_ENCODING, ADV_ENC_COMPACT);
+    if(g->opt.stamp)
+        command(i, CTRL_CMD_TIMESTAMP, 1);
+}
+
+void Collector::down(uint32_t i)
+{
+    Gateway *g = gws_[i];
+
+    if(g->fd >= 0)
+    {
+        epoll_ctl(ep_, EPOLL_CTL_DEL, g->fd, nullptr);
+        close(g->fd);
+        g->fd = -1;
+    }
+    if(g->state == UP)
+        g->disconnects++;
+    g->state = DOWN;
+    g->retry_ms = now_ms() + g->opt.reconnect_ms;
+}
+
+/*********************************************************************
+ * @fn      Collector::recv
+ *
+ * @brief   Read into the ring and parse everything complete in place.
+ *
+ * @return  frames delivered, -1 - connection closed
+ */
+int Collector::recv(uint32_t i)
+{
+    Gateway *g = gws_[i];
+    Frame f;
+    ssize_t n;
+    int cnt = 0;
+
+    for(;;)
+    {
+        if(!g->ring.wfree())
+        {
+            // a record longer than the ring: not a gateway stream
+            g->ring.clear();
+        }
+        n = ::recv(g->fd, g->ring.wptr(), g->ring.wfree(), 0);
+        if(n <= 0)
+        {
+            if(n < 0 && (errno == EAGAIN || errno == EINTR))
+                break;
+            return -1;
+        }
+        g->ring.produce(n);
+        g->parser.input(g->ring.rptr(), g->ring.ravail());
+        while(g->parser.next(f))
+        {
+            cnt++;
+            if(cb_)
+                cb_(f);
+        }
+        g->ring.consume(g->parser.consumed());
+        if(g->opt.compact && g->parser.losses() != g->losses)
+        {
+            // restart the gateway dictionary, the decoder lost its state
+            g->losses = g->parser.losses();
+            command(i, CTRL_CMD_ENCODING, ADV_ENC_COMPACT);
+        }
+        if((size_t)n < g->ring.wfree())
+            break;
+    }
+    return cnt;
+}
+
+/*********************************************************************
+ * @fn      Collector::poll
+ *
+ * @brief   Reopen due connections, wait for events, read.
+ *
+ * @param   timeout_ms - epoll wait, capped by the next reconnect
+ *
+ * @return  frames delivered, -1 - epoll error
+ */
+int Collector::poll(int timeout_ms)
+{
+    struct epoll_event ev[COL_EVENTS_MAX];
+    uint64_t t = now_ms();
+    int n, k, cnt = 0, err;
+    socklen_t len;
+    uint32_t i;
+
+    for(i = 0; i < gws_.size(); i++)
+    {
+        Gateway *g = gws_[i];
+
+        if(g->state != DOWN || !g->own)
+            continue;
+        if(t >= g->retry_ms)
+            open(i);
+        if(g->state == DOWN && (int64_t)(g->retry_ms - t) < timeout_ms)
+            timeout_ms = g->retry_ms - t;
+    }
+    n = epoll_wait(ep_, ev, COL_EVENTS_MAX, timeout_ms);
+    if(n < 0)
+        return errno == EINTR ? 0 : -1;
+    for(k = 0; k < n; k++)
+    {
+        i = ev[k].data.u32;
+        Gateway *g = gws_[i];
+
+        if(g->state == CONNECTING)
+        {
+            err = 0;
+            len = sizeof(err);
+            getsockopt(g->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+            if(err || (ev[k].events & (EPOLLERR | EPOLLHUP)))
+            {
+                down(i);
+                continue;
+            }
+            ev[k].events = EPOLLIN;
+            epoll_ctl(ep_, EPOLL_CTL_MOD, g->fd, &ev[k]);
+            up(i);
+            continue;
+        }
+        if(g->state != UP)
+            continue;
+        err = recv(i);
+        if(err < 0)
+            down(i);
+        else
+            cnt += err;
+    }
+    return cnt;
+}
+
+void Collector::run(int timeout_ms)
+{
+    stop_ = false;
+    while(!stop_)
+    {
+        if(poll(timeout_ms) < 0)
+            break;
+    }
+}
+
+} // namespace advcol
+
+/******************************** endfile @ advcol ******************************/
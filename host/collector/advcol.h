@@ -0,0 +1,283 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advcol.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/21
+ * Description        : Collector library: advert stream parser (v1 frames,
+ *                      v2 blocks, compact, time and LZ records) over a
+ *                      mirrored ring buffer, many gateways in one epoll loop
+ *********************************************************************************/
+
+#ifndef ADVCOL_H
+#define ADVCOL_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <netinet/in.h>
+#include "ctrl.h"
+#include "stream.h"
+#include "advenc.h"
+#include "gwtime.h"
+
+namespace advcol
+{
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Longest v2 block accepted, as the firmware sends at most SEND_BUF_LEN
+const uint32_t BLK_MAX = 4096;
+// Default receive ring per gateway, rounded up to pages
+const size_t RING_SIZE = 256 * 1024;
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * Frame handed out by the parser: a v1 frame (advenc.h, ADV_HDR_LEN
+ * header and payload) or a service frame. data points into the receive
+ * ring, the decompressed block or the device dictionary and is valid
+ * until the next call into the parser.
+ */
+struct Frame
+{
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t gw;                // gateway index in the Collector
+    uint64_t ts;                // receive time, us (has_ts)
+    uint8_t  ts_flags;          // GWTIME_SYNCED, GWTIME_TWSYNC
+    bool     has_ts;
+
+    bool     is_svc() const { return data[1] == ADV_SVC_MARKER; }
+    uint8_t  svc_id() const { return data[2]; }
+    uint8_t  adv_types() const { return data[1]; }       // eventType | addrType << 4
+    uint8_t  phy_types() const { return data[2]; }       // primary | secondary << 4
+    int8_t   rssi() const { return (int8_t)data[3]; }
+    const uint8_t *mac() const { return data + 4; }      // LE, as in the frame
+    uint64_t mac48() const
+    {
+        return data[4] | (data[5] << 8) | ((uint64_t)data[6] << 16) | ((uint64_t)data[7] << 24)
+               | ((uint64_t)data[8] << 32) | ((uint64_t)data[9] << 40);
+    }
+    const uint8_t *payload() const { return data + ADV_HDR_LEN; }
+    uint32_t payload_len() const { return data[0]; }
+};
+
+struct ParserStats
+{
+    uint64_t bytes;             // parsed
+    uint64_t frames;            // frames handed out, service ones included
+    uint64_t adverts;
+    uint64_t svc;
+    uint64_t blocks;            // v2 blocks with a good CRC
+    uint64_t block_err;         // bad header or CRC
+    uint64_t block_lost;        // sequence gaps
+    uint64_t block_dup;         // blocks received again (CTRL_CMD_RESUME replay), dropped
+    uint64_t skipped;           // bytes dropped while hunting for STREAM_MAGIC
+    uint64_t compact;           // compact records
+    uint64_t dict_miss;         // compact records with an unknown handle
+    uint64_t stamps;            // time records
+    uint64_t lz_blocks;         // compressed blocks
+    uint64_t lz_in;             // their payload bytes
+    uint64_t lz_out;            // and decompressed
+};
+
+/*
+ * Stream parser of one connection. Pull style:
+ *   p.input(buf, len); while(p.next(f)) ...; keep buf + p.consumed()..
+ * or p.parse(buf, len, cb). A frame or block cut at the end of the input
+ * is not consumed, the caller hands it in again with more bytes.
+ */
+class Parser
+{
+public:
+    explicit Parser(uint32_t gw = 0);
+
+    // New connection: the dictionary, the time base and the sequence restart,
+    // resume - the gateway replays the missed blocks, they go on from where they were
+    void reset(bool resume = false);
+
+    void input(const uint8_t *buf, size_t len);
+    bool next(Frame &f);
+    size_t consumed() const { return pos_; }
+
+    template<class F> size_t parse(const uint8_t *buf, size_t len, F &&cb)
+    {
+        Frame f;
+
+        input(buf, len);
+        while(next(f))
+            cb(f);
+        return pos_;
+    }
+
+    // Blocks lost or bad since the start: the gateway dictionary must restart
+    uint64_t losses() const { return st_.block_err + st_.block_lost; }
+    // Sequence number of the next v2 block, false - none received yet
+    bool seq_next(uint32_t &next) const { next = seq_next_; return seq_valid_; }
+    const ParserStats &stats() const { return st_; }
+
+private:
+    struct DictEnt
+    {
+        bool    valid;
+        uint8_t frame[ADV_HDR_LEN + 255];
+    };
+
+    bool record(const uint8_t *r, uint32_t len, Frame &f);
+    const uint8_t *decode(const uint8_t *r);
+    int block(const uint8_t *p, size_t avail, size_t &total);
+    void lost();
+    void hunt();
+
+    uint32_t gw_;
+    const uint8_t *buf_;
+    size_t len_;
+    size_t pos_;
+    bool hunting_;
+    // records of the current v2 block
+    const uint8_t *blk_;
+    uint32_t blk_pos_;
+    uint32_t blk_len_;
+    bool seq_valid_;
+    uint32_t seq_next_;
+    uint8_t gw_id_[6];
+    std::vector<DictEnt> dict_;
+    uint64_t ts_;
+    uint8_t ts_flags_;
+    bool ts_pending_;
+    ParserStats st_;
+    alignas(4) uint8_t raw_[BLK_MAX];
+};
+
+/*
+ * v2 block CRC (CRC unit algorithm: poly 0x04C11DB7, LE 32-bit words)
+ */
+uint32_t stream_crc32(const uint8_t *p, size_t len);
+
+/*
+ * Receive buffer mapped twice back to back: the free space and the
+ * unparsed bytes are always contiguous, nothing is moved.
+ */
+class RingBuf
+{
+public:
+    RingBuf() : base_(nullptr), size_(0), rd_(0), wr_(0) {}
+    ~RingBuf();
+    RingBuf(const RingBuf &) = delete;
+    RingBuf &operator=(const RingBuf &) = delete;
+
+    bool init(size_t size);
+    uint8_t *wptr() { return base_ + (wr_ & (size_ - 1)); }
+    size_t wfree() const { return size_ - (wr_ - rd_); }
+    void produce(size_t n) { wr_ += n; }
+    const uint8_t *rptr() const { return base_ + (rd_ & (size_ - 1)); }
+    size_t ravail() const { return wr_ - rd_; }
+    void consume(size_t n) { rd_ += n; }
+    void clear() { rd_ = wr_ = 0; }
+
+private:
+    uint8_t *base_;
+    size_t size_;               // power of 2, pages
+    uint64_t rd_, wr_;
+};
+
+struct GatewayOptions
+{
+    uint16_t port = 1000;
+    uint8_t  framing = STREAM_V2;
+    bool     compact = false;   // CTRL_CMD_ENCODING ADV_ENC_COMPACT
+    bool     stamp = false;     // CTRL_CMD_TIMESTAMP
+    bool     lz = false;        // CTRL_CMD_COMPRESS, v2 only
+    bool     resume = false;    // CTRL_CMD_RESUME: the blocks missed while not connected, v2 only
+    uint32_t reconnect_ms = 1000;
+};
+
+struct GatewayInfo
+{
+    std::string host;
+    bool connected;
+    uint32_t connects;
+    uint32_t disconnects;
+    const ParserStats *stats;
+};
+
+/*
+ * Gateways on non-blocking sockets, one epoll loop, frames to a callback.
+ * Lost connections are reopened after reconnect_ms, the control commands
+ * are sent again on every connect and the dictionary is restarted after
+ * lost blocks. With resume the gateway sends the blocks missed first.
+ */
+class Collector
+{
+public:
+    using FrameCb = std::function<void(const Frame &)>;
+
+    explicit Collector(size_t ring_size = RING_SIZE);
+    ~Collector();
+    Collector(const Collector &) = delete;
+    Collector &operator=(const Collector &) = delete;
+
+    // Gateway by IPv4 address or name, returns its index, -1 - bad address
+    int add(const std::string &host, const GatewayOptions &opt = GatewayOptions());
+    // Connected stream socket (tests, benchmarks), closed with the collector, no reconnect
+    int add_fd(int fd, const GatewayOptions &opt = GatewayOptions());
+
+    void on_frame(FrameCb cb) { cb_ = std::move(cb); }
+
+    // Wait up to timeout_ms, read and parse, returns frames delivered, -1 - epoll error
+    int poll(int timeout_ms);
+    // poll() until stop()
+    void run(int timeout_ms = 100);
+    void stop() { stop_ = true; }
+
+    size_t size() const { return gws_.size(); }
+    GatewayInfo info(int gw) const;
+
+private:
+    enum State { DOWN, CONNECTING, UP };
+
+    struct Gateway
+    {
+        std::string host;
+        sockaddr_in addr;
+        GatewayOptions opt;
+        int fd;
+        State state;
+        bool own;               // add(): reconnect
+        uint64_t retry_ms;
+        uint32_t connects;
+        uint32_t disconnects;
+        uint64_t losses;
+        Parser parser;
+        RingBuf ring;
+
+        Gateway(uint32_t gw) : fd(-1), state(DOWN), own(true), retry_ms(0), connects(0), disconnects(0),
+                               losses(0), parser(gw) {}
+    };
+
+    void open(uint32_t i);
+    void up(uint32_t i);
+    void down(uint32_t i);
+    int recv(uint32_t i);
+    void command(uint32_t i, uint8_t cmd, uint8_t arg);
+    void command(uint32_t i, uint8_t cmd, const uint8_t *data, uint8_t len);
+
+    int ep_;
+    size_t ring_size_;
+    std::vector<Gateway *> gws_;
+    FrameCb cb_;
+    volatile bool stop_;
+};
+
+} // namespace advcol
+
+#endif /* ADVCOL_H */
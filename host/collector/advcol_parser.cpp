@@ -0,0 +1,425 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advcol_parser.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/21
+ * Description        : Collector library: stream parser of one connection,
+ *                      frames are handed out in place (zero copy)
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include "advcol.h"
+#include "lz.h"
+
+namespace advcol
+{
+
+/*********************************************************************
+ * CONSTANTS
+ */
+static const uint8_t stream_magic[4] = { 0xA5, 0xFE, 0x42, 0x32 };   // STREAM_MAGIC, LE
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+
+/*
+ * Slice-by-4 tables of the CRC unit: crc_tab[k][b] - byte b at the top
+ * of the register shifted through 8 * (k + 1) bits
+ */
+struct CrcTab
+{
+    uint32_t t[4][256];
+
+    CrcTab()
+    {
+        for(uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t c = i << 24;
+
+            for(int j = 0; j < 8; j++)
+                c = (c & 0x80000000) ? (c << 1) ^ 0x04C11DB7 : c << 1;
+            t[0][i] = c;
+        }
+        for(uint32_t i = 0; i < 256; i++)
+            for(int k = 1; k < 4; k++)
+                t[k][i] = (t[k - 1][i] << 8) ^ t[0][t[k - 1][i] >> 24];
+    }
+};
+
+static const CrcTab crc_tab;
+
+static inline uint32_t get_le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*********************************************************************
+ * @fn      stream_crc32
+ *
+ * @brief   CRC of a v2 block: the unit takes a LE word MSB first, a
+ *          whole word is one table step.
+ *
+ * @param   p - data
+ * @param   len - length, the tail below a word is ignored
+ *
+ * @return  CRC32
+ */
+uint32_t stream_crc32(const uint8_t *p, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for(; len >= 4; p += 4, len -= 4)
+    {
+        crc ^= get_le32(p);
+        crc = crc_tab.t[3][crc >> 24] ^ crc_tab.t[2][(crc >> 16) & 0xFF]
+              ^ crc_tab.t[1][(crc >> 8) & 0xFF] ^ crc_tab.t[0][crc & 0xFF];
+    }
+    return crc;
+}
+
+Parser::Parser(uint32_t gw) : gw_(gw), buf_(nullptr), len_(0), pos_(0), st_()
+{
+    reset();
+}
+
+/*********************************************************************
+ * @fn      Parser::reset
+ *
+ * @brief   New connection: framing v1, empty dictionary of the default
+ *          size, no time base. The counters go on.
+ *
+ * @param   resume - the missed blocks are requested (CTRL_CMD_RESUME):
+ *                   the sequence, the dictionary and the time base they
+ *                   refer to are kept
+ */
+void Parser::reset(bool resume)
+{
+    hunting_ = false;
+    blk_ = nullptr;
+    blk_pos_ = blk_len_ = 0;
+    ts_pending_ = false;
+    if(resume && seq_valid_)
+        return;
+    seq_valid_ = false;
+    seq_next_ = 0;
+    memset(gw_id_, 0, sizeof(gw_id_));
+    dict_.assign(ADV_DICT_SIZE, DictEnt());
+    ts_ = 0;
+    ts_flags_ = 0;
+}
+
+void Parser::input(const uint8_t *buf, size_t len)
+{
+    buf_ = buf;
+    len_ = len;
+    pos_ = 0;
+    blk_pos_ = blk_len_ = 0;
+}
+
+/*********************************************************************
+ * @fn      Parser::lost
+ *
+ * @brief   Records lost: deltas would apply to stale payloads, a stamp
+ *          may belong to a lost advert.
+ */
+void Parser::lost()
+{
+    for(auto &d : dict_)
+        d.valid = false;
+    ts_pending_ = false;
+}
+
+/*********************************************************************
+ * @fn      Parser::hunt
+ *
+ * @brief   Skip to the next STREAM_MAGIC, a tail that may be its start
+ *          is kept for the next input.
+ */
+void Parser::hunt()
+{
+    const uint8_t *p = buf_ + pos_;
+    size_t n = len_ - pos_;
+    const uint8_t *m = (const uint8_t *)memmem(p, n, stream_magic, sizeof(stream_magic));
+    size_t skip;
+
+    if(m)
+    {
+        skip = m - p;
+        hunting_ = false;
+    }
+    else
+        skip = n > 3 ? n - 3 : 0;
+    st_.skipped += skip;
+    st_.bytes += skip;
+    pos_ += skip;
+}
+
+/*********************************************************************
+ * @fn      Parser::block
+ *
+ * @brief   Check a v2 block at p, decompress it, set the record cursor.
+ *
+ * @param   p - block start
+ * @param   avail - bytes at p
+ * @param   total - block length
+ *
+ * @return  1 - good or received before, 0 - need more bytes, -1 - bad
+ *          header or CRC
+ */
+int Parser::block(const uint8_t *p, size_t avail, size_t &total)
+{
+    uint32_t plen, seq;
+    int32_t n;
+
+    if(memcmp(p, stream_magic, avail < 4 ? avail : 4))
+        return -1;
+    if(avail < sizeof(stream_blk_hdr_t))
+        return 0;
+    plen = get_le16(p + 12);
+    if((p[4] & ~STREAM_BLK_LZ) != STREAM_V2 || p[5] != sizeof(stream_blk_hdr_t)
+       || sizeof(stream_blk_hdr_t) + plen + 3 + STREAM_CRC_LEN > BLK_MAX)
+        return -1;
+    total = sizeof(stream_blk_hdr_t) + ((plen + 3) & ~3) + STREAM_CRC_LEN;
+    if(avail < total)
+        return 0;
+    if(stream_crc32(p, total - STREAM_CRC_LEN) != get_le32(p + total - STREAM_CRC_LEN))
+        return -1;
+    seq = get_le32(p + 8);
+    if(seq_valid_ && (int32_t)(seq - seq_next_) < 0 && !memcmp(gw_id_, p + 14, sizeof(gw_id_)))
+    {
+        // sent again by a resume replay
+        st_.block_dup++;
+        return 1;
+    }
+    blk_ = p + sizeof(stream_blk_hdr_t);
+    if(p[4] & STREAM_BLK_LZ)
+    {
+        if(plen < STREAM_LZ_HDR_LEN)
+            return -1;
+        n = lz_decompress(blk_ + STREAM_LZ_HDR_LEN, plen - STREAM_LZ_HDR_LEN, raw_, sizeof(raw_));
+        if(n < 0 || (uint32_t)n != get_le16(blk_))
+            return -1;
+        st_.lz_blocks++;
+        st_.lz_in += plen;
+        st_.lz_out += n;
+        blk_ = raw_;
+        plen = n;
+    }
+    if(seq_valid_ && seq != seq_next_ && !memcmp(gw_id_, p + 14, sizeof(gw_id_)))
+    {
+        st_.block_lost += seq - seq_next_;
+        lost();
+    }
+    memcpy(gw_id_, p + 14, sizeof(gw_id_));
+    seq_valid_ = true;
+    seq_next_ = seq + 1;
+    blk_pos_ = 0;
+    blk_len_ = plen;
+    st_.blocks++;
+    return 1;
+}
+
+/*********************************************************************
+ * @fn      Parser::decode
+ *
+ * @brief   Compact record -> v1 frame kept in the dictionary entry.
+ *
+ * @return  the frame, nullptr - unknown handle
+ */
+const uint8_t *Parser::decode(const uint8_t *r)
+{
+    uint8_t kind = r[1] & ADV_REC_KIND_MASK;
+    uint32_t h = r[2], i, nb;
+    const uint8_t *p = r + 3, *ch, *end = r + adv_rec_len(r[0], r[1]);
+    uint8_t *d;
+
+    if(r[1] & ADV_REC_WIDE)
+    {
+        h |= r[3] << 8;
+        p++;
+    }
+    if(h >= dict_.size())
+        return nullptr;
+    d = dict_[h].frame;
+    if(kind == ADV_REC_NEW)
+    {
+        dict_[h].valid = true;
+        d[0] = r[0];
+        memcpy(d + 1, p, ADV_HDR_LEN - 1);
+        memcpy(d + ADV_HDR_LEN, p + ADV_HDR_LEN - 1, r[0]);
+        return d;
+    }
+    if(!dict_[h].valid)
+        return nullptr;
+    d[3] = *p++;
+    if(kind == ADV_REC_DATA)
+    {
+        d[0] = r[0];
+        memcpy(d + ADV_HDR_LEN, p, r[0]);
+    }
+    else if(kind == ADV_REC_DELTA)
+    {
+        nb = (d[0] + 7) / 8;
+        ch = p + nb;
+        if(ch > end)
+            return nullptr;
+        for(i = 0; i < d[0]; i++)
+        {
+            // v1 stream has no CRC: a damaged bitmap must not read past the record
+            if((p[i >> 3] & (1 << (i & 7))) && ch < end)
+                d[ADV_HDR_LEN + i] = *ch++;
+        }
+    }
+    return d;
+}
+
+/*********************************************************************
+ * @fn      Parser::record
+ *
+ * @brief   One record: time records set the stamp of the next advert,
+ *          compact ones are decoded.
+ *
+ * @return  true - f is a frame to hand out
+ */
+bool Parser::record(const uint8_t *r, uint32_t len, Frame &f)
+{
+    uint64_t z = 0;
+    int i;
+
+    if((r[1] & ADV_REC_TIME_MASK) == ADV_REC_TIME)
+    {
+        // gwtime_rec_parse()
+        st_.stamps++;
+        if(r[1] == ADV_REC_TIME)
+        {
+            ts_flags_ = r[2];
+            for(i = 7; i >= 0; i--)
+                z = (z << 8) | r[3 + i];
+            ts_ = z;
+        }
+        else
+        {
+            for(i = 0; i < r[0] && i < 10; i++)
+                z |= (uint64_t)(r[2 + i] & 0x7F) << (i * 7);
+            ts_ += (z >> 1) ^ (0 - (z & 1));
+        }
+        ts_pending_ = true;
+        return false;
+    }
+    if((r[1] & ADV_REC_TAG_MASK) == ADV_REC_TAG)
+    {
+        st_.compact++;
+        r = decode(r);
+        if(!r)
+        {
+            st_.dict_miss++;
+            ts_pending_ = false;
+            return false;
+        }
+        len = ADV_HDR_LEN + r[0];
+    }
+    st_.frames++;
+    f.data = r;
+    f.len = len;
+    f.gw = gw_;
+    f.ts = ts_;
+    f.ts_flags = ts_flags_;
+    f.has_ts = false;
+    if(r[1] == ADV_SVC_MARKER)
+    {
+        st_.svc++;
+        if(r[2] == ADV_SVC_DICT && r[0] >= ADV_DICT_SVC_LEN)
+        {
+            // the stamp before it is for the next advert
+            dict_.assign(get_le16(r + ADV_HDR_LEN + 1), DictEnt());
+        }
+        return true;
+    }
+    st_.adverts++;
+    f.has_ts = ts_pending_;
+    ts_pending_ = false;
+    return true;
+}
+
+/*********************************************************************
+ * @fn      Parser::next
+ *
+ * @brief   Next frame of the input: records of the current block, then
+ *          v1 frames and blocks at the input position.
+ *
+ * @param   f - frame
+ *
+ * @return  false - no complete frame left, consumed() bytes are done
+ */
+bool Parser::next(Frame &f)
+{
+    const uint8_t *p;
+    size_t avail, total = 0;
+    uint32_t flen;
+    int r;
+
+    for(;;)
+    {
+        while(blk_pos_ + 2 <= blk_len_)
+        {
+            p = blk_ + blk_pos_;
+            flen = adv_rec_len(p[0], p[1]);
+            if(blk_pos_ + flen > blk_len_)
+                break;
+            blk_pos_ += flen;
+            if(record(p, flen, f))
+                return true;
+        }
+        blk_pos_ = blk_len_ = 0;
+        if(hunting_)
+        {
+            hunt();
+            if(hunting_)
+                return false;
+        }
+        avail = len_ - pos_;
+        if(avail < 2)
+            return false;
+        p = buf_ + pos_;
+        if(p[1] == stream_magic[1])
+        {
+            r = block(p, avail, total);
+            if(!r)
+                return false;
+            if(r < 0)
+            {
+                // resync from the next byte
+                st_.block_err++;
+                lost();
+                hunting_ = true;
+                pos_++;
+                st_.skipped++;
+                st_.bytes++;
+                continue;
+            }
+            pos_ += total;
+            st_.bytes += total;
+            continue;
+        }
+        flen = adv_rec_len(p[0], p[1]);
+        if(avail < flen)
+            return false;
+        pos_ += flen;
+        st_.bytes += flen;
+        if(record(p, flen, f))
+            return true;
+    }
+}
+
+} // namespace advcol
+
+/******************************** endfile @ advcol_parser ******************************/
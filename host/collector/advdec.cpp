@@ -0,0 +1,549 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advdec.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/22
+ * Description        : Collector library: advert data decoder, BTHome v2,
+ *                      atc1441/pvvx custom, MiBeacon, iBeacon, Eddystone
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include "advdec.h"
+
+namespace advcol
+{
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define AD_SERVICE_DATA16       0x16
+#define AD_MANUFACTURER         0xFF
+
+#define UUID_BTHOME             0xFCD2
+#define UUID_ENV_SENSING        0x181A      // atc1441/pvvx custom
+#define UUID_MIBEACON           0xFE95
+#define UUID_EDDYSTONE          0xFEAA
+#define CID_APPLE               0x004C
+
+#define BTHOME_ENCRYPT          0x01
+#define BTHOME_VERSION2         (2 << 5)
+#define BTHOME_VERSION_MASK     0xE0
+
+#define MI_FC_ENCRYPT           0x0008
+#define MI_FC_MAC               0x0010
+#define MI_FC_CAP               0x0020
+#define MI_FC_OBJ               0x0040
+#define MI_CAP_IO               0x20
+
+// BTHome object: size, 0 - unknown (the rest cannot be walked), BT_VAR - length byte follows
+#define BT_VAR                  0xFF
+#define BT_SIGNED               0x80        // BtObj.size flag
+#define BT_SKIP                 0xFF        // BtObj.qty: device info, no value
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+struct BtObj
+{
+    uint8_t size;               // bytes | BT_SIGNED
+    uint8_t qty;
+    double  scale;
+};
+
+/*
+ * BTHome v2 objects indexed by id, filled once from the list below
+ */
+struct BtTab
+{
+    BtObj obj[256];
+
+    BtTab()
+    {
+        static const struct { uint8_t id, size, qty; double scale; } list[] = {
+            { 0x00, 1, Q_PACKET_ID, 1 },                    { 0x01, 1, Q_BATTERY, 1 },
+            { 0x02, 2 | BT_SIGNED, Q_TEMPERATURE, 0.01 },   { 0x03, 2, Q_HUMIDITY, 0.01 },
+            { 0x04, 3, Q_PRESSURE, 0.01 },                  { 0x05, 3, Q_ILLUMINANCE, 0.01 },
+            { 0x06, 2, Q_MASS_KG, 0.01 },                   { 0x07, 2, Q_MASS_LB, 0.01 },
+            { 0x08, 2 | BT_SIGNED, Q_DEWPOINT, 0.01 },      { 0x09, 1, Q_COUNT, 1 },
+            { 0x0A, 3, Q_ENERGY, 0.001 },                   { 0x0B, 3, Q_POWER, 0.01 },
+            { 0x0C, 2, Q_VOLTAGE, 0.001 },                  { 0x0D, 2, Q_PM25, 1 },
+            { 0x0E, 2, Q_PM10, 1 },                         { 0x12, 2, Q_CO2, 1 },
+            { 0x13, 2, Q_TVOC, 1 },                         { 0x14, 2, Q_MOISTURE, 0.01 },
+            { 0x2E, 1, Q_HUMIDITY, 1 },                     { 0x2F, 1, Q_MOISTURE, 1 },
+            { 0x3A, 1, Q_BUTTON, 1 },                       { 0x3C, 2, Q_DIMMER, 1 },
+            { 0x3D, 2, Q_COUNT, 1 },                        { 0x3E, 4, Q_COUNT, 1 },
+            { 0x3F, 2 | BT_SIGNED, Q_ROTATION, 0.1 },       { 0x40, 2, Q_DISTANCE, 1 },
+            { 0x41, 2, Q_DISTANCE, 100 },                   { 0x42, 3, Q_DURATION, 0.001 },
+            { 0x43, 2, Q_CURRENT, 0.001 },                  { 0x44, 2, Q_SPEED, 0.01 },
+            { 0x45, 2 | BT_SIGNED, Q_TEMPERATURE, 0.1 },    { 0x46, 1, Q_UV_INDEX, 0.1 },
+            { 0x47, 2, Q_VOLUME, 0.1 },                     { 0x48, 2, Q_VOLUME, 0.001 },
+            { 0x49, 2, Q_VOLUME_FLOW, 0.001 },              { 0x4A, 2, Q_VOLTAGE, 0.1 },
+            { 0x4B, 3, Q_GAS, 0.001 },                      { 0x4C, 4, Q_GAS, 0.001 },
+            { 0x4D, 4, Q_ENERGY, 0.001 },                   { 0x4E, 4, Q_VOLUME, 0.001 },
+            { 0x4F, 4, Q_WATER, 0.001 },                    { 0x50, 4, Q_TIMESTAMP, 1 },
+            { 0x51, 2, Q_ACCELERATION, 0.001 },             { 0x52, 2, Q_GYROSCOPE, 0.001 },
+            { 0x53, BT_VAR, BT_SKIP, 0 },                   { 0x54, BT_VAR, BT_SKIP, 0 },
+            { 0x55, 4, Q_VOLUME, 0.001 },                   { 0x56, 2, Q_CONDUCTIVITY, 1 },
+            { 0x57, 1 | BT_SIGNED, Q_TEMPERATURE, 1 },      { 0x58, 1 | BT_SIGNED, Q_TEMPERATURE, 0.35 },
+            { 0x59, 1 | BT_SIGNED, Q_COUNT, 1 },            { 0x5A, 2 | BT_SIGNED, Q_COUNT, 1 },
+            { 0x5B, 4 | BT_SIGNED, Q_COUNT, 1 },            { 0x5C, 4 | BT_SIGNED, Q_POWER, 0.01 },
+            { 0x5D, 2 | BT_SIGNED, Q_CURRENT, 0.001 },      { 0x5E, 2, Q_DIRECTION, 0.01 },
+            { 0x5F, 2, Q_PRECIPITATION, 0.1 },              { 0x60, 1, Q_CHANNEL, 1 },
+            { 0x61, 2, Q_ROT_SPEED, 1 },
+            { 0xF0, 2, BT_SKIP, 0 },                        { 0xF1, 4, BT_SKIP, 0 },
+            { 0xF2, 3, BT_SKIP, 0 },
+        };
+
+        memset(obj, 0, sizeof(obj));
+        // binary sensors: generic, power, opening, battery low .. window
+        for(uint32_t i = 0x0F; i <= 0x2D; i++)
+        {
+            if(i < 0x12 || i > 0x14)
+                obj[i] = { 1, (uint8_t)i, 1 };
+        }
+        for(const auto &o : list)
+            obj[o.id] = { o.size, o.qty, o.scale };
+    }
+};
+
+static const BtTab bt_tab;
+
+static inline uint32_t le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t be16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+// little-endian integer of n (1..4) bytes, sign extended
+static inline double le_int(const uint8_t *p, uint32_t n, bool sign)
+{
+    uint32_t v = 0;
+
+    for(uint32_t i = n; i--;)
+        v = (v << 8) | p[i];
+    if(sign && n < 4 && (v & (1u << (n * 8 - 1))))
+        v |= ~0u << (n * 8);
+    return sign ? (double)(int32_t)v : (double)v;
+}
+
+/*
+ * Columns common to the values of one frame
+ */
+struct Decoder::Row
+{
+    uint64_t ts;
+    uint64_t mac;
+    uint32_t gw;
+    int8_t   rssi;
+    uint8_t  fmt;
+    size_t   n;
+
+    void add(Batch &b, uint8_t qty, double v)
+    {
+        b.ts.push_back(ts);
+        b.mac.push_back(mac);
+        b.gw.push_back(gw);
+        b.rssi.push_back(rssi);
+        b.fmt.push_back(fmt);
+        b.qty.push_back(qty);
+        b.value.push_back(v);
+        n++;
+    }
+};
+
+void Batch::clear()
+{
+    ts.clear();
+    mac.clear();
+    gw.clear();
+    rssi.clear();
+    fmt.clear();
+    qty.clear();
+    value.clear();
+}
+
+void Batch::reserve(size_t n)
+{
+    ts.reserve(n);
+    mac.reserve(n);
+    gw.reserve(n);
+    rssi.reserve(n);
+    fmt.reserve(n);
+    qty.reserve(n);
+    value.reserve(n);
+}
+
+Decoder::Decoder() : st_()
+{
+    memset(tab_, 0, sizeof(tab_));
+    put(AD_SERVICE_DATA16, UUID_BTHOME, &Decoder::bthome);
+    put(AD_SERVICE_DATA16, UUID_ENV_SENSING, &Decoder::custom);
+    put(AD_SERVICE_DATA16, UUID_MIBEACON, &Decoder::mibeacon);
+    put(AD_SERVICE_DATA16, UUID_EDDYSTONE, &Decoder::eddystone);
+    put(AD_MANUFACTURER, CID_APPLE, &Decoder::ibeacon);
+}
+
+void Decoder::put(uint8_t ad_type, uint16_t id, Handler fn)
+{
+    uint32_t key = (ad_type << 16) | id, i = slot(key);
+
+    while(tab_[i].fn)
+        i = (i + 1) & (TAB_SIZE - 1);
+    tab_[i].key = key;
+    tab_[i].fn = fn;
+}
+
+/*********************************************************************
+ * @fn      Decoder::bthome
+ *
+ * @brief   BTHome v2: [device info][object id][value]..., objects of
+ *          known size only, the first unknown id ends the walk.
+ */
+bool Decoder::bthome(Row &r, const uint8_t *p, uint32_t len, Batch &b)
+{
+    uint32_t i = 1, n;
+    const BtObj *o;
+
+    r.fmt = FMT_BTHOME;
+    if(len < 1 || (p[0] & BTHOME_VERSION_MASK) != BTHOME_VERSION2)
+        return false;
+    if(p[0] & BTHOME_ENCRYPT)
+    {
+        st_.encrypted++;
+        return true;
+    }
+    while(i < len)
+    {
+        o = &bt_tab.obj[p[i++]];
+        if(o->size == BT_VAR)
+        {
+            if(i >= len)
+                break;
+            i += 1 + p[i];
+            continue;
+        }
+        n = o->size & ~BT_SIGNED;
+        if(!n || i + n > len)
+        {
+            st_.malformed++;
+            break;
+        }
+        if(o->qty != BT_SKIP)
+            r.add(b, o->qty, le_int(p + i, n, o->size & BT_SIGNED) * o->scale);
+        i += n;
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      Decoder::custom
+ *
+ * @brief   Service data 0x181A of the atc1441 and pvvx thermometer
+ *          firmware, told apart by length. Encrypted variants are
+ *          shorter and not decoded.
+ */
+bool Decoder::custom(Row &r, const uint8_t *p, uint32_t len, Batch &b)
+{
+    if(len == 13)
+    {
+        // atc1441: mac[6] BE, temp int16 BE 0.1, hum %, battery %, mV BE, count
+        r.fmt = FMT_ATC;
+        r.add(b, Q_TEMPERATURE, (int16_t)be16(p + 6) * 0.1);
+        r.add(b, Q_HUMIDITY, p[8]);
+        r.add(b, Q_BATTERY, p[9]);
+        r.add(b, Q_VOLTAGE, be16(p + 10) * 0.001);
+        r.add(b, Q_PACKET_ID, p[12]);
+        return true;
+    }
+    if(len == 15)
+    {
+        // pvvx: mac[6] LE, temp int16 0.01, hum 0.01, mV, battery %, count, flags
+        r.fmt = FMT_PVVX;
+        r.add(b, Q_TEMPERATURE, (int16_t)le16(p + 6) * 0.01);
+        r.add(b, Q_HUMIDITY, le16(p + 8) * 0.01);
+        r.add(b, Q_VOLTAGE, le16(p + 10) * 0.001);
+        r.add(b, Q_BATTERY, p[12]);
+        r.add(b, Q_PACKET_ID, p[13]);
+        r.add(b, Q_FLAGS, p[14]);
+        return true;
+    }
+    return false;
+}
+
+/*********************************************************************
+ * @fn      Decoder::mibeacon
+ *
+ * @brief   MiBeacon: frame control, product id, frame counter, optional
+ *          MAC and capability, objects [id LE16][len][data].
+ */
+bool Decoder::mibeacon(Row &r, const uint8_t *p, uint32_t len, Batch &b)
+{
+    uint32_t fc, i = 5, id, n;
+    const uint8_t *d;
+
+    r.fmt = FMT_MIBEACON;
+    if(len < 5)
+        return false;
+    fc = le16(p);
+    if(fc & MI_FC_ENCRYPT)
+    {
+        st_.encrypted++;
+        return true;
+    }
+    if(fc & MI_FC_MAC)
+        i += 6;
+    if(fc & MI_FC_CAP)
+    {
+        if(i < len && (p[i] & MI_CAP_IO))
+            i += 2;
+        i++;
+    }
+    if(!(fc & MI_FC_OBJ))
+        return true;
+    while(i + 3 <= len)
+    {
+        id = le16(p + i);
+        n = p[i + 2];
+        d = p + i + 3;
+        i += 3 + n;
+        if(i > len)
+        {
+            st_.malformed++;
+            break;
+        }
+        switch(id)
+        {
+            case 0x1004: if(n >= 2) r.add(b, Q_TEMPERATURE, (int16_t)le16(d) * 0.1); break;
+            case 0x1006: if(n >= 2) r.add(b, Q_HUMIDITY, le16(d) * 0.1); break;
+            case 0x100A: if(n >= 1) r.add(b, Q_BATTERY, d[0]); break;
+            case 0x100D:
+                if(n >= 4)
+                {
+                    r.add(b, Q_TEMPERATURE, (int16_t)le16(d) * 0.1);
+                    r.add(b, Q_HUMIDITY, le16(d + 2) * 0.1);
+                }
+                break;
+            case 0x1007: if(n >= 3) r.add(b, Q_ILLUMINANCE, le_int(d, 3, false)); break;
+            case 0x1008: if(n >= 1) r.add(b, Q_MOISTURE, d[0]); break;
+            case 0x1009: if(n >= 2) r.add(b, Q_CONDUCTIVITY, le16(d)); break;
+            case 0x1010: if(n >= 2) r.add(b, Q_FORMALDEHYDE, le16(d) * 0.01); break;
+            case 0x1017: if(n >= 4) r.add(b, Q_DURATION, le_int(d, 4, false)); break;     // no motion time
+            case 0x1018: if(n >= 1) r.add(b, Q_LIGHT, d[0] != 0); break;
+            case 0x1019: if(n >= 1 && d[0] < 2) r.add(b, Q_DOOR, d[0] == 0); break;     // 0 - open
+            case 0x000F:                                                                // motion + lux
+                if(n >= 3)
+                {
+                    r.add(b, Q_MOTION, 1);
+                    r.add(b, Q_ILLUMINANCE, le_int(d, 3, false));
+                }
+                break;
+            default: break;
+        }
+    }
+    return true;
+}
+
+/*********************************************************************
+ * @fn      Decoder::eddystone
+ *
+ * @brief   Eddystone UID/URL: calibrated TX power, TLM (plain): battery,
+ *          temperature, advert and time counters.
+ */
+bool Decoder::eddystone(Row &r, const uint8_t *p, uint32_t len, Batch &b)
+{
+    r.fmt = FMT_EDDYSTONE;
+    if(len < 2)
+        return false;
+    switch(p[0])
+    {
+        case 0x00:                              // UID
+        case 0x10:                              // URL
+            r.add(b, Q_TX_POWER, (int8_t)p[1]);
+            return true;
+        case 0x20:                              // TLM
+            if(p[1])
+            {
+                st_.encrypted++;
+                return true;
+            }
+            if(len < 14)
+            {
+                st_.malformed++;
+                return true;
+            }
+            if(be16(p + 2))
+                r.add(b, Q_VOLTAGE, be16(p + 2) * 0.001);
+            if(be16(p + 4) != 0x8000)
+                r.add(b, Q_TEMPERATURE, (int16_t)be16(p + 4) / 256.0);
+            r.add(b, Q_ADV_COUNT, be32(p + 6));
+            r.add(b, Q_UPTIME, be32(p + 10) * 0.1);
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*********************************************************************
+ * @fn      Decoder::ibeacon
+ *
+ * @brief   Apple 0x02 0x15: UUID, major, minor, TX power at 1 m.
+ */
+bool Decoder::ibeacon(Row &r, const uint8_t *p, uint32_t len, Batch &b)
+{
+    r.fmt = FMT_IBEACON;
+    if(len < 23 || p[0] != 0x02 || p[1] != 0x15)
+        return false;
+    r.add(b, Q_MAJOR, be16(p + 18));
+    r.add(b, Q_MINOR, be16(p + 20));
+    r.add(b, Q_TX_POWER, (int8_t)p[22]);
+    return true;
+}
+
+/*********************************************************************
+ * @fn      Decoder::decode
+ *
+ * @brief   Walk the AD structures of an advert: service data (16-bit
+ *          UUID) and manufacturer data go to the table handler.
+ *
+ * @param   f - frame
+ * @param   b - batch to append to
+ *
+ * @return  rows added
+ */
+size_t Decoder::decode(const Frame &f, Batch &b)
+{
+    const uint8_t *p = f.payload();
+    uint32_t len = f.payload_len(), i = 0, l, key, k;
+    bool known = false;
+    Handler fn;
+    Row r;
+
+    if(f.is_svc())
+        return 0;
+    st_.frames++;
+    r.ts = f.has_ts ? f.ts : 0;
+    r.mac = f.mac48();
+    r.gw = f.gw;
+    r.rssi = f.rssi();
+    r.n = 0;
+    while(i + 1 < len)
+    {
+        l = p[i];
+        if(!l || i + 1 + l > len)
+            break;
+        if(l >= 3 && (p[i + 1] == AD_SERVICE_DATA16 || p[i + 1] == AD_MANUFACTURER))
+        {
+            key = (p[i + 1] << 16) | le16(p + i + 2);
+            for(k = slot(key); tab_[k].fn; k = (k + 1) & (TAB_SIZE - 1))
+            {
+                if(tab_[k].key == key)
+                {
+                    fn = tab_[k].fn;
+                    known |= (this->*fn)(r, p + i + 4, l - 3, b);
+                    break;
+                }
+            }
+        }
+        i += 1 + l;
+    }
+    if(known)
+        st_.decoded++;
+    st_.values += r.n;
+    return r.n;
+}
+
+size_t Decoder::decode(const Frame *f, size_t n, Batch &b)
+{
+    size_t rows = 0;
+
+    for(size_t i = 0; i < n; i++)
+        rows += decode(f[i], b);
+    return rows;
+}
+
+const char *quantity_name(uint8_t qty)
+{
+    static const char *const bin[] = {
+        "generic", "power_on", "opening", nullptr, nullptr, nullptr,
+        "battery_low", "battery_charging", "carbon_monoxide", "cold", "connectivity", "door",
+        "garage_door", "gas_detected", "heat", "light", "lock", "moisture_detected", "motion",
+        "moving", "occupancy", "plug", "presence", "problem", "running", "safety", "smoke",
+        "sound", "tamper", "vibration", "window"
+    };
+
+    switch(qty)
+    {
+        case Q_PACKET_ID: return "packet_id";
+        case Q_BATTERY: return "battery";
+        case Q_TEMPERATURE: return "temperature";
+        case Q_HUMIDITY: return "humidity";
+        case Q_PRESSURE: return "pressure";
+        case Q_ILLUMINANCE: return "illuminance";
+        case Q_MASS_KG: return "mass_kg";
+        case Q_MASS_LB: return "mass_lb";
+        case Q_DEWPOINT: return "dewpoint";
+        case Q_COUNT: return "count";
+        case Q_ENERGY: return "energy";
+        case Q_POWER: return "power";
+        case Q_VOLTAGE: return "voltage";
+        case Q_PM25: return "pm2.5";
+        case Q_PM10: return "pm10";
+        case Q_CO2: return "co2";
+        case Q_TVOC: return "tvoc";
+        case Q_MOISTURE: return "moisture";
+        case Q_BUTTON: return "button";
+        case Q_DIMMER: return "dimmer";
+        case Q_ROTATION: return "rotation";
+        case Q_DISTANCE: return "distance";
+        case Q_DURATION: return "duration";
+        case Q_CURRENT: return "current";
+        case Q_SPEED: return "speed";
+        case Q_UV_INDEX: return "uv_index";
+        case Q_VOLUME: return "volume";
+        case Q_VOLUME_FLOW: return "volume_flow";
+        case Q_GAS: return "gas";
+        case Q_WATER: return "water";
+        case Q_TIMESTAMP: return "timestamp";
+        case Q_ACCELERATION: return "acceleration";
+        case Q_GYROSCOPE: return "gyroscope";
+        case Q_CONDUCTIVITY: return "conductivity";
+        case Q_DIRECTION: return "direction";
+        case Q_PRECIPITATION: return "precipitation";
+        case Q_CHANNEL: return "channel";
+        case Q_ROT_SPEED: return "rotational_speed";
+        case Q_TX_POWER: return "tx_power";
+        case Q_MAJOR: return "major";
+        case Q_MINOR: return "minor";
+        case Q_ADV_COUNT: return "adv_count";
+        case Q_UPTIME: return "uptime";
+        case Q_FLAGS: return "flags";
+        case Q_FORMALDEHYDE: return "formaldehyde";
+        default: break;
+    }
+    if(qty >= Q_GENERIC && qty <= 0x2D)
+        return bin[qty - Q_GENERIC];
+    return nullptr;
+}
+
+const char *format_name(uint8_t fmt)
+{
+    static const char *const name[] = { nullptr, "bthome", "atc", "pvvx", "mibeacon", "ibeacon", "eddystone" };
+
+    return fmt < sizeof(name) / sizeof(name[0]) ? name[fmt] : nullptr;
+}
+
+} // namespace advcol
+
+/******************************** endfile @ advdec ******************************/
@@ -0,0 +1,183 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advdec.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/22
+ * Description        : Collector library: advert data decoder, AD
+ *                      structures of the common sensor and beacon formats
+ *                      to typed measurements in columnar batches
+ *********************************************************************************/
+
+#ifndef ADVDEC_H
+#define ADVDEC_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "advcol.h"
+
+namespace advcol
+{
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Batch::fmt - advert format of the measurement
+enum Format : uint8_t
+{
+    FMT_BTHOME = 1,             // BTHome v2, service data 0xFCD2
+    FMT_ATC,                    // atc1441 custom, service data 0x181A, 13 bytes
+    FMT_PVVX,                   // pvvx custom, service data 0x181A, 15 bytes
+    FMT_MIBEACON,               // Xiaomi MiBeacon, service data 0xFE95, not encrypted
+    FMT_IBEACON,                // Apple iBeacon, manufacturer data 0x004C
+    FMT_EDDYSTONE,              // Eddystone UID/URL/TLM, service data 0xFEAA
+};
+
+/*
+ * Batch::qty - measured quantity. The codes are the BTHome v2 object ids
+ * of the quantity, values are scaled to the units of that object
+ * (temperature C, humidity %, pressure hPa, voltage V, ...) whatever the
+ * source format and resolution. 0xC0.. - quantities BTHome has no id for.
+ */
+enum Quantity : uint8_t
+{
+    Q_PACKET_ID     = 0x00,
+    Q_BATTERY       = 0x01,     // %
+    Q_TEMPERATURE   = 0x02,     // C
+    Q_HUMIDITY      = 0x03,     // %
+    Q_PRESSURE      = 0x04,     // hPa
+    Q_ILLUMINANCE   = 0x05,     // lx
+    Q_MASS_KG       = 0x06,
+    Q_MASS_LB       = 0x07,
+    Q_DEWPOINT      = 0x08,     // C
+    Q_COUNT         = 0x09,
+    Q_ENERGY        = 0x0A,     // kWh
+    Q_POWER         = 0x0B,     // W
+    Q_VOLTAGE       = 0x0C,     // V
+    Q_PM25          = 0x0D,     // ug/m3
+    Q_PM10          = 0x0E,     // ug/m3
+    Q_GENERIC       = 0x0F,     // binary sensors 0x0F..0x11, 0x15..0x2D: 0/1
+    Q_POWER_ON      = 0x10,
+    Q_OPENING       = 0x11,
+    Q_CO2           = 0x12,     // ppm
+    Q_TVOC          = 0x13,     // ug/m3
+    Q_MOISTURE      = 0x14,     // %
+    Q_DOOR          = 0x1A,
+    Q_LIGHT         = 0x1E,
+    Q_MOTION        = 0x21,
+    Q_BUTTON        = 0x3A,     // event code
+    Q_DIMMER        = 0x3C,     // steps << 8 | event code
+    Q_ROTATION      = 0x3F,     // deg
+    Q_DISTANCE      = 0x40,     // mm
+    Q_DURATION      = 0x42,     // s
+    Q_CURRENT       = 0x43,     // A
+    Q_SPEED         = 0x44,     // m/s
+    Q_UV_INDEX      = 0x46,
+    Q_VOLUME        = 0x47,     // L
+    Q_VOLUME_FLOW   = 0x49,     // m3/h
+    Q_GAS           = 0x4B,     // m3
+    Q_WATER         = 0x4F,     // L
+    Q_TIMESTAMP     = 0x50,     // s, UNIX
+    Q_ACCELERATION  = 0x51,     // m/s2
+    Q_GYROSCOPE     = 0x52,     // deg/s
+    Q_CONDUCTIVITY  = 0x56,     // uS/cm
+    Q_DIRECTION     = 0x5E,     // deg
+    Q_PRECIPITATION = 0x5F,     // mm
+    Q_CHANNEL       = 0x60,
+    Q_ROT_SPEED     = 0x61,     // rpm
+    Q_TX_POWER      = 0xC0,     // dBm, calibrated at 0 m (iBeacon: 1 m)
+    Q_MAJOR         = 0xC1,     // iBeacon
+    Q_MINOR         = 0xC2,
+    Q_ADV_COUNT     = 0xC3,     // Eddystone TLM
+    Q_UPTIME        = 0xC4,     // s, Eddystone TLM
+    Q_FLAGS         = 0xC5,     // pvvx custom: GPIO, trigger, ...
+    Q_FORMALDEHYDE  = 0xC6,     // mg/m3, MiBeacon
+};
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * Measurements as a struct of arrays, one row per measured value: the
+ * columns map 1:1 onto numpy/Arrow arrays.
+ */
+struct Batch
+{
+    std::vector<uint64_t> ts;       // receive time, us, 0 - not stamped
+    std::vector<uint64_t> mac;      // Frame::mac48()
+    std::vector<uint32_t> gw;
+    std::vector<int8_t>   rssi;
+    std::vector<uint8_t>  fmt;      // Format
+    std::vector<uint8_t>  qty;      // Quantity
+    std::vector<double>   value;
+
+    size_t size() const { return value.size(); }
+    void clear();
+    void reserve(size_t n);
+};
+
+struct DecoderStats
+{
+    uint64_t frames;            // adverts looked at
+    uint64_t decoded;           // with a known format
+    uint64_t values;            // rows added
+    uint64_t encrypted;         // known format, encrypted: skipped
+    uint64_t malformed;         // known format, bad length or object
+};
+
+/*
+ * Decoder of advert frames (Frame, v1 layout): the AD structures are
+ * walked once, service data and manufacturer data go through a 16-bit
+ * UUID / company id table to the format handler, the values are
+ * appended to a Batch.
+ */
+class Decoder
+{
+public:
+    Decoder();
+
+    // Returns rows added for the frame, service frames are skipped
+    size_t decode(const Frame &f, Batch &b);
+    size_t decode(const Frame *f, size_t n, Batch &b);
+
+    const DecoderStats &stats() const { return st_; }
+
+private:
+    struct Row;
+    typedef bool (Decoder::*Handler)(Row &r, const uint8_t *p, uint32_t len, Batch &b);
+
+    // AD type << 16 | UUID or company id -> handler, open addressing
+    struct Slot
+    {
+        uint32_t key;
+        Handler  fn;
+    };
+    static const uint32_t TAB_SIZE = 16;
+
+    void put(uint8_t ad_type, uint16_t id, Handler fn);
+    static uint32_t slot(uint32_t key) { return (key * 2654435761u) >> 28; }
+
+    bool bthome(Row &r, const uint8_t *p, uint32_t len, Batch &b);
+    bool custom(Row &r, const uint8_t *p, uint32_t len, Batch &b);
+    bool mibeacon(Row &r, const uint8_t *p, uint32_t len, Batch &b);
+    bool eddystone(Row &r, const uint8_t *p, uint32_t len, Batch &b);
+    bool ibeacon(Row &r, const uint8_t *p, uint32_t len, Batch &b);
+
+    Slot tab_[TAB_SIZE];
+    DecoderStats st_;
+};
+
+/*
+ * Name of a Quantity ("temperature", ...), nullptr - unknown code
+ */
+const char *quantity_name(uint8_t qty);
+const char *format_name(uint8_t fmt);
+
+} // namespace advcol
+
+#endif /* ADVDEC_H */
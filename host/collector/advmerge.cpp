@@ -0,0 +1,273 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advmerge.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/25
+ * Description        : Collector library: multi-gateway merge with
+ *                      cross-gateway dedup and a bounded reorder window
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include "advmerge.h"
+
+namespace advcol
+{
+
+typedef std::pair<uint64_t, uint32_t> HeapEnt;
+
+/*
+ * FNV-1a of the MAC and the advert: report types, PHY, length and data,
+ * the RSSI byte is left out
+ */
+static uint64_t advert_key(const uint8_t *fr, uint32_t len)
+{
+    uint64_t h = 14695981039346656037ull;
+
+    for(uint32_t i = 0; i < len; i++)
+    {
+        if(i != 3)
+            h = (h ^ fr[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+static bool same_advert(const uint8_t *a, const uint8_t *b, uint32_t len)
+{
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2] && !memcmp(a + 4, b + 4, len - 4);
+}
+
+Merger::Merger(uint32_t gateways, const MergeOptions &opt) : opt_(opt), max_ts_(0), last_out_(0), st_()
+{
+    size_t n = 16;
+
+    if(gateways > MERGE_GW_MAX)
+        gateways = MERGE_GW_MAX;
+    if(!opt_.pending_max)
+        opt_.pending_max = 1;
+    for(uint32_t i = 0; i < gateways; i++)
+        in_.push_back(new Input(opt_.ring_size));
+    groups_.resize(opt_.pending_max);
+    free_.reserve(opt_.pending_max);
+    for(uint32_t i = opt_.pending_max; i-- > 0;)
+        free_.push_back(i);
+    while(n < 2 * (size_t)opt_.pending_max)
+        n <<= 1;
+    tab_.assign(n, 0);
+    heap_.reserve(opt_.pending_max);
+}
+
+Merger::~Merger()
+{
+    for(size_t i = 0; i < in_.size(); i++)
+        delete in_[i];
+}
+
+bool Merger::push(uint32_t gw, const Frame &f, uint64_t ts_us)
+{
+    InSlot *s;
+
+    if(gw >= in_.size() || f.is_svc())
+        return true;
+    s = in_[gw]->ring.wslot();
+    if(!s)
+    {
+        in_[gw]->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    s->ts = ts_us;
+    s->len = f.len;
+    memcpy(s->frame, f.data, f.len);
+    in_[gw]->ring.commit();
+    return true;
+}
+
+/*
+ * Linear probing, backward shift: the entries after the hole that
+ * would not be found from their home slot move into it
+ */
+void Merger::tab_erase(uint32_t slot)
+{
+    size_t mask = tab_.size() - 1, i = groups_[slot].key & mask, j, k;
+
+    while(tab_[i] != slot + 1)
+        i = (i + 1) & mask;
+    for(j = i;;)
+    {
+        j = (j + 1) & mask;
+        if(!tab_[j])
+            break;
+        k = groups_[tab_[j] - 1].key & mask;
+        if((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j))
+        {
+            tab_[i] = tab_[j];
+            i = j;
+        }
+    }
+    tab_[i] = 0;
+}
+
+void Merger::pop_emit(const MergedCb &cb)
+{
+    uint32_t slot = heap_.front().second;
+    Group &g = groups_[slot];
+
+    std::pop_heap(heap_.begin(), heap_.end(), std::greater<HeapEnt>());
+    heap_.pop_back();
+    tab_erase(slot);
+    if(g.m.ts > last_out_)
+        last_out_ = g.m.ts;
+    st_.out++;
+    cb(g.m);
+    free_.push_back(slot);
+}
+
+/*********************************************************************
+ * @fn      Merger::add
+ *
+ * @brief   A copy of a held advert (same MAC and data, a gateway not
+ *          in it yet, time within dedup_us) adds its RSSI and time,
+ *          anything else opens a new group. A frame older than the last
+ *          advert out goes out at once, marked late.
+ *
+ * @return  adverts out
+ */
+size_t Merger::add(uint32_t gw, const InSlot &s, const MergedCb &cb)
+{
+    uint64_t key = advert_key(s.frame, s.len);
+    size_t mask = tab_.size() - 1, i;
+    uint32_t bit = 1u << gw, slot;
+    size_t n = 0;
+
+    st_.in++;
+    if(s.ts > max_ts_)
+        max_ts_ = s.ts;
+    for(i = key & mask; tab_[i]; i = (i + 1) & mask)
+    {
+        Group &g = groups_[tab_[i] - 1];
+        int64_t dt = (int64_t)(s.ts - g.m.ts);
+
+        if(g.key == key && !(g.m.gw_mask & bit) && g.m.len == s.len && dt <= opt_.dedup_us
+           && dt >= -(int64_t)opt_.dedup_us && same_advert(g.frame, s.frame, s.len))
+        {
+            g.m.gw_mask |= bit;
+            g.m.n++;
+            g.m.rssi[gw] = (int8_t)s.frame[3];
+            g.m.dt[gw] = (int32_t)dt;
+            st_.dups++;
+            return 0;
+        }
+    }
+    if(free_.empty())
+    {
+        st_.forced++;
+        pop_emit(cb);
+        n++;
+        // the probe may have passed the freed group's place
+        for(i = key & mask; tab_[i]; i = (i + 1) & mask)
+            ;
+    }
+    if(s.ts < last_out_)
+    {
+        Group late;
+
+        late.m.ts = s.ts;
+        late.m.mac = Frame{ s.frame }.mac48();
+        late.m.data = s.frame;
+        late.m.len = s.len;
+        late.m.gw_mask = bit;
+        late.m.n = 1;
+        late.m.late = true;
+        memset(late.m.rssi, MERGE_NO_RSSI, sizeof(late.m.rssi));
+        memset(late.m.dt, 0, sizeof(late.m.dt));
+        late.m.rssi[gw] = (int8_t)s.frame[3];
+        st_.late++;
+        st_.out++;
+        cb(late.m);
+        return n + 1;
+    }
+    slot = free_.back();
+    free_.pop_back();
+    Group &g = groups_[slot];
+
+    g.key = key;
+    memcpy(g.frame, s.frame, s.len);
+    g.m.ts = s.ts;
+    g.m.mac = Frame{ g.frame }.mac48();
+    g.m.data = g.frame;
+    g.m.len = s.len;
+    g.m.gw_mask = bit;
+    g.m.n = 1;
+    g.m.late = false;
+    memset(g.m.rssi, MERGE_NO_RSSI, sizeof(g.m.rssi));
+    memset(g.m.dt, 0, sizeof(g.m.dt));
+    g.m.rssi[gw] = (int8_t)s.frame[3];
+    tab_[i] = slot + 1;
+    heap_.push_back(HeapEnt(s.ts, slot));
+    std::push_heap(heap_.begin(), heap_.end(), std::greater<HeapEnt>());
+    return n;
+}
+
+/*********************************************************************
+ * @fn      Merger::pump
+ *
+ * @brief   Drain the gateway rings (at most a ring each, a busy gateway
+ *          does not hold the others), then hand out the adverts older
+ *          than the newest time less the reorder window.
+ *
+ * @return  adverts out
+ */
+size_t Merger::pump(uint64_t now_us, const MergedCb &cb)
+{
+    uint64_t t = now_us > max_ts_ ? now_us : max_ts_;
+    size_t n = 0;
+    InSlot *s;
+
+    for(uint32_t gw = 0; gw < in_.size(); gw++)
+    {
+        SpscRing<InSlot> &ring = in_[gw]->ring;
+
+        for(size_t k = ring.size(); k && (s = ring.rslot()) != nullptr; k--)
+        {
+            n += add(gw, *s, cb);
+            ring.release();
+        }
+    }
+    if(t < opt_.window_us)
+        return n;
+    t -= opt_.window_us;
+    while(!heap_.empty() && heap_.front().first <= t)
+    {
+        pop_emit(cb);
+        n++;
+    }
+    return n;
+}
+
+size_t Merger::flush(const MergedCb &cb)
+{
+    size_t n = pump(0, cb);
+
+    while(!heap_.empty())
+    {
+        pop_emit(cb);
+        n++;
+    }
+    return n;
+}
+
+MergeStats Merger::stats() const
+{
+    MergeStats st = st_;
+
+    st.dropped = 0;
+    for(uint32_t gw = 0; gw < in_.size(); gw++)
+        st.dropped += dropped(gw);
+    return st;
+}
+
+} // namespace advcol
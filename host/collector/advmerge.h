@@ -0,0 +1,208 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advmerge.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/25
+ * Description        : Collector library: merge of several gateway
+ *                      streams into one time ordered stream, the copies
+ *                      of an advert heard by several gateways collapsed
+ *                      into one with per-gateway RSSI and time vectors
+ *********************************************************************************/
+
+#ifndef ADVMERGE_H
+#define ADVMERGE_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include "advcol.h"
+
+namespace advcol
+{
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+const uint32_t MERGE_GW_MAX = 32;               // gateways of one Merger, gw_mask bits
+const int8_t   MERGE_NO_RSSI = -128;            // Merged::rssi of a gateway that did not hear it
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * Single producer, single consumer ring of fixed slots, lock-free: the
+ * producer fills wslot() and publishes it with commit(), the consumer
+ * reads rslot() and frees it with release(). Each side keeps a copy of
+ * the other's index and reloads it only when the ring looks full/empty.
+ */
+template<class T> class SpscRing
+{
+public:
+    explicit SpscRing(size_t size) : head_(0), tail_cache_(0), tail_(0), head_cache_(0)
+    {
+        size_t n = 2;
+
+        while(n < size)
+            n <<= 1;
+        buf_.resize(n);
+        mask_ = n - 1;
+    }
+
+    // producer
+    T *wslot()
+    {
+        size_t t = tail_.load(std::memory_order_relaxed);
+
+        if(t - head_cache_ > mask_)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if(t - head_cache_ > mask_)
+                return nullptr;
+        }
+        return &buf_[t & mask_];
+    }
+    void commit() { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    // consumer
+    T *rslot()
+    {
+        size_t h = head_.load(std::memory_order_relaxed);
+
+        if(h == tail_cache_)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if(h == tail_cache_)
+                return nullptr;
+        }
+        return &buf_[h & mask_];
+    }
+    void release() { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+    size_t size() const { return mask_ + 1; }
+
+private:
+    // the two sides' indexes 64 bytes apart: no false sharing
+    std::vector<T> buf_;
+    size_t mask_;
+    size_t pad0_[8];
+    std::atomic<size_t> head_;  // consumer
+    size_t tail_cache_;
+    size_t pad1_[8];
+    std::atomic<size_t> tail_;  // producer
+    size_t head_cache_;
+    size_t pad2_[8];
+};
+
+struct MergeOptions
+{
+    uint32_t window_us = 200000;    // reorder window: output lags the newest time by this
+    uint32_t dedup_us = 20000;      // copies of one advert: same MAC and data, times within
+    uint32_t ring_size = 4096;      // per gateway, frames
+    uint32_t pending_max = 16384;   // adverts held in the window, the oldest goes out when full
+};
+
+/*
+ * One advert as heard by the gateways in gw_mask. ts - the time of the
+ * copy that reached the merge first, dt - the times of the others
+ * relative to it. data - v1 frame of that copy, valid in the callback.
+ */
+struct Merged
+{
+    uint64_t ts;                // us
+    uint64_t mac;               // Frame::mac48()
+    const uint8_t *data;
+    uint32_t len;
+    uint32_t gw_mask;
+    uint32_t n;                 // gateways
+    bool     late;              // came after the window had passed its time: out of order
+    int8_t   rssi[MERGE_GW_MAX];
+    int32_t  dt[MERGE_GW_MAX];  // us
+};
+
+struct MergeStats
+{
+    uint64_t in;                // frames pushed
+    uint64_t dropped;           // ring full
+    uint64_t out;               // merged adverts
+    uint64_t dups;              // copies collapsed
+    uint64_t late;
+    uint64_t forced;            // sent before the window passed: pending_max reached
+};
+
+/*
+ * Merge stage. push() is called by the reader thread of each gateway
+ * (one thread per gw, lock-free, never blocks: a full ring drops), pump()
+ * by the merge thread: it drains the rings, collapses the copies and
+ * hands out the adverts older than the reorder window in time order.
+ */
+class Merger
+{
+public:
+    using MergedCb = std::function<void(const Merged &)>;
+
+    explicit Merger(uint32_t gateways, const MergeOptions &opt = MergeOptions());
+    ~Merger();
+    Merger(const Merger &) = delete;
+    Merger &operator=(const Merger &) = delete;
+
+    // Reader thread of gateway gw: advert frame received at ts_us, service frames are skipped
+    bool push(uint32_t gw, const Frame &f, uint64_t ts_us);
+    uint64_t dropped(uint32_t gw) const { return in_[gw]->dropped.load(std::memory_order_relaxed); }
+
+    // Merge thread. now_us - current time on the scale of the stamps (0 -
+    // none: the window moves with the newest frame only). Returns adverts out
+    size_t pump(uint64_t now_us, const MergedCb &cb);
+    // Everything held, in time order
+    size_t flush(const MergedCb &cb);
+
+    // Merge thread counters (dropped - the sum over the rings)
+    MergeStats stats() const;
+
+private:
+    struct InSlot
+    {
+        uint64_t ts;
+        uint32_t len;
+        uint8_t  frame[ADV_HDR_LEN + 255];
+    };
+
+    struct Input
+    {
+        SpscRing<InSlot> ring;
+        std::atomic<uint64_t> dropped;
+
+        explicit Input(size_t size) : ring(size), dropped(0) {}
+    };
+
+    struct Group
+    {
+        uint64_t key;           // hash of MAC and data
+        Merged   m;
+        uint8_t  frame[ADV_HDR_LEN + 255];
+    };
+
+    size_t add(uint32_t gw, const InSlot &s, const MergedCb &cb);
+    void pop_emit(const MergedCb &cb);
+    void tab_erase(uint32_t slot);
+
+    MergeOptions opt_;
+    std::vector<Input *> in_;
+    std::vector<Group> groups_;
+    std::vector<uint32_t> free_;
+    std::vector<uint32_t> tab_;                 // open addressing: group + 1
+    std::vector<std::pair<uint64_t, uint32_t>> heap_;   // (ts, group), min-heap
+    uint64_t max_ts_;
+    uint64_t last_out_;                         // time of the last advert out in order
+    MergeStats st_;
+};
+
+} // namespace advcol
+
+#endif /* ADVMERGE_H */
@@ -0,0 +1,407 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advpcap.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/23
+ * Description        : Collector library: pcapng writer, advert frames
+ *                      rebuilt as BLE link layer packets with the RF
+ *                      pseudo header
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include "advpcap.h"
+
+namespace advcol
+{
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// pcapng blocks and options
+#define PCAPNG_SHB              0x0A0D0D0A
+#define PCAPNG_IDB              0x00000001
+#define PCAPNG_EPB              0x00000006
+#define PCAPNG_BYTE_ORDER       0x1A2B3C4D
+#define PCAPNG_OPT_END          0
+#define PCAPNG_SHB_USERAPPL     4
+#define PCAPNG_IF_NAME          2
+#define PCAPNG_SNAPLEN          512
+
+// LINKTYPE_BLUETOOTH_LE_LL_WITH_PHDR pseudo header flags
+#define PHDR_DEWHITENED         0x0001
+#define PHDR_SIGPOWER_VALID     0x0002
+#define PHDR_REF_AA_VALID       0x0010
+#define PHDR_CRC_CHECKED        0x0400
+#define PHDR_CRC_VALID          0x0800
+#define PHDR_PDU_ADV            (0 << 7)    // advertising or data, unspecified direction
+#define PHDR_PDU_AUX_ADV        (1 << 7)    // auxiliary advertising
+#define PHDR_PHY_1M             (0 << 14)
+#define PHDR_PHY_2M             (1 << 14)
+#define PHDR_PHY_CODED          (2 << 14)
+#define PHDR_LEN                10
+
+#define LL_ADV_AA               0x8E89BED6  // advertising channel access address
+#define LL_CRC_INIT             0x555555
+#define LL_CRC_POLY             0x00065B    // x^24 + x^10 + x^9 + x^6 + x^4 + x^3 + x + 1
+
+// PDU types of the advertising physical channel
+#define LL_ADV_IND              0x0
+#define LL_ADV_DIRECT_IND       0x1
+#define LL_ADV_NONCONN_IND      0x2
+#define LL_SCAN_RSP             0x4
+#define LL_ADV_SCAN_IND         0x6
+#define LL_ADV_EXT              0x7         // ADV_EXT_IND, AUX_ADV_IND, AUX_CHAIN_IND, ...
+#define LL_TXADD                0x40
+
+// Common extended advertising payload
+#define LL_EXT_ADVA             0x01        // extended header flags: AdvA present
+#define LL_EXT_MODE_CONN        (1 << 6)
+#define LL_EXT_MODE_SCAN        (2 << 6)
+#define LL_PDU_MAX              255
+#define LL_LEGACY_DATA_MAX      31
+
+// Longest packet: pseudo header, AA, CI, PDU header, PDU, CRC
+#define PKT_MAX                 (PHDR_LEN + 4 + 1 + 2 + LL_PDU_MAX + 3)
+
+// advenc.h frame: GAP report types and PHY bits
+#define GAP_REPORT_LEGACY_MAX   0x04        // GAP_ADRPT_SCAN_RSP
+#define GAP_PHY_2M              0x02
+#define GAP_PHY_CODED           0x04
+#define GAP_PHY_CODED_S2        0x08
+
+static inline void set_le16(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void set_le32(uint8_t *p, uint32_t v)
+{
+    set_le16(p, v);
+    set_le16(p + 2, v >> 16);
+}
+
+static inline uint8_t bit_rev8(uint8_t b)
+{
+    b = (b >> 4) | (b << 4);
+    b = ((b & 0xCC) >> 2) | ((b & 0x33) << 2);
+    return ((b & 0xAA) >> 1) | ((b & 0x55) << 1);
+}
+
+/*********************************************************************
+ * @fn      ll_crc24
+ *
+ * @brief   Core spec Vol 6 Part B 3.1.1: the PDU bits LSB first into
+ *          the LFSR preset with CRCInit (position 0 - LSB), the CRC is
+ *          sent from position 23. Air order is LSB first in a byte,
+ *          so the bytes are bit reversed.
+ */
+void ll_crc24(const uint8_t *pdu, size_t len, uint8_t crc[3])
+{
+    uint32_t r = LL_CRC_INIT, b;
+
+    while(len--)
+    {
+        b = *pdu++;
+        for(int i = 0; i < 8; i++, b >>= 1)
+        {
+            if((b ^ (r >> 23)) & 1)
+                r = ((r << 1) ^ LL_CRC_POLY) & 0xFFFFFF;
+            else
+                r = (r << 1) & 0xFFFFFF;
+        }
+    }
+    crc[0] = bit_rev8(r >> 16);
+    crc[1] = bit_rev8(r >> 8);
+    crc[2] = bit_rev8(r);
+}
+
+PcapWriter::PcapWriter() : f_(nullptr), own_(false), err_(false), st_()
+{
+}
+
+PcapWriter::~PcapWriter()
+{
+    close();
+}
+
+bool PcapWriter::open(const char *name)
+{
+    FILE *f = strcmp(name, "-") ? fopen(name, "wb") : stdout;
+
+    if(!f)
+        return false;
+    open(f);
+    own_ = f != stdout;
+    return true;
+}
+
+bool PcapWriter::open(FILE *f)
+{
+    close();
+    f_ = f;
+    own_ = false;
+    err_ = false;
+    st_ = PcapStats();
+    ifs_.clear();
+    buf_.clear();
+    buf_.reserve(PCAP_BUF_SIZE);
+    shb();
+    return true;
+}
+
+bool PcapWriter::close()
+{
+    bool ok;
+
+    if(!f_)
+        return true;
+    ok = flush();
+    if(own_ && fclose(f_))
+        ok = false;
+    f_ = nullptr;
+    return ok;
+}
+
+bool PcapWriter::flush()
+{
+    if(!f_)
+        return false;
+    if(!buf_.empty() && fwrite(buf_.data(), 1, buf_.size(), f_) != buf_.size())
+        err_ = true;
+    buf_.clear();
+    if(fflush(f_))
+        err_ = true;
+    return !err_;
+}
+
+uint8_t *PcapWriter::reserve(size_t len)
+{
+    size_t pos;
+
+    if(buf_.size() + len > PCAP_BUF_SIZE)
+    {
+        if(fwrite(buf_.data(), 1, buf_.size(), f_) != buf_.size())
+            err_ = true;
+        buf_.clear();
+    }
+    pos = buf_.size();
+    buf_.resize(pos + len);
+    st_.bytes += len;
+    return &buf_[pos];
+}
+
+void PcapWriter::put(const void *p, size_t len)
+{
+    memcpy(reserve(len), p, len);
+}
+
+/*
+ * Option with the value padded to 32 bits, at p
+ */
+static size_t put_opt(uint8_t *p, uint16_t code, const void *val, size_t len)
+{
+    size_t pad = (len + 3) & ~3;
+
+    set_le16(p, code);
+    set_le16(p + 2, (uint32_t)len);
+    memcpy(p + 4, val, len);
+    memset(p + 4 + len, 0, pad - len);
+    return 4 + pad;
+}
+
+void PcapWriter::shb()
+{
+    static const char appl[] = "WCHBLE2ETH advcol";
+    uint8_t b[64], *p = b;
+    uint32_t len;
+
+    set_le32(p + 8, PCAPNG_BYTE_ORDER);
+    set_le16(p + 12, 1);                    // version 1.0
+    set_le16(p + 14, 0);
+    set_le32(p + 16, 0xFFFFFFFF);           // section length not known
+    set_le32(p + 20, 0xFFFFFFFF);
+    p += 24;
+    p += put_opt(p, PCAPNG_SHB_USERAPPL, appl, sizeof(appl) - 1);
+    p += put_opt(p, PCAPNG_OPT_END, nullptr, 0);
+    len = (uint32_t)(p - b) + 4;
+    set_le32(b, PCAPNG_SHB);
+    set_le32(b + 4, len);
+    set_le32(p, len);
+    put(b, len);
+}
+
+void PcapWriter::idb(const std::string &name)
+{
+    uint8_t b[16 + 4 + 256 + 4 + 4], *p = b;
+    size_t nl = name.size() < 255 ? name.size() : 255;
+    uint32_t len;
+
+    set_le16(p + 8, LINKTYPE_BLUETOOTH_LE_LL_WITH_PHDR);
+    set_le16(p + 10, 0);
+    set_le32(p + 12, PCAPNG_SNAPLEN);
+    p += 16;
+    if(nl)
+        p += put_opt(p, PCAPNG_IF_NAME, name.data(), nl);
+    p += put_opt(p, PCAPNG_OPT_END, nullptr, 0);
+    len = (uint32_t)(p - b) + 4;
+    set_le32(b, PCAPNG_IDB);
+    set_le32(b + 4, len);
+    set_le32(p, len);
+    put(b, len);
+    ifs_.push_back(name);
+}
+
+/*********************************************************************
+ * @fn      PcapWriter::add_interface
+ *
+ * @brief   Interfaces are numbered in the order of their IDB: the
+ *          missing ones below gw get a default name, a gateway that
+ *          already has its IDB keeps it.
+ */
+void PcapWriter::add_interface(uint32_t gw, const std::string &name)
+{
+    char def[16];
+
+    if(!f_)
+        return;
+    while(ifs_.size() < gw)
+    {
+        snprintf(def, sizeof(def), "gw%u", (unsigned)ifs_.size());
+        idb(def);
+    }
+    if(ifs_.size() == gw)
+        idb(name);
+}
+
+void PcapWriter::epb(uint32_t gw, uint64_t ts_us, const uint8_t *pkt, uint32_t len)
+{
+    uint32_t pad = (len + 3) & ~3, blen = 28 + pad + 4;
+    uint8_t *p = reserve(blen);
+
+    set_le32(p, PCAPNG_EPB);
+    set_le32(p + 4, blen);
+    set_le32(p + 8, gw);
+    set_le32(p + 12, (uint32_t)(ts_us >> 32));
+    set_le32(p + 16, (uint32_t)ts_us);
+    set_le32(p + 20, len);
+    set_le32(p + 24, len);
+    memcpy(p + 28, pkt, len);
+    memset(p + 28 + len, 0, pad - len);
+    set_le32(p + 28 + pad, blen);
+    st_.packets++;
+}
+
+/*********************************************************************
+ * @fn      PcapWriter::write
+ *
+ * @brief   Rebuild the advertising PDU of a report: [pseudo header]
+ *          [access address][CI, coded PHY][PDU header][PDU][CRC].
+ *          Extended advertising data that does not fit one AUX_ADV_IND
+ *          goes on in an AUX_CHAIN_IND.
+ *
+ * @param   f - frame, v1 layout
+ * @param   ts_us - receive time, UNIX us
+ */
+void PcapWriter::write(const Frame &f, uint64_t ts_us)
+{
+    uint8_t pkt[PKT_MAX], *pdu;
+    const uint8_t *data = f.payload();
+    uint32_t dlen = f.payload_len(), n, hdr, flags;
+    uint8_t evt = f.adv_types() & 0x0F, txadd = (f.adv_types() >> 4) & 3 ? LL_TXADD : 0;
+    uint8_t phy = f.phy_types() >> 4, mode;
+    bool legacy = evt <= GAP_REPORT_LEGACY_MAX && dlen <= LL_LEGACY_DATA_MAX;
+
+    if(!f_)
+        return;
+    if(f.is_svc())
+    {
+        st_.skipped++;
+        return;
+    }
+    if(f.gw >= ifs_.size())
+        add_interface(f.gw, std::string());
+    st_.adverts++;
+    flags = PHDR_DEWHITENED | PHDR_SIGPOWER_VALID | PHDR_REF_AA_VALID | PHDR_CRC_CHECKED | PHDR_CRC_VALID;
+    pkt[0] = legacy ? 0 : 1;                // RF channel: not known
+    pkt[1] = (uint8_t)f.rssi();
+    pkt[2] = 0;                             // noise power
+    pkt[3] = 0;                             // access address offenses
+    set_le32(pkt + 4, LL_ADV_AA);
+    set_le32(pkt + PHDR_LEN, LL_ADV_AA);
+    hdr = PHDR_LEN + 4;
+    if(legacy)
+        flags |= PHDR_PDU_ADV | PHDR_PHY_1M;
+    else if(phy & (GAP_PHY_CODED | GAP_PHY_CODED_S2))
+    {
+        flags |= PHDR_PDU_AUX_ADV | PHDR_PHY_CODED;
+        pkt[hdr++] = phy & GAP_PHY_CODED_S2 ? 1 : 0;    // coding indicator: S=2 / S=8
+    }
+    else
+        flags |= PHDR_PDU_AUX_ADV | (phy & GAP_PHY_2M ? PHDR_PHY_2M : PHDR_PHY_1M);
+    set_le16(pkt + 8, flags);
+    pdu = pkt + hdr;
+    if(legacy)
+    {
+        static const uint8_t pdu_type[] = { LL_ADV_IND, LL_ADV_DIRECT_IND, LL_ADV_SCAN_IND,
+                                            LL_ADV_NONCONN_IND, LL_SCAN_RSP };
+
+        pdu[0] = pdu_type[evt] | txadd;
+        memcpy(pdu + 2, f.mac(), 6);
+        if(pdu_type[evt] == LL_ADV_DIRECT_IND)
+        {
+            memset(pdu + 8, 0, 6);          // TargetA: not reported
+            n = 12;
+        }
+        else
+        {
+            memcpy(pdu + 8, data, dlen);
+            n = 6 + dlen;
+        }
+        pdu[1] = (uint8_t)n;
+        ll_crc24(pdu, 2 + n, pdu + 2 + n);
+        epb(f.gw, ts_us, pkt, hdr + 2 + n + 3);
+        return;
+    }
+    switch(evt)
+    {
+        case 0x05:                          // GAP_ADRPT_EXT_CONN_DIRECT
+        case 0x08:                          // GAP_ADRPT_EXT_CONN_UNDIRECT
+            mode = LL_EXT_MODE_CONN;
+            break;
+        case 0x06:                          // GAP_ADRPT_EXT_SCAN_UNDIRECT
+        case 0x09:                          // GAP_ADRPT_EXT_SCAN_DIRECT
+            mode = LL_EXT_MODE_SCAN;
+            break;
+        default:
+            mode = 0;
+            break;
+    }
+    // AUX_ADV_IND: [ext header len | AdvMode][flags][AdvA][AdvData]
+    n = dlen < LL_PDU_MAX - 8 ? dlen : LL_PDU_MAX - 8;
+    pdu[0] = LL_ADV_EXT | txadd;
+    pdu[1] = (uint8_t)(8 + n);
+    pdu[2] = 7 | mode;
+    pdu[3] = LL_EXT_ADVA;
+    memcpy(pdu + 4, f.mac(), 6);
+    memcpy(pdu + 10, data, n);
+    ll_crc24(pdu, 2 + 8 + n, pdu + 2 + 8 + n);
+    epb(f.gw, ts_us, pkt, hdr + 2 + 8 + n + 3);
+    if(n == dlen)
+        return;
+    // AUX_CHAIN_IND: empty extended header, the rest of AdvData
+    data += n;
+    n = dlen - n;
+    pdu[0] = LL_ADV_EXT;
+    pdu[1] = (uint8_t)(1 + n);
+    pdu[2] = 0;
+    memcpy(pdu + 3, data, n);
+    ll_crc24(pdu, 2 + 1 + n, pdu + 2 + 1 + n);
+    epb(f.gw, ts_us, pkt, hdr + 2 + 1 + n + 3);
+}
+
+} // namespace advcol
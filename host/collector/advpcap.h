@@ -0,0 +1,107 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advpcap.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/23
+ * Description        : Collector library: pcapng writer, advert frames as
+ *                      BLE link layer packets with the RF pseudo header
+ *                      (LINKTYPE_BLUETOOTH_LE_LL_WITH_PHDR), one
+ *                      interface per gateway
+ *********************************************************************************/
+
+#ifndef ADVPCAP_H
+#define ADVPCAP_H
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "advcol.h"
+
+namespace advcol
+{
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+const uint16_t LINKTYPE_BLUETOOTH_LE_LL_WITH_PHDR = 256;
+
+// Output buffer: written out when full and by flush(), memory stays bounded
+const size_t PCAP_BUF_SIZE = 64 * 1024;
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+struct PcapStats
+{
+    uint64_t packets;           // EPB written, an advert can take two (AUX_CHAIN_IND)
+    uint64_t adverts;
+    uint64_t skipped;           // service frames
+    uint64_t bytes;             // file size
+};
+
+/*
+ * pcapng writer. An advert frame (v1 layout) is rebuilt as the PDU the
+ * gateway received: legacy reports as ADV_IND / ADV_DIRECT_IND /
+ * ADV_SCAN_IND / ADV_NONCONN_IND / SCAN_RSP, extended reports as
+ * AUX_ADV_IND (AdvMode from the report type, AdvA in the extended header)
+ * on the secondary PHY. The pseudo header carries RSSI and the PHY, the
+ * CRC is recomputed (the controller reports only packets with a good
+ * CRC). The RF channel is not reported by the gateway: 0 (2402 MHz)
+ * for the legacy PDUs, 1 for AUX_ADV_IND.
+ */
+class PcapWriter
+{
+public:
+    PcapWriter();
+    ~PcapWriter();
+    PcapWriter(const PcapWriter &) = delete;
+    PcapWriter &operator=(const PcapWriter &) = delete;
+
+    // "-" - stdout (wireshark -k -i -), returns false on an open error
+    bool open(const char *name);
+    bool open(FILE *f);
+    // Flush and close, returns false if a write failed
+    bool close();
+
+    // Interface description of gateway gw (before its first frame or
+    // it gets "gw<N>"), interfaces up to gw are added as needed
+    void add_interface(uint32_t gw, const std::string &name);
+
+    // Advert frame of gateway f.gw received at ts_us (UNIX us: Frame::ts
+    // if stamped), service frames are skipped
+    void write(const Frame &f, uint64_t ts_us);
+
+    bool flush();
+    bool error() const { return err_; }
+    const PcapStats &stats() const { return st_; }
+
+private:
+    void shb();
+    void idb(const std::string &name);
+    void epb(uint32_t gw, uint64_t ts_us, const uint8_t *pkt, uint32_t len);
+    void put(const void *p, size_t len);
+    uint8_t *reserve(size_t len);
+
+    FILE *f_;
+    bool own_;
+    bool err_;
+    std::vector<uint8_t> buf_;
+    std::vector<std::string> ifs_;
+    PcapStats st_;
+};
+
+/*
+ * BLE link layer CRC24 of an advertising channel PDU (CRCInit 0x555555),
+ * in transmission order: 3 bytes, the first one on air first
+ */
+void ll_crc24(const uint8_t *pdu, size_t len, uint8_t crc[3]);
+
+} // namespace advcol
+
+#endif /* ADVPCAP_H */
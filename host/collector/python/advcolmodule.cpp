@@ -0,0 +1,515 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advcolmodule.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/21
+ * Description        : Python module advcol: thin wrapper of the collector
+ *                      library, frames as (gw, ts, flags, bytes) tuples
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <vector>
+#include "advcol.h"
+#include "advdec.h"
+
+/*
+ * Frames of one poll()/feed() call, gathered without the GIL
+ */
+struct FrameList
+{
+    struct Ent
+    {
+        uint32_t gw;
+        uint64_t ts;
+        uint8_t flags;
+        bool has_ts;
+        size_t off;
+        uint32_t len;
+    };
+    std::vector<Ent> ents;
+    std::vector<uint8_t> data;
+
+    void add(const advcol::Frame &f)
+    {
+        ents.push_back({ f.gw, f.ts, f.ts_flags, f.has_ts, data.size(), f.len });
+        data.insert(data.end(), f.data, f.data + f.len);
+    }
+
+    PyObject *list(bool with_gw) const
+    {
+        PyObject *l = PyList_New(ents.size()), *t;
+        size_t i = 0;
+
+        if(!l)
+            return nullptr;
+        for(const auto &e : ents)
+        {
+            PyObject *ts = e.has_ts ? PyLong_FromUnsignedLongLong(e.ts) : (Py_INCREF(Py_None), Py_None);
+
+            if(with_gw)
+                t = Py_BuildValue("(INby#)", e.gw, ts, e.flags, (const char *)&data[e.off], (Py_ssize_t)e.len);
+            else
+                t = Py_BuildValue("(Nby#)", ts, e.flags, (const char *)&data[e.off], (Py_ssize_t)e.len);
+            if(!t)
+            {
+                Py_DECREF(l);
+                return nullptr;
+            }
+            PyList_SET_ITEM(l, i++, t);
+        }
+        return l;
+    }
+};
+
+static PyObject *stats_dict(const advcol::ParserStats &s)
+{
+    return Py_BuildValue("{sKsKsKsKsKsKsKsKsKsKsKsKsKsKsK}",
+                         "bytes", s.bytes, "frames", s.frames, "adverts", s.adverts, "svc", s.svc,
+                         "blocks", s.blocks, "block_err", s.block_err, "block_lost", s.block_lost,
+                         "block_dup", s.block_dup,
+                         "skipped", s.skipped, "compact", s.compact, "dict_miss", s.dict_miss,
+                         "stamps", s.stamps, "lz_blocks", s.lz_blocks, "lz_in", s.lz_in, "lz_out", s.lz_out);
+}
+
+// PyDict_SetItemString() with a new reference
+static int dict_set(PyObject *d, const char *key, PyObject *v)
+{
+    int r;
+
+    if(!v)
+        return -1;
+    r = PyDict_SetItemString(d, key, v);
+    Py_DECREF(v);
+    return r;
+}
+
+/*********************************************************************
+ * Parser: a stream read by the caller
+ */
+typedef struct
+{
+    PyObject_HEAD
+    advcol::Parser *parser;
+    std::vector<uint8_t> *tail;     // unparsed end of the last feed()
+} ParserObject;
+
+static int Parser_init(ParserObject *self, PyObject *args, PyObject *kw)
+{
+    static const char *kwlist[] = { "gw", nullptr };
+    unsigned int gw = 0;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kw, "|I", (char **)kwlist, &gw))
+        return -1;
+    delete self->parser;
+    delete self->tail;
+    self->parser = new advcol::Parser(gw);
+    self->tail = new std::vector<uint8_t>();
+    return 0;
+}
+
+static void Parser_dealloc(ParserObject *self)
+{
+    delete self->parser;
+    delete self->tail;
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Parser_feed(ParserObject *self, PyObject *arg)
+{
+    FrameList fl;
+    Py_buffer b;
+    const uint8_t *p;
+    size_t len, used;
+
+    if(!self->parser)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Parser not initialized");
+        return nullptr;
+    }
+    if(PyObject_GetBuffer(arg, &b, PyBUF_SIMPLE) < 0)
+        return nullptr;
+    if(self->tail->empty())
+    {
+        p = (const uint8_t *)b.buf;
+        len = b.len;
+    }
+    else
+    {
+        self->tail->insert(self->tail->end(), (const uint8_t *)b.buf, (const uint8_t *)b.buf + b.len);
+        p = self->tail->data();
+        len = self->tail->size();
+    }
+    used = self->parser->parse(p, len, [&fl](const advcol::Frame &f) { fl.add(f); });
+    if(p == self->tail->data())
+        self->tail->erase(self->tail->begin(), self->tail->begin() + used);
+    else
+        self->tail->assign(p + used, p + len);
+    PyBuffer_Release(&b);
+    return fl.list(false);
+}
+
+static PyObject *Parser_reset(ParserObject *self, PyObject *)
+{
+    if(self->parser)
+    {
+        self->parser->reset();
+        self->tail->clear();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *Parser_stats(ParserObject *self, PyObject *)
+{
+    if(!self->parser)
+        Py_RETURN_NONE;
+    return stats_dict(self->parser->stats());
+}
+
+static PyMethodDef Parser_methods[] = {
+    { "feed", (PyCFunction)Parser_feed, METH_O,
+      "feed(data) -> [(ts or None, flags, frame)]: parse received bytes, a cut frame waits for the next call" },
+    { "reset", (PyCFunction)Parser_reset, METH_NOARGS, "reset(): new connection" },
+    { "stats", (PyCFunction)Parser_stats, METH_NOARGS, "stats() -> dict of parser counters" },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+static PyTypeObject ParserType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+/*********************************************************************
+ * Collector: gateways on the library epoll loop
+ */
+typedef struct
+{
+    PyObject_HEAD
+    advcol::Collector *col;
+    FrameList *fl;
+} CollectorObject;
+
+static int Collector_init(CollectorObject *self, PyObject *args, PyObject *kw)
+{
+    static const char *kwlist[] = { "ring_size", nullptr };
+    Py_ssize_t ring = advcol::RING_SIZE;
+
+    if(!PyArg_ParseTupleAndKeywords(args, kw, "|n", (char **)kwlist, &ring))
+        return -1;
+    delete self->col;
+    delete self->fl;
+    self->col = new advcol::Collector(ring);
+    self->fl = new FrameList();
+    FrameList *fl = self->fl;
+    self->col->on_frame([fl](const advcol::Frame &f) { fl->add(f); });
+    return 0;
+}
+
+static void Collector_dealloc(CollectorObject *self)
+{
+    delete self->col;
+    delete self->fl;
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Collector_add(CollectorObject *self, PyObject *args, PyObject *kw)
+{
+    static const char *kwlist[] = { "host", "port", "v2", "compact", "stamp", "lz", "resume", nullptr };
+    advcol::GatewayOptions opt;
+    const char *host;
+    unsigned short port = opt.port;
+    int v2 = 1, compact = 0, stamp = 0, lz = 0, resume = 0, gw;
+
+    if(!self->col)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Collector not initialized");
+        return nullptr;
+    }
+    if(!PyArg_ParseTupleAndKeywords(args, kw, "s|Hppppp", (char **)kwlist, &host, &port, &v2, &compact,
+                                    &stamp, &lz, &resume))
+        return nullptr;
+    opt.port = port;
+    opt.framing = v2 || lz ? STREAM_V2 : STREAM_V1;
+    opt.compact = compact;
+    opt.stamp = stamp;
+    opt.lz = lz;
+    opt.resume = resume;
+    gw = self->col->add(host, opt);
+    if(gw < 0)
+    {
+        PyErr_Format(PyExc_OSError, "%s: unknown host", host);
+        return nullptr;
+    }
+    return PyLong_FromLong(gw);
+}
+
+static PyObject *Collector_poll(CollectorObject *self, PyObject *args)
+{
+    int timeout = 100, r;
+
+    if(!self->col)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Collector not initialized");
+        return nullptr;
+    }
+    if(!PyArg_ParseTuple(args, "|i", &timeout))
+        return nullptr;
+    self->fl->ents.clear();
+    self->fl->data.clear();
+    Py_BEGIN_ALLOW_THREADS
+    r = self->col->poll(timeout);
+    Py_END_ALLOW_THREADS
+    if(r < 0)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    return self->fl->list(true);
+}
+
+static PyObject *Collector_stats(CollectorObject *self, PyObject *args)
+{
+    advcol::GatewayInfo gi;
+    PyObject *d;
+    int gw;
+
+    if(!self->col)
+        Py_RETURN_NONE;
+    if(!PyArg_ParseTuple(args, "i", &gw))
+        return nullptr;
+    if(gw < 0 || (size_t)gw >= self->col->size())
+    {
+        PyErr_SetString(PyExc_IndexError, "no such gateway");
+        return nullptr;
+    }
+    gi = self->col->info(gw);
+    d = stats_dict(*gi.stats);
+    if(!d)
+        return nullptr;
+    if(dict_set(d, "host", PyUnicode_FromString(gi.host.c_str()))
+       || dict_set(d, "connected", PyBool_FromLong(gi.connected))
+       || dict_set(d, "connects", PyLong_FromUnsignedLong(gi.connects))
+       || dict_set(d, "disconnects", PyLong_FromUnsignedLong(gi.disconnects)))
+    {
+        Py_DECREF(d);
+        return nullptr;
+    }
+    return d;
+}
+
+static PyMethodDef Collector_methods[] = {
+    { "add", (PyCFunction)(void (*)(void))Collector_add, METH_VARARGS | METH_KEYWORDS,
+      "add(host, port=1000, v2=True, compact=False, stamp=False, lz=False, resume=False) -> gateway index" },
+    { "poll", (PyCFunction)Collector_poll, METH_VARARGS,
+      "poll(timeout_ms=100) -> [(gw, ts or None, flags, frame)]" },
+    { "stats", (PyCFunction)Collector_stats, METH_VARARGS, "stats(gw) -> dict of connection and parser counters" },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+static PyTypeObject CollectorType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+/*********************************************************************
+ * Decoder: frames to columns of measurements
+ */
+typedef struct
+{
+    PyObject_HEAD
+    advcol::Decoder *dec;
+    advcol::Batch *batch;
+} DecoderObject;
+
+static int Decoder_init(DecoderObject *self, PyObject *args, PyObject *kw)
+{
+    static const char *kwlist[] = { nullptr };
+
+    if(!PyArg_ParseTupleAndKeywords(args, kw, "", (char **)kwlist))
+        return -1;
+    delete self->dec;
+    delete self->batch;
+    self->dec = new advcol::Decoder();
+    self->batch = new advcol::Batch();
+    return 0;
+}
+
+static void Decoder_dealloc(DecoderObject *self)
+{
+    delete self->dec;
+    delete self->batch;
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+template<class T> static int column(PyObject *d, const char *key, const std::vector<T> &v)
+{
+    return dict_set(d, key, PyBytes_FromStringAndSize((const char *)v.data(), v.size() * sizeof(T)));
+}
+
+static PyObject *Decoder_decode(DecoderObject *self, PyObject *arg)
+{
+    advcol::Batch &b = *self->batch;
+    advcol::Frame f;
+    PyObject *seq, *it, *fr, *d;
+    Py_ssize_t n, k;
+    char *data;
+    Py_ssize_t len;
+
+    if(!self->dec)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Decoder not initialized");
+        return nullptr;
+    }
+    seq = PySequence_Fast(arg, "frames must be a sequence");
+    if(!seq)
+        return nullptr;
+    b.clear();
+    n = PySequence_Fast_GET_SIZE(seq);
+    for(Py_ssize_t i = 0; i < n; i++)
+    {
+        // frame, (ts, flags, frame) of Parser.feed() or (gw, ts, flags, frame) of Collector.poll()
+        it = PySequence_Fast_GET_ITEM(seq, i);
+        fr = it;
+        f.gw = 0;
+        f.has_ts = false;
+        f.ts = 0;
+        f.ts_flags = 0;
+        if(PyTuple_Check(it) && (k = PyTuple_GET_SIZE(it)) >= 3)
+        {
+            PyObject *ts = PyTuple_GET_ITEM(it, k - 3);
+
+            fr = PyTuple_GET_ITEM(it, k - 1);
+            if(k > 3)
+                f.gw = PyLong_AsUnsignedLong(PyTuple_GET_ITEM(it, 0));
+            if(ts != Py_None)
+            {
+                f.ts = PyLong_AsUnsignedLongLong(ts);
+                f.has_ts = true;
+            }
+            if(PyErr_Occurred())
+            {
+                Py_DECREF(seq);
+                return nullptr;
+            }
+        }
+        if(PyBytes_AsStringAndSize(fr, &data, &len) < 0)
+        {
+            Py_DECREF(seq);
+            return nullptr;
+        }
+        if(len < ADV_HDR_LEN || len < ADV_HDR_LEN + (uint8_t)data[0])
+            continue;
+        f.data = (const uint8_t *)data;
+        f.len = len;
+        self->dec->decode(f, b);
+    }
+    Py_DECREF(seq);
+    d = PyDict_New();
+    if(!d)
+        return nullptr;
+    if(column(d, "ts", b.ts) || column(d, "mac", b.mac) || column(d, "gw", b.gw) || column(d, "rssi", b.rssi)
+       || column(d, "fmt", b.fmt) || column(d, "qty", b.qty) || column(d, "value", b.value))
+    {
+        Py_DECREF(d);
+        return nullptr;
+    }
+    return d;
+}
+
+static PyObject *Decoder_stats(DecoderObject *self, PyObject *)
+{
+    const advcol::DecoderStats *s;
+
+    if(!self->dec)
+        Py_RETURN_NONE;
+    s = &self->dec->stats();
+    return Py_BuildValue("{sKsKsKsKsK}", "frames", s->frames, "decoded", s->decoded, "values", s->values,
+                         "encrypted", s->encrypted, "malformed", s->malformed);
+}
+
+static PyMethodDef Decoder_methods[] = {
+    { "decode", (PyCFunction)Decoder_decode, METH_O,
+      "decode(frames) -> {column: bytes}: ts u64, mac u64, gw u32, rssi i8, fmt u8, qty u8, value f64" },
+    { "stats", (PyCFunction)Decoder_stats, METH_NOARGS, "stats() -> dict of decoder counters" },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+static PyTypeObject DecoderType = { PyVarObject_HEAD_INIT(nullptr, 0) };
+
+static PyObject *mod_quantity_name(PyObject *, PyObject *arg)
+{
+    const char *s = advcol::quantity_name((uint8_t)PyLong_AsLong(arg));
+
+    if(PyErr_Occurred())
+        return nullptr;
+    if(!s)
+        Py_RETURN_NONE;
+    return PyUnicode_FromString(s);
+}
+
+static PyObject *mod_format_name(PyObject *, PyObject *arg)
+{
+    const char *s = advcol::format_name((uint8_t)PyLong_AsLong(arg));
+
+    if(PyErr_Occurred())
+        return nullptr;
+    if(!s)
+        Py_RETURN_NONE;
+    return PyUnicode_FromString(s);
+}
+
+static PyMethodDef advcol_methods[] = {
+    { "quantity_name", mod_quantity_name, METH_O, "quantity_name(qty) -> str or None" },
+    { "format_name", mod_format_name, METH_O, "format_name(fmt) -> str or None" },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+static struct PyModuleDef advcol_module = {
+    PyModuleDef_HEAD_INIT, "advcol",
+    "WCHBLE2ETH advert stream collector: v1 frames, v2 blocks, compact, time and LZ records", -1,
+    advcol_methods, nullptr, nullptr, nullptr, nullptr
+};
+
+PyMODINIT_FUNC PyInit_advcol(void)
+{
+    PyObject *m;
+
+    ParserType.tp_name = "advcol.Parser";
+    ParserType.tp_basicsize = sizeof(ParserObject);
+    ParserType.tp_flags = Py_TPFLAGS_DEFAULT;
+    ParserType.tp_doc = "Parser(gw=0): stream parser of one connection";
+    ParserType.tp_new = PyType_GenericNew;
+    ParserType.tp_init = (initproc)Parser_init;
+    ParserType.tp_dealloc = (destructor)Parser_dealloc;
+    ParserType.tp_methods = Parser_methods;
+    CollectorType.tp_name = "advcol.Collector";
+    CollectorType.tp_basicsize = sizeof(CollectorObject);
+    CollectorType.tp_flags = Py_TPFLAGS_DEFAULT;
+    CollectorType.tp_doc = "Collector(ring_size): gateways on one epoll loop";
+    CollectorType.tp_new = PyType_GenericNew;
+    CollectorType.tp_init = (initproc)Collector_init;
+    CollectorType.tp_dealloc = (destructor)Collector_dealloc;
+    CollectorType.tp_methods = Collector_methods;
+    DecoderType.tp_name = "advcol.Decoder";
+    DecoderType.tp_basicsize = sizeof(DecoderObject);
+    DecoderType.tp_flags = Py_TPFLAGS_DEFAULT;
+    DecoderType.tp_doc = "Decoder(): advert data to measurements (BTHome, atc/pvvx, MiBeacon, iBeacon, Eddystone)";
+    DecoderType.tp_new = PyType_GenericNew;
+    DecoderType.tp_init = (initproc)Decoder_init;
+    DecoderType.tp_dealloc = (destructor)Decoder_dealloc;
+    DecoderType.tp_methods = Decoder_methods;
+    if(PyType_Ready(&ParserType) < 0 || PyType_Ready(&CollectorType) < 0 || PyType_Ready(&DecoderType) < 0)
+        return nullptr;
+    m = PyModule_Create(&advcol_module);
+    if(!m)
+        return nullptr;
+    Py_INCREF(&ParserType);
+    Py_INCREF(&CollectorType);
+    Py_INCREF(&DecoderType);
+    if(PyModule_AddObject(m, "Parser", (PyObject *)&ParserType) < 0
+       || PyModule_AddObject(m, "Collector", (PyObject *)&CollectorType) < 0
+       || PyModule_AddObject(m, "Decoder", (PyObject *)&DecoderType) < 0)
+    {
+        Py_DECREF(m);
+        return nullptr;
+    }
+    PyModule_AddIntConstant(m, "GWTIME_SYNCED", GWTIME_SYNCED);
+    PyModule_AddIntConstant(m, "GWTIME_TWSYNC", GWTIME_TWSYNC);
+    return m;
+}
+
+/******************************** endfile @ advcolmodule ******************************/
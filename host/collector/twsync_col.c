@@ -0,0 +1,232 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : twsync_col.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/19
+ * Description        : Collector side of the two-way time transfer
+ *                      (APP/include/twsync.h): probes, samples, offset
+ *                      and rate fit of one gateway clock
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include "twsync_col.h"
+
+/*********************************************************************
+ * @fn      twsync_col_init
+ *
+ * @brief   No samples, no fit.
+ */
+void twsync_col_init(twsync_col_t *c)
+{
+    memset(c, 0, sizeof(*c));
+    c->seq = 1;
+}
+
+/*********************************************************************
+ * @fn      twsync_col_probe
+ *
+ * @brief   Probe at the reply size: the exchange is symmetric on the
+ *          wire.
+ *
+ * @param   c - gateway state
+ * @param   t1 - collector send time, us
+ * @param   out - sizeof(twsync_msg_t) bytes
+ *
+ * @return  message length
+ */
+uint32_t twsync_col_probe(twsync_col_t *c, uint64_t t1, uint8_t *out)
+{
+    twsync_msg_t m;
+
+    memset(&m, 0, sizeof(m));
+    m.magic[0] = TWSYNC_MAGIC0;
+    m.magic[1] = TWSYNC_MAGIC1;
+    m.type = TWSYNC_PROBE;
+    m.seq = c->seq++;
+    m.t1 = t1;
+    memcpy(out, &m, sizeof(m));
+    return sizeof(m);
+}
+
+/*********************************************************************
+ * @fn      twsync_col_reply
+ *
+ * @brief   A reply completes the previous one (its transmit time) and
+ *          waits for its own. Replies stamped by the gateway socket
+ *          callback carry the stack delay and are not used.
+ *
+ * @param   c - gateway state
+ * @param   msg - datagram
+ * @param   len - datagram length
+ * @param   t4 - collector receive time, us
+ *
+ * @return  1 - a new sample in the window
+ */
+int twsync_col_reply(twsync_col_t *c, const uint8_t *msg, uint32_t len, uint64_t t4)
+{
+    twsync_msg_t m;
+    twsync_sample_t *s;
+    int ret = 0;
+
+    if(len < sizeof(m) || msg[0] != TWSYNC_MAGIC0 || msg[1] != TWSYNC_MAGIC1 || msg[2] != TWSYNC_REPLY)
+        return 0;
+    memcpy(&m, msg, sizeof(m));
+    c->replies++;
+    memcpy(c->gw_id, m.gw_id, sizeof(c->gw_id));
+    c->gw_set = (m.flags & TWSYNC_F_SET) != 0;
+    if(c->wait && (m.flags & TWSYNC_F_T3_HW) && m.prev_seq == c->wait_seq)
+    {
+        s = &c->win[c->wr];
+        s->t1 = c->wait_t1;
+        s->t2 = c->wait_t2;
+        s->t3 = m.prev_t3;
+        s->t4 = c->wait_t4;
+        c->wr = (c->wr + 1) % TWSYNC_COL_WIN;
+        if(c->n < TWSYNC_COL_WIN)
+            c->n++;
+        c->samples++;
+        ret = 1;
+    }
+    c->wait = 0;
+    if(!(m.flags & TWSYNC_F_T2_HW))
+    {
+        c->sw_stamps++;
+        return ret;
+    }
+    c->wait = 1;
+    c->wait_seq = m.seq;
+    c->wait_t1 = m.t1;
+    c->wait_t2 = m.t2;
+    c->wait_t4 = t4;
+    return ret;
+}
+
+static int twsync_cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*********************************************************************
+ * @fn      twsync_col_fit
+ *
+ * @brief   Least squares line of the offset (collector - gateway) over
+ *          the gateway time, samples with a round trip above the
+ *          window median are dropped: queueing on the way is one-sided
+ *          and skews the offset. Sums are taken relative to the newest
+ *          sample, doubles keep sub-us steps of UTC microseconds.
+ *
+ * @param   c - gateway state
+ *
+ * @return  1 - c->ref_local, ref_utc, rate are valid
+ */
+int twsync_col_fit(twsync_col_t *c)
+{
+    uint32_t delay[TWSYNC_COL_WIN], dmed;
+    const twsync_sample_t *s, *last;
+    double sx = 0, sy = 0, sxx = 0, sxy = 0, x, y, a, b = 0, r, rr = 0, span;
+    double xmin = 0, xmax = 0;
+    int64_t x2_last, y2_last, d;
+    uint32_t i, n = 0;
+
+    c->valid = 0;
+    if(c->n < TWSYNC_COL_MIN)
+        return 0;
+    for(i = 0; i < c->n; i++)
+    {
+        s = &c->win[i];
+        d = (int64_t)(s->t4 - s->t1) - (int64_t)(s->t3 - s->t2);
+        delay[i] = d < 0 ? 0 : (uint32_t)d;
+    }
+    qsort(delay, c->n, sizeof(delay[0]), twsync_cmp_u32);
+    c->delay_min = delay[0];
+    dmed = delay[(c->n - 1) / 2];
+    last = &c->win[(c->wr + TWSYNC_COL_WIN - 1) % TWSYNC_COL_WIN];
+    x2_last = (int64_t)(last->t2 + last->t3);
+    y2_last = (int64_t)(last->t1 - last->t2) + (int64_t)(last->t4 - last->t3);
+    for(i = 0; i < c->n; i++)
+    {
+        s = &c->win[i];
+        d = (int64_t)(s->t4 - s->t1) - (int64_t)(s->t3 - s->t2);
+        if(d > (int64_t)dmed)
+            continue;
+        x = (double)((int64_t)(s->t2 + s->t3) - x2_last) / 2;
+        y = (double)((int64_t)(s->t1 - s->t2) + (int64_t)(s->t4 - s->t3) - y2_last) / 2;
+        if(!n || x < xmin)
+            xmin = x;
+        if(!n || x > xmax)
+            xmax = x;
+        sx += x;
+        sy += y;
+        sxx += x * x;
+        sxy += x * y;
+        n++;
+    }
+    span = xmax - xmin;
+    if(n >= 2 && span >= TWSYNC_COL_RATE_SPAN_US)
+        b = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+    a = (sy - b * sx) / n;
+    for(i = 0; i < c->n; i++)
+    {
+        s = &c->win[i];
+        d = (int64_t)(s->t4 - s->t1) - (int64_t)(s->t3 - s->t2);
+        if(d > (int64_t)dmed)
+            continue;
+        x = (double)((int64_t)(s->t2 + s->t3) - x2_last) / 2;
+        y = (double)((int64_t)(s->t1 - s->t2) + (int64_t)(s->t4 - s->t3) - y2_last) / 2;
+        r = y - a - b * x;
+        rr += r * r;
+    }
+    c->rms = sqrt(rr / n);
+    c->used = n;
+    c->rate = b * 1e9;
+    // reference point: the newest sample, whole us
+    c->ref_local = (uint64_t)x2_last >> 1;
+    c->ref_utc = c->ref_local + y2_last / 2
+                 + llround((double)(y2_last % 2) / 2 + a - b * (double)(x2_last & 1) / 2);
+    c->valid = 1;
+    return 1;
+}
+
+/*********************************************************************
+ * @fn      twsync_col_set
+ *
+ * @brief   TWSYNC_SET of the fit.
+ *
+ * @param   c - gateway state
+ * @param   out - sizeof(twsync_set_t) bytes
+ *
+ * @return  message length, 0 - no fit yet
+ */
+uint32_t twsync_col_set(const twsync_col_t *c, uint8_t *out)
+{
+    twsync_set_t m;
+
+    if(!c->valid)
+        return 0;
+    memset(&m, 0, sizeof(m));
+    m.magic[0] = TWSYNC_MAGIC0;
+    m.magic[1] = TWSYNC_MAGIC1;
+    m.type = TWSYNC_SET;
+    m.seq = c->seq - 1;
+    m.ref_local = c->ref_local;
+    m.ref_utc = c->ref_utc;
+    m.rate = (int32_t)llround(c->rate);
+    memcpy(out, &m, sizeof(m));
+    return sizeof(m);
+}
+
+uint64_t twsync_col_utc(const twsync_col_t *c, uint64_t local)
+{
+    int64_t d = (int64_t)(local - c->ref_local);
+
+    return c->ref_utc + d + llround(d * c->rate / 1e9);
+}
+
+/******************************** endfile @ twsync_col ******************************/
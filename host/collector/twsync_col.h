@@ -0,0 +1,108 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : twsync_col.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/19
+ * Description        : Collector side of the two-way time transfer
+ *                      (APP/include/twsync.h): probes, samples, offset
+ *                      and rate fit of one gateway clock
+ *********************************************************************************/
+
+#ifndef TWSYNC_COL_H
+#define TWSYNC_COL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include "twsync.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+// Samples in the fit window and before the first correction
+#define TWSYNC_COL_WIN          64
+#define TWSYNC_COL_MIN          4
+// Shortest window span for a rate estimate, us
+#define TWSYNC_COL_RATE_SPAN_US 4000000
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * One exchange: t1/t4 - collector send/receive, t2/t3 - gateway
+ * receive/transmit (gwtime_local() us)
+ */
+typedef struct
+{
+    uint64_t t1, t2, t3, t4;
+} twsync_sample_t;
+
+typedef struct
+{
+    uint32_t seq;               // next probe
+    // the last reply waits for its transmit time in the next one
+    uint8_t  wait;
+    uint32_t wait_seq;
+    uint64_t wait_t1, wait_t2, wait_t4;
+    twsync_sample_t win[TWSYNC_COL_WIN];
+    uint32_t n;                 // samples in win
+    uint32_t wr;
+    uint8_t  gw_id[6];
+    uint8_t  gw_set;            // the gateway follows the corrections (TWSYNC_F_SET)
+    // fit: collector time = ref_utc + (local - ref_local) * (1 + rate / 1e9)
+    uint8_t  valid;
+    uint64_t ref_local;
+    uint64_t ref_utc;
+    double   rate;              // ppb
+    double   rms;               // offset residual of the samples used, us
+    uint32_t delay_min;         // round trip, us
+    uint32_t used;              // samples used by the fit
+    // counters
+    uint32_t replies;
+    uint32_t samples;
+    uint32_t sw_stamps;         // replies stamped by the gateway socket callback
+} twsync_col_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+extern void twsync_col_init(twsync_col_t *c);
+
+/*
+ * Probe sent at the collector time t1 into out (sizeof(twsync_msg_t)), returns the length
+ */
+extern uint32_t twsync_col_probe(twsync_col_t *c, uint64_t t1, uint8_t *out);
+
+/*
+ * Reply received at the collector time t4, returns 1 - a new sample
+ */
+extern int twsync_col_reply(twsync_col_t *c, const uint8_t *msg, uint32_t len, uint64_t t4);
+
+/*
+ * Refit the window, returns c->valid
+ */
+extern int twsync_col_fit(twsync_col_t *c);
+
+/*
+ * TWSYNC_SET of the fit into out (sizeof(twsync_set_t)), returns the length, 0 - no fit
+ */
+extern uint32_t twsync_col_set(const twsync_col_t *c, uint8_t *out);
+
+/*
+ * Gateway local time -> collector time by the fit
+ */
+extern uint64_t twsync_col_utc(const twsync_col_t *c, uint64_t local);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TWSYNC_COL_H */
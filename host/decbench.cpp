@@ -0,0 +1,283 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : decbench.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/22
+ * Description        : Advert data decoder benchmark: captures (.advc) or
+ *                      a synthetic sensor population decoded into
+ *                      columnar batches
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <vector>
+#include "advcap.h"
+#include "advdec.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define DB_BATCH                4096        // frames per decode() call
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static uint32_t rnd_state;
+static std::vector<uint8_t> frames;         // v1 frames back to back
+static std::vector<advcol::Frame> frame_idx;
+
+static uint32_t rnd()
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static double host_time()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void frame_put(const advcap_rec_t *rec, const uint8_t *data, uint64_t ts)
+{
+    uint8_t hdr[ADV_HDR_LEN];
+
+    hdr[0] = rec->dataLen;
+    hdr[1] = rec->eventType | (rec->addrType << 4);
+    hdr[2] = rec->type == ADVCAP_EXT_ADV_INFO ? rec->primaryPHY | (rec->secondaryPHY << 4) : 0x11;
+    hdr[3] = (uint8_t)rec->rssi;
+    memcpy(&hdr[4], rec->addr, 6);
+    frames.insert(frames.end(), hdr, hdr + ADV_HDR_LEN);
+    frames.insert(frames.end(), data, data + rec->dataLen);
+    frame_idx.push_back({ nullptr, (uint32_t)(ADV_HDR_LEN + rec->dataLen), 0, ts, 0, ts != 0 });
+}
+
+/*********************************************************************
+ * @fn      synth_adv
+ *
+ * @brief   Sensor adverts in the formats of the decoder: BTHome v2,
+ *          atc1441 and pvvx custom, MiBeacon, iBeacon, Eddystone TLM
+ *          and Apple continuity (not decoded).
+ */
+static uint32_t synth_adv(uint32_t dev, uint8_t *d)
+{
+    uint32_t n = 0, kind = (dev * 2654435761u) >> 29;
+    int t = 1500 + (int)(rnd() % 1500);     // 0.01 C
+    uint32_t h = 3000 + rnd() % 4000;       // 0.01 %
+    uint32_t mv = 2800 + rnd() % 300;
+
+    d[n++] = 0x02; d[n++] = 0x01; d[n++] = 0x06;
+    switch(kind)
+    {
+        case 0:                                 // BTHome v2: packet, battery, temperature, humidity
+            d[n++] = 0x0E; d[n++] = 0x16; d[n++] = 0xD2; d[n++] = 0xFC; d[n++] = 0x40;
+            d[n++] = 0x00; d[n++] = (uint8_t)rnd();
+            d[n++] = 0x01; d[n++] = 90;
+            d[n++] = 0x02; d[n++] = (uint8_t)t; d[n++] = (uint8_t)(t >> 8);
+            d[n++] = 0x03; d[n++] = (uint8_t)h; d[n++] = (uint8_t)(h >> 8);
+            break;
+        case 1:                                 // pvvx custom
+            d[n++] = 0x12; d[n++] = 0x16; d[n++] = 0x1A; d[n++] = 0x18;
+            d[n++] = (uint8_t)dev; d[n++] = (uint8_t)(dev >> 8); d[n++] = 0x38;
+            d[n++] = 0xC1; d[n++] = 0xA4; d[n++] = 0x00;
+            d[n++] = (uint8_t)t; d[n++] = (uint8_t)(t >> 8); d[n++] = (uint8_t)h; d[n++] = (uint8_t)(h >> 8);
+            d[n++] = (uint8_t)mv; d[n++] = (uint8_t)(mv >> 8); d[n++] = 80; d[n++] = (uint8_t)rnd(); d[n++] = 0x04;
+            break;
+        case 2:                                 // atc1441 custom
+            d[n++] = 0x10; d[n++] = 0x16; d[n++] = 0x1A; d[n++] = 0x18;
+            d[n++] = 0x00; d[n++] = 0xA4; d[n++] = 0xC1; d[n++] = 0x38;
+            d[n++] = (uint8_t)(dev >> 8); d[n++] = (uint8_t)dev;
+            d[n++] = (uint8_t)((t / 10) >> 8); d[n++] = (uint8_t)(t / 10); d[n++] = (uint8_t)(h / 100);
+            d[n++] = 75; d[n++] = (uint8_t)(mv >> 8); d[n++] = (uint8_t)mv; d[n++] = (uint8_t)rnd();
+            break;
+        case 3:                                 // MiBeacon v5, MAC, temperature + humidity
+            d[n++] = 0x15; d[n++] = 0x16; d[n++] = 0x95; d[n++] = 0xFE;
+            d[n++] = 0x50; d[n++] = 0x50; d[n++] = 0x5B; d[n++] = 0x05; d[n++] = (uint8_t)rnd();
+            d[n++] = (uint8_t)dev; d[n++] = (uint8_t)(dev >> 8); d[n++] = 0x38; d[n++] = 0xC1; d[n++] = 0xA4; d[n++] = 0x00;
+            d[n++] = 0x0D; d[n++] = 0x10; d[n++] = 0x04;
+            d[n++] = (uint8_t)(t / 10); d[n++] = (uint8_t)((t / 10) >> 8);
+            d[n++] = (uint8_t)(h / 10); d[n++] = (uint8_t)((h / 10) >> 8);
+            break;
+        case 4:                                 // iBeacon
+            d[n++] = 0x1A; d[n++] = 0xFF; d[n++] = 0x4C; d[n++] = 0x00; d[n++] = 0x02; d[n++] = 0x15;
+            for(uint32_t i = 0; i < 16; i++)
+                d[n++] = (uint8_t)(0xE2 + i * 7);
+            d[n++] = 0x00; d[n++] = (uint8_t)(dev >> 4); d[n++] = 0x00; d[n++] = (uint8_t)dev; d[n++] = 0xC5;
+            break;
+        case 5:                                 // Eddystone TLM
+            d[n++] = 0x03; d[n++] = 0x03; d[n++] = 0xAA; d[n++] = 0xFE;
+            d[n++] = 0x11; d[n++] = 0x16; d[n++] = 0xAA; d[n++] = 0xFE; d[n++] = 0x20; d[n++] = 0x00;
+            d[n++] = (uint8_t)(mv >> 8); d[n++] = (uint8_t)mv;
+            d[n++] = (uint8_t)(t / 100); d[n++] = (uint8_t)((t % 100) * 256 / 100);
+            for(uint32_t i = 0; i < 8; i++)
+                d[n++] = (uint8_t)rnd();
+            break;
+        default:                                // Apple continuity: no values
+            d[n++] = 0x0A; d[n++] = 0xFF; d[n++] = 0x4C; d[n++] = 0x00; d[n++] = 0x10; d[n++] = 0x05;
+            d[n++] = 0x01 + (rnd() & 0x3F);
+            for(uint32_t i = 0; i < 4; i++)
+                d[n++] = (uint8_t)rnd();
+            break;
+    }
+    return n;
+}
+
+static void load_synth(uint32_t devices, uint32_t count)
+{
+    advcap_rec_t rec;
+    uint8_t data[255];
+    uint32_t dev;
+
+    memset(&rec, 0, sizeof(rec));
+    for(uint32_t i = 0; i < count; i++)
+    {
+        dev = rnd() % devices;
+        rec.eventType = 0x03;
+        rec.rssi = -40 - (int8_t)(rnd() % 50);
+        rec.addr[0] = (uint8_t)dev;
+        rec.addr[1] = (uint8_t)(dev >> 8);
+        rec.addr[2] = 0x38;
+        rec.addr[3] = 0xC1;
+        rec.addr[4] = 0xA4;
+        rec.dataLen = (uint8_t)synth_adv(dev, data);
+        frame_put(&rec, data, 0);
+    }
+}
+
+static int write_csv(const char *name, const advcol::Batch &b)
+{
+    FILE *f = fopen(name, "w");
+
+    if(!f)
+        return -1;
+    fprintf(f, "ts,mac,gw,rssi,format,quantity,value\n");
+    for(size_t i = 0; i < b.size(); i++)
+    {
+        const char *q = advcol::quantity_name(b.qty[i]);
+
+        fprintf(f, "%llu,%012llX,%u,%d,%s,%s,%g\n", (unsigned long long)b.ts[i], (unsigned long long)b.mac[i],
+                b.gw[i], b.rssi[i], advcol::format_name(b.fmt[i]), q ? q : "?", b.value[i]);
+    }
+    return fclose(f);
+}
+
+static void usage()
+{
+    printf("Usage: decbench [options] [capture.advc ...]\n"
+           "  -S N     no capture: synthetic population of N devices\n"
+           "  -n N     synthetic reports (default 1000000)\n"
+           "  -l N     loops (default 10)\n"
+           "  -R N     random seed (default 1)\n"
+           "  -c FILE  write the decoded values of one pass as CSV\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t synth = 0, count = 1000000, loops = 10, seed = 1;
+    uint64_t rows = 0, per_fmt[8] = { 0 };
+    const char *csv = nullptr;
+    uint8_t data[255];
+    advcol::Batch batch;
+    advcap_rec_t rec;
+    advcap_t cap;
+    size_t pos, i;
+    double t;
+    int c, r;
+
+    while((c = getopt(argc, argv, "S:n:l:R:c:h")) != -1)
+    {
+        switch(c)
+        {
+            case 'S': synth = strtoul(optarg, NULL, 0); break;
+            case 'n': count = strtoul(optarg, NULL, 0); break;
+            case 'l': loops = strtoul(optarg, NULL, 0); break;
+            case 'R': seed = strtoul(optarg, NULL, 0); break;
+            case 'c': csv = optarg; break;
+            default: usage(); return 1;
+        }
+    }
+    if((optind >= argc && !synth) || !loops)
+    {
+        usage();
+        return 1;
+    }
+    rnd_state = seed ? seed : 1;
+    for(; optind < argc; optind++)
+    {
+        if(advcap_open(&cap, argv[optind]))
+        {
+            perror(argv[optind]);
+            return 1;
+        }
+        while((r = advcap_read(&cap, &rec, data)) > 0)
+            frame_put(&rec, data, advcap_ts_us(&cap, rec.ts));
+        advcap_close(&cap);
+        if(r < 0)
+        {
+            fprintf(stderr, "%s: read error\n", argv[optind]);
+            return 1;
+        }
+    }
+    if(synth)
+        load_synth(synth, count);
+    if(frame_idx.empty())
+    {
+        fprintf(stderr, "no records\n");
+        return 1;
+    }
+    for(i = 0, pos = 0; i < frame_idx.size(); pos += frame_idx[i++].len)
+        frame_idx[i].data = &frames[pos];
+
+    // one pass: values per format, optional CSV
+    {
+        advcol::Decoder dec;
+
+        batch.reserve(frame_idx.size() * 4);
+        dec.decode(frame_idx.data(), frame_idx.size(), batch);
+        for(i = 0; i < batch.size(); i++)
+            per_fmt[batch.fmt[i] & 7]++;
+        if(csv && write_csv(csv, batch))
+        {
+            perror(csv);
+            return 1;
+        }
+        printf("frames             %zu, %llu decoded, %llu encrypted, %llu malformed\n", frame_idx.size(),
+               (unsigned long long)dec.stats().decoded, (unsigned long long)dec.stats().encrypted,
+               (unsigned long long)dec.stats().malformed);
+        printf("values             %zu:", batch.size());
+        for(i = 1; i < 8; i++)
+        {
+            if(per_fmt[i])
+                printf(" %s %llu", advcol::format_name(i), (unsigned long long)per_fmt[i]);
+        }
+        printf("\n");
+    }
+
+    // decode in batches of DB_BATCH frames, the batch is reused
+    advcol::Decoder dec;
+    t = host_time();
+    for(uint32_t loop = 0; loop < loops; loop++)
+    {
+        for(pos = 0; pos < frame_idx.size(); pos += DB_BATCH)
+        {
+            batch.clear();
+            rows += dec.decode(&frame_idx[pos], frame_idx.size() - pos < DB_BATCH ? frame_idx.size() - pos : DB_BATCH, batch);
+        }
+    }
+    t = host_time() - t;
+    printf("decode             %.2f M frames/s, %.2f M values/s, %.1f ns/frame\n",
+           frame_idx.size() * loops / t / 1e6, rows / t / 1e6, t * 1e9 / (frame_idx.size() * loops));
+    return 0;
+}
+
+/******************************** endfile @ decbench ******************************/
@@ -0,0 +1,432 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : gwmerge.cpp
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/25
+ * Description        : Merge of several live gateways into one stream:
+ *                      a reader thread per gateway, the copies of an
+ *                      advert collapsed with per-gateway RSSI. Synthetic
+ *                      mode checks the grouping and measures throughput
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "advmerge.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define GM_SYNTH_T0             1709251200000000ull // 2024-03-01 00:00 UTC, us
+#define GM_SYNTH_PERIOD         100         // us between adverts of all devices
+#define GM_SYNTH_STEP           1000        // us, synthetic clock step
+#define GM_SYNTH_BATCH          10000       // us, gateway stream block
+#define GM_SYNTH_JITTER         1000        // us, +- per gateway stamp
+#define GM_SYNTH_REPEAT         4           // adverts with the same data per device
+#define GM_SYNTH_HEARD          70          // % of the gateways hearing an advert
+#define GM_SYNTH_LAG            8           // gateway delays: 1..GM_SYNTH_LAG blocks
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static volatile sig_atomic_t stop_req;
+
+static uint64_t unix_us()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    return (uint64_t)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static double host_time()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop_req = 1;
+}
+
+static void print_merged(const advcol::Merged &m, uint32_t gateways)
+{
+    char tbuf[32];
+    time_t t = (time_t)(m.ts / 1000000);
+    struct tm tm;
+
+    gmtime_r(&t, &tm);
+    strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%06u %012llx %u%s ", tbuf, (unsigned)(m.ts % 1000000), (unsigned long long)m.mac, m.n,
+           m.late ? "L" : "");
+    for(uint32_t gw = 0; gw < gateways; gw++)
+    {
+        if(m.gw_mask & (1u << gw))
+            printf("%s%d", gw ? "," : "", m.rssi[gw]);
+        else
+            printf("%s.", gw ? "," : "");
+    }
+    printf(" %02x %02x ", m.data[1], m.data[2]);
+    for(uint32_t i = ADV_HDR_LEN; i < m.len; i++)
+        printf("%02x", m.data[i]);
+    printf("\n");
+}
+
+static void print_stats(const advcol::MergeStats &st, double t)
+{
+    fprintf(stderr, "%llu frames in, %llu dropped, %llu adverts out, %llu copies collapsed (%.2f per advert), "
+            "%llu late, %llu forced; %.3f s\n", (unsigned long long)st.in, (unsigned long long)st.dropped,
+            (unsigned long long)st.out, (unsigned long long)st.dups, st.out ? 1.0 * st.in / st.out : 0.0,
+            (unsigned long long)st.late, (unsigned long long)st.forced, t);
+}
+
+/*********************************************************************
+ * Synthetic gateways
+ *
+ * Devices advertise in turn, GM_SYNTH_PERIOD apart, each gateway hears
+ * an advert with GM_SYNTH_HEARD % (at least one does), stamps it with its
+ * own jitter and hands the stream out in GM_SYNTH_BATCH blocks, some
+ * gateways later than others. The gateway threads follow a common clock that the
+ * merge thread moves on once all of them have sent everything up to it,
+ * so nothing comes later than the stream block and the gateway delay.
+ */
+
+struct SynthCfg
+{
+    uint32_t gateways;
+    uint32_t devices;
+    uint64_t adverts;
+};
+
+static uint32_t mix32(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return (uint32_t)x;
+}
+
+static bool synth_heard(const SynthCfg &cfg, uint64_t ev, uint32_t gw)
+{
+    for(uint32_t i = 0; i < cfg.gateways; i++)
+    {
+        if(mix32(ev * 64 + i) % 100 < GM_SYNTH_HEARD)
+            return mix32(ev * 64 + gw) % 100 < GM_SYNTH_HEARD;
+    }
+    return gw == ev % cfg.gateways;
+}
+
+static uint32_t synth_copies(const SynthCfg &cfg, uint64_t ev)
+{
+    uint32_t n = 0;
+
+    for(uint32_t gw = 0; gw < cfg.gateways; gw++)
+        n += synth_heard(cfg, ev, gw);
+    return n;
+}
+
+static uint64_t synth_ts(uint64_t ev, uint32_t gw)
+{
+    return GM_SYNTH_T0 + ev * GM_SYNTH_PERIOD + mix32(ev * 131 + gw + 7) % (2 * GM_SYNTH_JITTER + 1)
+           - GM_SYNTH_JITTER;
+}
+
+/*
+ * v1 frame of advert ev as heard by gw: MAC of the device, service data
+ * with a counter that changes every GM_SYNTH_REPEAT adverts
+ */
+static uint32_t synth_frame(const SynthCfg &cfg, uint64_t ev, uint32_t gw, uint8_t *fr)
+{
+    uint32_t dev = (uint32_t)(ev % cfg.devices);
+    uint32_t cnt = (uint32_t)(ev / cfg.devices / GM_SYNTH_REPEAT);
+    uint8_t *p = fr + ADV_HDR_LEN;
+
+    fr[1] = 0x00;                   // ADV_IND, public
+    fr[2] = 0x01;                   // 1M
+    fr[3] = (uint8_t)(int8_t)(-40 - (int)(mix32(ev * 17 + gw) % 50));
+    fr[4] = (uint8_t)dev;
+    fr[5] = (uint8_t)(dev >> 8);
+    fr[6] = (uint8_t)(dev >> 16);
+    fr[7] = 0x38;
+    fr[8] = 0xc1;
+    fr[9] = 0xa4;
+    *p++ = 2; *p++ = 0x01; *p++ = 0x06;
+    *p++ = 9; *p++ = 0x16; *p++ = 0x1a; *p++ = 0x18;
+    *p++ = (uint8_t)cnt; *p++ = (uint8_t)(cnt >> 8); *p++ = (uint8_t)(cnt >> 16); *p++ = (uint8_t)(cnt >> 24);
+    *p++ = (uint8_t)dev; *p++ = (uint8_t)(dev >> 8);
+    fr[0] = (uint8_t)(p - fr - ADV_HDR_LEN);
+    return (uint32_t)(p - fr);
+}
+
+/*
+ * Advert number of a merged output: the device from the MAC, the turn
+ * from the time (the jitter is well below a device period)
+ */
+static uint64_t synth_event(const SynthCfg &cfg, const advcol::Merged &m)
+{
+    uint64_t dev = m.mac & 0xffffff, period = (uint64_t)cfg.devices * GM_SYNTH_PERIOD;
+    int64_t t = (int64_t)(m.ts - GM_SYNTH_T0) - (int64_t)(dev * GM_SYNTH_PERIOD);
+
+    if(t < -(int64_t)period / 2)
+        return UINT64_MAX;
+    return (uint64_t)((t + (int64_t)period / 2) / (int64_t)period) * cfg.devices + dev;
+}
+
+static int run_synth(const SynthCfg &cfg, const advcol::MergeOptions &mopt, bool print)
+{
+    struct Item
+    {
+        uint64_t ts;
+        uint64_t ev;
+        bool operator<(const Item &o) const { return ts < o.ts; }
+    };
+    advcol::Merger mg(cfg.gateways, mopt);
+    std::vector<std::vector<Item>> items(cfg.gateways);
+    std::vector<uint8_t> seen(cfg.adverts);
+    std::vector<std::thread> th;
+    std::atomic<uint64_t> clock(GM_SYNTH_T0);
+    std::atomic<uint64_t> progress[advcol::MERGE_GW_MAX];
+    std::atomic<bool> done(false);
+    uint64_t frames = 0, bad_group = 0, bad_ev = 0, order = 0, last = 0, end;
+    double t;
+
+    for(uint32_t gw = 0; gw < cfg.gateways; gw++)
+    {
+        for(uint64_t ev = 0; ev < cfg.adverts; ev++)
+        {
+            if(synth_heard(cfg, ev, gw))
+                items[gw].push_back(Item{ synth_ts(ev, gw), ev });
+        }
+        std::sort(items[gw].begin(), items[gw].end());
+        frames += items[gw].size();
+        progress[gw] = 0;
+    }
+    end = GM_SYNTH_T0 + cfg.adverts * GM_SYNTH_PERIOD + GM_SYNTH_JITTER + GM_SYNTH_BATCH * (GM_SYNTH_LAG + 1);
+    advcol::Merger::MergedCb out = [&](const advcol::Merged &m)
+    {
+        uint64_t ev = synth_event(cfg, m);
+
+        if(ev >= cfg.adverts || seen[ev])
+            bad_ev++;
+        else
+        {
+            seen[ev] = 1;
+            if(m.n != synth_copies(cfg, ev))
+                bad_group++;
+        }
+        if(!m.late)
+        {
+            if(m.ts < last)
+                order++;
+            last = m.ts;
+        }
+        if(print)
+            print_merged(m, cfg.gateways);
+    };
+
+    t = host_time();
+    for(uint32_t gw = 0; gw < cfg.gateways; gw++)
+    {
+        th.emplace_back([&, gw]()
+        {
+            const std::vector<Item> &v = items[gw];
+            uint64_t delay = (uint64_t)GM_SYNTH_BATCH * (gw % GM_SYNTH_LAG + 1), now;
+            uint8_t fr[ADV_HDR_LEN + 255];
+            advcol::Frame f = advcol::Frame();
+            size_t i = 0;
+
+            f.data = fr;
+            while(!done.load(std::memory_order_relaxed))
+            {
+                now = clock.load(std::memory_order_acquire);
+                // a block holds everything stamped before its end
+                while(i < v.size() && (v[i].ts / GM_SYNTH_BATCH + 1) * GM_SYNTH_BATCH + delay <= now)
+                {
+                    f.len = synth_frame(cfg, v[i].ev, gw, fr);
+                    while(!mg.push(gw, f, v[i].ts))
+                        std::this_thread::yield();
+                    i++;
+                }
+                progress[gw].store(now, std::memory_order_release);
+                while(clock.load(std::memory_order_acquire) == now && !done.load(std::memory_order_relaxed))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    for(uint64_t now = GM_SYNTH_T0; now < end && !stop_req; now += GM_SYNTH_STEP)
+    {
+        clock.store(now, std::memory_order_release);
+        for(uint32_t gw = 0; gw < cfg.gateways; gw++)
+        {
+            // pumping meanwhile: a thread may wait for room in its ring
+            while(progress[gw].load(std::memory_order_acquire) != now)
+            {
+                if(!mg.pump(now, out))
+                    std::this_thread::yield();
+            }
+        }
+        mg.pump(now, out);
+    }
+    done = true;
+    for(size_t i = 0; i < th.size(); i++)
+        th[i].join();
+    mg.flush(out);
+    t = host_time() - t;
+
+    advcol::MergeStats st = mg.stats();
+
+    for(uint64_t ev = 0; ev < cfg.adverts && !stop_req; ev++)
+    {
+        if(!seen[ev])
+            bad_ev++;
+    }
+    print_stats(st, t);
+    fprintf(stderr, "%u gateways, %llu adverts, %llu frames: %.0f frames/s; %llu wrong groups, %llu lost or "
+            "extra adverts, %llu out of order\n", cfg.gateways, (unsigned long long)cfg.adverts,
+            (unsigned long long)frames, t > 0 ? st.in / t : 0.0, (unsigned long long)bad_group,
+            (unsigned long long)bad_ev, (unsigned long long)order);
+    return bad_group || bad_ev || order ? 1 : 0;
+}
+
+static void usage()
+{
+    printf("Usage: gwmerge [options] gateway ...\n"
+           "       gwmerge -S N [options]\n"
+           "  gateway  IP address or name, one reader thread each (up to %u)\n"
+           "  -p PORT  gateway TCP port (default 1000)\n"
+           "  -1       v1 framing (default v2)\n"
+           "  -D       compact records\n"
+           "  -Z       receive time records\n"
+           "  -L       compressed v2 blocks\n"
+           "  -w MS    reorder window (default 200)\n"
+           "  -d MS    copies of one advert within (default 20)\n"
+           "  -r N     frames per gateway ring (default 4096)\n"
+           "  -P N     adverts held in the window (default 16384)\n"
+           "  -q       counters only, no adverts\n"
+           "  -H       host receive time, not the gateway stamps\n"
+           "  -t SEC   stop after SEC seconds (default: Ctrl+C)\n"
+           "  -S N     no gateways: N synthetic ones, check the merge\n"
+           "  -n N     synthetic adverts (default 1000000)\n"
+           "  -m N     synthetic devices (default 300)\n"
+           "Output: time MAC gateways RSSI,... adTypes phyTypes data ('L' - late, '.' - not heard)\n",
+           advcol::MERGE_GW_MAX);
+}
+
+int main(int argc, char **argv)
+{
+    advcol::GatewayOptions opt;
+    advcol::MergeOptions mopt;
+    SynthCfg cfg = { 0, 300, 1000000 };
+    bool quiet = false, host_ts = false;
+    double t, t_stop = 0;
+    int c;
+
+    while((c = getopt(argc, argv, "p:1DZLw:d:r:P:qHt:S:n:m:h")) != -1)
+    {
+        switch(c)
+        {
+            case 'p': opt.port = (uint16_t)strtoul(optarg, NULL, 0); break;
+            case '1': opt.framing = STREAM_V1; break;
+            case 'D': opt.compact = true; break;
+            case 'Z': opt.stamp = true; break;
+            case 'L': opt.lz = true; break;
+            case 'w': mopt.window_us = (uint32_t)(strtod(optarg, NULL) * 1e3); break;
+            case 'd': mopt.dedup_us = (uint32_t)(strtod(optarg, NULL) * 1e3); break;
+            case 'r': mopt.ring_size = strtoul(optarg, NULL, 0); break;
+            case 'P': mopt.pending_max = strtoul(optarg, NULL, 0); break;
+            case 'q': quiet = true; break;
+            case 'H': host_ts = true; break;
+            case 't': t_stop = strtod(optarg, NULL); break;
+            case 'S': cfg.gateways = strtoul(optarg, NULL, 0); break;
+            case 'n': cfg.adverts = strtoull(optarg, NULL, 0); break;
+            case 'm': cfg.devices = strtoul(optarg, NULL, 0); break;
+            default: usage(); return 1;
+        }
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    if(cfg.gateways)
+    {
+        if(cfg.gateways > advcol::MERGE_GW_MAX || !cfg.devices || cfg.devices > 0xffffff)
+        {
+            usage();
+            return 1;
+        }
+        return run_synth(cfg, mopt, !quiet);
+    }
+    if(optind >= argc || argc - optind > (int)advcol::MERGE_GW_MAX)
+    {
+        usage();
+        return 1;
+    }
+
+    uint32_t gateways = (uint32_t)(argc - optind);
+    advcol::Merger mg(gateways, mopt);
+    std::vector<std::thread> th;
+    std::atomic<bool> done(false);
+    advcol::Merger::MergedCb out = [&](const advcol::Merged &m)
+    {
+        if(!quiet)
+            print_merged(m, gateways);
+    };
+
+    // reader threads: a collector each, only push() is shared
+    for(uint32_t gw = 0; gw < gateways; gw++)
+    {
+        const char *host = argv[optind + gw];
+
+        th.emplace_back([&, gw, host]()
+        {
+            advcol::Collector col;
+
+            if(col.add(host, opt) < 0)
+            {
+                fprintf(stderr, "%s: bad address\n", host);
+                stop_req = 1;
+                return;
+            }
+            // stamps in UTC as they are, else the time of reception here: the
+            // window follows the host clock, a gateway clock off by more is late
+            col.on_frame([&](const advcol::Frame &f)
+            {
+                mg.push(gw, f, !host_ts && f.has_ts && (f.ts_flags & GWTIME_SYNCED) ? f.ts : unix_us());
+            });
+            while(!done.load(std::memory_order_relaxed) && col.poll(100) >= 0)
+                ;
+        });
+    }
+    t = host_time();
+    while(!stop_req)
+    {
+        if(t_stop && host_time() - t >= t_stop)
+            break;
+        if(!mg.pump(unix_us(), out))
+            usleep(2000);
+        if(!quiet)
+            fflush(stdout);
+    }
+    done = true;
+    for(size_t i = 0; i < th.size(); i++)
+        th[i].join();
+    mg.flush(out);
+    fflush(stdout);
+    print_stats(mg.stats(), host_time() - t);
+    return 0;
+}
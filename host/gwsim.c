@@ -0,0 +1,492 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : gwsim.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : Gateway simulator: the APP layer with injected adverts
+ *                      and a TCP sink with limited bandwidth and stalls
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include "sim.h"
+#include "wchnet.h"
+#include "stats.h"
+#include "eth_driver.h"
+#include "trace.h"
+#include "advcap.h"
+#include "ctrl.h"
+#include "stream.h"
+#include "advenc.h"
+#include "gwtime.h"
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+    double   seconds;           // simulated time
+    uint32_t rate;              // adverts/s, all devices
+    uint32_t devices;
+    uint32_t len;               // advert data length
+    uint32_t ext;               // % of extended adverts
+    uint32_t seed;
+    uint32_t framing;           // STREAM_V1/STREAM_V2, requested after connect
+    uint32_t corrupt;           // flip a byte every N bytes delivered, 0 - never
+    uint32_t encoding;          // ADV_ENC_FULL/ADV_ENC_COMPACT, requested after connect
+    uint32_t stamp;             // request receive time records after connect
+    uint32_t compress;          // STREAM_LZ_OFF/STREAM_LZ_ON, requested after connect
+    uint32_t drop;              // client drops the connection every N ms, 0 - never
+    uint32_t resume;            // request the missed blocks after connect (CTRL_CMD_RESUME)
+    const char *trace;          // trace_ring image file
+    const char *capture;        // advert capture file
+} gwsim_cfg_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static uint32_t rnd_state;
+static uint32_t corrupt_every, corrupt_cnt, corrupted;
+
+// receive time error of the stamped adverts: stamp - injection UTC, us
+static int32_t *stamp_err;
+static uint32_t stamp_n, stamp_max, stamp_unsynced;
+
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+/*********************************************************************
+ * @fn      corrupt_input
+ *
+ * @brief   Client input with a byte flipped every corrupt_every bytes.
+ */
+static void corrupt_input(const uint8_t *data, uint32_t len)
+{
+    uint8_t buf[SEND_BUF_LEN * 2];
+
+    while(len)
+    {
+        uint32_t n = MIN(len, sizeof(buf));
+
+        memcpy(buf, data, n);
+        for(uint32_t i = 0; i < n; i++)
+        {
+            if(++corrupt_cnt >= corrupt_every)
+            {
+                buf[i] ^= 0x5A;
+                corrupt_cnt = 0;
+                corrupted++;
+            }
+        }
+        sim_client_input(buf, n);
+        data += n;
+        len -= n;
+    }
+}
+
+/*********************************************************************
+ * @fn      stamp_frame
+ *
+ * @brief   Frame callback: compare the receive time record of an advert
+ *          with the injection time gen_adv() put into its data.
+ */
+static void stamp_frame(const uint8_t *frame, uint32_t len)
+{
+    uint64_t ts, utc = 0;
+    uint8_t flags;
+
+    if(frame[1] == ADV_SVC_MARKER || frame[0] < 8 || !sim_client_stamp(&ts, &flags))
+        return;
+    if(!(flags & GWTIME_SYNCED))
+    {
+        stamp_unsynced++;
+        return;
+    }
+    for(int i = 7; i >= 0; i--)
+        utc = (utc << 8) | frame[ADV_HDR_LEN + i];
+    if(stamp_n == stamp_max)
+    {
+        stamp_max = stamp_max ? stamp_max * 2 : 65536;
+        stamp_err = realloc(stamp_err, stamp_max * sizeof(*stamp_err));
+        if(!stamp_err)
+            exit(1);
+    }
+    stamp_err[stamp_n++] = (int32_t)(int64_t)(ts - utc);
+}
+
+static int cmp_abs(const void *a, const void *b)
+{
+    int32_t x = abs(*(const int32_t *)a), y = abs(*(const int32_t *)b);
+
+    return (x > y) - (x < y);
+}
+
+/*********************************************************************
+ * @fn      gen_adv
+ *
+ * @brief   Next advert of the synthetic population.
+ */
+static void gen_adv(const gwsim_cfg_t *cfg, sim_adv_t *adv)
+{
+    uint32_t dev = rnd() % cfg->devices;
+
+    memset(adv, 0, sizeof(*adv));
+    adv->ext = (rnd() % 100) < cfg->ext;
+    adv->eventType = adv->ext ? GAP_ADRPT_EXT_NONCONN_NONSCAN_UNDIRECT : GAP_ADRPT_ADV_NONCONN_IND;
+    adv->addrType = ADDRTYPE_PUBLIC;
+    adv->primaryPHY = adv->ext ? GAP_PHY_BIT_LE_CODED : GAP_PHY_BIT_LE_1M;
+    adv->secondaryPHY = adv->ext ? GAP_PHY_BIT_LE_CODED : GAP_PHY_BIT_LE_1M;
+    adv->rssi = -40 - (int8_t)(rnd() % 50);
+    adv->addr[0] = (uint8_t)dev;
+    adv->addr[1] = (uint8_t)(dev >> 8);
+    adv->addr[2] = (uint8_t)(dev >> 16);
+    adv->addr[3] = 0x38;
+    adv->addr[4] = 0xC1;
+    adv->addr[5] = 0xA4;
+    adv->dataLen = (uint8_t)cfg->len;
+    for(uint32_t i = 0; i < cfg->len; i++)
+        adv->data[i] = (uint8_t)rnd();
+    if(cfg->stamp && cfg->len >= 8)
+    {
+        // true reception time for stamp_frame()
+        uint64_t utc = sim_utc_us();
+
+        for(int i = 0; i < 8; i++)
+            adv->data[i] = (uint8_t)(utc >> (i * 8));
+    }
+}
+
+/*********************************************************************
+ * @fn      capture_adv
+ *
+ * @brief   Append the advert to the capture, timestamp - now.
+ */
+static void capture_adv(advcap_t *cap, const sim_adv_t *adv)
+{
+    advcap_rec_t rec;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.ts = sim_now() / SIM_NS_PER_US;
+    rec.type = adv->ext ? ADVCAP_EXT_ADV_INFO : ADVCAP_DEVICE_INFO;
+    rec.eventType = adv->eventType;
+    rec.addrType = adv->addrType;
+    rec.primaryPHY = adv->primaryPHY;
+    rec.secondaryPHY = adv->secondaryPHY;
+    rec.rssi = adv->rssi;
+    memcpy(rec.addr, adv->addr, sizeof(rec.addr));
+    rec.advertisingSID = 0xFF;
+    rec.txPower = 127;
+    rec.dataLen = adv->dataLen;
+    advcap_write(cap, &rec, adv->data);
+}
+
+static void usage(void)
+{
+    printf("Usage: gwsim [options]\n"
+           "  -t SEC   simulated time, s (default 10)\n"
+           "  -r N     adverts per second (default 500)\n"
+           "  -n N     number of devices (default 100)\n"
+           "  -l N     advert data length (default 31)\n"
+           "  -x PCT   share of extended adverts, %% (default 0)\n"
+           "  -b N     sink bandwidth, bytes/s, 0 - unlimited (default 1000000)\n"
+           "  -w N     TCP send window, bytes (default %u)\n"
+           "  -s MS    client stall period, ms (default 0 - no stalls)\n"
+           "  -S MS    client stall length, ms (default 100)\n"
+           "  -c MS    client connect delay, ms (default 100)\n"
+           "  -d US    client round trip time, the window is freed by ACKs, us (default 0)\n"
+           "  -H       half duplex link, the gateway paces short segments (ETH_LINK_SLOW)\n"
+           "  -k MS    PHY link up after boot, ms (default 0)\n"
+           "  -g MS    DHCP server answer time, ms (default 0)\n"
+           "  -G       the lease of a previous boot is kept in flash (ipcfg.h)\n"
+           "  -M       as -G, the lease is of another network: no router answers the ARP check\n"
+           "  -O       as -G, another host has the address now, DHCP gives a new one\n"
+           "  -2       request v2 stream framing after connect\n"
+           "  -E N     corrupt one byte every N bytes received by the client\n"
+           "  -D       request compact records (device dictionary) after connect\n"
+           "  -L       request v2 framing and compressed blocks after connect\n"
+           "  -Z       request receive time records after connect, check them\n"
+           "  -K MS    client drops the connection every MS ms, connects again after -c\n"
+           "  -Q       request the blocks missed while not connected (v2 resume)\n"
+           "  -P PPM   HSE crystal error, ppm (default 0)\n"
+           "  -u US    SNTP request path delay, us (default 250)\n"
+           "  -U US    SNTP reply path delay, us (default 250)\n"
+           "  -j US    SNTP and twsync path jitter, us (default 0)\n"
+           "  -W MS    twsync collector on the LAN, probe period, ms (default 0 - none)\n"
+           "  -J US    gateway stack delay jitter on the twsync path, us (default 200)\n"
+           "  -i NS    main loop WFI wakeup latency, ns (default %u)\n"
+           "  -I       busy main loop, no WFI (HAL_WFI FALSE)\n"
+           "  -T FILE  write the trace_ring image (tools/trace2json.py)\n"
+           "  -C FILE  write the generated adverts as a capture (advreplay)\n"
+           "  -R N     random seed\n"
+           "  -v       firmware debug output\n",
+           WCHNET_TCP_MSS * WCHNET_NUM_TCP_SEG, SIM_WAKE_NS);
+}
+
+int main(int argc, char **argv)
+{
+    gwsim_cfg_t cfg = { 10.0, 500, 100, 31, 0, 1, STREAM_V1, 0, ADV_ENC_FULL, 0, STREAM_LZ_OFF, 0, 0, NULL, NULL };
+    sim_sink_cfg_t sink = { 1000000, WCHNET_TCP_MSS * WCHNET_NUM_TCP_SEG, 0, 100, 100 };
+    sim_sntp_cfg_t sntp = { 250, 250, 0, 0 };
+    sim_twsync_cfg_t tw = { 0, 50, 50, 0, 200 };
+    sim_idle_cfg_t idle = { SIM_WAKE_NS, 0 };
+    const sim_idle_stats_t *is;
+    const sim_twsync_stats_t *tws;
+    const twsync_col_t *col;
+    int32_t ppm = 0;
+    int lease = 0;
+    uint64_t end, next_adv, next_drop, step;
+    uint32_t injected = 0, missed = 0, lost_seen = 0, drops = 0;
+    uint8_t framing_sent = 0, encoding_sent = 0, stamp_sent = 0, compress_sent = 0, resume_sent = 0;
+    const sim_sink_stats_t *ss;
+    const sim_client_stats_t *cs;
+    gw_stats_rep_t st;
+    struct timespec t0, t1;
+    double wall, sec;
+    sim_adv_t adv;
+    advcap_t cap;
+    int c;
+
+    while((c = getopt(argc, argv, "t:r:n:l:x:b:w:s:S:c:d:Hk:g:GMO2E:DLZK:QP:u:U:j:W:J:i:IT:C:R:vh")) != -1)
+    {
+        switch(c)
+        {
+            case 't': cfg.seconds = atof(optarg); break;
+            case 'r': cfg.rate = strtoul(optarg, NULL, 0); break;
+            case 'n': cfg.devices = strtoul(optarg, NULL, 0); break;
+            case 'l': cfg.len = strtoul(optarg, NULL, 0); break;
+            case 'x': cfg.ext = strtoul(optarg, NULL, 0); break;
+            case 'b': sink.bandwidth = strtoul(optarg, NULL, 0); break;
+            case 'w': sink.window = strtoul(optarg, NULL, 0); break;
+            case 's': sink.stall_period = strtoul(optarg, NULL, 0); break;
+            case 'S': sink.stall_len = strtoul(optarg, NULL, 0); break;
+            case 'c': sink.connect_delay = strtoul(optarg, NULL, 0); break;
+            case 'd': sink.rtt_us = strtoul(optarg, NULL, 0); break;
+            case 'H': sink.half_duplex = 1; break;
+            case 'k': sink.link_ms = strtoul(optarg, NULL, 0); break;
+            case 'g': sink.dhcp_ms = strtoul(optarg, NULL, 0); break;
+            case 'G': lease = 1 + SIM_LEASE_SAME; break;
+            case 'M': lease = 1 + SIM_LEASE_MOVED; break;
+            case 'O': lease = 1 + SIM_LEASE_TAKEN; break;
+            case '2': cfg.framing = STREAM_V2; break;
+            case 'E': cfg.corrupt = strtoul(optarg, NULL, 0); break;
+            case 'D': cfg.encoding = ADV_ENC_COMPACT; break;
+            case 'L': cfg.compress = STREAM_LZ_ON; cfg.framing = STREAM_V2; break;
+            case 'Z': cfg.stamp = 1; break;
+            case 'K': cfg.drop = strtoul(optarg, NULL, 0); break;
+            case 'Q': cfg.resume = 1; cfg.framing = STREAM_V2; break;
+            case 'P': ppm = strtol(optarg, NULL, 0); break;
+            case 'u': sntp.up_us = strtoul(optarg, NULL, 0); break;
+            case 'U': sntp.down_us = strtoul(optarg, NULL, 0); break;
+            case 'j': sntp.jitter_us = tw.jitter_us = strtoul(optarg, NULL, 0); break;
+            case 'W': tw.period_ms = strtoul(optarg, NULL, 0); break;
+            case 'J': tw.stack_us = strtoul(optarg, NULL, 0); break;
+            case 'i': idle.wake_ns = strtoul(optarg, NULL, 0); break;
+            case 'I': idle.poll = 1; break;
+            case 'T': cfg.trace = optarg; break;
+            case 'C': cfg.capture = optarg; break;
+            case 'R': cfg.seed = strtoul(optarg, NULL, 0); break;
+            case 'v': sim_verbose = 1; break;
+            default: usage(); return 1;
+        }
+    }
+    if(cfg.len > 255 - 6 || !cfg.devices || !cfg.rate)
+    {
+        usage();
+        return 1;
+    }
+    rnd_state = cfg.seed ? cfg.seed : 1;
+    if(cfg.capture && advcap_create(&cap, cfg.capture, 1000000))
+    {
+        perror(cfg.capture);
+        return 1;
+    }
+
+    corrupt_every = cfg.corrupt;
+    sim_net_config(&sink, cfg.corrupt ? corrupt_input : sim_client_input);
+    sim_client_reset(cfg.stamp ? stamp_frame : NULL);
+    sim_sntp_config(&sntp);
+    sim_twsync_config(&tw);
+    sim_set_xtal_ppm(ppm);
+    sim_idle_config(&idle);
+    if(lease)
+        sim_net_lease_keep(lease - 1);
+    sim_gw_init();
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    end = (uint64_t)(cfg.seconds * SIM_NS_PER_SEC);
+    step = SIM_NS_PER_SEC / cfg.rate;
+    next_adv = step;
+    next_drop = (uint64_t)cfg.drop * SIM_NS_PER_MS;
+    while(next_adv < end)
+    {
+        sim_gw_run_until(next_adv);
+        if(cfg.drop && next_adv >= next_drop)
+        {
+            next_drop += (uint64_t)cfg.drop * SIM_NS_PER_MS;
+            if(sim_net_connected())
+            {
+                // a new connection is a new session: everything is requested again
+                sim_net_disconnect();
+                sim_client_restart();
+                framing_sent = encoding_sent = compress_sent = stamp_sent = resume_sent = 0;
+                drops++;
+            }
+        }
+        if(cfg.resume && !resume_sent && sim_net_connected())
+        {
+            uint32_t seq;
+            uint8_t cmd[6] = { CTRL_CMD_RESUME, 4 };
+
+            // nothing received yet: all the gateway holds, recorded before the first connect
+            if(!sim_client_seq(&seq))
+                seq = 0;
+            cmd[2] = (uint8_t)seq;
+            cmd[3] = (uint8_t)(seq >> 8);
+            cmd[4] = (uint8_t)(seq >> 16);
+            cmd[5] = (uint8_t)(seq >> 24);
+            resume_sent = sim_net_client_send(cmd, sizeof(cmd));
+        }
+        if(cfg.framing != STREAM_V1 && !framing_sent && sim_net_connected())
+        {
+            uint8_t cmd[3] = { CTRL_CMD_FRAMING, 1, (uint8_t)cfg.framing };
+
+            framing_sent = sim_net_client_send(cmd, sizeof(cmd));
+        }
+        cs = sim_client_stats();
+        if(cs->block_err + cs->block_lost != lost_seen)
+        {
+            // blocks lost: the client dictionary is cleared, restart the gateway one
+            lost_seen = cs->block_err + cs->block_lost;
+            encoding_sent = 0;
+        }
+        if(cfg.encoding != ADV_ENC_FULL && !encoding_sent && sim_net_connected())
+        {
+            uint8_t cmd[3] = { CTRL_CMD_ENCODING, 1, (uint8_t)cfg.encoding };
+
+            encoding_sent = sim_net_client_send(cmd, sizeof(cmd));
+        }
+        if(cfg.compress != STREAM_LZ_OFF && !compress_sent && sim_net_connected())
+        {
+            uint8_t cmd[3] = { CTRL_CMD_COMPRESS, 1, (uint8_t)cfg.compress };
+
+            compress_sent = sim_net_client_send(cmd, sizeof(cmd));
+        }
+        if(cfg.stamp && !stamp_sent && sim_net_connected())
+        {
+            uint8_t cmd[3] = { CTRL_CMD_TIMESTAMP, 1, 1 };
+
+            stamp_sent = sim_net_client_send(cmd, sizeof(cmd));
+        }
+        gen_adv(&cfg, &adv);
+        if(sim_ble_inject(&adv))
+            injected++;
+        else
+            missed++;
+        if(cfg.capture)
+            capture_adv(&cap, &adv);
+        // jitter +-25% around the mean interval
+        next_adv += step - step / 4 + rnd() % (step / 2 + 1);
+    }
+    sim_gw_run_until(end);
+    if(cfg.capture)
+        advcap_close(&cap);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+
+    ss = sim_net_stats();
+    cs = sim_client_stats();
+    stats_get(&st);
+    sec = cfg.seconds;
+    printf("simulated time     %.3f s (%.3f s host)\n", sec, wall);
+    printf("adverts injected   %u (%.0f/s), not scanning %u\n", injected, injected / sec, missed);
+    printf("adverts received   %u (%.0f/s), service frames %u\n", cs->adverts, cs->adverts / sec, cs->svc);
+    printf("adverts lost       %d (%.2f%%)\n", (int)(injected - cs->adverts),
+           injected ? (injected - cs->adverts) * 100.0 / injected : 0.0);
+    printf("stream             %llu bytes (%.0f B/s), %.1f bytes/advert\n",
+           (unsigned long long)ss->bytes, ss->bytes / sec,
+           cs->adverts ? (double)cs->bytes / cs->adverts : 0.0);
+    printf("socket send        %u calls, %u short, %u busy, %llu bytes not accepted\n",
+           ss->send_calls, ss->send_short, ss->send_busy, (unsigned long long)ss->send_rest);
+    printf("sink               %u stalls, in flight max %u bytes\n", ss->stalls, ss->inflight_hwm);
+    printf("link               %u Mbit/s, %s duplex%s\n", st.eth_mbps, (st.eth_link & ETH_LINK_FDX) ? "full" : "half",
+           (st.eth_link & ETH_LINK_SLOW) ? ", slow send mode" : "");
+    printf("TX FIFO            %u of %u bytes max\n", st.fifo_hwm, st.fifo_size);
+    printf("boot, ms           link %u, address %u (DHCP %u), first advert %u, client %u, first data %u\n",
+           st.boot_ms[BOOT_LINK], st.boot_ms[BOOT_IP], st.boot_ms[BOOT_DHCP], st.boot_ms[BOOT_SCAN],
+           st.boot_ms[BOOT_CONNECT], st.boot_ms[BOOT_SEND]);
+    is = sim_idle_get_stats();
+    printf("main loop          %u passes (%.0f/s), %u WFI, idle %.1f%%\n", st.loop_num, st.loop_num / sec,
+           st.sleep_num, st.idle_pm / 10.0);
+    printf("advert wakeup      %u events, latency avg %.2f us, max %.2f us\n", is->events,
+           is->events ? is->lat_sum / 1000.0 / is->events : 0.0, is->lat_max / 1000.0);
+    if(cfg.encoding == ADV_ENC_COMPACT)
+        printf("compact records    %u, unknown handle %u\n", cs->compact, cs->dict_miss);
+    if(cfg.framing == STREAM_V2 || cfg.corrupt)
+        printf("v2 blocks          %u good, %u bad, %u lost, %llu bytes skipped, %u bytes corrupted\n",
+               cs->blocks, cs->block_err, cs->block_lost, (unsigned long long)cs->skipped, corrupted);
+    if(cfg.drop || cfg.resume)
+        printf("resume             %u drops, %u requests, %u blocks replayed, %u duplicates, %u dropped from the ring\n",
+               drops, st.resume_req, st.resume_blocks, cs->block_dup, st.resume_drop);
+    if(cfg.compress != STREAM_LZ_OFF)
+        printf("compression        %u -> %u bytes (%.2f:1), %u blocks compressed\n",
+               st.lz_in, st.lz_out, st.lz_out ? (double)st.lz_in / st.lz_out : 0.0, cs->lz_blocks);
+    if(cfg.stamp)
+    {
+        printf("clock              %u samples, offset %d us, delay %u us, rate %+.3f ppm (crystal %+d ppm)%s\n",
+               gwtime_stat.syncs, (int)gwtime_stat.offset, (unsigned)gwtime_stat.delay,
+               gwtime_stat.rate / 1000.0, (int)ppm, gwtime_flags() & GWTIME_TWSYNC ? ", twsync" : "");
+        printf("clock error        %+lld us at the end\n", (long long)(int64_t)(gwtime_now() - sim_utc_us()));
+        printf("receive time       %u records, %u adverts checked, %u before sync\n",
+               cs->stamps, stamp_n, stamp_unsynced);
+        if(stamp_n)
+        {
+            qsort(stamp_err, stamp_n, sizeof(*stamp_err), cmp_abs);
+            printf("receive time error |p50| %d us, |p99| %d us, |max| %d us\n",
+                   abs(stamp_err[stamp_n / 2]), abs(stamp_err[(uint64_t)stamp_n * 99 / 100]),
+                   abs(stamp_err[stamp_n - 1]));
+        }
+    }
+
+    if(tw.period_ms)
+    {
+        tws = sim_twsync_get_stats();
+        col = sim_twsync_collector();
+        printf("twsync             %u probes, %u replies, %u corrections, %u samples (%u callback stamped)\n",
+               tws->probes, tws->replies, tws->sets, col->samples, col->sw_stamps);
+        printf("twsync fit         %u samples used, delay min %u us, residual %.2f us rms, rate %+.3f ppm\n",
+               col->used, col->delay_min, col->rms, col->rate / 1000.0);
+    }
+
+    if(cfg.trace)
+    {
+        FILE *f = fopen(cfg.trace, "wb");
+
+        if(!f || fwrite(&trace_ring, sizeof(trace_ring), 1, f) != 1)
+        {
+            perror(cfg.trace);
+            return 1;
+        }
+        fclose(f);
+    }
+    // no corruption injected: every block and compact record must decode
+    if(!cfg.corrupt && (cs->block_err || cs->dict_miss || (injected > missed && !cs->adverts)))
+    {
+        fprintf(stderr, "stream check failed: %u of %u adverts, %u bad blocks, %u dictionary misses\n",
+                cs->adverts, injected, cs->block_err, cs->dict_miss);
+        return 1;
+    }
+    return 0;
+}
+
+/******************************** endfile @ gwsim ******************************/
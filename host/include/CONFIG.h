@@ -0,0 +1,30 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : CONFIG.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : Host build stand-in for HAL/include/config.h
+ *********************************************************************************/
+
+#ifndef __CONFIG_H
+#define __CONFIG_H
+
+#define ID_CH32V208                         0x0208
+
+#define CHIP_ID                             ID_CH32V208
+
+#include "wchble.h"
+
+#include "ch32v20x.h"
+#include "debug.h"
+
+#ifndef BLE_MEMHEAP_SIZE
+#define BLE_MEMHEAP_SIZE                    (1024*7)
+#endif
+
+// one flat memory on the host
+#define __HIGH_CODE
+
+extern uint32_t MEM_BUF[BLE_MEMHEAP_SIZE / 4];
+
+#endif
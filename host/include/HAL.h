@@ -0,0 +1,27 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : HAL.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : Host build stand-in for HAL/include/HAL.h
+ *********************************************************************************/
+
+#ifndef __HAL_H
+#define __HAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "CONFIG.h"
+
+extern tmosTaskID halTaskID;
+
+extern void HAL_Init(void);
+extern void WCHBLE_Init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
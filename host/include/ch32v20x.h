@@ -0,0 +1,168 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : ch32v20x.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : Host build stand-in for the CH32V20x device header.
+ *                      Only what the application layer touches, peripherals
+ *                      are fake register blocks in host/sim/sim_hw.c
+ *********************************************************************************/
+
+#ifndef __CH32V20x_H
+#define __CH32V20x_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define __IO    volatile
+#define __I     volatile const
+#define __O     volatile
+
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef uint8_t  u8;
+
+typedef int32_t  s32;
+typedef int16_t  s16;
+typedef int8_t   s8;
+
+typedef enum {NoREADY = 0, READY = !NoREADY} ErrorStatus;
+
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+
+#define RV_STATIC_INLINE  static inline
+
+/* Interrupt numbers used by the application */
+typedef enum
+{
+    DMA1_Channel7_IRQn = 33,
+    TIM2_IRQn = 44,
+    ETH_IRQn  = 77,
+    BB_IRQn   = 78,
+    LLE_IRQn  = 79,
+} IRQn_Type;
+
+/* Timer */
+typedef struct
+{
+    uint16_t TIM_Prescaler;
+    uint16_t TIM_CounterMode;
+    uint16_t TIM_Period;
+    uint16_t TIM_ClockDivision;
+    uint8_t  TIM_RepetitionCounter;
+} TIM_TimeBaseInitTypeDef;
+
+typedef struct
+{
+    __IO uint16_t CTLR1;
+    __IO uint16_t CNT;
+    __IO uint16_t PSC;
+    __IO uint16_t ATRLR;
+    __IO uint16_t CH4CVR;
+    __IO uint16_t DMAINTENR;
+    __IO uint16_t INTFR;
+} TIM_TypeDef;
+
+extern TIM_TypeDef sim_tim2;
+#define TIM2                        (&sim_tim2)
+
+#define TIM_CounterMode_Up          ((uint16_t)0x0000)
+#define TIM_IT_Update               ((uint16_t)0x0001)
+#define TIM_OPMode_Single           ((uint16_t)0x0008)
+#define TIM_CEN                     ((uint16_t)0x0001)
+#define RCC_APB1Periph_TIM2         ((uint32_t)0x00000001)
+
+/* DMA */
+typedef struct
+{
+    uint32_t DMA_PeripheralBaseAddr;
+    uint32_t DMA_MemoryBaseAddr;
+    uint32_t DMA_DIR;
+    uint32_t DMA_BufferSize;
+    uint32_t DMA_PeripheralInc;
+    uint32_t DMA_MemoryInc;
+    uint32_t DMA_PeripheralDataSize;
+    uint32_t DMA_MemoryDataSize;
+    uint32_t DMA_Mode;
+    uint32_t DMA_Priority;
+    uint32_t DMA_M2M;
+} DMA_InitTypeDef;
+
+typedef struct
+{
+    __IO uint32_t CFGR;
+    __IO uint32_t CNTR;
+    __IO uint32_t PADDR;
+    __IO uint32_t MADDR;
+} DMA_Channel_TypeDef;
+
+extern DMA_Channel_TypeDef sim_dma_ch7;
+#define DMA1_Channel7               (&sim_dma_ch7)
+
+#define DMA_CFGR1_EN                ((uint16_t)0x0001)
+#define DMA_CFGR1_PSIZE             ((uint16_t)0x0300)
+#define DMA_CFGR1_MSIZE             ((uint16_t)0x0C00)
+#define DMA_DIR_PeripheralSRC       ((uint32_t)0x00000000)
+#define DMA_PeripheralInc_Enable    ((uint32_t)0x00000040)
+#define DMA_MemoryInc_Enable        ((uint32_t)0x00000080)
+#define DMA_PeripheralDataSize_Byte ((uint32_t)0x00000000)
+#define DMA_PeripheralDataSize_Word ((uint32_t)0x00000200)
+#define DMA_MemoryDataSize_Byte     ((uint32_t)0x00000000)
+#define DMA_MemoryDataSize_Word     ((uint32_t)0x00000800)
+#define DMA_Mode_Normal             ((uint32_t)0x00000000)
+#define DMA_Priority_Low            ((uint32_t)0x00000000)
+#define DMA_M2M_Enable              ((uint32_t)0x00004000)
+#define DMA_IT_TC                   ((uint32_t)0x00000002)
+#define DMA1_IT_TC7                 ((uint32_t)0x02000000)
+#define RCC_AHBPeriph_DMA1          ((uint32_t)0x00000001)
+
+/* PHY */
+#define PHY_Linked_Status           ((uint16_t)0x0004)
+
+/* FLASH: one fast page of data flash, the lease of ipcfg.c, erased to 0xE339 as the chip */
+#define SIM_FLASH_PAGE              256
+#define SIM_FLASH_ERASED            0xE339E339
+
+extern uint32_t sim_flash_page[SIM_FLASH_PAGE / 4];
+#define IPCFG_LEASE_ADDR            ((uint32_t)(uintptr_t)sim_flash_page)
+
+extern uint32_t SystemCoreClock;
+
+void RCC_APB1PeriphClockCmd(uint32_t RCC_APB1Periph, FunctionalState NewState);
+void TIM_TimeBaseInit(TIM_TypeDef *TIMx, TIM_TimeBaseInitTypeDef *TIM_TimeBaseInitStruct);
+void TIM_ITConfig(TIM_TypeDef *TIMx, uint16_t TIM_IT, FunctionalState NewState);
+void TIM_Cmd(TIM_TypeDef *TIMx, FunctionalState NewState);
+void TIM_ClearITPendingBit(TIM_TypeDef *TIMx, uint16_t TIM_IT);
+void TIM_SelectOnePulseMode(TIM_TypeDef *TIMx, uint16_t TIM_OPMode);
+void TIM_SetAutoreload(TIM_TypeDef *TIMx, uint16_t Autoreload);
+void TIM_SetCounter(TIM_TypeDef *TIMx, uint16_t Counter);
+void RCC_AHBPeriphClockCmd(uint32_t RCC_AHBPeriph, FunctionalState NewState);
+void DMA_Init(DMA_Channel_TypeDef *DMAy_Channelx, DMA_InitTypeDef *DMA_InitStruct);
+void DMA_ITConfig(DMA_Channel_TypeDef *DMAy_Channelx, uint32_t DMA_IT, FunctionalState NewState);
+void DMA_ClearITPendingBit(uint32_t DMAy_IT);
+void FLASH_Unlock_Fast(void);
+void FLASH_Lock_Fast(void);
+void FLASH_ErasePage_Fast(uint32_t Page_Address);
+void FLASH_ProgramPage_Fast(uint32_t Page_Address, uint32_t *pbuf);
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+
+/* CRC unit: CRC-32/MPEG-2 over 32-bit words */
+void     CRC_ResetDR(void);
+uint32_t CRC_CalcCRC(uint32_t Data);
+uint32_t CRC_CalcBlockCRC(uint32_t pBuffer[], uint32_t BufferLength);
+uint32_t CRC_GetCRC(void);
+
+#define __disable_irq()
+#define __enable_irq()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CH32V20x_H */
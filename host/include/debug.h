@@ -0,0 +1,55 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : debug.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : Host build stand-in for SRC/Debug/debug.h,
+ *                      SysTick is the simulation clock
+ *********************************************************************************/
+
+#ifndef __DEBUG_H
+#define __DEBUG_H
+
+#include "stdio.h"
+#include "ch32v20x.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef DEBUG
+#define DEBUG   1
+#endif
+
+void Delay_Init(void);
+void Delay_Us(uint32_t n);
+void Delay_Ms(uint32_t n);
+
+extern int sim_verbose;
+
+#if(DEBUG)
+  #define PRINT(format, ...)    do{ if(sim_verbose) printf(format, ##__VA_ARGS__); }while(0)
+#else
+  #define PRINT(X...)
+#endif
+
+/* SysTick of the simulated core: HCLK/8 */
+#define SYSTICK_FREQ   (SystemCoreClock / 8)
+
+extern uint64_t sim_systick(void);
+
+RV_STATIC_INLINE uint32_t SysTick_GetCount(void)
+{
+    return (uint32_t)sim_systick();
+}
+
+RV_STATIC_INLINE uint64_t SysTick_GetCount64(void)
+{
+    return sim_systick();
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,55 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : eth_driver.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : Host build stand-in for NetLib/eth_driver.h,
+ *                      the driver itself is modelled by host/sim/sim_net.c
+ *********************************************************************************/
+
+#ifndef __ETH_DRIVER__
+#define __ETH_DRIVER__
+
+#ifdef __cplusplus
+ extern "C" {
+#endif
+
+#include "debug.h"
+
+#ifndef WCHNETTIMERPERIOD
+#define WCHNETTIMERPERIOD                       10   /* Timer period, in Ms. */
+#endif
+
+#define WCHNET_TICK_FAST_MS                     50   /* TCP connection open: retransmit unit, delayed ACK */
+#define WCHNET_TICK_SLOW_MS                     500  /* listening only: ARP ageing, DHCP lease */
+
+#define ETH_LINK_MBPS             10   /* the only rate of the built-in PHY */
+
+#define ETH_LINK_UP               0x01 /* ETH_LinkState() bits, stats eth_link */
+#define ETH_LINK_FDX              0x02 /* full duplex */
+#define ETH_LINK_SLOW             0x04 /* half duplex or errors: slow send mode */
+
+/* ETHERNET errors */
+#define  ETH_ERROR              ((uint32_t)0)
+#define  ETH_SUCCESS            ((uint32_t)1)
+
+/* definition for Ethernet frame */
+#define ETH_MAX_PACKET_SIZE    1536    /* ETH_HEADER + VLAN_TAG + MAX_ETH_PAYLOAD + ETH_CRC */
+
+#include "wchnet.h"
+
+extern SOCK_INF SocketInf[ ];
+
+void WCHNET_MainTask( void );
+void WCHNET_TimeIsr( uint16_t timperiod );
+uint32_t WCHNET_TimeUpdate( void );
+uint32_t WCHNET_TimePeriod( void );
+uint8_t ETH_LinkState( void );
+uint32_t ETH_TxPktChainMode( uint16_t len, uint32_t *pBuff );
+uint8_t ETH_LibInit( uint8_t *ip, uint8_t *gwip, uint8_t *mask, uint8_t *macaddr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
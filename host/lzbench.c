@@ -0,0 +1,386 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : lzbench.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/20
+ * Description        : Block compression benchmark: advert captures
+ *                      (.advc) packed into v2 block payloads, lz.c
+ *                      compress/decompress speed and ratio
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "sim.h"
+#include "advcap.h"
+#include "wchnet.h"
+#include "ctrl.h"
+#include "stream.h"
+#include "advenc.h"
+#include "lz.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define LZB_PAYLOAD_MAX         ((SEND_BUF_LEN - sizeof(stream_blk_hdr_t) - STREAM_CRC_LEN) & ~3)
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+    uint32_t block;             // payload size, bytes
+    uint32_t loops;
+    uint32_t encoding;          // ADV_ENC_FULL/ADV_ENC_COMPACT
+    uint32_t synth;             // synthetic population, devices, 0 - captures only
+    uint32_t count;             // synthetic reports
+    uint32_t seed;
+} lzb_cfg_t;
+
+typedef struct
+{
+    uint8_t *raw;
+    uint16_t raw_len;
+    uint16_t lz_len;            // 0 - sent raw
+    uint8_t *lz;
+    uint64_t cyc;               // fastest compression over the loops
+} lzb_block_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static lzb_block_t *blocks;
+static uint32_t blk_num, blk_size;
+static uint8_t blk_buf[SEND_BUF_LEN];
+static uint32_t blk_len;
+static uint32_t records;
+static uint32_t rnd_state;
+
+static uint32_t rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 17;
+    rnd_state ^= rnd_state << 5;
+    return rnd_state;
+}
+
+static inline uint64_t host_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * SIM_NS_PER_SEC + t.tv_nsec;
+#endif
+}
+
+static double host_time(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/*********************************************************************
+ * @fn      block_flush
+ *
+ * @brief   Close the block being packed.
+ */
+static void block_flush(void)
+{
+    lzb_block_t *b;
+
+    if(!blk_len)
+        return;
+    if(blk_num == blk_size)
+    {
+        blk_size = blk_size ? blk_size * 2 : 1024;
+        blocks = realloc(blocks, blk_size * sizeof(*blocks));
+        if(!blocks)
+            exit(1);
+    }
+    b = &blocks[blk_num++];
+    b->raw = malloc(blk_len);
+    b->lz = malloc(LZ_BOUND(blk_len));
+    if(!b->raw || !b->lz)
+        exit(1);
+    memcpy(b->raw, blk_buf, blk_len);
+    b->raw_len = (uint16_t)blk_len;
+    b->lz_len = 0;
+    b->cyc = UINT64_MAX;
+    blk_len = 0;
+}
+
+/*********************************************************************
+ * @fn      block_put
+ *
+ * @brief   Append a record, as stream_block() does: whole records up
+ *          to the payload size.
+ */
+static void block_put(const lzb_cfg_t *cfg, const uint8_t *rec, uint32_t len)
+{
+    if(blk_len + len > cfg->block)
+        block_flush();
+    memcpy(&blk_buf[blk_len], rec, len);
+    blk_len += len;
+}
+
+/*********************************************************************
+ * @fn      report_put
+ *
+ * @brief   An advert report as ObserverEventCB() queues it: a v1 frame
+ *          or a compact record.
+ */
+static void report_put(const lzb_cfg_t *cfg, const advcap_rec_t *rec, const uint8_t *data)
+{
+    uint8_t frame[ADV_HDR_LEN + 255];
+    uint8_t out[ADV_REC_MAX + ADV_HDR_LEN + 8];
+    uint32_t len;
+
+    frame[0] = rec->dataLen;
+    frame[1] = rec->eventType | (rec->addrType << 4);
+    if(rec->type == ADVCAP_EXT_ADV_INFO)
+        frame[2] = rec->primaryPHY | (rec->secondaryPHY << 4);
+    else
+        frame[2] = GAP_PHY_BIT_LE_1M | (GAP_PHY_BIT_LE_1M << 4);
+    frame[3] = (uint8_t)rec->rssi;
+    memcpy(&frame[4], rec->addr, B_ADDR_LEN);
+    memcpy(&frame[ADV_HDR_LEN], data, rec->dataLen);
+    records++;
+    if(cfg->encoding == ADV_ENC_COMPACT)
+    {
+        len = advenc_encode(frame, out);
+        advenc_commit(frame);
+        block_put(cfg, out, len);
+    }
+    else
+        block_put(cfg, frame, ADV_HDR_LEN + rec->dataLen);
+}
+
+/*********************************************************************
+ * @fn      synth_adv
+ *
+ * @brief   Stand-in for a capture: devices with the common advert
+ *          layouts (flags, service data 0x181A / BTHome / MiBeacon,
+ *          iBeacon, Apple manufacturer data), a few changing bytes.
+ */
+static uint32_t synth_adv(uint32_t dev, uint8_t *d)
+{
+    static const uint8_t flags[3] = { 0x02, 0x01, 0x06 };
+    uint32_t kind = (dev * 2654435761u) >> 29, n = sizeof(flags), i;
+
+    memcpy(d, flags, sizeof(flags));
+    switch(kind)
+    {
+        case 0: case 1:                         // custom 0x181A: mac, temp, hum, battery, count
+            d[n++] = 0x12; d[n++] = 0x16; d[n++] = 0x1A; d[n++] = 0x18;
+            d[n++] = (uint8_t)dev; d[n++] = (uint8_t)(dev >> 8); d[n++] = 0x38;
+            d[n++] = 0xC1; d[n++] = 0xA4; d[n++] = 0x00;
+            for(i = 0; i < 8; i++)
+                d[n++] = (uint8_t)(i < 4 ? rnd() : rnd() & 0x0F);
+            break;
+        case 2: case 3:                         // BTHome v2
+            d[n++] = 0x0D; d[n++] = 0x16; d[n++] = 0xD2; d[n++] = 0xFC; d[n++] = 0x40;
+            d[n++] = 0x00; d[n++] = (uint8_t)rnd(); d[n++] = 0x01; d[n++] = 0x5C + (rnd() & 3);
+            d[n++] = 0x02; d[n++] = (uint8_t)rnd(); d[n++] = 0x09;
+            d[n++] = 0x03; d[n++] = (uint8_t)rnd();
+            break;
+        case 4:                                 // MiBeacon
+            d[n++] = 0x15; d[n++] = 0x16; d[n++] = 0x95; d[n++] = 0xFE; d[n++] = 0x50; d[n++] = 0x20;
+            d[n++] = 0x5B; d[n++] = 0x05; d[n++] = (uint8_t)rnd();
+            d[n++] = (uint8_t)dev; d[n++] = (uint8_t)(dev >> 8); d[n++] = 0x38; d[n++] = 0xC1; d[n++] = 0xA4; d[n++] = 0x00;
+            d[n++] = 0x0D; d[n++] = 0x10; d[n++] = 0x04;
+            for(i = 0; i < 4; i++)
+                d[n++] = (uint8_t)rnd();
+            break;
+        case 5:                                 // iBeacon
+            d[n++] = 0x1A; d[n++] = 0xFF; d[n++] = 0x4C; d[n++] = 0x00; d[n++] = 0x02; d[n++] = 0x15;
+            for(i = 0; i < 16; i++)
+                d[n++] = (uint8_t)(0xE2 + i * 7);
+            d[n++] = 0x00; d[n++] = (uint8_t)(dev >> 4); d[n++] = 0x00; d[n++] = (uint8_t)dev; d[n++] = 0xC5;
+            break;
+        default:                                // Apple continuity, mostly random
+            d[n++] = 0x0A; d[n++] = 0xFF; d[n++] = 0x4C; d[n++] = 0x00; d[n++] = 0x10; d[n++] = 0x05;
+            d[n++] = 0x01 + (rnd() & 0x3F);
+            for(i = 0; i < 4; i++)
+                d[n++] = (uint8_t)rnd();
+            break;
+    }
+    return n;
+}
+
+/*********************************************************************
+ * @fn      load_synth
+ */
+static void load_synth(const lzb_cfg_t *cfg)
+{
+    advcap_rec_t rec;
+    uint8_t data[255];
+    uint32_t dev;
+
+    memset(&rec, 0, sizeof(rec));
+    rec.type = ADVCAP_DEVICE_INFO;
+    rec.eventType = GAP_ADRPT_ADV_NONCONN_IND;
+    rec.addrType = ADDRTYPE_PUBLIC;
+    rec.primaryPHY = GAP_PHY_BIT_LE_1M;
+    rec.secondaryPHY = GAP_PHY_BIT_LE_1M;
+    for(uint32_t i = 0; i < cfg->count; i++)
+    {
+        dev = rnd() % cfg->synth;
+        rec.rssi = -40 - (int8_t)(rnd() % 50);
+        rec.addr[0] = (uint8_t)dev;
+        rec.addr[1] = (uint8_t)(dev >> 8);
+        rec.addr[2] = 0x38;
+        rec.addr[3] = 0xC1;
+        rec.addr[4] = 0xA4;
+        rec.addr[5] = 0x00;
+        rec.dataLen = (uint8_t)synth_adv(dev, data);
+        report_put(cfg, &rec, data);
+    }
+}
+
+static void usage(void)
+{
+    printf("Usage: lzbench [options] [capture.advc ...]\n"
+           "  -b N     block payload, bytes (default %u)\n"
+           "  -L N     timing loops (default 20)\n"
+           "  -D       compact records (device dictionary)\n"
+           "  -S N     no capture: synthetic population of N devices\n"
+           "  -n N     synthetic reports (default 100000)\n"
+           "  -R N     random seed (default 1)\n",
+           (unsigned)LZB_PAYLOAD_MAX);
+}
+
+int main(int argc, char **argv)
+{
+    lzb_cfg_t cfg = { LZB_PAYLOAD_MAX, 20, ADV_ENC_FULL, 0, 100000, 1 };
+    uint8_t data[255], out[SEND_BUF_LEN];
+    uint64_t raw = 0, sent = 0, unpacked = 0, cyc, cyc_max = 0, cyc_sum = 0;
+    uint32_t packed = 0, i;
+    double tc, td;
+    advcap_rec_t rec;
+    advcap_t cap;
+    lzb_block_t *b;
+    int32_t n;
+    int c, r;
+
+    while((c = getopt(argc, argv, "b:L:DS:n:R:h")) != -1)
+    {
+        switch(c)
+        {
+            case 'b': cfg.block = strtoul(optarg, NULL, 0); break;
+            case 'L': cfg.loops = strtoul(optarg, NULL, 0); break;
+            case 'D': cfg.encoding = ADV_ENC_COMPACT; break;
+            case 'S': cfg.synth = strtoul(optarg, NULL, 0); break;
+            case 'n': cfg.count = strtoul(optarg, NULL, 0); break;
+            case 'R': cfg.seed = strtoul(optarg, NULL, 0); break;
+            default: usage(); return 1;
+        }
+    }
+    if((optind >= argc && !cfg.synth) || cfg.block < 64 || cfg.block > LZB_PAYLOAD_MAX || !cfg.loops)
+    {
+        usage();
+        return 1;
+    }
+    rnd_state = cfg.seed ? cfg.seed : 1;
+    advenc_set_mode(cfg.encoding);
+    for(; optind < argc; optind++)
+    {
+        if(advcap_open(&cap, argv[optind]))
+        {
+            perror(argv[optind]);
+            return 1;
+        }
+        while((r = advcap_read(&cap, &rec, data)) > 0)
+            report_put(&cfg, &rec, data);
+        advcap_close(&cap);
+        if(r < 0)
+        {
+            fprintf(stderr, "%s: read error\n", argv[optind]);
+            return 1;
+        }
+    }
+    if(cfg.synth)
+        load_synth(&cfg);
+    block_flush();
+    if(!blk_num)
+    {
+        fprintf(stderr, "no records\n");
+        return 1;
+    }
+
+    // compress: the payload the gateway sends, raw when it does not shrink
+    tc = host_time();
+    for(uint32_t loop = 0; loop < cfg.loops; loop++)
+    {
+        for(i = 0; i < blk_num; i++)
+        {
+            b = &blocks[i];
+            cyc = host_cycles();
+            b->lz_len = b->raw_len > LZ_MFLIMIT
+                        ? lz_compress(b->raw, b->raw_len, b->lz, b->raw_len - STREAM_LZ_HDR_LEN - 1) : 0;
+            cyc = host_cycles() - cyc;
+            cyc_sum += cyc;
+            if(cyc < b->cyc)
+                b->cyc = cyc;
+        }
+    }
+    tc = host_time() - tc;
+    for(i = 0; i < blk_num; i++)
+    {
+        b = &blocks[i];
+        if(b->cyc > cyc_max)
+            cyc_max = b->cyc;
+        raw += b->raw_len;
+        if(b->lz_len)
+        {
+            sent += b->lz_len + STREAM_LZ_HDR_LEN;
+            unpacked += b->raw_len;
+            packed++;
+        }
+        else
+            sent += b->raw_len;
+    }
+
+    // decompress and check
+    td = host_time();
+    for(uint32_t loop = 0; loop < cfg.loops; loop++)
+    {
+        for(i = 0; i < blk_num; i++)
+        {
+            b = &blocks[i];
+            if(!b->lz_len)
+                continue;
+            n = lz_decompress(b->lz, b->lz_len, out, sizeof(out));
+            if(n != b->raw_len || (!loop && memcmp(out, b->raw, n)))
+            {
+                fprintf(stderr, "block %u: round trip failed\n", i);
+                return 1;
+            }
+        }
+    }
+    td = host_time() - td;
+
+    printf("records            %u, %s\n", records, cfg.encoding == ADV_ENC_COMPACT ? "compact" : "full frames");
+    printf("blocks             %u, payload up to %u bytes, %u compressed\n", blk_num, cfg.block, packed);
+    printf("payload            %llu -> %llu bytes, ratio %.2f:1 (%.1f%% saved)\n",
+           (unsigned long long)raw, (unsigned long long)sent, (double)raw / sent,
+           (raw - sent) * 100.0 / raw);
+    printf("compress           %.1f MB/s, %.1f host cycles/byte, block max %llu cycles\n",
+           raw * cfg.loops / tc / 1e6, (double)cyc_sum / (raw * cfg.loops), (unsigned long long)cyc_max);
+    printf("decompress         %.1f MB/s\n", td > 0 ? unpacked * cfg.loops / td / 1e6 : 0.0);
+    return 0;
+}
+
+/******************************** endfile @ lzbench ******************************/
@@ -0,0 +1,141 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advcap.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/12
+ * Description        : Advert capture file reader/writer
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include "advcap.h"
+
+_Static_assert(sizeof(advcap_hdr_t) == 16, "advcap_hdr_t layout");
+_Static_assert(sizeof(advcap_rec_t) == 24, "advcap_rec_t layout");
+
+/*********************************************************************
+ * @fn      advcap_open
+ *
+ * @brief   Open a capture for reading.
+ *
+ * @param   cap - capture
+ * @param   name - file name
+ *
+ * @return  0 - ok, -1 - error
+ */
+int advcap_open(advcap_t *cap, const char *name)
+{
+    advcap_hdr_t hdr;
+
+    memset(cap, 0, sizeof(*cap));
+    cap->f = fopen(name, "rb");
+    if(!cap->f)
+        return -1;
+    if(fread(&hdr, sizeof(hdr), 1, cap->f) != 1
+       || hdr.magic != ADVCAP_MAGIC || hdr.version != ADVCAP_VERSION
+       || hdr.hdr_size < sizeof(hdr) || !hdr.ts_freq
+       || fseek(cap->f, hdr.hdr_size, SEEK_SET))
+    {
+        fclose(cap->f);
+        cap->f = NULL;
+        return -1;
+    }
+    cap->start = hdr.hdr_size;
+    cap->ts_freq = hdr.ts_freq;
+    return 0;
+}
+
+/*********************************************************************
+ * @fn      advcap_create
+ *
+ * @brief   Create a capture file.
+ *
+ * @param   cap - capture
+ * @param   name - file name
+ * @param   ts_freq - timestamp units, Hz
+ *
+ * @return  0 - ok, -1 - error
+ */
+int advcap_create(advcap_t *cap, const char *name, uint32_t ts_freq)
+{
+    advcap_hdr_t hdr = { ADVCAP_MAGIC, ADVCAP_VERSION, sizeof(advcap_hdr_t), ts_freq, 0 };
+
+    memset(cap, 0, sizeof(*cap));
+    cap->f = fopen(name, "wb");
+    if(!cap->f)
+        return -1;
+    cap->start = sizeof(hdr);
+    cap->ts_freq = ts_freq;
+    if(fwrite(&hdr, sizeof(hdr), 1, cap->f) != 1)
+    {
+        fclose(cap->f);
+        cap->f = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*********************************************************************
+ * @fn      advcap_read
+ *
+ * @brief   Read the next record.
+ *
+ * @param   cap - capture
+ * @param   rec - record header
+ * @param   data - report data, 255 bytes
+ *
+ * @return  1 - ok, 0 - end of file, -1 - error
+ */
+int advcap_read(advcap_t *cap, advcap_rec_t *rec, uint8_t *data)
+{
+    if(fread(rec, sizeof(*rec), 1, cap->f) != 1)
+        return feof(cap->f) ? 0 : -1;
+    if(rec->dataLen && fread(data, rec->dataLen, 1, cap->f) != 1)
+        return -1;
+    cap->count++;
+    return 1;
+}
+
+/*********************************************************************
+ * @fn      advcap_write
+ *
+ * @brief   Append a record.
+ *
+ * @param   cap - capture
+ * @param   rec - record header
+ * @param   data - report data, rec->dataLen bytes
+ *
+ * @return  0 - ok, -1 - error
+ */
+int advcap_write(advcap_t *cap, const advcap_rec_t *rec, const uint8_t *data)
+{
+    if(fwrite(rec, sizeof(*rec), 1, cap->f) != 1)
+        return -1;
+    if(rec->dataLen && fwrite(data, rec->dataLen, 1, cap->f) != 1)
+        return -1;
+    cap->count++;
+    return 0;
+}
+
+void advcap_rewind(advcap_t *cap)
+{
+    fseek(cap->f, cap->start, SEEK_SET);
+}
+
+void advcap_close(advcap_t *cap)
+{
+    if(cap->f)
+        fclose(cap->f);
+    cap->f = NULL;
+}
+
+uint64_t advcap_ts_us(const advcap_t *cap, uint64_t ts)
+{
+    if(cap->ts_freq == 1000000 || !cap->ts_freq)
+        return ts;
+    return ts / cap->ts_freq * 1000000 + ts % cap->ts_freq * 1000000 / cap->ts_freq;
+}
+
+/******************************** endfile @ advcap ******************************/
@@ -0,0 +1,119 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : advcap.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/12
+ * Description        : Advert capture file (.advc): timestamped GAP device
+ *                      info / extended device info reports.
+ *                      Written by tools/advcap.py from a live gateway stream
+ *                      or by the host tools, replayed by advreplay.
+ *********************************************************************************/
+
+#ifndef ADVCAP_H
+#define ADVCAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define ADVCAP_MAGIC            0x43564441  // "ADVC"
+#define ADVCAP_VERSION          1
+
+// advcap_rec_t.type
+#define ADVCAP_DEVICE_INFO      0           // gapDeviceInfoEvent_t
+#define ADVCAP_EXT_ADV_INFO     1           // gapExtAdvDeviceInfoEvent_t
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * File header, all fields little-endian
+ */
+typedef struct
+{
+    uint32_t magic;             // ADVCAP_MAGIC
+    uint16_t version;           // ADVCAP_VERSION
+    uint16_t hdr_size;          // sizeof(advcap_hdr_t)
+    uint32_t ts_freq;           // timestamp units, Hz
+    uint32_t rsv;
+} advcap_hdr_t;
+
+/*
+ * Record header, followed by dataLen bytes of the report data
+ */
+typedef struct
+{
+    uint64_t ts;                // receive time, advcap_hdr_t.ts_freq units
+    uint8_t  type;              // ADVCAP_DEVICE_INFO / ADVCAP_EXT_ADV_INFO
+    uint8_t  eventType;
+    uint8_t  addrType;
+    uint8_t  primaryPHY;        // GAP_PHY_BIT_LE_*
+    uint8_t  secondaryPHY;
+    int8_t   rssi;
+    uint8_t  addr[6];
+    uint8_t  advertisingSID;    // 0xFF - not known
+    int8_t   txPower;           // 127 - not known
+    uint8_t  rsv;
+    uint8_t  dataLen;
+} advcap_rec_t;
+
+typedef struct
+{
+    FILE    *f;
+    long     start;             // first record offset
+    uint32_t ts_freq;
+    uint32_t count;
+} advcap_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Open for reading, checks the header. 0 - ok
+ */
+extern int advcap_open(advcap_t *cap, const char *name);
+
+/*
+ * Create for writing. 0 - ok
+ */
+extern int advcap_create(advcap_t *cap, const char *name, uint32_t ts_freq);
+
+/*
+ * Read the next record. 1 - ok, 0 - end of file, -1 - error
+ */
+extern int advcap_read(advcap_t *cap, advcap_rec_t *rec, uint8_t *data);
+
+/*
+ * Append a record. 0 - ok
+ */
+extern int advcap_write(advcap_t *cap, const advcap_rec_t *rec, const uint8_t *data);
+
+/*
+ * Rewind to the first record
+ */
+extern void advcap_rewind(advcap_t *cap);
+
+extern void advcap_close(advcap_t *cap);
+
+/*
+ * Record time in us, without overflow for UNIX time stamps
+ */
+extern uint64_t advcap_ts_us(const advcap_t *cap, uint64_t ts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ADVCAP_H */
@@ -0,0 +1,267 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : sim.h
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : Host simulation of the gateway: virtual clock,
+ *                      TMOS scheduler, BLE observer role and WCHNET TCP
+ *                      and UDP socket stand-ins around the real APP layer,
+ *                      SNTP server and twsync collector on the network
+ *********************************************************************************/
+
+#ifndef SIM_H
+#define SIM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdint.h>
+#include "CONFIG.h"
+#include "twsync_col.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+
+#define SIM_NS_PER_SEC          1000000000ull
+#define SIM_NS_PER_MS           1000000ull
+#define SIM_NS_PER_US           1000ull
+
+#define SIM_TIME_NEVER          UINT64_MAX
+
+#define SIM_CORE_CLOCK          120000000   // HCLK, Hz
+
+// UTC at sim time 0 (2024-03-09 16:00:00), us
+#define SIM_UTC_EPOCH_US        1710000000000000ull
+
+// Default main loop iteration cost, ns
+#define SIM_LOOP_COST_NS        2000
+
+// Default WFI wakeup: interrupt entry and return to the loop, ns
+#define SIM_WAKE_NS             500
+
+// Memory-to-memory DMA: HCLK cycles per transfer (byte or word)
+#define SIM_DMA_CYCLES          4
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+
+/*
+ * Advert to inject into the observer role
+ */
+typedef struct
+{
+    uint8_t  ext;               // 0: GAP_DEVICE_INFO_EVENT, 1: GAP_EXT_ADV_DEVICE_INFO_EVENT
+    uint8_t  eventType;
+    uint8_t  addrType;
+    uint8_t  primaryPHY;        // GAP_PHY_BIT_LE_*
+    uint8_t  secondaryPHY;
+    int8_t   rssi;
+    uint8_t  addr[B_ADDR_LEN];
+    uint8_t  dataLen;
+    uint8_t  data[255];
+} sim_adv_t;
+
+/*
+ * TCP sink (the client side of the stream socket)
+ */
+typedef struct
+{
+    uint32_t bandwidth;         // drain rate, bytes/s, 0 - unlimited
+    uint32_t window;            // bytes in flight accepted by WCHNET_SocketSend()
+    uint32_t stall_period;      // ms, 0 - no stalls
+    uint32_t stall_len;         // ms, the client reads nothing
+    uint32_t connect_delay;     // ms after the listen socket is up
+    uint32_t rtt_us;            // client round trip: the window is freed this long after delivery
+    uint8_t  half_duplex;       // 1 - half duplex link: the gateway sends in the slow mode (ETH_LINK_SLOW)
+    uint32_t link_ms;           // PHY link up after boot, nothing reaches the gateway before
+    uint32_t dhcp_ms;           // DHCP server answer after the DHCP start or the link up
+} sim_sink_cfg_t;
+
+typedef struct
+{
+    uint64_t bytes;             // delivered to the client
+    uint32_t send_calls;
+    uint32_t send_short;        // WCHNET_SocketSend() accepted less than asked
+    uint64_t send_rest;         // bytes not accepted by short sends
+    uint32_t send_busy;         // nothing accepted
+    uint32_t stalls;
+    uint32_t inflight_hwm;
+} sim_sink_stats_t;
+
+/*
+ * SNTP server stand-in on the UDP socket, reference clock sim_utc_us()
+ */
+typedef struct
+{
+    uint32_t up_us;             // request path delay
+    uint32_t down_us;           // reply path delay
+    uint32_t jitter_us;         // added to each path, uniform 0..jitter_us
+    uint32_t loss;              // % of requests lost
+} sim_sntp_cfg_t;
+
+typedef struct
+{
+    uint32_t requests;
+    uint32_t replies;
+    uint32_t lost;
+} sim_sntp_stats_t;
+
+/*
+ * Two-way time transfer collector on the LAN (twsync.h), its clock is sim_utc_us()
+ */
+typedef struct
+{
+    uint32_t period_ms;         // probe period, 0 - no collector
+    uint32_t up_us;             // collector to gateway, without the 10 Mbit/s wire time
+    uint32_t down_us;           // gateway to collector
+    uint32_t jitter_us;         // added to each path, uniform 0..jitter_us
+    uint32_t stack_us;          // gateway stack delay, ETH interrupt to socket and back, 0..stack_us
+} sim_twsync_cfg_t;
+
+typedef struct
+{
+    uint32_t probes;
+    uint32_t replies;
+    uint32_t sets;
+} sim_twsync_stats_t;
+
+/*
+ * Main loop idle: WFI between the events (HAL_IdleWFI) or the busy loop
+ */
+typedef struct
+{
+    uint32_t wake_ns;           // WFI to the pass that handles the interrupt
+    uint8_t  poll;              // 1 - busy loop (HAL_WFI FALSE): an event waits for the pass in progress
+} sim_idle_cfg_t;
+
+typedef struct
+{
+    uint32_t events;            // BLE controller events (adverts)
+    uint64_t lat_sum;           // ns, event to the start of the pass that handles it
+    uint32_t lat_max;
+} sim_idle_stats_t;
+
+/*
+ * Client data callback, called with the bytes delivered by the sink
+ */
+typedef void (*sim_rx_cb_t)(const uint8_t *data, uint32_t len);
+
+/*
+ * Client side stream parser, v1 frames and v2 blocks
+ */
+typedef void (*sim_frame_cb_t)(const uint8_t *frame, uint32_t len);
+
+typedef struct
+{
+    uint64_t bytes;
+    uint32_t frames;
+    uint32_t adverts;
+    uint32_t svc;               // service frames (ADV_SVC_MARKER)
+    uint32_t blocks;            // v2 blocks with a good CRC
+    uint32_t block_err;         // v2 blocks with a bad header or CRC
+    uint32_t block_lost;        // v2 sequence gaps
+    uint32_t block_dup;         // v2 blocks received again, dropped
+    uint64_t skipped;           // bytes dropped while hunting for STREAM_MAGIC
+    uint32_t compact;           // compact records (advenc.h)
+    uint32_t dict_miss;         // compact records with an unknown handle
+    uint32_t stamps;            // time records
+    uint32_t lz_blocks;         // compressed v2 blocks
+    uint64_t lz_in;             // their payload bytes received
+    uint64_t lz_out;            // and decompressed
+} sim_client_stats_t;
+
+/*********************************************************************
+ * FUNCTIONS
+ */
+
+/*
+ * Virtual clock
+ */
+extern uint64_t sim_now(void);
+extern void sim_set_time(uint64_t t);
+extern void sim_advance(uint64_t dt);
+extern uint64_t sim_utc_us(void);
+extern void sim_set_xtal_ppm(int32_t ppm);
+extern uint64_t sim_systick_at(uint64_t t);
+
+/*
+ * TMOS: earliest pending timer or SIM_TIME_NEVER, any event set
+ */
+extern uint64_t sim_tmos_next(void);
+extern int sim_tmos_pending(void);
+
+/*
+ * BLE observer role
+ */
+extern int sim_ble_scanning(void);
+extern void sim_ble_poll(void);
+extern uint64_t sim_ble_next(void);
+extern int sim_ble_inject(const sim_adv_t *adv);
+
+/*
+ * WCHNET and the TCP sink
+ */
+// sim_net_lease_keep(): the lease kept in flash is
+#define SIM_LEASE_SAME          0           // of this network, free
+#define SIM_LEASE_MOVED         1           // of another network: no router answers
+#define SIM_LEASE_TAKEN         2           // of this network, another host has the address now
+extern void sim_net_config(const sim_sink_cfg_t *cfg, sim_rx_cb_t cb);
+extern void sim_net_poll(void);
+extern uint64_t sim_net_next(void);
+extern int sim_net_pending(void);
+extern int sim_net_connected(void);
+extern int sim_net_client_send(const uint8_t *data, uint32_t len);
+extern void sim_net_disconnect(void);
+extern void sim_net_lease_keep(uint8_t where);
+extern const sim_sink_stats_t *sim_net_stats(void);
+extern void sim_sntp_config(const sim_sntp_cfg_t *cfg);
+extern const sim_sntp_stats_t *sim_sntp_get_stats(void);
+
+/*
+ * Two-way time transfer: the collector and the ETH interrupt stamps (sim_twsync.c)
+ */
+extern void sim_twsync_config(const sim_twsync_cfg_t *cfg);
+extern const sim_twsync_stats_t *sim_twsync_get_stats(void);
+extern const twsync_col_t *sim_twsync_collector(void);
+extern uint64_t sim_twsync_next(void);
+extern void sim_twsync_poll(void);
+extern void sim_twsync_task(void);
+extern void sim_twsync_sendto(const uint8_t *buf, uint32_t len);
+
+/*
+ * Client side stream parser, sim_client_input() is a sim_rx_cb_t
+ */
+extern void sim_client_reset(sim_frame_cb_t cb);
+extern void sim_client_input(const uint8_t *data, uint32_t len);
+extern const sim_client_stats_t *sim_client_stats(void);
+extern int sim_client_stamp(uint64_t *ts, uint8_t *flags);
+extern void sim_client_restart(void);
+extern int sim_client_seq(uint32_t *next);
+
+/*
+ * Gateway: firmware init sequence and one Main_Circulation() pass
+ */
+extern void sim_gw_init(void);
+extern void sim_gw_step(void);
+extern uint64_t sim_gw_next(void);
+extern void sim_gw_run_until(uint64_t t);
+
+/*
+ * Main loop idle model: configuration, an interrupt (IDLE_WAKE_*) waking
+ * the loop, the wakeup latency of the BLE events
+ */
+extern void sim_idle_config(const sim_idle_cfg_t *cfg);
+extern void sim_gw_wake(uint32_t flags);
+extern const sim_idle_stats_t *sim_idle_get_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIM_H */
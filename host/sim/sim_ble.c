@@ -0,0 +1,186 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : sim_ble.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : GAP observer role stand-in, delivers injected
+ *                      adverts to the application callback
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include "sim.h"
+#include "idle.h"
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static gapRoleObserverCB_t *sim_observer_cb;
+static uint8_t sim_init_pending;
+static uint8_t sim_scanning;
+static uint64_t sim_scan_end = SIM_TIME_NEVER;
+static uint16_t sim_scan_duration = 16384;     // TGAP_DISC_SCAN default, 10.24 s
+
+/*********************************************************************
+ * @fn      sim_ble_event
+ *
+ * @brief   Call the application GAP role callback.
+ */
+static void sim_ble_event(gapRoleEvent_t *ev)
+{
+    ev->gap.hdr.event = GAP_MSG_EVENT;
+    ev->gap.hdr.status = SUCCESS;
+    if(sim_observer_cb && sim_observer_cb->eventCB)
+        sim_observer_cb->eventCB(ev);
+}
+
+/*********************************************************************
+ * @fn      sim_ble_scanning
+ *
+ * @return  1 - discovery is running, adverts are delivered
+ */
+int sim_ble_scanning(void)
+{
+    return sim_scanning;
+}
+
+/*********************************************************************
+ * @fn      sim_ble_next
+ *
+ * @return  time of the next role event, ns or SIM_TIME_NEVER
+ */
+uint64_t sim_ble_next(void)
+{
+    if(sim_init_pending)
+        return sim_now();
+    return sim_scanning ? sim_scan_end : SIM_TIME_NEVER;
+}
+
+/*********************************************************************
+ * @fn      sim_ble_poll
+ *
+ * @brief   Deliver the init done and discovery complete events.
+ */
+void sim_ble_poll(void)
+{
+    gapRoleEvent_t ev;
+
+    memset(&ev, 0, sizeof(ev));
+    if(sim_init_pending)
+    {
+        sim_init_pending = 0;
+        ev.initDone.opcode = GAP_DEVICE_INIT_DONE_EVENT;
+        sim_ble_event(&ev);
+    }
+    else if(sim_scanning && sim_now() >= sim_scan_end)
+    {
+        sim_scanning = 0;
+        sim_scan_end = SIM_TIME_NEVER;
+        ev.discCmpl.opcode = GAP_DEVICE_DISCOVERY_EVENT;
+        sim_ble_event(&ev);
+    }
+}
+
+/*********************************************************************
+ * @fn      sim_ble_inject
+ *
+ * @brief   Deliver one advert report, as the controller would.
+ *
+ * @param   adv - advert
+ *
+ * @return  1 - delivered, 0 - not scanning, the advert is missed
+ */
+int sim_ble_inject(const sim_adv_t *adv)
+{
+    gapRoleEvent_t ev;
+    uint8_t data[255];
+
+    if(!sim_scanning)
+        return 0;
+    // BB interrupt, the report is handled by the next TMOS pass
+    sim_gw_wake(IDLE_WAKE_BLE);
+    memset(&ev, 0, sizeof(ev));
+    memcpy(data, adv->data, adv->dataLen);
+    if(adv->ext)
+    {
+        ev.deviceExtAdvInfo.opcode = GAP_EXT_ADV_DEVICE_INFO_EVENT;
+        ev.deviceExtAdvInfo.eventType = adv->eventType;
+        ev.deviceExtAdvInfo.addrType = adv->addrType;
+        memcpy(ev.deviceExtAdvInfo.addr, adv->addr, B_ADDR_LEN);
+        ev.deviceExtAdvInfo.primaryPHY = adv->primaryPHY;
+        ev.deviceExtAdvInfo.secondaryPHY = adv->secondaryPHY;
+        ev.deviceExtAdvInfo.txPower = 127;
+        ev.deviceExtAdvInfo.rssi = adv->rssi;
+        ev.deviceExtAdvInfo.dataLen = adv->dataLen;
+        ev.deviceExtAdvInfo.pEvtData = data;
+    }
+    else
+    {
+        ev.deviceInfo.opcode = GAP_DEVICE_INFO_EVENT;
+        ev.deviceInfo.eventType = adv->eventType;
+        ev.deviceInfo.addrType = adv->addrType;
+        memcpy(ev.deviceInfo.addr, adv->addr, B_ADDR_LEN);
+        ev.deviceInfo.rssi = adv->rssi;
+        ev.deviceInfo.dataLen = adv->dataLen;
+        ev.deviceInfo.pEvtData = data;
+    }
+    sim_ble_event(&ev);
+    return 1;
+}
+
+/*********************************************************************
+ * GAP API
+ */
+
+bStatus_t GAPRole_ObserverInit(void)
+{
+    sim_observer_cb = NULL;
+    sim_scanning = 0;
+    return SUCCESS;
+}
+
+bStatus_t GAPRole_ObserverStartDevice(gapRoleObserverCB_t *pAppCallbacks)
+{
+    sim_observer_cb = pAppCallbacks;
+    sim_init_pending = 1;
+    return SUCCESS;
+}
+
+bStatus_t GAPRole_ObserverStartDiscovery(uint8_t mode, uint8_t activeScan, uint8_t whiteList)
+{
+    (void)mode;
+    (void)activeScan;
+    (void)whiteList;
+    sim_scanning = 1;
+    if(sim_scan_duration)
+        sim_scan_end = sim_now() + (uint64_t)sim_scan_duration * SYSTEM_TIME_MICROSEN * SIM_NS_PER_US;
+    else
+        sim_scan_end = SIM_TIME_NEVER;
+    return SUCCESS;
+}
+
+bStatus_t GAPRole_ObserverCancelDiscovery(void)
+{
+    sim_scanning = 0;
+    sim_scan_end = SIM_TIME_NEVER;
+    return SUCCESS;
+}
+
+bStatus_t GAPRole_SetParameter(uint16_t param, uint16_t len, void *pValue)
+{
+    (void)param;
+    (void)len;
+    (void)pValue;
+    return SUCCESS;
+}
+
+bStatus_t GAP_SetParamValue(uint16_t paramID, uint16_t paramValue)
+{
+    if(paramID == TGAP_DISC_SCAN)
+        sim_scan_duration = paramValue;
+    return SUCCESS;
+}
+
+/******************************** endfile @ sim_ble ******************************/
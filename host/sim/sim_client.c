@@ -0,0 +1,450 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : sim_client.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : Client side parser of the advert stream,
+ *                      v1 frames, compact and time records, v2 blocks,
+ *                      compressed or not
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include "sim.h"
+#include "ctrl.h"
+#include "stream.h"
+#include "advenc.h"
+#include "gwtime.h"
+#include "lz.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define SIM_BLK_HDR_LEN         sizeof(stream_blk_hdr_t)
+#define SIM_BLK_MAX             4096
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+typedef struct
+{
+    uint8_t valid;
+    uint8_t hdr[ADV_HDR_LEN];               // v1 header, [0] - payload length
+    uint8_t data[255];
+} sim_dict_ent_t;
+
+static uint8_t sim_frame[ADV_REC_MAX];
+static uint32_t sim_frame_len;
+static sim_frame_cb_t sim_frame_cb;
+static sim_client_stats_t sim_cstats;
+
+static uint8_t sim_blk[SIM_BLK_MAX];
+static uint8_t sim_raw[SIM_BLK_MAX];        // decompressed payload
+static uint32_t sim_blk_len;
+static uint8_t sim_in_blk;                  // collecting a v2 block
+static uint8_t sim_hunt;                    // sync lost, looking for STREAM_MAGIC
+static uint32_t sim_sync;                   // last 4 bytes while hunting
+static uint8_t sim_seq_valid;
+static uint32_t sim_seq_next;
+
+static sim_dict_ent_t sim_dict[ADV_DICT_SIZE];
+
+static uint64_t sim_ts;                     // running receive time
+static uint8_t sim_ts_flags;
+static uint8_t sim_ts_pending;              // a time record waits for its advert
+static uint8_t sim_ts_valid;                // the advert being delivered has a stamp
+static uint8_t sim_dec[ADV_HDR_LEN + 255];
+
+static uint32_t get_le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*********************************************************************
+ * @fn      stream_crc32
+ *
+ * @brief   Reference CRC of a v2 block (CRC unit algorithm, LE words).
+ */
+static uint32_t stream_crc32(const uint8_t *p, uint32_t len)
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for(; len >= 4; p += 4, len -= 4)
+    {
+        crc ^= get_le32(p);
+        for(int i = 0; i < 32; i++)
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+    return crc;
+}
+
+/*********************************************************************
+ * @fn      sim_client_reset
+ *
+ * @brief   Drop the partial frame and the counters.
+ *
+ * @param   cb - called for every complete frame, may be NULL
+ *
+ * @return  none
+ */
+void sim_client_reset(sim_frame_cb_t cb)
+{
+    sim_frame_len = 0;
+    sim_blk_len = 0;
+    sim_in_blk = 0;
+    sim_hunt = 0;
+    sim_seq_valid = 0;
+    memset(sim_dict, 0, sizeof(sim_dict));
+    sim_ts_pending = 0;
+    sim_ts_valid = 0;
+    sim_frame_cb = cb;
+    memset(&sim_cstats, 0, sizeof(sim_cstats));
+}
+
+/*********************************************************************
+ * @fn      sim_client_restart
+ *
+ * @brief   New connection: the partial frame or block of the old one is
+ *          dropped, the block sequence and the dictionary are kept for
+ *          the replay (CTRL_CMD_RESUME).
+ *
+ * @return  none
+ */
+void sim_client_restart(void)
+{
+    sim_frame_len = 0;
+    sim_blk_len = 0;
+    sim_in_blk = 0;
+    sim_hunt = 0;
+    sim_ts_pending = 0;
+    sim_ts_valid = 0;
+}
+
+/*********************************************************************
+ * @fn      sim_client_seq
+ *
+ * @brief   The next block sequence number expected.
+ *
+ * @return  0 - no block received yet
+ */
+int sim_client_seq(uint32_t *next)
+{
+    *next = sim_seq_next;
+    return sim_seq_valid;
+}
+
+const sim_client_stats_t *sim_client_stats(void)
+{
+    return &sim_cstats;
+}
+
+/*********************************************************************
+ * @fn      sim_client_stamp
+ *
+ * @brief   Receive time of the advert given to the frame callback.
+ *
+ * @param   ts - time, us
+ * @param   flags - GWTIME_SYNCED: UTC, else time since boot
+ *
+ * @return  0 - the advert has no time record
+ */
+int sim_client_stamp(uint64_t *ts, uint8_t *flags)
+{
+    if(!sim_ts_valid)
+        return 0;
+    *ts = sim_ts;
+    *flags = sim_ts_flags;
+    return 1;
+}
+
+/*********************************************************************
+ * @fn      sim_decode
+ *
+ * @brief   Compact record -> v1 frame in sim_dec.
+ *
+ * @return  v1 frame length, 0 - unknown handle
+ */
+static uint32_t sim_decode(const uint8_t *r)
+{
+    uint8_t kind = r[1] & ADV_REC_KIND_MASK;
+    uint32_t h = r[2], i, nb;
+    const uint8_t *p = r + 3, *ch;
+    sim_dict_ent_t *d;
+
+    if(r[1] & ADV_REC_WIDE)
+    {
+        h |= r[3] << 8;
+        p++;
+    }
+    if(h >= ADV_DICT_SIZE)
+        return 0;
+    d = &sim_dict[h];
+    if(kind == ADV_REC_NEW)
+    {
+        d->valid = 1;
+        d->hdr[0] = r[0];
+        d->hdr[1] = p[0];
+        d->hdr[2] = p[1];
+        d->hdr[3] = p[2];
+        memcpy(&d->hdr[4], p + 3, B_ADDR_LEN);
+        memcpy(d->data, p + 9, r[0]);
+    }
+    else if(!d->valid)
+        return 0;
+    else
+    {
+        d->hdr[3] = *p++;
+        if(kind == ADV_REC_DATA)
+        {
+            d->hdr[0] = r[0];
+            memcpy(d->data, p, r[0]);
+        }
+        else if(kind == ADV_REC_DELTA)
+        {
+            nb = (d->hdr[0] + 7) / 8;
+            ch = p + nb;
+            for(i = 0; i < d->hdr[0]; i++)
+            {
+                if(p[i >> 3] & (1 << (i & 7)))
+                    d->data[i] = *ch++;
+            }
+        }
+    }
+    memcpy(sim_dec, d->hdr, ADV_HDR_LEN);
+    memcpy(&sim_dec[ADV_HDR_LEN], d->data, d->hdr[0]);
+    return ADV_HDR_LEN + d->hdr[0];
+}
+
+static void sim_frame_done(const uint8_t *frame, uint32_t len)
+{
+    if((frame[1] & ADV_REC_TIME_MASK) == ADV_REC_TIME)
+    {
+        sim_cstats.stamps++;
+        gwtime_rec_parse(frame, &sim_ts, &sim_ts_flags);
+        sim_ts_pending = 1;
+        return;
+    }
+    if((frame[1] & ADV_REC_TAG_MASK) == ADV_REC_TAG)
+    {
+        sim_cstats.compact++;
+        len = sim_decode(frame);
+        if(!len)
+        {
+            sim_cstats.dict_miss++;
+            sim_ts_pending = 0;
+            return;
+        }
+        frame = sim_dec;
+    }
+    sim_cstats.frames++;
+    if(frame[1] == ADV_SVC_MARKER)
+    {
+        sim_cstats.svc++;
+        if(frame[2] == ADV_SVC_DICT)
+            memset(sim_dict, 0, sizeof(sim_dict));
+    }
+    else
+    {
+        sim_cstats.adverts++;
+        sim_ts_valid = sim_ts_pending;
+        sim_ts_pending = 0;
+    }
+    if(sim_frame_cb)
+        sim_frame_cb(frame, len);
+    sim_ts_valid = 0;
+}
+
+/*********************************************************************
+ * @fn      sim_block_error
+ *
+ * @brief   Bad block: look for the next STREAM_MAGIC in what is buffered,
+ *          else hunt for it in the incoming bytes.
+ */
+static void sim_block_error(void)
+{
+    uint32_t k;
+
+    sim_cstats.block_err++;
+    // records are lost: deltas would apply to stale payloads until ADV_SVC_DICT
+    memset(sim_dict, 0, sizeof(sim_dict));
+    sim_ts_pending = 0;
+    for(k = 1; k + 4 <= sim_blk_len; k++)
+    {
+        if(get_le32(&sim_blk[k]) == STREAM_MAGIC)
+        {
+            sim_cstats.skipped += k;
+            sim_blk_len -= k;
+            memmove(sim_blk, &sim_blk[k], sim_blk_len);
+            return;
+        }
+    }
+    // keep the tail: it may be the beginning of the magic
+    sim_sync = 0;
+    for(; k < sim_blk_len; k++)
+        sim_sync = (sim_sync >> 8) | ((uint32_t)sim_blk[k] << 24);
+    sim_cstats.skipped += sim_blk_len;
+    sim_blk_len = 0;
+    sim_in_blk = 0;
+    sim_hunt = 1;
+}
+
+/*********************************************************************
+ * @fn      sim_block_need
+ *
+ * @brief   Bytes of the block to collect, 0 - the buffered header is bad.
+ */
+static uint32_t sim_block_need(void)
+{
+    uint32_t len;
+
+    if(sim_blk_len >= 4 && get_le32(sim_blk) != STREAM_MAGIC)
+        return 0;
+    if(sim_blk_len < SIM_BLK_HDR_LEN)
+        return SIM_BLK_HDR_LEN;
+    len = get_le16(&sim_blk[12]);
+    if((sim_blk[4] & ~STREAM_BLK_LZ) != STREAM_V2 || sim_blk[5] != SIM_BLK_HDR_LEN
+       || SIM_BLK_HDR_LEN + len + 3 + STREAM_CRC_LEN > SIM_BLK_MAX)
+        return 0;
+    return SIM_BLK_HDR_LEN + ((len + 3) & ~3) + STREAM_CRC_LEN;
+}
+
+/*********************************************************************
+ * @fn      sim_block_done
+ *
+ * @brief   Check the CRC of a complete block, decompress the payload
+ *          and pass its frames on.
+ *
+ * @return  0 - bad block
+ */
+static int sim_block_done(uint32_t total)
+{
+    uint32_t len = get_le16(&sim_blk[12]);
+    uint32_t seq = get_le32(&sim_blk[8]);
+    const uint8_t *p = &sim_blk[SIM_BLK_HDR_LEN];
+    uint32_t pos, flen;
+    int32_t n;
+
+    if(stream_crc32(sim_blk, total - STREAM_CRC_LEN) != get_le32(&sim_blk[total - STREAM_CRC_LEN]))
+        return 0;
+    if(sim_blk[4] & STREAM_BLK_LZ)
+    {
+        if(len < STREAM_LZ_HDR_LEN)
+            return 0;
+        n = lz_decompress(p + STREAM_LZ_HDR_LEN, len - STREAM_LZ_HDR_LEN, sim_raw, sizeof(sim_raw));
+        if(n < 0 || (uint32_t)n != get_le16(p))
+            return 0;
+        sim_cstats.lz_blocks++;
+        sim_cstats.lz_in += len;
+        sim_cstats.lz_out += n;
+        p = sim_raw;
+        len = n;
+    }
+    if(sim_seq_valid && (int32_t)(seq - sim_seq_next) < 0)
+    {
+        // already received: sent again by a replay
+        sim_cstats.block_dup++;
+        sim_blk_len = 0;
+        sim_in_blk = 0;
+        return 1;
+    }
+    sim_cstats.blocks++;
+    if(sim_seq_valid && seq != sim_seq_next)
+    {
+        sim_cstats.block_lost += seq - sim_seq_next;
+        memset(sim_dict, 0, sizeof(sim_dict));
+    }
+    sim_seq_valid = 1;
+    sim_seq_next = seq + 1;
+    for(pos = 0; pos + 2 <= len; pos += flen)
+    {
+        flen = adv_rec_len(p[pos], p[pos + 1]);
+        if(pos + flen > len)
+            break;
+        sim_frame_done(&p[pos], flen);
+    }
+    sim_blk_len = 0;
+    sim_in_blk = 0;
+    return 1;
+}
+
+/*********************************************************************
+ * @fn      sim_client_input
+ *
+ * @brief   Split the byte stream into records: v1 frames [len][hdr 9][data len]
+ *          and compact records (decoded to v1 frames). A record with
+ *          byte 1 == 0xFE starts a v2 block, after a bad block the parser
+ *          resyncs on STREAM_MAGIC.
+ *
+ * @param   data - stream bytes
+ * @param   len - length
+ *
+ * @return  none
+ */
+void sim_client_input(const uint8_t *data, uint32_t len)
+{
+    uint32_t need, n;
+
+    sim_cstats.bytes += len;
+    while(len)
+    {
+        if(sim_hunt)
+        {
+            sim_sync = (sim_sync >> 8) | ((uint32_t)*data++ << 24);
+            len--;
+            sim_cstats.skipped++;
+            if(sim_sync == STREAM_MAGIC)
+            {
+                sim_cstats.skipped -= 4;
+                memcpy(sim_blk, &sim_sync, 4);
+                sim_blk_len = 4;
+                sim_in_blk = 1;
+                sim_hunt = 0;
+            }
+            continue;
+        }
+        if(sim_in_blk)
+        {
+            need = sim_block_need();
+            if(!need)
+            {
+                sim_block_error();
+                continue;
+            }
+            n = MIN(need - sim_blk_len, len);
+            memcpy(&sim_blk[sim_blk_len], data, n);
+            sim_blk_len += n;
+            data += n;
+            len -= n;
+            if(sim_blk_len == need && need > SIM_BLK_HDR_LEN && !sim_block_done(need))
+                sim_block_error();
+            continue;
+        }
+        need = sim_frame_len < 2 ? 2 : adv_rec_len(sim_frame[0], sim_frame[1]);
+        n = MIN(need - sim_frame_len, len);
+        memcpy(&sim_frame[sim_frame_len], data, n);
+        sim_frame_len += n;
+        data += n;
+        len -= n;
+        if(sim_frame_len >= 2 && sim_frame[1] == (uint8_t)(STREAM_MAGIC >> 8))
+        {
+            memcpy(sim_blk, sim_frame, sim_frame_len);
+            sim_blk_len = sim_frame_len;
+            sim_frame_len = 0;
+            sim_in_blk = 1;
+            continue;
+        }
+        if(sim_frame_len < need || need == 2)
+            continue;
+        sim_frame_done(sim_frame, sim_frame_len);
+        sim_frame_len = 0;
+    }
+}
+
+/******************************** endfile @ sim_client ******************************/
@@ -0,0 +1,506 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : sim_hw.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : Virtual clock, MCU peripheral stand-ins and the
+ *                      gateway main loop (main.c) on the host
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include "sim.h"
+#include "eth_driver.h"
+#include "observer.h"
+#include "eth.h"
+#include "trace.h"
+#include "stats.h"
+#include "idle.h"
+#include "fifo_dma.h"
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+uint32_t SystemCoreClock = SIM_CORE_CLOCK;
+TIM_TypeDef sim_tim2;
+DMA_Channel_TypeDef sim_dma_ch7;
+uint32_t sim_flash_page[SIM_FLASH_PAGE / 4];
+int sim_verbose;
+
+__attribute__((aligned(4))) uint32_t MEM_BUF[BLE_MEMHEAP_SIZE / 4];
+
+/*
+ * Link.ld symbols used by stats.c: the stack is a static array here,
+ * painted by sim_gw_init()
+ */
+#define SIM_STACK_SIZE          2048
+
+__attribute__((aligned(4))) uint32_t sim_stack_ram[SIM_STACK_SIZE / 4];
+
+__asm__(
+    ".globl _ebss\n"
+    ".set _ebss, sim_stack_ram\n"
+    ".globl _eusrstack\n"
+    ".set _eusrstack, sim_stack_ram + 2048\n"
+    ".globl __stack_size\n"
+    ".set __stack_size, 2048\n");
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static uint64_t sim_time;                   // ns
+static uint64_t sim_next_tick;              // TIM2 update, 0 - stopped
+static uint64_t sim_dma_done;               // DMA1 channel 7 transfer complete, 0 - idle
+static uint32_t sim_dma_maddr;              // destination of that transfer
+static uint32_t sim_crc_dr = 0xFFFFFFFF;    // CRC->DATAR
+static int32_t  sim_xtal_ppm;               // HSE error, SysTick only
+static sim_idle_cfg_t sim_idle = { SIM_WAKE_NS, 0 };
+static sim_idle_stats_t sim_idle_stats;
+static uint64_t sim_idle_from = SIM_TIME_NEVER; // WFI entered / busy loop spinning since, ns
+
+/*********************************************************************
+ * Virtual clock
+ */
+
+uint64_t sim_now(void)
+{
+    return sim_time;
+}
+
+void sim_set_time(uint64_t t)
+{
+    if(t > sim_time)
+        sim_time = t;
+}
+
+void sim_advance(uint64_t dt)
+{
+    sim_time += dt;
+}
+
+/*
+ * SysTick: HCLK/8, free running, off by the crystal error
+ */
+uint64_t sim_systick(void)
+{
+    return sim_systick_at(sim_time);
+}
+
+uint64_t sim_systick_at(uint64_t t)
+{
+    t += (int64_t)t / 1000 * sim_xtal_ppm / 1000;
+    return t * (SIM_CORE_CLOCK / 8 / 1000) / SIM_NS_PER_MS;
+}
+
+void sim_set_xtal_ppm(int32_t ppm)
+{
+    sim_xtal_ppm = ppm;
+}
+
+/*
+ * Reference (true) time: UTC of sim time 0 plus the sim time
+ */
+uint64_t sim_utc_us(void)
+{
+    return SIM_UTC_EPOCH_US + sim_time / SIM_NS_PER_US;
+}
+
+void Delay_Init(void)
+{
+}
+
+void Delay_Us(uint32_t n)
+{
+    sim_advance(n * SIM_NS_PER_US);
+}
+
+void Delay_Ms(uint32_t n)
+{
+    sim_advance(n * SIM_NS_PER_MS);
+}
+
+/*********************************************************************
+ * Peripherals
+ */
+
+void RCC_APB1PeriphClockCmd(uint32_t RCC_APB1Periph, FunctionalState NewState)
+{
+    (void)RCC_APB1Periph;
+    (void)NewState;
+}
+
+void TIM_TimeBaseInit(TIM_TypeDef *TIMx, TIM_TimeBaseInitTypeDef *TIM_TimeBaseInitStruct)
+{
+    TIMx->PSC = TIM_TimeBaseInitStruct->TIM_Prescaler;
+    TIMx->ATRLR = TIM_TimeBaseInitStruct->TIM_Period;
+    TIMx->INTFR |= TIM_IT_Update;           // UG
+}
+
+void TIM_SelectOnePulseMode(TIM_TypeDef *TIMx, uint16_t TIM_OPMode)
+{
+    TIMx->CTLR1 = (TIMx->CTLR1 & ~TIM_OPMode_Single) | TIM_OPMode;
+}
+
+void TIM_SetAutoreload(TIM_TypeDef *TIMx, uint16_t Autoreload)
+{
+    TIMx->ATRLR = Autoreload;
+}
+
+void TIM_SetCounter(TIM_TypeDef *TIMx, uint16_t Counter)
+{
+    TIMx->CNT = Counter;
+}
+
+/*
+ * TIM2 update time: the counter runs from CNT to ATRLR at HCLK/(PSC+1)
+ */
+static uint64_t sim_tim_update(TIM_TypeDef *TIMx)
+{
+    uint64_t n = (uint64_t)(TIMx->PSC + 1) * (TIMx->ATRLR + 1u - TIMx->CNT);
+
+    return sim_time + n * SIM_NS_PER_SEC / SystemCoreClock;
+}
+
+void TIM_ITConfig(TIM_TypeDef *TIMx, uint16_t TIM_IT, FunctionalState NewState)
+{
+    if(NewState)
+        TIMx->DMAINTENR |= TIM_IT;
+    else
+        TIMx->DMAINTENR &= ~TIM_IT;
+}
+
+void TIM_Cmd(TIM_TypeDef *TIMx, FunctionalState NewState)
+{
+    if(NewState)
+    {
+        TIMx->CTLR1 |= TIM_CEN;
+        sim_next_tick = sim_tim_update(TIMx);
+    }
+    else
+    {
+        TIMx->CTLR1 &= ~TIM_CEN;
+        sim_next_tick = 0;
+    }
+}
+
+void TIM_ClearITPendingBit(TIM_TypeDef *TIMx, uint16_t TIM_IT)
+{
+    TIMx->INTFR &= ~TIM_IT;
+}
+
+void RCC_AHBPeriphClockCmd(uint32_t RCC_AHBPeriph, FunctionalState NewState)
+{
+    (void)RCC_AHBPeriph;
+    (void)NewState;
+}
+
+void DMA_Init(DMA_Channel_TypeDef *DMAy_Channelx, DMA_InitTypeDef *DMA_InitStruct)
+{
+    DMAy_Channelx->CFGR = DMA_InitStruct->DMA_DIR | DMA_InitStruct->DMA_PeripheralInc
+                          | DMA_InitStruct->DMA_MemoryInc | DMA_InitStruct->DMA_PeripheralDataSize
+                          | DMA_InitStruct->DMA_MemoryDataSize | DMA_InitStruct->DMA_Mode
+                          | DMA_InitStruct->DMA_Priority | DMA_InitStruct->DMA_M2M;
+    DMAy_Channelx->CNTR = DMA_InitStruct->DMA_BufferSize;
+    DMAy_Channelx->PADDR = DMA_InitStruct->DMA_PeripheralBaseAddr;
+    DMAy_Channelx->MADDR = DMA_InitStruct->DMA_MemoryBaseAddr;
+}
+
+void DMA_ITConfig(DMA_Channel_TypeDef *DMAy_Channelx, uint32_t DMA_IT, FunctionalState NewState)
+{
+    if(NewState)
+        DMAy_Channelx->CFGR |= DMA_IT;
+    else
+        DMAy_Channelx->CFGR &= ~DMA_IT;
+}
+
+void DMA_ClearITPendingBit(uint32_t DMAy_IT)
+{
+    (void)DMAy_IT;
+}
+
+void FLASH_Unlock_Fast(void)
+{
+}
+
+void FLASH_Lock_Fast(void)
+{
+}
+
+void FLASH_ErasePage_Fast(uint32_t Page_Address)
+{
+    if(Page_Address == (uint32_t)(uintptr_t)sim_flash_page)
+        for(int i = 0; i < SIM_FLASH_PAGE / 4; i++)
+            sim_flash_page[i] = SIM_FLASH_ERASED;
+}
+
+void FLASH_ProgramPage_Fast(uint32_t Page_Address, uint32_t *pbuf)
+{
+    if(Page_Address == (uint32_t)(uintptr_t)sim_flash_page)
+        memcpy(sim_flash_page, pbuf, SIM_FLASH_PAGE);
+}
+
+/*
+ * DMA1 channel 7 memory-to-memory: a transfer programmed by fifo_dma_start()
+ * completes SIM_DMA_CYCLES per item later, the bytes move at completion
+ */
+static void sim_dma_check(void)
+{
+    DMA_Channel_TypeDef *ch = &sim_dma_ch7;
+
+    if(!(ch->CFGR & DMA_CFGR1_EN) || !ch->CNTR)
+        sim_dma_done = 0;                   // stopped (fifo_dma_abort)
+    else if(!sim_dma_done || ch->MADDR != sim_dma_maddr)
+    {
+        sim_dma_done = sim_time + (uint64_t)ch->CNTR * SIM_DMA_CYCLES * SIM_NS_PER_SEC / SystemCoreClock;
+        sim_dma_maddr = ch->MADDR;
+    }
+}
+
+static void sim_dma_complete(void)
+{
+    DMA_Channel_TypeDef *ch = &sim_dma_ch7;
+    uint32_t unit = (ch->CFGR & DMA_CFGR1_MSIZE) == DMA_MemoryDataSize_Word ? 4 : 1;
+
+    memcpy((void *)(uintptr_t)ch->MADDR, (const void *)(uintptr_t)ch->PADDR, ch->CNTR * unit);
+    ch->CNTR = 0;
+    sim_dma_done = 0;
+    // DMA1_Channel7_IRQHandler
+    if(fifo_dma_isr())
+        IDLE_WAKE(IDLE_WAKE_DMA);
+    sim_dma_check();                        // the rest of a wrapped read
+}
+
+void NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+    (void)IRQn;
+}
+
+void NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+    (void)IRQn;
+}
+
+/*
+ * CRC unit: poly 0x04C11DB7, MSB first, a word at a time
+ */
+void CRC_ResetDR(void)
+{
+    sim_crc_dr = 0xFFFFFFFF;
+}
+
+uint32_t CRC_CalcCRC(uint32_t Data)
+{
+    sim_crc_dr ^= Data;
+    for(int i = 0; i < 32; i++)
+        sim_crc_dr = (sim_crc_dr & 0x80000000) ? (sim_crc_dr << 1) ^ 0x04C11DB7 : sim_crc_dr << 1;
+    return sim_crc_dr;
+}
+
+uint32_t CRC_CalcBlockCRC(uint32_t pBuffer[], uint32_t BufferLength)
+{
+    for(uint32_t i = 0; i < BufferLength; i++)
+        CRC_CalcCRC(pBuffer[i]);
+    return sim_crc_dr;
+}
+
+uint32_t CRC_GetCRC(void)
+{
+    return sim_crc_dr;
+}
+
+/*********************************************************************
+ * Gateway
+ */
+
+/*********************************************************************
+ * @fn      sim_gw_init
+ *
+ * @brief   main() without the hardware: trace, observer and eth tasks.
+ *
+ * @return  none
+ */
+void sim_gw_init(void)
+{
+    for(int i = 0; i < SIM_STACK_SIZE / 4; i++)
+        sim_stack_ram[i] = STATS_PAINT_WORD;
+    trace_init();
+    GAPRole_ObserverInit();
+    Observer_Init();
+    eth_init();
+}
+
+/*********************************************************************
+ * @fn      sim_idle_config
+ *
+ * @brief   Main loop idle model, by default WFI with SIM_WAKE_NS.
+ *
+ * @param   cfg - model
+ *
+ * @return  none
+ */
+void sim_idle_config(const sim_idle_cfg_t *cfg)
+{
+    sim_idle = *cfg;
+}
+
+const sim_idle_stats_t *sim_idle_get_stats(void)
+{
+    return &sim_idle_stats;
+}
+
+/*********************************************************************
+ * @fn      sim_idle_end
+ *
+ * @brief   The loop was idle since sim_idle_from and an interrupt comes
+ *          now: WFI ends after wake_ns (HAL_IdleWFI accounting), the
+ *          busy loop finishes the pass in progress, the passes it spun
+ *          are counted.
+ *
+ * @return  none
+ */
+static void sim_idle_end(void)
+{
+    uint64_t n;
+
+    if(sim_idle_from == SIM_TIME_NEVER)
+        return;
+    if(sim_idle.poll)
+    {
+        n = (sim_time - sim_idle_from + SIM_LOOP_COST_NS - 1) / SIM_LOOP_COST_NS;
+        idle_stat.loops += (uint32_t)n;
+        sim_time = sim_idle_from + n * SIM_LOOP_COST_NS;
+    }
+    else
+    {
+        idle_stat.sleeps++;
+        idle_stat.idle_ticks += sim_systick_at(sim_time) - sim_systick_at(sim_idle_from);
+        sim_advance(sim_idle.wake_ns);
+    }
+    sim_idle_from = SIM_TIME_NEVER;
+}
+
+/*********************************************************************
+ * @fn      sim_gw_wake
+ *
+ * @brief   Interrupt with work for the main loop at the current time.
+ *          A BLE event counts into the wakeup latency.
+ *
+ * @param   flags - IDLE_WAKE_*
+ *
+ * @return  none
+ */
+void sim_gw_wake(uint32_t flags)
+{
+    uint64_t t0 = sim_time;
+    uint32_t lat;
+
+    IDLE_WAKE(flags);
+    sim_idle_end();
+    if(flags & IDLE_WAKE_BLE)
+    {
+        // the report is delivered at once, by the pass the firmware would run
+        idle_stat.loops++;
+        lat = (uint32_t)(sim_time - t0);
+        sim_idle_stats.events++;
+        sim_idle_stats.lat_sum += lat;
+        if(lat > sim_idle_stats.lat_max)
+            sim_idle_stats.lat_max = lat;
+    }
+}
+
+/*********************************************************************
+ * @fn      sim_gw_step
+ *
+ * @brief   Interrupts due by now, then one Main_Circulation() pass.
+ *
+ * @return  none
+ */
+void sim_gw_step(void)
+{
+    sim_idle_end();
+    if(sim_next_tick && sim_time >= sim_next_tick)
+    {
+        // TIM2_IRQHandler, the one-shot stops
+        IDLE_WAKE(IDLE_WAKE_TICK);
+        sim_tim2.CNT = 0;
+        if(sim_tim2.CTLR1 & TIM_OPMode_Single)
+        {
+            sim_tim2.CTLR1 &= ~TIM_CEN;
+            sim_next_tick = 0;
+        }
+        else
+            sim_next_tick = sim_tim_update(&sim_tim2);
+    }
+    sim_dma_check();
+    if(sim_dma_done && sim_time >= sim_dma_done)
+        sim_dma_complete();
+    sim_ble_poll();
+    sim_net_poll();
+    // frames due (datagrams, ACKs, the connection): the ETH interrupt
+    if(sim_net_next() <= sim_time)
+        IDLE_WAKE(IDLE_WAKE_ETH);
+    eth_process();
+    TMOS_SystemProcess();
+    sim_advance(SIM_LOOP_COST_NS);
+}
+
+/*********************************************************************
+ * @fn      sim_gw_next
+ *
+ * @brief   Earliest time the main loop has something to do.
+ *
+ * @return  ns, now if busy
+ */
+uint64_t sim_gw_next(void)
+{
+    uint64_t next = sim_next_tick ? sim_next_tick : SIM_TIME_NEVER;
+    uint64_t t;
+
+    if(sim_tmos_pending() || sim_net_pending())
+        return sim_time;
+    sim_dma_check();
+    if(sim_dma_done && sim_dma_done < next)
+        next = sim_dma_done;
+    t = sim_tmos_next();
+    if(t < next)
+        next = t;
+    t = sim_ble_next();
+    if(t < next)
+        next = t;
+    t = sim_net_next();
+    if(t < next)
+        next = t;
+    return next;
+}
+
+/*********************************************************************
+ * @fn      sim_gw_run_until
+ *
+ * @brief   Run the main loop up to t, the idle time in WFI or spinning
+ *          (sim_idle_config) is skipped.
+ *
+ * @param   t - end time, ns
+ *
+ * @return  none
+ */
+void sim_gw_run_until(uint64_t t)
+{
+    while(sim_time < t)
+    {
+        uint64_t next = sim_gw_next();
+
+        if(next > sim_time)
+        {
+            if(sim_idle_from == SIM_TIME_NEVER)
+                sim_idle_from = sim_time;
+            sim_set_time(MIN(next, t));
+            if(sim_time >= t)
+                break;
+        }
+        sim_gw_step();
+    }
+}
+
+/******************************** endfile @ sim_hw ******************************/
@@ -0,0 +1,875 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : sim_net.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : WCHNET stand-in: DHCP, one TCP listen socket and
+ *                      a client (sink) with limited bandwidth and stalls,
+ *                      UDP sockets: SNTP server stand-in, twsync collector
+ *                      (sim_twsync.c)
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include "sim.h"
+#include "eth_driver.h"
+#include "twsync.h"
+#include "stats.h"
+#include "ipcfg.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define SIM_SOCK_LISTEN         0
+#define SIM_SOCK_CONN           1           // socket_connected == 0 means "no client"
+#define SIM_SOCK_UDP            2           // WCHNET_NUM_UDP sockets from here
+
+#define SIM_SNTP_PORT           123
+#define SIM_SNTP_MSG_LEN        48
+#define SIM_SNTP_UNIX_OFFSET    2208988800ull
+#define SIM_SNTP_PROC_US        20          // server receive to send
+
+#define SIM_SINK_BUF_SIZE       0x10000     // power of 2, >= window
+#define SIM_ACK_NUM             256         // ACKs on the way back (rtt_us), power of 2
+
+#define SIM_ARP_NUM             4           // ARP answers on the way, power of 2
+#define SIM_ARP_US              300         // request to answer on the LAN
+#define SIM_ARP_LEN             60
+
+/*********************************************************************
+ * GLOBAL VARIABLES
+ */
+__attribute__((__aligned__(4))) SOCK_INF SocketInf[WCHNET_MAX_SOCKET_NUM];
+__attribute__((__aligned__(4))) uint8_t Memp_Memory[WCHNET_MEMP_SIZE];
+__attribute__((__aligned__(4))) uint8_t Mem_Heap_Memory[WCHNET_RAM_HEAP_SIZE];
+__attribute__((__aligned__(4))) uint8_t Mem_ArpTable[WCHNET_RAM_ARP_TABLE_SIZE];
+
+uint32_t volatile LocalTime;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static sim_sink_cfg_t sim_cfg = {
+    .bandwidth = 1000000,
+    .window = WCHNET_TCP_MSS * WCHNET_NUM_TCP_SEG,
+    .connect_delay = 100,
+};
+static sim_rx_cb_t sim_rx_cb;
+static sim_sink_stats_t sim_stats;
+
+static dhcp_callback sim_dhcp_cb;
+static uint8_t sim_dhcp_pending;
+static uint64_t sim_dhcp_time;              // the server answers
+static uint8_t sim_link_up;
+
+// the lease of the DHCP server: ip, gateway, mask, DNS 1, DNS 2
+static uint8_t sim_dhcp_lease[20] = {
+    192, 168, 2, 134,
+    192, 168, 2, 1,
+    255, 255, 255, 0,
+    192, 168, 2, 1,
+    8, 8, 8, 8
+};
+
+static uint8_t sim_arp_owner[4];            // another host with the kept address (SIM_LEASE_TAKEN)
+static struct
+{
+    uint64_t t;                             // the answer reaches the gateway
+    uint8_t frame[SIM_ARP_LEN];
+} sim_arp_q[SIM_ARP_NUM];
+static uint32_t sim_arp_head, sim_arp_tail;
+
+static uint8_t sim_glob_int;
+static uint8_t sim_sock_int[WCHNET_MAX_SOCKET_NUM];
+static uint8_t sim_connected;
+static uint64_t sim_connect_time = SIM_TIME_NEVER;
+static uint64_t sim_conn_start;
+
+static uint8_t sim_sink_buf[SIM_SINK_BUF_SIZE];
+static uint32_t sim_sink_rd, sim_sink_wr;   // not delivered: wr - rd
+static uint32_t sim_sink_ack;               // in flight, the window: wr - ack
+static struct
+{
+    uint64_t t;                             // the ACK reaches the gateway
+    uint32_t rd;                            // acknowledged up to
+} sim_ack_q[SIM_ACK_NUM];
+static uint32_t sim_ack_head, sim_ack_tail;
+static uint64_t sim_sink_last;              // last drain time
+static uint64_t sim_sink_credit;            // drained bytes * SIM_NS_PER_SEC not yet delivered
+static uint8_t sim_stalled;
+
+static sim_sntp_cfg_t sim_sntp = { .up_us = 250, .down_us = 250 };
+static sim_sntp_stats_t sim_sntp_stats;
+static uint8_t sim_sntp_reply[SIM_SNTP_MSG_LEN];
+static uint64_t sim_sntp_time = SIM_TIME_NEVER;    // reply delivery
+static uint8_t sim_sntp_sock;
+static uint32_t sim_sntp_rnd = 1;
+
+/*********************************************************************
+ * @fn      sim_net_config
+ *
+ * @brief   Set the sink model and the client data callback.
+ *
+ * @param   cfg - sink parameters, NULL - keep
+ * @param   cb - client data callback
+ *
+ * @return  none
+ */
+void sim_net_config(const sim_sink_cfg_t *cfg, sim_rx_cb_t cb)
+{
+    if(cfg)
+    {
+        sim_cfg = *cfg;
+        if(sim_cfg.window == 0 || sim_cfg.window > SIM_SINK_BUF_SIZE)
+            sim_cfg.window = SIM_SINK_BUF_SIZE;
+    }
+    sim_rx_cb = cb;
+}
+
+/*********************************************************************
+ * @fn      sim_sntp_config
+ *
+ * @brief   Set the SNTP server path model.
+ *
+ * @param   cfg - path parameters
+ *
+ * @return  none
+ */
+void sim_sntp_config(const sim_sntp_cfg_t *cfg)
+{
+    sim_sntp = *cfg;
+}
+
+const sim_sntp_stats_t *sim_sntp_get_stats(void)
+{
+    return &sim_sntp_stats;
+}
+
+const sim_sink_stats_t *sim_net_stats(void)
+{
+    return &sim_stats;
+}
+
+/*
+ * The link comes up link_ms after boot, the LAN reaches the gateway from then
+ */
+static uint64_t sim_link_time(void)
+{
+    return (uint64_t)sim_cfg.link_ms * SIM_NS_PER_MS;
+}
+
+static uint64_t sim_reach_time(void)
+{
+    return MAX(sim_now(), sim_link_time());
+}
+
+int sim_net_connected(void)
+{
+    return sim_connected;
+}
+
+int sim_net_pending(void)
+{
+    return sim_glob_int || (sim_dhcp_pending && sim_now() >= sim_dhcp_time)
+           || (!sim_link_up && sim_now() >= sim_link_time())
+           || (sim_arp_tail != sim_arp_head && sim_now() >= sim_arp_q[sim_arp_tail & (SIM_ARP_NUM - 1)].t);
+}
+
+/*********************************************************************
+ * @fn      sim_net_lease_keep
+ *
+ * @brief   A previous boot got a lease: it is in the flash page of
+ *          ipcfg.c, call before sim_gw_init().
+ *
+ * @param   where - SIM_LEASE_*
+ */
+void sim_net_lease_keep(uint8_t where)
+{
+    static const uint8_t other[12] = { 10, 0, 0, 57, 10, 0, 0, 1, 255, 255, 255, 0 };
+
+    if(where == SIM_LEASE_MOVED)
+    {
+        ipcfg_save(other, other + 4, other + 8);
+        return;
+    }
+    ipcfg_save(sim_dhcp_lease, sim_dhcp_lease + 4, sim_dhcp_lease + 8);
+    if(where == SIM_LEASE_TAKEN)
+    {
+        memcpy(sim_arp_owner, sim_dhcp_lease, 4);
+        sim_dhcp_lease[3]++;                // the server gives us another one
+    }
+}
+
+/*********************************************************************
+ * @fn      sim_arp_answer
+ *
+ * @brief   A host of the LAN answers an ARP request, the router or the
+ *          owner of the address.
+ *
+ * @param   req - ARP request frame
+ */
+static void sim_arp_answer(const uint8_t *req)
+{
+    static const uint8_t router_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    static const uint8_t owner_mac[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x02 };
+    const uint8_t *a = req + 14;
+    const uint8_t *mac;
+    uint8_t *f, *r;
+
+    if(!memcmp(a + 24, sim_dhcp_lease + 4, 4))
+        mac = router_mac;
+    else if(sim_arp_owner[0] && !memcmp(a + 24, sim_arp_owner, 4))
+        mac = owner_mac;
+    else
+        return;
+    if(sim_arp_head - sim_arp_tail == SIM_ARP_NUM)
+        return;
+    f = sim_arp_q[sim_arp_head & (SIM_ARP_NUM - 1)].frame;
+    r = f + 14;
+    memset(f, 0, SIM_ARP_LEN);
+    memcpy(f, a + 8, 6);
+    memcpy(f + 6, mac, 6);
+    f[12] = 0x08;
+    f[13] = 0x06;
+    memcpy(r, a, 6);                        // Ethernet, IPv4, 6, 4
+    r[7] = 0x02;                            // reply
+    memcpy(r + 8, mac, 6);
+    memcpy(r + 14, a + 24, 4);
+    memcpy(r + 18, a + 8, 10);
+    sim_arp_q[sim_arp_head & (SIM_ARP_NUM - 1)].t = sim_reach_time() + (uint64_t)SIM_ARP_US * SIM_NS_PER_US;
+    sim_arp_head++;
+}
+
+/*********************************************************************
+ * @fn      sim_sink_stall
+ *
+ * @brief   Is the client in a stall at time t.
+ *
+ * @return  0 - reading, else the stall end time
+ */
+static uint64_t sim_sink_stall(uint64_t t)
+{
+    uint64_t period, pos;
+
+    if(!sim_cfg.stall_period || !sim_cfg.stall_len)
+        return 0;
+    period = sim_cfg.stall_period * SIM_NS_PER_MS;
+    pos = (t - sim_conn_start) % period;
+    if(pos < period - sim_cfg.stall_len * SIM_NS_PER_MS)
+        return 0;
+    return t - pos + period;
+}
+
+/*********************************************************************
+ * @fn      sim_sink_deliver
+ *
+ * @brief   Hand n in-flight bytes to the client.
+ */
+static void sim_sink_deliver(uint32_t n)
+{
+    while(n)
+    {
+        uint32_t pos = sim_sink_rd & (SIM_SINK_BUF_SIZE - 1);
+        uint32_t len = MIN(n, SIM_SINK_BUF_SIZE - pos);
+
+        if(sim_rx_cb)
+            sim_rx_cb(&sim_sink_buf[pos], len);
+        sim_sink_rd += len;
+        sim_stats.bytes += len;
+        n -= len;
+    }
+}
+
+/*********************************************************************
+ * @fn      sim_sink_ack_put
+ *
+ * @brief   Delivered up to sim_sink_rd: the window is freed rtt_us
+ *          later. A full queue merges into the newest ACK.
+ */
+static void sim_sink_ack_put(uint64_t now)
+{
+    if(!sim_cfg.rtt_us)
+    {
+        sim_sink_ack = sim_sink_rd;
+        return;
+    }
+    if(sim_ack_head - sim_ack_tail == SIM_ACK_NUM)
+    {
+        sim_ack_q[(sim_ack_head - 1) & (SIM_ACK_NUM - 1)].rd = sim_sink_rd;
+        return;
+    }
+    sim_ack_q[sim_ack_head & (SIM_ACK_NUM - 1)].t = now + (uint64_t)sim_cfg.rtt_us * 1000;
+    sim_ack_q[sim_ack_head & (SIM_ACK_NUM - 1)].rd = sim_sink_rd;
+    sim_ack_head++;
+}
+
+/*********************************************************************
+ * @fn      sim_sink_ack_take
+ *
+ * @brief   ACKs that have come back by now.
+ */
+static void sim_sink_ack_take(uint64_t now)
+{
+    while(sim_ack_tail != sim_ack_head && sim_ack_q[sim_ack_tail & (SIM_ACK_NUM - 1)].t <= now)
+        sim_sink_ack = sim_ack_q[(sim_ack_tail++) & (SIM_ACK_NUM - 1)].rd;
+}
+
+/*********************************************************************
+ * @fn      sim_sink_drain
+ *
+ * @brief   Move bytes from the window to the client up to now.
+ */
+static void sim_sink_drain(void)
+{
+    uint64_t now = sim_now();
+    uint64_t stall = sim_sink_stall(now);
+    uint32_t inflight = sim_sink_wr - sim_sink_rd;
+
+    sim_sink_ack_take(now);
+    if(stall)
+    {
+        if(!sim_stalled)
+            sim_stats.stalls++;
+        sim_stalled = 1;
+        sim_sink_last = now;
+        sim_sink_credit = 0;
+        return;
+    }
+    sim_stalled = 0;
+    if(!inflight)
+    {
+        sim_sink_last = now;
+        sim_sink_credit = 0;
+        return;
+    }
+    if(sim_cfg.bandwidth == 0)
+    {
+        sim_sink_deliver(inflight);
+        sim_sink_ack_put(now);
+    }
+    else
+    {
+        uint64_t n;
+
+        sim_sink_credit += (now - sim_sink_last) * sim_cfg.bandwidth;
+        n = sim_sink_credit / SIM_NS_PER_SEC;
+        if(n > inflight)
+            n = inflight;
+        sim_sink_credit -= n * SIM_NS_PER_SEC;
+        if(n)
+        {
+            sim_sink_deliver((uint32_t)n);
+            sim_sink_ack_put(now);
+        }
+        if(sim_sink_wr == sim_sink_rd)
+            sim_sink_credit = 0;
+    }
+    sim_sink_last = now;
+}
+
+/*********************************************************************
+ * @fn      sim_sntp_put_ts
+ *
+ * @brief   UTC us -> NTP timestamp (BE).
+ */
+static void sim_sntp_put_ts(uint8_t *p, uint64_t us)
+{
+    uint64_t sec = us / 1000000 + SIM_SNTP_UNIX_OFFSET;
+    uint64_t frac = (((us % 1000000) << 32) + 999999) / 1000000;   // read back exact
+
+    for(int i = 0; i < 4; i++)
+    {
+        p[i] = (uint8_t)(sec >> (24 - i * 8));
+        p[4 + i] = (uint8_t)(frac >> (24 - i * 8));
+    }
+}
+
+/*********************************************************************
+ * @fn      sim_sntp_request
+ *
+ * @brief   SNTP server stand-in: the reference clock is sim_utc_us(),
+ *          the path adds the configured one-way delays and jitter.
+ */
+static void sim_sntp_request(const uint8_t *req, uint32_t len)
+{
+    uint64_t up = sim_sntp.up_us, down = sim_sntp.down_us, t2;
+
+    sim_sntp_stats.requests++;
+    if(len < SIM_SNTP_MSG_LEN || sim_sntp_time != SIM_TIME_NEVER)
+        return;
+    if(sim_sntp.loss && (sim_sntp_rnd = sim_sntp_rnd * 1103515245 + 12345) % 100 < sim_sntp.loss)
+    {
+        sim_sntp_stats.lost++;
+        return;
+    }
+    if(sim_sntp.jitter_us)
+    {
+        sim_sntp_rnd = sim_sntp_rnd * 1103515245 + 12345;
+        up += (sim_sntp_rnd >> 8) % sim_sntp.jitter_us;
+        sim_sntp_rnd = sim_sntp_rnd * 1103515245 + 12345;
+        down += (sim_sntp_rnd >> 8) % sim_sntp.jitter_us;
+    }
+    t2 = sim_utc_us() + up;
+    memset(sim_sntp_reply, 0, sizeof(sim_sntp_reply));
+    sim_sntp_reply[0] = (4 << 3) | 4;           // v4, server
+    sim_sntp_reply[1] = 1;                      // stratum
+    sim_sntp_reply[2] = 6;                      // poll
+    sim_sntp_reply[3] = 0xEC;                   // precision 2^-20
+    memcpy(&sim_sntp_reply[12], "SIM", 3);      // reference id
+    memcpy(&sim_sntp_reply[24], &req[40], 8);   // originate = client transmit
+    sim_sntp_put_ts(&sim_sntp_reply[16], t2);
+    sim_sntp_put_ts(&sim_sntp_reply[32], t2);
+    sim_sntp_put_ts(&sim_sntp_reply[40], t2 + SIM_SNTP_PROC_US);
+    sim_sntp_time = sim_now() + (up + SIM_SNTP_PROC_US + down) * SIM_NS_PER_US;
+}
+
+/*********************************************************************
+ * @fn      sim_net_next
+ *
+ * @return  time of the next sink or socket event, ns or SIM_TIME_NEVER
+ */
+uint64_t sim_net_next(void)
+{
+    uint64_t now = sim_now();
+    uint64_t next = sim_connect_time;
+    uint64_t t;
+    uint32_t inflight = sim_sink_wr - sim_sink_rd;
+
+    if(sim_net_pending())
+        return now;
+    if(sim_arp_tail != sim_arp_head && sim_arp_q[sim_arp_tail & (SIM_ARP_NUM - 1)].t < next)
+        next = sim_arp_q[sim_arp_tail & (SIM_ARP_NUM - 1)].t;
+    if(sim_dhcp_pending && sim_dhcp_time < next)
+        next = sim_dhcp_time;
+    if(!sim_link_up && sim_link_time() < next)
+        next = sim_link_time();
+    if(sim_sntp_time < next)
+        next = sim_sntp_time;
+    t = sim_twsync_next();
+    if(t < next)
+        next = t;
+    if(sim_connected && sim_ack_tail != sim_ack_head && sim_ack_q[sim_ack_tail & (SIM_ACK_NUM - 1)].t < next)
+        next = sim_ack_q[sim_ack_tail & (SIM_ACK_NUM - 1)].t;
+    if(sim_connected && inflight)
+    {
+        t = sim_sink_stall(now);
+        if(!t)
+        {
+            // next full segment (or the rest) drained
+            uint64_t n = MIN(inflight, WCHNET_TCP_MSS);
+
+            if(sim_cfg.bandwidth == 0)
+                t = now;
+            else
+                // the credit grows from the last drain, not from now
+                t = sim_sink_last + (n * SIM_NS_PER_SEC - MIN(sim_sink_credit, n * SIM_NS_PER_SEC)
+                                     + sim_cfg.bandwidth - 1) / sim_cfg.bandwidth;
+        }
+        if(t < next)
+            next = t;
+    }
+    return next;
+}
+
+/*********************************************************************
+ * @fn      sim_net_poll
+ *
+ * @brief   Run the client: accept the connection, drain the window.
+ */
+void sim_net_poll(void)
+{
+    sim_twsync_poll();
+    // ETH interrupt: the driver hands ARP to ipcfg.c while the kept lease is checked
+    while(sim_arp_tail != sim_arp_head && sim_now() >= sim_arp_q[sim_arp_tail & (SIM_ARP_NUM - 1)].t)
+    {
+        if(ipcfg_guard)
+            ipcfg_eth_rx(sim_arp_q[sim_arp_tail & (SIM_ARP_NUM - 1)].frame, SIM_ARP_LEN);
+        sim_arp_tail++;
+    }
+    if(sim_now() >= sim_connect_time)
+    {
+        SOCK_INF *p = &SocketInf[SIM_SOCK_CONN];
+
+        sim_connect_time = SIM_TIME_NEVER;
+        memset(p, 0, sizeof(*p));
+        p->SockIndex = SIM_SOCK_CONN;
+        p->ProtoType = PROTO_TYPE_TCP;
+        p->SockStatus = SOCK_STAT_OPEN | (TCP_ESTABLISHED << 8);
+        p->SourPort = SocketInf[SIM_SOCK_LISTEN].SourPort;
+        p->DesPort = 50000;
+        p->IPAddr[0] = 192; p->IPAddr[1] = 168; p->IPAddr[2] = 2; p->IPAddr[3] = 1;
+        sim_connected = 1;
+        sim_conn_start = sim_now();
+        sim_sink_rd = sim_sink_wr = sim_sink_ack = 0;
+        sim_ack_head = sim_ack_tail = 0;
+        sim_sink_last = sim_now();
+        sim_sink_credit = 0;
+        sim_sock_int[SIM_SOCK_CONN] |= SINT_STAT_CONNECT;
+        sim_glob_int |= GINT_STAT_SOCKET;
+    }
+    if(sim_connected)
+        sim_sink_drain();
+}
+
+/*********************************************************************
+ * @fn      sim_net_client_send
+ *
+ * @brief   Client writes to the gateway (commands).
+ *
+ * @return  bytes accepted by the socket receive buffer
+ */
+int sim_net_client_send(const uint8_t *data, uint32_t len)
+{
+    SOCK_INF *p = &SocketInf[SIM_SOCK_CONN];
+    uint32_t n = 0;
+
+    if(!sim_connected || !p->RecvBufLen)
+        return 0;
+    while(n < len && p->RecvRemLen < p->RecvBufLen)
+    {
+        *(uint8_t *)(uintptr_t)p->RecvCurPoint = data[n++];
+        p->RecvCurPoint++;
+        if(p->RecvCurPoint >= p->RecvStartPoint + p->RecvBufLen)
+            p->RecvCurPoint = p->RecvStartPoint;
+        p->RecvRemLen++;
+    }
+    if(n)
+    {
+        sim_sock_int[SIM_SOCK_CONN] |= SINT_STAT_RECV;
+        sim_glob_int |= GINT_STAT_SOCKET;
+    }
+    return n;
+}
+
+/*********************************************************************
+ * @fn      sim_net_disconnect
+ *
+ * @brief   Client closes the connection, the bytes in flight are lost.
+ *          It connects again after connect_delay.
+ */
+void sim_net_disconnect(void)
+{
+    if(!sim_connected)
+        return;
+    sim_connected = 0;
+    sim_connect_time = sim_reach_time() + sim_cfg.connect_delay * SIM_NS_PER_MS;
+    sim_sink_rd = sim_sink_ack = sim_sink_wr;
+    sim_ack_head = sim_ack_tail;
+    SocketInf[SIM_SOCK_CONN].SockStatus = SOCK_STAT_CLOSED;
+    sim_sock_int[SIM_SOCK_CONN] |= SINT_STAT_DISCONNECT;
+    sim_glob_int |= GINT_STAT_SOCKET;
+}
+
+/*********************************************************************
+ * eth_driver API
+ */
+
+void WCHNET_TimeIsr(uint16_t timperiod)
+{
+    LocalTime += timperiod;
+}
+
+/*
+ * As the driver: LocalTime from SysTick, whole ms
+ */
+uint32_t WCHNET_TimeUpdate(void)
+{
+    static uint64_t last;
+    uint64_t dt = SysTick_GetCount64() - last;
+    uint32_t per_ms = SYSTICK_FREQ / 1000;
+    uint32_t ms;
+
+    if(dt > 0xFFFFFFFF)
+        dt = 0xFFFFFFFF;
+    ms = (uint32_t)dt / per_ms;
+    if(ms)
+    {
+        last += (uint64_t)ms * per_ms;
+        LocalTime += ms;
+    }
+    return ms;
+}
+
+/*
+ * No PHY negotiation: the connection alone decides
+ */
+uint32_t WCHNET_TimePeriod(void)
+{
+    return sim_connected ? WCHNET_TICK_FAST_MS : WCHNET_TICK_SLOW_MS;
+}
+
+uint8_t ETH_LibInit(uint8_t *ip, uint8_t *gwip, uint8_t *mask, uint8_t *macaddr)
+{
+    (void)ip;
+    (void)gwip;
+    (void)mask;
+    (void)macaddr;
+    memset(Mem_Heap_Memory, 0xA5, sizeof(Mem_Heap_Memory));
+    memset(SocketInf, 0, sizeof(SocketInf));
+    return WCHNET_ERR_SUCCESS;
+}
+
+/*
+ * Raw frames of the application: only the ARP requests of ipcfg.c, the
+ * LAN answers them
+ */
+uint32_t ETH_TxPktChainMode(uint16_t len, uint32_t *pBuff)
+{
+    const uint8_t *f = (const uint8_t *)pBuff;
+
+    if(ipcfg_guard && !ipcfg_eth_tx(f, len))
+        return ETH_SUCCESS;
+    if(len >= 14 + 28 && f[12] == 0x08 && f[13] == 0x06 && f[14 + 7] == 0x01)
+        sim_arp_answer(f);
+    return ETH_SUCCESS;
+}
+
+/*
+ * The link is up from the start and loses nothing, only a half duplex
+ * partner (gwsim -H) puts the sender into the slow mode
+ */
+uint8_t ETH_LinkState(void)
+{
+    if(!sim_link_up)
+        return 0;
+    return sim_cfg.half_duplex ? ETH_LINK_UP | ETH_LINK_SLOW : ETH_LINK_UP | ETH_LINK_FDX;
+}
+
+void WCHNET_MainTask(void)
+{
+    if(!sim_link_up && sim_now() >= sim_link_time())
+    {
+        sim_link_up = 1;
+        STATS_BOOT(BOOT_LINK);
+    }
+    if(sim_dhcp_pending && sim_now() >= sim_dhcp_time)
+    {
+        sim_dhcp_pending = 0;
+        if(sim_dhcp_cb)
+            sim_dhcp_cb(0, sim_dhcp_lease);
+    }
+    if(sim_now() >= sim_sntp_time)
+    {
+        SOCK_INF *p = &SocketInf[sim_sntp_sock];
+
+        sim_sntp_time = SIM_TIME_NEVER;
+        sim_sntp_stats.replies++;
+        if(p->AppCallBack)
+            p->AppCallBack(p, 0x0102A8C0, SIM_SNTP_PORT, sim_sntp_reply, SIM_SNTP_MSG_LEN);
+    }
+    sim_twsync_task();
+    if(sim_connected)
+        sim_sink_drain();
+}
+
+/*********************************************************************
+ * WCHNET API
+ */
+
+uint8_t WCHNET_GetVer(void)
+{
+    return WCHNET_LIB_VER;
+}
+
+void WCHNET_GetMacAddr(uint8_t *macaddr)
+{
+    static const uint8_t mac[6] = {0x84, 0xC2, 0xE4, 0x03, 0x02, 0x02};
+
+    memcpy(macaddr, mac, sizeof(mac));
+}
+
+uint8_t WCHNET_QueryGlobalInt(void)
+{
+    return sim_glob_int;
+}
+
+uint8_t WCHNET_GetGlobalInt(void)
+{
+    uint8_t r = sim_glob_int;
+
+    sim_glob_int = 0;
+    return r;
+}
+
+uint8_t WCHNET_GetSocketInt(uint8_t socketid)
+{
+    uint8_t r;
+
+    if(socketid >= WCHNET_MAX_SOCKET_NUM)
+        return 0;
+    r = sim_sock_int[socketid];
+    sim_sock_int[socketid] = 0;
+    return r;
+}
+
+uint8_t WCHNET_GetPHYStatus(void)
+{
+    return PHY_Linked_Status;
+}
+
+uint8_t WCHNET_DHCPStart(dhcp_callback dhcp)
+{
+    sim_dhcp_cb = dhcp;
+    sim_dhcp_pending = 1;
+    sim_dhcp_time = sim_reach_time() + sim_cfg.dhcp_ms * SIM_NS_PER_MS;
+    return WCHNET_ERR_SUCCESS;
+}
+
+uint8_t WCHNET_DHCPStop(void)
+{
+    sim_dhcp_pending = 0;
+    return WCHNET_ERR_SUCCESS;
+}
+
+uint8_t WCHNET_DHCPSetHostname(char *name)
+{
+    (void)name;
+    return WCHNET_ERR_SUCCESS;
+}
+
+void WCHNET_ConfigKeepLive(struct _KEEP_CFG *cfg)
+{
+    (void)cfg;
+}
+
+uint8_t WCHNET_SocketSetKeepLive(uint8_t socketid, uint8_t enable)
+{
+    (void)socketid;
+    (void)enable;
+    return WCHNET_ERR_SUCCESS;
+}
+
+/*
+ * TCP: the listen socket, UDP: the next free UDP socket
+ */
+uint8_t WCHNET_SocketCreat(uint8_t *socketid, SOCK_INF *socinf)
+{
+    uint8_t id = SIM_SOCK_LISTEN;
+
+    if(socinf->ProtoType == PROTO_TYPE_UDP)
+    {
+        for(id = SIM_SOCK_UDP; id < SIM_SOCK_UDP + WCHNET_NUM_UDP; id++)
+        {
+            if(SocketInf[id].ProtoType != PROTO_TYPE_UDP)
+                break;
+        }
+        if(id == SIM_SOCK_UDP + WCHNET_NUM_UDP)
+            return WCHNET_ERR_SOCKET_MEM;
+    }
+
+    SocketInf[id] = *socinf;
+    SocketInf[id].SockIndex = id;
+    SocketInf[id].SockStatus = SOCK_STAT_OPEN;
+    *socketid = id;
+    return WCHNET_ERR_SUCCESS;
+}
+
+uint8_t WCHNET_SocketListen(uint8_t socketid)
+{
+    if(socketid != SIM_SOCK_LISTEN)
+        return WCHNET_ERR_ARG;
+    SocketInf[SIM_SOCK_LISTEN].SockStatus = SOCK_STAT_OPEN | (TCP_LISTEN << 8);
+    if(!sim_connected)
+        sim_connect_time = sim_reach_time() + sim_cfg.connect_delay * SIM_NS_PER_MS;
+    return WCHNET_ERR_SUCCESS;
+}
+
+uint8_t WCHNET_SocketClose(uint8_t socketid, uint8_t mode)
+{
+    (void)mode;
+    if(socketid == SIM_SOCK_CONN)
+        sim_net_disconnect();
+    return WCHNET_ERR_SUCCESS;
+}
+
+void WCHNET_ModifyRecvBuf(uint8_t socketid, uint32_t bufaddr, uint32_t bufsize)
+{
+    SOCK_INF *p = &SocketInf[socketid];
+
+    p->RecvStartPoint = bufaddr;
+    p->RecvBufLen = bufsize;
+    p->RecvCurPoint = bufaddr;
+    p->RecvReadPoint = bufaddr;
+    p->RecvRemLen = 0;
+}
+
+uint8_t WCHNET_SocketRecv(uint8_t socketid, uint8_t *buf, uint32_t *len)
+{
+    SOCK_INF *p = &SocketInf[socketid];
+    uint32_t n = MIN(*len, p->RecvRemLen);
+    uint32_t end = p->RecvStartPoint + p->RecvBufLen;
+
+    n = MIN(n, end - p->RecvReadPoint);
+    if(buf)
+        memcpy(buf, (uint8_t *)(uintptr_t)p->RecvReadPoint, n);
+    p->RecvReadPoint += n;
+    if(p->RecvReadPoint >= end)
+        p->RecvReadPoint = p->RecvStartPoint;
+    p->RecvRemLen -= n;
+    *len = n;
+    return WCHNET_ERR_SUCCESS;
+}
+
+uint32_t WCHNET_SocketRecvLen(uint8_t socketid, uint32_t *bufaddr)
+{
+    if(bufaddr)
+        *bufaddr = SocketInf[socketid].RecvReadPoint;
+    return SocketInf[socketid].RecvRemLen;
+}
+
+/*
+ * Accepts what fits into the window, *len returns the accepted length
+ */
+uint8_t WCHNET_SocketSend(uint8_t socketid, uint8_t *buf, uint32_t *len)
+{
+    uint32_t room, n;
+
+    if(socketid != SIM_SOCK_CONN || !sim_connected)
+    {
+        *len = 0;
+        return WCHNET_ERR_CONN;
+    }
+    sim_stats.send_calls++;
+    sim_sink_drain();
+    room = sim_cfg.window - (sim_sink_wr - sim_sink_ack);
+    n = MIN(*len, room);
+    if(n < *len)
+    {
+        sim_stats.send_short++;
+        sim_stats.send_rest += *len - n;
+        if(!n)
+            sim_stats.send_busy++;
+    }
+    for(uint32_t i = 0; i < n; i++)
+        sim_sink_buf[(sim_sink_wr++) & (SIM_SINK_BUF_SIZE - 1)] = buf[i];
+    if(sim_sink_wr - sim_sink_ack > sim_stats.inflight_hwm)
+        sim_stats.inflight_hwm = sim_sink_wr - sim_sink_ack;
+    *len = n;
+    return WCHNET_ERR_SUCCESS;
+}
+
+/*
+ * Datagrams to port 123 go to the SNTP server stand-in, from the twsync
+ * socket - to the collector, the rest is lost
+ */
+uint8_t WCHNET_SocketUdpSendTo(uint8_t socketid, uint8_t *buf, uint32_t *slen, uint8_t *sip, uint16_t port)
+{
+    (void)sip;
+    if(socketid >= WCHNET_MAX_SOCKET_NUM || SocketInf[socketid].ProtoType != PROTO_TYPE_UDP)
+    {
+        *slen = 0;
+        return WCHNET_ERR_ARG;
+    }
+    if(SocketInf[socketid].SourPort == TWSYNC_PORT)
+        sim_twsync_sendto(buf, *slen);
+    else if(port == SIM_SNTP_PORT)
+    {
+        sim_sntp_sock = socketid;
+        sim_sntp_request(buf, *slen);
+    }
+    return WCHNET_ERR_SUCCESS;
+}
+
+/******************************** endfile @ sim_net ******************************/
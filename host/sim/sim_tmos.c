@@ -0,0 +1,262 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : sim_tmos.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/09
+ * Description        : TMOS task scheduler stand-in on the virtual clock
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define SIM_TMOS_TASKS          8
+#define SIM_TMOS_EVENTS         16
+
+/*********************************************************************
+ * TYPEDEFS
+ */
+typedef struct
+{
+    pTaskEventHandlerFn cb;
+    tmosEvents events;
+    uint64_t timer[SIM_TMOS_EVENTS];     // expiry time, SIM_TIME_NEVER - stopped
+    tmosTimer reload[SIM_TMOS_EVENTS];
+} sim_task_t;
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static sim_task_t sim_tasks[SIM_TMOS_TASKS];
+static uint8_t sim_task_num;
+static uint32_t sim_rand_state = 1;
+
+/*********************************************************************
+ * @fn      sim_tmos_ticks
+ *
+ * @brief   TMOS ticks (625 us) to ns.
+ */
+static uint64_t sim_tmos_ticks(tmosTimer time)
+{
+    return (uint64_t)time * SYSTEM_TIME_MICROSEN * SIM_NS_PER_US;
+}
+
+/*********************************************************************
+ * @fn      sim_tmos_timers
+ *
+ * @brief   Move expired timers into the task event bits.
+ */
+static void sim_tmos_timers(void)
+{
+    uint64_t now = sim_now();
+
+    for(int t = 0; t < sim_task_num; t++)
+    {
+        for(int e = 0; e < SIM_TMOS_EVENTS; e++)
+        {
+            if(sim_tasks[t].timer[e] <= now)
+            {
+                sim_tasks[t].events |= (tmosEvents)(1u << e);
+                if(sim_tasks[t].reload[e])
+                    sim_tasks[t].timer[e] += sim_tmos_ticks(sim_tasks[t].reload[e]);
+                else
+                    sim_tasks[t].timer[e] = SIM_TIME_NEVER;
+            }
+        }
+    }
+}
+
+/*********************************************************************
+ * @fn      sim_tmos_next
+ *
+ * @brief   Earliest pending timer.
+ *
+ * @return  expiry time, ns or SIM_TIME_NEVER
+ */
+uint64_t sim_tmos_next(void)
+{
+    uint64_t next = SIM_TIME_NEVER;
+
+    for(int t = 0; t < sim_task_num; t++)
+        for(int e = 0; e < SIM_TMOS_EVENTS; e++)
+            if(sim_tasks[t].timer[e] < next)
+                next = sim_tasks[t].timer[e];
+    return next;
+}
+
+/*********************************************************************
+ * @fn      sim_tmos_pending
+ *
+ * @return  1 - some task has an event to process
+ */
+int sim_tmos_pending(void)
+{
+    for(int t = 0; t < sim_task_num; t++)
+        if(sim_tasks[t].events)
+            return 1;
+    return 0;
+}
+
+/*********************************************************************
+ * TMOS API
+ */
+
+tmosTaskID TMOS_ProcessEventRegister(pTaskEventHandlerFn eventCb)
+{
+    sim_task_t *p;
+
+    if(sim_task_num >= SIM_TMOS_TASKS)
+        return INVALID_TASK_ID;
+    p = &sim_tasks[sim_task_num];
+    memset(p, 0, sizeof(*p));
+    p->cb = eventCb;
+    for(int e = 0; e < SIM_TMOS_EVENTS; e++)
+        p->timer[e] = SIM_TIME_NEVER;
+    return sim_task_num++;
+}
+
+/*
+ * One call runs the highest priority (lowest id) task that has events,
+ * as the library scheduler does.
+ */
+void TMOS_SystemProcess(void)
+{
+    sim_tmos_timers();
+    for(int t = 0; t < sim_task_num; t++)
+    {
+        tmosEvents ev = sim_tasks[t].events;
+
+        if(ev)
+        {
+            sim_tasks[t].events = 0;
+            ev = sim_tasks[t].cb((tmosTaskID)t, ev);
+            sim_tasks[t].events |= ev;
+            break;
+        }
+    }
+}
+
+uint32_t TMOS_GetSystemClock(void)
+{
+    return (uint32_t)(sim_now() / (SYSTEM_TIME_MICROSEN * SIM_NS_PER_US));
+}
+
+bStatus_t tmos_set_event(tmosTaskID taskID, tmosEvents event)
+{
+    if(taskID >= sim_task_num)
+        return INVALID_TASK_ID;
+    sim_tasks[taskID].events |= event;
+    return SUCCESS;
+}
+
+bStatus_t tmos_clear_event(tmosTaskID taskID, tmosEvents event)
+{
+    if(taskID >= sim_task_num)
+        return INVALID_TASK_ID;
+    sim_tasks[taskID].events &= ~event;
+    return SUCCESS;
+}
+
+static bStatus_t sim_tmos_start(tmosTaskID taskID, tmosEvents event, tmosTimer time, tmosTimer reload)
+{
+    if(taskID >= sim_task_num)
+        return INVALID_TASK_ID;
+    for(int e = 0; e < SIM_TMOS_EVENTS; e++)
+    {
+        if(event & (1u << e))
+        {
+            sim_tasks[taskID].timer[e] = sim_now() + sim_tmos_ticks(time);
+            sim_tasks[taskID].reload[e] = reload;
+        }
+    }
+    return SUCCESS;
+}
+
+BOOL tmos_start_task(tmosTaskID taskID, tmosEvents event, tmosTimer time)
+{
+    return sim_tmos_start(taskID, event, time, 0) == SUCCESS;
+}
+
+bStatus_t tmos_start_reload_task(tmosTaskID taskID, tmosEvents event, tmosTimer time)
+{
+    return sim_tmos_start(taskID, event, time, time);
+}
+
+bStatus_t tmos_stop_task(tmosTaskID taskID, tmosEvents event)
+{
+    if(taskID >= sim_task_num)
+        return INVALID_TASK_ID;
+    for(int e = 0; e < SIM_TMOS_EVENTS; e++)
+        if(event & (1u << e))
+            sim_tasks[taskID].timer[e] = SIM_TIME_NEVER;
+    sim_tasks[taskID].events &= ~event;
+    return SUCCESS;
+}
+
+tmosTimer tmos_get_task_timer(tmosTaskID taskID, tmosEvents event)
+{
+    uint64_t now = sim_now();
+
+    if(taskID >= sim_task_num)
+        return 0;
+    for(int e = 0; e < SIM_TMOS_EVENTS; e++)
+        if((event & (1u << e)) && sim_tasks[taskID].timer[e] != SIM_TIME_NEVER)
+            return (tmosTimer)((sim_tasks[taskID].timer[e] - now) / (SYSTEM_TIME_MICROSEN * SIM_NS_PER_US));
+    return 0;
+}
+
+/*
+ * The application only drains messages, nobody sends them on the host
+ */
+uint8_t *tmos_msg_allocate(uint16_t len)
+{
+    return malloc(len);
+}
+
+bStatus_t tmos_msg_send(tmosTaskID taskID, uint8_t *msg_ptr)
+{
+    (void)taskID;
+    free(msg_ptr);
+    return FAILURE;
+}
+
+uint8_t *tmos_msg_receive(tmosTaskID taskID)
+{
+    (void)taskID;
+    return NULL;
+}
+
+bStatus_t tmos_msg_deallocate(uint8_t *msg_ptr)
+{
+    free(msg_ptr);
+    return SUCCESS;
+}
+
+uint32_t tmos_rand(void)
+{
+    sim_rand_state = sim_rand_state * 1103515245u + 12345u;
+    return sim_rand_state >> 1;
+}
+
+void tmos_memset(void *pDst, uint8_t Value, uint32_t len)
+{
+    memset(pDst, Value, len);
+}
+
+void tmos_memcpy(void *dst, const void *src, uint32_t len)
+{
+    memcpy(dst, src, len);
+}
+
+BOOL tmos_memcmp(const void *src1, const void *src2, uint32_t len)
+{
+    return memcmp(src1, src2, len) == 0;
+}
+
+/******************************** endfile @ sim_tmos ******************************/
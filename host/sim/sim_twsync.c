@@ -0,0 +1,273 @@
+/********************************** (C) COPYRIGHT *******************************
+ * File Name          : sim_twsync.c
+ * Author             : pvvx
+ * Version            : V1.0
+ * Date               : 2024/03/19
+ * Description        : Two-way time transfer on the simulated LAN: the
+ *                      collector (host/collector/twsync_col.c) on the
+ *                      true UTC, the wire, the ETH interrupt stamps and
+ *                      the stack delays of the gateway
+ *********************************************************************************/
+
+/*********************************************************************
+ * INCLUDES
+ */
+#include <string.h>
+#include "sim.h"
+#include "eth_driver.h"
+#include "twsync.h"
+#include "twsync_col.h"
+
+/*********************************************************************
+ * CONSTANTS
+ */
+#define SIM_TW_HDR_LEN          42          // Ethernet, IPv4, UDP
+#define SIM_TW_COL_PORT         50124
+#define SIM_TW_NS_PER_BYTE      800         // 10BASE-T
+#define SIM_TW_STACK_MIN_US     20          // interrupt to socket callback, send to MAC
+
+/*********************************************************************
+ * LOCAL VARIABLES
+ */
+static const uint8_t sim_tw_col_ip[4] = { 192, 168, 2, 10 };
+static const uint8_t sim_tw_gw_ip[4] = { 192, 168, 2, 134 };
+
+static sim_twsync_cfg_t sim_tw_cfg;
+static sim_twsync_stats_t sim_tw_stats;
+static twsync_col_t sim_tw_col;
+static uint32_t sim_tw_rnd = 7;
+
+// one exchange in flight: each stage has its time, SIM_TIME_NEVER - idle
+static uint64_t sim_tw_probe = SIM_TIME_NEVER;     // collector sends a probe
+static uint64_t sim_tw_rx = SIM_TIME_NEVER;        // probe received, ETH interrupt
+static uint64_t sim_tw_cb = SIM_TIME_NEVER;        // socket callback
+static uint64_t sim_tw_tx = SIM_TIME_NEVER;        // reply handed to the MAC
+static uint64_t sim_tw_txdone = SIM_TIME_NEVER;    // reply sent, ETH interrupt
+static uint64_t sim_tw_col_rx = SIM_TIME_NEVER;    // reply at the collector
+static uint64_t sim_tw_set = SIM_TIME_NEVER;       // correction at the gateway socket
+
+static uint8_t sim_tw_frame[SIM_TW_HDR_LEN + sizeof(twsync_msg_t)];
+static uint32_t sim_tw_frame_len;
+static uint8_t sim_tw_set_msg[sizeof(twsync_set_t)];
+
+/*********************************************************************
+ * @fn      sim_tw_jitter
+ *
+ * @return  uniform 0..max - 1 us as ns
+ */
+static uint64_t sim_tw_jitter(uint32_t max)
+{
+    if(!max)
+        return 0;
+    sim_tw_rnd = sim_tw_rnd * 1103515245 + 12345;
+    return (uint64_t)((sim_tw_rnd >> 8) % max) * SIM_NS_PER_US;
+}
+
+static uint64_t sim_tw_stack(void)
+{
+    return SIM_TW_STACK_MIN_US * SIM_NS_PER_US + sim_tw_jitter(sim_tw_cfg.stack_us);
+}
+
+static uint64_t sim_tw_wire(uint32_t len)
+{
+    return (uint64_t)TWSYNC_WIRE_BYTES(len) * SIM_TW_NS_PER_BYTE;
+}
+
+static uint64_t sim_tw_utc(uint64_t t)
+{
+    return SIM_UTC_EPOCH_US + t / SIM_NS_PER_US;
+}
+
+/*********************************************************************
+ * @fn      sim_tw_socket
+ *
+ * @return  the gateway twsync UDP socket, NULL - not created yet
+ */
+static SOCK_INF *sim_tw_socket(void)
+{
+    for(int i = 0; i < WCHNET_MAX_SOCKET_NUM; i++)
+    {
+        if(SocketInf[i].ProtoType == PROTO_TYPE_UDP && SocketInf[i].SourPort == TWSYNC_PORT
+           && SocketInf[i].AppCallBack)
+            return &SocketInf[i];
+    }
+    return NULL;
+}
+
+/*********************************************************************
+ * @fn      sim_tw_build
+ *
+ * @brief   Ethernet/IPv4/UDP frame around a message for the driver hooks.
+ */
+static void sim_tw_build(const uint8_t *src, const uint8_t *dst, uint16_t sport, uint16_t dport,
+                         const uint8_t *msg, uint32_t len)
+{
+    uint8_t *f = sim_tw_frame;
+    uint16_t ip_len = (uint16_t)(20 + 8 + len);
+
+    memset(f, 0, SIM_TW_HDR_LEN);
+    f[12] = 0x08;                   // IPv4
+    f[14] = 0x45;
+    f[16] = (uint8_t)(ip_len >> 8);
+    f[17] = (uint8_t)ip_len;
+    f[22] = 64;                     // TTL
+    f[23] = 17;                     // UDP
+    memcpy(&f[26], src, 4);
+    memcpy(&f[30], dst, 4);
+    f[34] = (uint8_t)(sport >> 8);
+    f[35] = (uint8_t)sport;
+    f[36] = (uint8_t)(dport >> 8);
+    f[37] = (uint8_t)dport;
+    f[38] = (uint8_t)((len + 8) >> 8);
+    f[39] = (uint8_t)(len + 8);
+    memcpy(&f[SIM_TW_HDR_LEN], msg, len);
+    sim_tw_frame_len = SIM_TW_HDR_LEN + len;
+}
+
+/*********************************************************************
+ * @fn      sim_twsync_config
+ *
+ * @brief   Start the collector, the first probe after a period.
+ *
+ * @param   cfg - period_ms 0 - no collector
+ *
+ * @return  none
+ */
+void sim_twsync_config(const sim_twsync_cfg_t *cfg)
+{
+    sim_tw_cfg = *cfg;
+    twsync_col_init(&sim_tw_col);
+    memset(&sim_tw_stats, 0, sizeof(sim_tw_stats));
+    sim_tw_probe = cfg->period_ms ? sim_now() + cfg->period_ms * SIM_NS_PER_MS : SIM_TIME_NEVER;
+}
+
+const sim_twsync_stats_t *sim_twsync_get_stats(void)
+{
+    return &sim_tw_stats;
+}
+
+const twsync_col_t *sim_twsync_collector(void)
+{
+    return &sim_tw_col;
+}
+
+/*********************************************************************
+ * @fn      sim_twsync_next
+ *
+ * @return  time of the next stage, ns or SIM_TIME_NEVER
+ */
+uint64_t sim_twsync_next(void)
+{
+    uint64_t t = sim_tw_probe;
+
+    t = MIN(t, sim_tw_rx);
+    t = MIN(t, sim_tw_cb);
+    t = MIN(t, sim_tw_tx);
+    t = MIN(t, sim_tw_txdone);
+    t = MIN(t, sim_tw_col_rx);
+    t = MIN(t, sim_tw_set);
+    return t;
+}
+
+/*********************************************************************
+ * @fn      sim_twsync_poll
+ *
+ * @brief   Collector and wire stages, ETH interrupts. Interrupt stamps
+ *          are taken at the stage time, not at the loop pass.
+ */
+void sim_twsync_poll(void)
+{
+    uint64_t now = sim_now(), t;
+    uint8_t msg[sizeof(twsync_msg_t)];
+    uint32_t len;
+
+    if(now >= sim_tw_probe)
+    {
+        t = sim_tw_probe;
+        sim_tw_probe = t + sim_tw_cfg.period_ms * SIM_NS_PER_MS;
+        // a lost exchange is abandoned
+        if(sim_tw_socket() && sim_tw_rx == SIM_TIME_NEVER && sim_tw_cb == SIM_TIME_NEVER
+           && sim_tw_tx == SIM_TIME_NEVER && sim_tw_txdone == SIM_TIME_NEVER && sim_tw_col_rx == SIM_TIME_NEVER)
+        {
+            len = twsync_col_probe(&sim_tw_col, sim_tw_utc(t), msg);
+            sim_tw_build(sim_tw_col_ip, sim_tw_gw_ip, SIM_TW_COL_PORT, TWSYNC_PORT, msg, len);
+            sim_tw_rx = t + (sim_tw_cfg.up_us * SIM_NS_PER_US + sim_tw_jitter(sim_tw_cfg.jitter_us))
+                        + sim_tw_wire(sim_tw_frame_len);
+            sim_tw_stats.probes++;
+        }
+    }
+    if(now >= sim_tw_rx)
+    {
+        twsync_eth_rx(sim_tw_frame, sim_tw_frame_len, sim_systick_at(sim_tw_rx));
+        sim_tw_cb = sim_tw_rx + sim_tw_stack();
+        sim_tw_rx = SIM_TIME_NEVER;
+    }
+    if(now >= sim_tw_tx)
+    {
+        twsync_eth_tx(sim_tw_frame, sim_tw_frame_len);
+        sim_tw_txdone = sim_tw_tx + sim_tw_wire(sim_tw_frame_len);
+        sim_tw_tx = SIM_TIME_NEVER;
+    }
+    if(now >= sim_tw_txdone)
+    {
+        twsync_eth_txdone(sim_systick_at(sim_tw_txdone), 1);
+        sim_tw_col_rx = sim_tw_txdone + sim_tw_cfg.down_us * SIM_NS_PER_US + sim_tw_jitter(sim_tw_cfg.jitter_us);
+        sim_tw_txdone = SIM_TIME_NEVER;
+    }
+    if(now >= sim_tw_col_rx)
+    {
+        t = sim_tw_col_rx;
+        sim_tw_col_rx = SIM_TIME_NEVER;
+        sim_tw_stats.replies++;
+        if(twsync_col_reply(&sim_tw_col, &sim_tw_frame[SIM_TW_HDR_LEN], sim_tw_frame_len - SIM_TW_HDR_LEN,
+                            sim_tw_utc(t))
+           && twsync_col_fit(&sim_tw_col)
+           && twsync_col_set(&sim_tw_col, sim_tw_set_msg))
+        {
+            sim_tw_set = t + (sim_tw_cfg.up_us + SIM_TW_STACK_MIN_US) * SIM_NS_PER_US;
+            sim_tw_stats.sets++;
+        }
+    }
+}
+
+/*********************************************************************
+ * @fn      sim_twsync_task
+ *
+ * @brief   WCHNET_MainTask: datagrams for the gateway socket.
+ */
+void sim_twsync_task(void)
+{
+    uint64_t now = sim_now();
+    SOCK_INF *p = sim_tw_socket();
+    uint32_t ip;
+
+    memcpy(&ip, sim_tw_col_ip, 4);
+    if(now >= sim_tw_cb)
+    {
+        sim_tw_cb = SIM_TIME_NEVER;
+        if(p)
+            p->AppCallBack(p, ip, SIM_TW_COL_PORT, &sim_tw_frame[SIM_TW_HDR_LEN], sim_tw_frame_len - SIM_TW_HDR_LEN);
+    }
+    if(now >= sim_tw_set)
+    {
+        sim_tw_set = SIM_TIME_NEVER;
+        if(p)
+            p->AppCallBack(p, ip, SIM_TW_COL_PORT, sim_tw_set_msg, sizeof(sim_tw_set_msg));
+    }
+}
+
+/*********************************************************************
+ * @fn      sim_twsync_sendto
+ *
+ * @brief   WCHNET_SocketUdpSendTo() on the twsync socket: the reply
+ *          reaches the MAC after the stack delay.
+ */
+void sim_twsync_sendto(const uint8_t *buf, uint32_t len)
+{
+    if(len > sizeof(twsync_msg_t))
+        return;
+    sim_tw_build(sim_tw_gw_ip, sim_tw_col_ip, TWSYNC_PORT, SIM_TW_COL_PORT, buf, len);
+    sim_tw_tx = sim_now() + sim_tw_stack();
+}
+
+/******************************** endfile @ sim_twsync ******************************/
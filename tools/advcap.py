@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+
+# advcap.py 12.03.2024 pvvx #
+#
+# Record the advert stream of a live WCHBLE2ETH gateway into a capture file
+# (.advc, see host/sim/advcap.h) for host/advreplay.
+#   python3 advcap.py 192.168.2.134 -o room.advc -t 600
+
+import sys
+import time
+import struct
+import socket
+import argparse
+
+ADVCAP_MAGIC = 0x43564441
+ADVCAP_VERSION = 1
+ADVCAP_HDR = '<IHHII'
+ADVCAP_REC = '<QBBBBBb6sBbBB'
+
+ADVCAP_DEVICE_INFO = 0
+ADVCAP_EXT_ADV_INFO = 1
+
+ADV_HDR_LEN = 10
+ADV_SVC_MARKER = 0xFF
+
+GAP_PHY_BIT_LE_1M = 1
+PHY_LEGACY = GAP_PHY_BIT_LE_1M | (GAP_PHY_BIT_LE_1M << 4)
+
+def frame_to_rec(ts, frame):
+	"""v1 stream frame -> (record header, data) or None for service frames."""
+	if frame[1] == ADV_SVC_MARKER:
+		return None
+	evt = frame[1] & 0x0F
+	addr_type = frame[1] >> 4
+	phy = frame[2]
+	# the stream does not carry the report type: legacy reports are 1M/1M
+	# with event types 0..4
+	typ = ADVCAP_DEVICE_INFO if phy == PHY_LEGACY and evt <= 4 else ADVCAP_EXT_ADV_INFO
+	rssi = frame[3] - 256 if frame[3] > 127 else frame[3]
+	data = frame[ADV_HDR_LEN:]
+	hdr = struct.pack(ADVCAP_REC, ts, typ, evt, addr_type, phy & 0x0F, phy >> 4, rssi,
+		bytes(frame[4:10]), 0xFF, 127, 0, len(data))
+	return hdr + data
+
+def main():
+	parser = argparse.ArgumentParser(description='Record a WCHBLE2ETH advert stream to a capture file')
+	parser.add_argument('host', help='device IP address or url')
+	parser.add_argument('-p', '--port', type=int, default=1000, help='device TCP port (default: 1000)')
+	parser.add_argument('-o', '--output', default='capture.advc', help='capture file (default: capture.advc)')
+	parser.add_argument('-t', '--time', type=float, default=0, help='stop after T seconds')
+	parser.add_argument('-n', '--count', type=int, default=0, help='stop after N adverts')
+	args = parser.parse_args()
+	sock = socket.create_connection((args.host, args.port), timeout=5)
+	sock.settimeout(1)
+	count = 0
+	t0 = time.monotonic()
+	with open(args.output, 'wb') as f:
+		f.write(struct.pack(ADVCAP_HDR, ADVCAP_MAGIC, ADVCAP_VERSION, struct.calcsize(ADVCAP_HDR), 1000000, 0))
+		buf = bytearray()
+		pos = 0
+		try:
+			while True:
+				if args.time and time.monotonic() - t0 >= args.time:
+					break
+				if args.count and count >= args.count:
+					break
+				try:
+					chunk = sock.recv(1460 * 2)
+				except socket.timeout:
+					continue
+				if not chunk:
+					break
+				ts = time.time_ns() // 1000
+				buf += chunk
+				while len(buf) - pos >= ADV_HDR_LEN and len(buf) - pos >= ADV_HDR_LEN + buf[pos]:
+					end = pos + ADV_HDR_LEN + buf[pos]
+					rec = frame_to_rec(ts, buf[pos:end])
+					pos = end
+					if rec:
+						f.write(rec)
+						count += 1
+				del buf[:pos]
+				pos = 0
+		except KeyboardInterrupt:
+			pass
+		finally:
+			sock.close()
+	sys.stderr.write('%d adverts, %.1f s -> %s\n' % (count, time.monotonic() - t0, args.output))
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,388 @@
+#!/usr/bin/env python3
+
+# advstream.py 14.03.2024 pvvx #
+#
+# Reference parser of the WCHBLE2ETH TCP stream: v1 frames, compact and
+# receive time records (APP/include/advenc.h) and v2 blocks
+# (APP/include/stream.h) with CRC check, resync, sequence gap detection
+# and LZ4 block payloads (APP/include/lz.h).
+#   python3 advstream.py 192.168.2.134 -2 -D -Z -z
+
+import sys
+import time
+import struct
+import socket
+import argparse
+
+CTRL_CMD_FRAMING = 0x03
+CTRL_CMD_ENCODING = 0x04
+CTRL_CMD_TIMESTAMP = 0x05
+CTRL_CMD_SNTP = 0x06
+CTRL_CMD_COMPRESS = 0x07
+STREAM_V1 = 1
+STREAM_V2 = 2
+STREAM_BLK_LZ = 0x80
+STREAM_LZ_ON = 1
+ADV_ENC_FULL = 0
+ADV_ENC_COMPACT = 1
+
+ADV_HDR_LEN = 10
+ADV_SVC_MARKER = 0xFF
+ADV_SVC_DICT = 0x03
+
+ADV_REC_TAG = 0x80
+ADV_REC_TAG_MASK = 0xF8
+ADV_REC_KIND_MASK = 0xFE
+ADV_REC_NEW = 0x80
+ADV_REC_DATA = 0x82
+ADV_REC_SAME = 0x84
+ADV_REC_DELTA = 0x86
+ADV_REC_WIDE = 0x01
+ADV_REC_TIME = 0x88
+ADV_REC_TIME_DELTA = 0x89
+ADV_REC_TIME_MASK = 0xFE
+GWTIME_SYNCED = 0x01
+
+STREAM_MAGIC = b'\xA5\xFE\x42\x32'
+STREAM_BLK_HDR = '<4sBBHIH6s'
+STREAM_BLK_HDR_LEN = struct.calcsize(STREAM_BLK_HDR)
+STREAM_CRC_LEN = 4
+STREAM_BLK_MAX = 4096
+
+def _crc_table():
+	tab = []
+	for i in range(256):
+		c = i << 24
+		for _ in range(8):
+			c = ((c << 1) ^ 0x04C11DB7) if c & 0x80000000 else (c << 1)
+		tab.append(c & 0xFFFFFFFF)
+	return tab
+
+CRC_TABLE = _crc_table()
+
+def rec_len(b0, b1):
+	"""Record length from its first two bytes, see adv_rec_len()."""
+	if b1 & ADV_REC_TIME_MASK == ADV_REC_TIME:
+		return 2 + b0
+	if b1 & ADV_REC_TAG_MASK != ADV_REC_TAG:
+		return ADV_HDR_LEN + b0
+	return 4 + (b1 & ADV_REC_WIDE) + (8 if b1 & ADV_REC_KIND_MASK == ADV_REC_NEW else 0) + b0
+
+def stream_crc32(data):
+	"""CRC unit of the CH32: CRC-32/MPEG-2 over little-endian 32-bit words."""
+	crc = 0xFFFFFFFF
+	for i in range(0, len(data) & ~3, 4):
+		# the unit takes a word MSB first
+		for b in (data[i + 3], data[i + 2], data[i + 1], data[i]):
+			crc = ((crc << 8) & 0xFFFFFFFF) ^ CRC_TABLE[(crc >> 24) ^ b]
+	return crc
+
+def lz_decompress(src):
+	"""LZ4 block (no frame), None - bad block."""
+	out = bytearray()
+	i, n = 0, len(src)
+	while i < n:
+		tok = src[i]
+		i += 1
+		lit = tok >> 4
+		if lit == 15:
+			while True:
+				if i >= n:
+					return None
+				b = src[i]
+				i += 1
+				lit += b
+				if b != 255:
+					break
+		if i + lit > n:
+			return None
+		out += src[i:i + lit]
+		i += lit
+		if i == n:
+			break
+		if i + 2 > n:
+			return None
+		off = src[i] | (src[i + 1] << 8)
+		i += 2
+		ml = (tok & 15) + 4
+		if tok & 15 == 15:
+			while True:
+				if i >= n:
+					return None
+				b = src[i]
+				i += 1
+				ml += b
+				if b != 255:
+					break
+		if off == 0 or off > len(out):
+			return None
+		start = len(out) - off
+		if off >= ml:
+			out += out[start:start + ml]
+		else:
+			# overlapping match repeats the last off bytes
+			for k in range(ml):
+				out.append(out[start + k])
+	return bytes(out)
+
+class AdvDict:
+	"""Client side device dictionary: compact record -> v1 frame."""
+
+	def __init__(self):
+		self.ent = {}
+		self.miss = 0
+
+	def clear(self):
+		self.ent.clear()
+
+	def decode(self, r):
+		kind = r[1] & ADV_REC_KIND_MASK
+		p = 3
+		h = r[2]
+		if r[1] & ADV_REC_WIDE:
+			h |= r[3] << 8
+			p = 4
+		if kind == ADV_REC_NEW:
+			# v1 header without the length, payload
+			e = [bytearray(r[p:p + 3]) + r[p + 3:p + 9], bytearray(r[p + 9:p + 9 + r[0]])]
+			self.ent[h] = e
+		else:
+			e = self.ent.get(h)
+			if e is None:
+				self.miss += 1
+				return None
+			e[0][2] = r[p]
+			p += 1
+			if kind == ADV_REC_DATA:
+				e[1] = bytearray(r[p:p + r[0]])
+			elif kind == ADV_REC_DELTA:
+				d = e[1]
+				ch = p + (len(d) + 7) // 8
+				for i in range(len(d)):
+					if r[p + (i >> 3)] & (1 << (i & 7)):
+						d[i] = r[ch]
+						ch += 1
+		return bytes([len(e[1])]) + bytes(e[0]) + bytes(e[1])
+
+class StreamParser:
+	"""Feed stream bytes, get (time, v1 frame) pairs back: compact records
+	decoded, time - (us, flags) of the advert receive time record or None.
+	Counts v2 blocks, bad blocks, sequence gaps and bytes skipped while
+	resyncing."""
+
+	def __init__(self):
+		self.dict = AdvDict()
+		self.ts = 0
+		self.ts_flags = 0
+		self.ts_pending = False
+		self.buf = bytearray()
+		self.pos = 0
+		self.hunt = False
+		self.gw_id = None
+		self.seq = None
+		self.blocks = 0
+		self.block_err = 0
+		self.block_lost = 0
+		self.skipped = 0
+		self.lz_blocks = 0
+		self.lz_in = 0
+		self.lz_out = 0
+
+	def _resync(self, start):
+		"""Skip to the next STREAM_MAGIC at or after start."""
+		i = self.buf.find(STREAM_MAGIC, start)
+		if i < 0:
+			# the tail may be the beginning of the magic
+			i = max(start, len(self.buf) - 3)
+			self.hunt = True
+		else:
+			self.hunt = False
+		self.skipped += i - self.pos
+		self.pos = i
+
+	def _block(self):
+		"""Returns frames of a complete block, [] - bad block, None - need more data."""
+		buf, p = self.buf, self.pos
+		if len(buf) - p < STREAM_BLK_HDR_LEN:
+			if buf[p:p + 4] != STREAM_MAGIC[:len(buf) - p]:
+				return []
+			return None
+		magic, ver, hdr_len, count, seq, plen, gw_id = struct.unpack_from(STREAM_BLK_HDR, buf, p)
+		if magic != STREAM_MAGIC or ver & ~STREAM_BLK_LZ != STREAM_V2 or hdr_len != STREAM_BLK_HDR_LEN \
+			or hdr_len + plen + 3 + STREAM_CRC_LEN > STREAM_BLK_MAX:
+			return []
+		total = hdr_len + ((plen + 3) & ~3) + STREAM_CRC_LEN
+		if len(buf) - p < total:
+			return None
+		crc = struct.unpack_from('<I', buf, p + total - STREAM_CRC_LEN)[0]
+		if stream_crc32(buf[p:p + total - STREAM_CRC_LEN]) != crc:
+			return []
+		data = buf
+		off = p + hdr_len
+		end = off + plen
+		if ver & STREAM_BLK_LZ:
+			if plen < 2:
+				return []
+			data = lz_decompress(bytes(buf[off + 2:end]))
+			if data is None or len(data) != buf[off] | (buf[off + 1] << 8):
+				return []
+			self.lz_blocks += 1
+			self.lz_in += plen
+			self.lz_out += len(data)
+			off, end = 0, len(data)
+		frames = []
+		n = 0
+		while off + 2 <= end and off + rec_len(data[off], data[off + 1]) <= end:
+			frames.append(bytes(data[off:off + rec_len(data[off], data[off + 1])]))
+			off += rec_len(data[off], data[off + 1])
+			n += 1
+		if n != count:
+			return []
+		if self.seq is not None and gw_id == self.gw_id and seq != self.seq:
+			self.block_lost += (seq - self.seq) & 0xFFFFFFFF
+			self.lost()
+		self.gw_id = gw_id
+		self.seq = (seq + 1) & 0xFFFFFFFF
+		self.blocks += 1
+		self.pos = p + total
+		return frames
+
+	def lost(self):
+		"""Records lost: deltas would apply to stale payloads until the
+		dictionary restarts (the client repeats CTRL_CMD_ENCODING)."""
+		self.dict.clear()
+		self.ts_pending = False
+
+	def _time(self, r):
+		"""Apply a time record, see gwtime_rec_parse()."""
+		if r[1] == ADV_REC_TIME:
+			self.ts_flags = r[2]
+			self.ts = int.from_bytes(r[3:11], 'little')
+		else:
+			z = 0
+			for i, b in enumerate(r[2:2 + r[0]]):
+				z |= (b & 0x7F) << (i * 7)
+			self.ts = (self.ts + ((z >> 1) ^ -(z & 1))) & 0xFFFFFFFFFFFFFFFF
+		self.ts_pending = True
+
+	def _record(self, r):
+		"""Record -> (time, v1 frame) or None."""
+		if r[1] & ADV_REC_TIME_MASK == ADV_REC_TIME:
+			self._time(r)
+			return None
+		if r[1] & ADV_REC_TAG_MASK == ADV_REC_TAG:
+			r = self.dict.decode(r)
+			if r is None:
+				self.ts_pending = False
+				return None
+		elif r[1] == ADV_SVC_MARKER:
+			if r[2] == ADV_SVC_DICT:
+				self.dict.clear()
+			return None, r
+		ts = None
+		if self.ts_pending:
+			ts = (self.ts, self.ts_flags)
+			self.ts_pending = False
+		return ts, r
+
+	def feed(self, data):
+		"""Returns the list of (time, frame) of complete frames."""
+		self.buf += data
+		records = []
+		while self.pos < len(self.buf):
+			if self.hunt:
+				self._resync(self.pos)
+				if self.hunt:
+					break
+			buf, p = self.buf, self.pos
+			if len(buf) - p >= 2 and buf[p + 1] == STREAM_MAGIC[1]:
+				res = self._block()
+				if res is None:
+					break
+				if not res:
+					self.block_err += 1
+					self.lost()
+					self._resync(p + 1)
+					continue
+				records += res
+				continue
+			if len(buf) - p < 2 or len(buf) - p < rec_len(buf[p], buf[p + 1]):
+				break
+			n = rec_len(buf[p], buf[p + 1])
+			records.append(bytes(buf[p:p + n]))
+			self.pos = p + n
+		del self.buf[:self.pos]
+		self.pos = 0
+		frames = []
+		for r in records:
+			f = self._record(r)
+			if f is not None:
+				frames.append(f)
+		return frames
+
+def fmt_time(ts):
+	if ts is None:
+		return '-'
+	t, flags = ts
+	if flags & GWTIME_SYNCED:
+		return time.strftime('%H:%M:%S', time.gmtime(t // 1000000)) + '.%06d' % (t % 1000000)
+	return '+%d.%06d' % (t // 1000000, t % 1000000)
+
+def main():
+	parser = argparse.ArgumentParser(description='WCHBLE2ETH stream parser, v1 frames and v2 blocks')
+	parser.add_argument('host', help='device IP address or url')
+	parser.add_argument('-p', '--port', type=int, default=1000, help='device TCP port (default: 1000)')
+	parser.add_argument('-2', '--v2', action='store_true', help='request v2 framing (blocks with CRC)')
+	parser.add_argument('-D', '--compact', action='store_true', help='request compact records (device dictionary)')
+	parser.add_argument('-Z', '--stamp', action='store_true', help='request receive time records')
+	parser.add_argument('-z', '--lz', action='store_true', help='request compressed v2 blocks (implies -2)')
+	parser.add_argument('-s', '--sntp', help='set the SNTP server IP (0.0.0.0 - the DHCP gateway)')
+	parser.add_argument('-t', '--time', type=float, default=0, help='stop after T seconds')
+	parser.add_argument('-q', '--quiet', action='store_true', help='counters only, no frames')
+	args = parser.parse_args()
+	sock = socket.create_connection((args.host, args.port), timeout=5)
+	sock.settimeout(1)
+	if args.v2 or args.lz:
+		sock.sendall(bytes([CTRL_CMD_FRAMING, 1, STREAM_V2]))
+	if args.lz:
+		sock.sendall(bytes([CTRL_CMD_COMPRESS, 1, STREAM_LZ_ON]))
+	if args.compact:
+		sock.sendall(bytes([CTRL_CMD_ENCODING, 1, ADV_ENC_COMPACT]))
+	if args.stamp:
+		sock.sendall(bytes([CTRL_CMD_TIMESTAMP, 1, 1]))
+	if args.sntp:
+		sock.sendall(bytes([CTRL_CMD_SNTP, 4]) + socket.inet_aton(args.sntp))
+	sp = StreamParser()
+	adverts = svc = lost = 0
+	t0 = time.monotonic()
+	try:
+		while not args.time or time.monotonic() - t0 < args.time:
+			try:
+				chunk = sock.recv(1460 * 2)
+			except socket.timeout:
+				continue
+			if not chunk:
+				break
+			for ts, f in sp.feed(chunk):
+				if f[1] == ADV_SVC_MARKER:
+					svc += 1
+					continue
+				adverts += 1
+				if not args.quiet:
+					print('%s %02x %02x %02x %s %s' % (fmt_time(ts), f[1], f[2], f[3], f[4:10][::-1].hex(), f[10:].hex()))
+			if args.compact and sp.block_err + sp.block_lost != lost:
+				# blocks lost: restart the gateway dictionary
+				lost = sp.block_err + sp.block_lost
+				sock.sendall(bytes([CTRL_CMD_ENCODING, 1, ADV_ENC_COMPACT]))
+	except KeyboardInterrupt:
+		pass
+	finally:
+		sock.close()
+	sys.stderr.write('%d adverts, %d service frames, %d blocks, %d bad, %d lost, %d bytes skipped, %d unknown handles\n'
+		% (adverts, svc, sp.blocks, sp.block_err, sp.block_lost, sp.skipped, sp.dict.miss))
+	if sp.lz_blocks:
+		sys.stderr.write('%d compressed blocks, %d -> %d bytes (%.2f:1)\n'
+			% (sp.lz_blocks, sp.lz_in, sp.lz_out, sp.lz_out / sp.lz_in))
+
+if __name__ == '__main__':
+	main()
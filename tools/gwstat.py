@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+
+# gwstat.py 05.03.2024 pvvx #
+#
+# Request and print WCHBLE2ETH runtime statistics (gw_stats_rep_t).
+#   python3 gwstat.py 192.168.2.134
+
+import sys
+import struct
+import socket
+import argparse
+
+CTRL_CMD_STATS = 0x02
+ADV_SVC_MARKER = 0xFF
+ADV_SVC_STATS = 0x02
+
+# gw_stats_rep_t, keep in sync with APP/include/stats.h
+STATS_FIELDS = (
+	('version', 'H'),
+	('size', 'H'),
+	('fifo_size', 'H'),
+	('fifo_hwm', 'H'),
+	('stack_size', 'I'),
+	('stack_hwm', 'I'),
+	('stack_free', 'I'),
+	('net_heap_size', 'I'),
+	('net_heap_hwm', 'I'),
+	('adv_count', 'I'),
+	('adv_drop', 'I'),
+	('time_syncs', 'I'),
+	('time_offset', 'i'),
+	('time_delay', 'I'),
+	('time_rate', 'i'),
+	('lz_in', 'I'),
+	('lz_out', 'I'),
+	('eth_tx_num', 'H'),
+	('eth_tx_hwm', 'H'),
+	('eth_tx_busy', 'I'),
+	('eth_tx_err', 'I'),
+	('eth_rx_filtered', 'I'),
+	('eth_rx_overflow', 'I'),
+	('eth_rx_err', 'I'),
+	('loop_num', 'I'),
+	('sleep_num', 'I'),
+	('idle_pm', 'I'),
+	('eth_link', 'B'),
+	('eth_mbps', 'B'),
+	('eth_slow', 'H'),
+	('eth_crc_err', 'I'),
+	('eth_renego', 'I'),
+	('eth_nego_ms', 'I'),
+	('resume_size', 'H'),
+	('resume_len', 'H'),
+	('resume_first', 'I'),
+	('resume_next', 'I'),
+	('resume_req', 'I'),
+	('resume_blocks', 'I'),
+	('resume_drop', 'I'),
+	('boot_ble', 'I'),
+	('boot_eth', 'I'),
+	('boot_scan', 'I'),
+	('boot_link', 'I'),
+	('boot_ip', 'I'),
+	('boot_dhcp', 'I'),
+	('boot_connect', 'I'),
+	('boot_send', 'I'),
+)
+
+STATS_UNKNOWN = 0xFFFFFFFF
+
+# eth_link bits, NetLib/eth_driver.h ETH_LINK_*
+ETH_LINK_UP = 0x01
+ETH_LINK_FDX = 0x02
+ETH_LINK_SLOW = 0x04
+
+def decode_stats(data):
+	"""Decode as many fields as the device sent."""
+	res = {}
+	off = 0
+	for name, fmt in STATS_FIELDS:
+		n = struct.calcsize(fmt)
+		if off + n > len(data):
+			break
+		res[name] = struct.unpack_from('<' + fmt, data, off)[0]
+		off += n
+	return res
+
+def recv_exact(sock, n):
+	buf = bytearray()
+	while len(buf) < n:
+		chunk = sock.recv(n - len(buf))
+		if not chunk:
+			raise ConnectionError('connection closed')
+		buf += chunk
+	return bytes(buf)
+
+def request(host, port, cmd, svc):
+	"""Send a command and return the data of the first matching service frame."""
+	sock = socket.create_connection((host, port), timeout=5)
+	try:
+		sock.sendall(bytes([cmd, 0]))
+		while True:
+			hdr = recv_exact(sock, 10)
+			data = recv_exact(sock, hdr[0])
+			if hdr[1] == ADV_SVC_MARKER and hdr[2] == svc:
+				return data
+	finally:
+		sock.close()
+
+def main():
+	parser = argparse.ArgumentParser(description='WCHBLE2ETH runtime statistics')
+	parser.add_argument('host', help='device IP address or url')
+	parser.add_argument('-p', '--port', type=int, default=1000, help='device TCP port (default: 1000)')
+	args = parser.parse_args()
+	st = decode_stats(request(args.host, args.port, CTRL_CMD_STATS, ADV_SVC_STATS))
+	for name, _ in STATS_FIELDS:
+		if name in st:
+			v = st[name]
+			print('%-16s %s' % (name, 'n/a' if v == STATS_UNKNOWN else v))
+	if st.get('lz_out'):
+		print('%-16s %.2f' % ('lz_ratio', st['lz_in'] / st['lz_out']))
+	if 'eth_link' in st:
+		v = st['eth_link']
+		if not v & ETH_LINK_UP:
+			desc = 'down'
+		else:
+			desc = '%d Mbit/s %s duplex' % (st['eth_mbps'], 'full' if v & ETH_LINK_FDX else 'half')
+			if v & ETH_LINK_SLOW:
+				desc += ', slow send mode'
+		print('%-16s %s' % ('link', desc))
+	if st.get('resume_size'):
+		print('%-16s %d of %d bytes, blocks %d..%d' % ('resume_ring', st['resume_len'], st['resume_size'],
+			st['resume_first'], st['resume_next'] - 1))
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+
+# ramtable.py 05.03.2024 pvvx #
+#
+# Print the static RAM allocations from a GNU ld map file.
+# Used as a post-build step (see .cproject):
+#   python ../../tools/ramtable.py adv2eth.map
+
+import re
+import sys
+import argparse
+
+RAM_SECTIONS = ('.data', '.sdata', '.bss', '.sbss', '.stack')
+
+re_region = re.compile(r'^(\w+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)')
+re_out = re.compile(r'^(\.\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)')
+re_in = re.compile(r'^ (\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(.+)$')
+re_in_name = re.compile(r'^ (\S+)$')
+re_in_cont = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(.+)$')
+re_sym = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+([A-Za-z_]\w*)$')
+re_assign = re.compile(r'^\s+0x([0-9a-fA-F]+)\s+(\S+)\s*=')
+
+def parse_map(path):
+	"""Return (ram_origin, ram_length, stack_size, [(name, size, section, obj), ...])."""
+	ram = (0x20000000, 0)
+	stack_size = 0
+	items = []
+	section = None
+	cur = None          # current input section [name, addr, size, obj, [(addr, sym)]]
+	pending = None
+	in_regions = False
+
+	def flush():
+		if cur is None or cur[2] == 0:
+			return
+		name, addr, size, obj, syms = cur
+		syms = sorted(s for s in syms if addr <= s[0] < addr + size)
+		short = re.sub(r'^\.s?(bss|data)\.', '', name)
+		if len(syms) <= 1 or short != name:
+			sym = syms[0][1] if syms else short
+			items.append((sym, size, section, obj))
+			return
+		# COMMON or a merged section: split by symbol addresses
+		for i, (a, s) in enumerate(syms):
+			end = syms[i + 1][0] if i + 1 < len(syms) else addr + size
+			items.append((s, end - a, section, obj))
+
+	with open(path, errors='replace') as f:
+		for line in f:
+			line = line.rstrip('\r\n')
+			if line.startswith('Memory Configuration'):
+				in_regions = True
+				continue
+			if in_regions:
+				m = re_region.match(line)
+				if m and m.group(1) == 'RAM':
+					ram = (int(m.group(2), 16), int(m.group(3), 16))
+				if line.startswith('Linker script and memory map'):
+					in_regions = False
+				continue
+			m = re_assign.match(line)
+			if m and m.group(2) == '__stack_size':
+				stack_size = int(m.group(1), 16)
+				continue
+			m = re_out.match(line)
+			if m:
+				flush()
+				cur = None
+				section = m.group(1) if m.group(1) in RAM_SECTIONS else None
+				continue
+			if not line or not line.startswith(' '):
+				if line and not line.startswith(' '):
+					flush()
+					cur = None
+					section = None
+				continue
+			if section is None:
+				continue
+			m = re_in.match(line)
+			if m:
+				flush()
+				cur = [m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4), []]
+				continue
+			m = re_in_name.match(line)
+			if m:
+				pending = m.group(1)
+				continue
+			m = re_in_cont.match(line)
+			if m and pending:
+				flush()
+				cur = [pending, int(m.group(1), 16), int(m.group(2), 16), m.group(3), []]
+				pending = None
+				continue
+			m = re_sym.match(line)
+			if m and cur is not None:
+				cur[4].append((int(m.group(1), 16), m.group(2)))
+		flush()
+	return ram[0], ram[1], stack_size, items
+
+def main():
+	parser = argparse.ArgumentParser(description='Static RAM allocation table from a GNU ld map file')
+	parser.add_argument('map', help='map file')
+	parser.add_argument('-n', '--top', type=int, default=0, help='show only N largest objects')
+	parser.add_argument('-m', '--min', type=int, default=16, help='hide objects smaller than MIN bytes (default: 16)')
+	args = parser.parse_args()
+	try:
+		origin, length, stack_size, items = parse_map(args.map)
+	except OSError as e:
+		print('ramtable: %s' % e)
+		sys.exit(1)
+	items.sort(key=lambda x: -x[1])
+	total = sum(x[1] for x in items)
+	shown = [x for x in items if x[1] >= args.min]
+	if args.top:
+		shown = shown[:args.top]
+	print('%-32s %8s %6s  %-7s %s' % ('Object', 'Bytes', '%RAM', 'Section', 'File'))
+	for name, size, section, obj in shown:
+		print('%-32s %8d %5.1f%%  %-7s %s' % (name[:32], size, size * 100.0 / length if length else 0, section, obj))
+	other = total - sum(x[1] for x in shown)
+	if other:
+		print('%-32s %8d' % ('(other)', other))
+	print('-' * 60)
+	print('%-32s %8d' % ('Static total', total))
+	if stack_size:
+		print('%-32s %8d' % ('Stack (__stack_size)', stack_size))
+	if length:
+		free = length - total - stack_size
+		print('%-32s %8d' % ('RAM size', length))
+		print('%-32s %8d' % ('Free (heap)', free))
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+
+# sntpd.py 18.03.2024 pvvx #
+#
+# Minimal SNTP server (RFC 4330) for a WCHBLE2ETH test bench without a
+# NTP server on the gateway: the host clock, stratum 1.
+#   sudo python3 sntpd.py
+#   python3 advstream.py 192.168.2.134 -s 192.168.2.10 -Z
+
+import time
+import struct
+import socket
+import argparse
+
+NTP_UNIX_OFFSET = 2208988800
+SNTP_MODE_CLIENT = 3
+SNTP_MODE_SERVER = 4
+
+def ntp_ts(t):
+	sec = int(t)
+	return struct.pack('>II', sec + NTP_UNIX_OFFSET, int((t - sec) * 4294967296) & 0xFFFFFFFF)
+
+def main():
+	parser = argparse.ArgumentParser(description='Minimal SNTP server for WCHBLE2ETH tests')
+	parser.add_argument('-b', '--bind', default='0.0.0.0', help='bind address (default: 0.0.0.0)')
+	parser.add_argument('-p', '--port', type=int, default=123, help='UDP port (default: 123)')
+	parser.add_argument('-d', '--delay', type=float, default=0, help='hold the reply for D ms (path delay test)')
+	parser.add_argument('-v', '--verbose', action='store_true', help='print requests')
+	args = parser.parse_args()
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.bind((args.bind, args.port))
+	while True:
+		msg, addr = sock.recvfrom(512)
+		t2 = time.time()
+		if len(msg) < 48 or msg[0] & 7 != SNTP_MODE_CLIENT:
+			continue
+		if args.delay:
+			time.sleep(args.delay / 1000)
+		ver = (msg[0] >> 3) & 7
+		# LI 0, mode 4, stratum 1, poll 6, precision 2^-20, 'LOCL'
+		rep = bytes([(ver << 3) | SNTP_MODE_SERVER, 1, 6, 0xEC]) + bytes(8) + b'LOCL'
+		rep += ntp_ts(t2) + msg[40:48] + ntp_ts(t2)
+		rep += ntp_ts(time.time())
+		sock.sendto(rep, addr)
+		if args.verbose:
+			print('%s:%d' % addr)
+
+if __name__ == '__main__':
+	main()
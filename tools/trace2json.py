@@ -0,0 +1,214 @@
+#!/usr/bin/env python3
+
+# trace2json.py 02.03.2024 pvvx #
+#
+# Decode the WCHBLE2ETH event trace ring (trace_ring) into Chrome trace JSON
+# (open in chrome://tracing or https://ui.perfetto.dev).
+#
+# Input: raw image of trace_ring read by a debug probe, e.g. in gdb:
+#   dump binary value trace.bin trace_ring
+# or fetched from a running device over the TCP stream socket (-c).
+#
+# -s prints the durations of the BEGIN/END events in core cycles instead,
+# -b adds a baseline dump to compare against (e.g. HAL_HIGHCODE=FALSE build).
+
+import sys
+import json
+import struct
+import socket
+import argparse
+
+TRACE_MAGIC = 0x31435254
+TRACE_HDR = '<IHHIII12x'
+TRACE_HDR_LEN = struct.calcsize(TRACE_HDR)
+
+TRACE_ID_BEGIN = 0x4000
+TRACE_ID_END = 0x8000
+TRACE_ID_MASK = 0x0FFF
+
+TRACE_CYCLES_PER_TICK = 8	# SysTick at HCLK/8
+
+# keep in sync with APP/include/trace.h
+TRACE_NAMES = {
+	0x0001: ('ETH_ISR', 'eth'),
+	0x0002: ('ETH_RX_DROP', 'eth'),
+	0x0003: ('ETH_TX_BUSY', 'eth'),
+	0x0004: ('ETH_LINK', 'eth'),
+	0x0005: ('BOOT', 'app'),
+	0x0010: ('SOCK_INT', 'net'),
+	0x0011: ('SOCK_SEND', 'net'),
+	0x0012: ('SOCK_RECV', 'net'),
+	0x0020: ('ADV_EVT', 'ble'),
+	0x0021: ('ADV_DROP', 'ble'),
+	0x0022: ('ADV_PUT', 'ble'),
+	0x0030: ('FIFO_WRITE', 'fifo'),
+	0x0031: ('FIFO_READ', 'fifo'),
+	0x0032: ('FIFO_FULL', 'fifo'),
+	0x0040: ('SEND_FIFO', 'net'),
+	0x0041: ('TMOS_ETH', 'net'),
+	0x0042: ('LZ_BLOCK', 'net'),
+	0x0043: ('RESUME', 'net'),
+}
+
+CTRL_CMD_TRACE_DUMP = 0x01
+ADV_SVC_MARKER = 0xFF
+ADV_SVC_TRACE = 0x01
+
+def parse_ring(img):
+	"""Return (freq, [(ts, id, arg0, arg1), ...]) oldest first, ts unwrapped."""
+	if len(img) < TRACE_HDR_LEN:
+		raise ValueError('trace image too short')
+	magic, num, rec_size, freq, idx, enable = struct.unpack_from(TRACE_HDR, img)
+	if magic != TRACE_MAGIC:
+		raise ValueError('bad trace magic %08x' % magic)
+	if len(img) < TRACE_HDR_LEN + num * rec_size:
+		raise ValueError('trace image truncated')
+	count = min(idx, num)
+	recs = []
+	last = None
+	high = 0
+	for n in range(idx - count, idx):
+		off = TRACE_HDR_LEN + (n % num) * rec_size
+		ts, eid, a0, a1 = struct.unpack_from('<IIII', img, off)
+		if last is not None and ts < last:
+			high += 1 << 32
+		last = ts
+		recs.append((ts + high, eid, a0, a1))
+	return freq, recs
+
+def to_chrome(freq, recs):
+	events = []
+	if not recs:
+		return {'traceEvents': events}
+	t0 = recs[0][0]
+	for ts, eid, a0, a1 in recs:
+		name, cat = TRACE_NAMES.get(eid & TRACE_ID_MASK, ('EVT_%03x' % (eid & TRACE_ID_MASK), 'misc'))
+		if eid & TRACE_ID_BEGIN:
+			ph = 'B'
+		elif eid & TRACE_ID_END:
+			ph = 'E'
+		else:
+			ph = 'i'
+		ev = {
+			'name': name,
+			'cat': cat,
+			'ph': ph,
+			'ts': (ts - t0) * 1e6 / freq,
+			'pid': 1,
+			'tid': 1 if cat == 'eth' else 2,
+			'args': {'arg0': '0x%x' % a0, 'arg1': a1},
+		}
+		if ph == 'i':
+			ev['s'] = 't'
+		events.append(ev)
+	return {'traceEvents': events, 'displayTimeUnit': 'ns'}
+
+def durations(recs):
+	"""Pair the BEGIN/END records: {event id: [ticks, ...]}."""
+	start = {}
+	res = {}
+	for ts, eid, a0, a1 in recs:
+		i = eid & TRACE_ID_MASK
+		if eid & TRACE_ID_BEGIN:
+			start[i] = ts
+		elif eid & TRACE_ID_END and i in start:
+			res.setdefault(i, []).append(ts - start.pop(i))
+	return res
+
+def dur_stat(ticks):
+	"""(count, min, avg, p50, max) in core cycles."""
+	v = sorted(t * TRACE_CYCLES_PER_TICK for t in ticks)
+	return len(v), v[0], sum(v) / len(v), v[len(v) // 2], v[-1]
+
+def print_summary(recs, base=None):
+	cur = durations(recs)
+	ref = durations(base) if base is not None else {}
+	if base is None:
+		print('%-12s %6s %8s %8s %8s %8s' % ('event', 'count', 'min', 'avg', 'p50', 'max'))
+	else:
+		print('%-12s %6s %8s %8s %8s %8s %8s %8s' % ('event', 'count', 'min', 'avg', 'p50', 'max',
+			'base avg', 'change'))
+	for i in sorted(set(cur) | set(ref)):
+		name = TRACE_NAMES.get(i, ('EVT_%03x' % i, ''))[0]
+		if i in cur:
+			n, lo, avg, p50, hi = dur_stat(cur[i])
+			line = '%-12s %6d %8d %8.0f %8d %8d' % (name, n, lo, avg, p50, hi)
+		else:
+			avg = None
+			line = '%-12s %6s %8s %8s %8s %8s' % (name, '-', '-', '-', '-', '-')
+		if base is not None:
+			if i in ref:
+				bavg = dur_stat(ref[i])[2]
+				line += ' %8.0f' % bavg
+				if avg is not None and bavg:
+					line += ' %+7.1f%%' % ((avg - bavg) * 100 / bavg)
+			else:
+				line += ' %8s' % '-'
+		print(line)
+
+def recv_exact(sock, n):
+	buf = bytearray()
+	while len(buf) < n:
+		chunk = sock.recv(n - len(buf))
+		if not chunk:
+			raise ConnectionError('connection closed')
+		buf += chunk
+	return bytes(buf)
+
+def fetch_ring(host, port):
+	"""Request a trace dump and collect the ADV_SVC_TRACE service frames."""
+	sock = socket.create_connection((host, port), timeout=5)
+	sock.sendall(bytes([CTRL_CMD_TRACE_DUMP, 0]))
+	img = None
+	got = 0
+	try:
+		while img is None or got < len(img):
+			hdr = recv_exact(sock, 10)
+			data = recv_exact(sock, hdr[0])
+			if hdr[1] != ADV_SVC_MARKER or hdr[2] != ADV_SVC_TRACE:
+				continue
+			offset, total = struct.unpack_from('<IH', hdr, 4)
+			if img is None:
+				img = bytearray(total)
+			img[offset:offset + len(data)] = data
+			got += len(data)
+	finally:
+		sock.close()
+	return bytes(img)
+
+def main():
+	parser = argparse.ArgumentParser(description='WCHBLE2ETH trace ring to Chrome trace JSON')
+	parser.add_argument('input', nargs='?', help='raw trace_ring image file')
+	parser.add_argument('-c', '--connect', metavar='HOST', help='fetch the trace from a device')
+	parser.add_argument('-p', '--port', type=int, default=1000, help='device TCP port (default: 1000)')
+	parser.add_argument('-o', '--output', help='output JSON file (default: stdout)')
+	parser.add_argument('-s', '--summary', action='store_true', help='print event durations in core cycles')
+	parser.add_argument('-b', '--base', metavar='FILE', help='baseline trace_ring image for -s')
+	args = parser.parse_args()
+	if args.connect:
+		img = fetch_ring(args.connect, args.port)
+	elif args.input:
+		with open(args.input, 'rb') as f:
+			img = f.read()
+	else:
+		parser.print_usage()
+		sys.exit(1)
+	freq, recs = parse_ring(img)
+	if args.summary:
+		base = None
+		if args.base:
+			with open(args.base, 'rb') as f:
+				base = parse_ring(f.read())[1]
+		print_summary(recs, base)
+		if not args.output:
+			return
+	out = json.dumps(to_chrome(freq, recs), indent=1)
+	if args.output:
+		with open(args.output, 'w') as f:
+			f.write(out)
+	else:
+		print(out)
+	sys.stderr.write('%d records, %d Hz\n' % (len(recs), freq))
+
+if __name__ == '__main__':
+	main()
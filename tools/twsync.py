@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+
+# twsync.py 19.03.2024 pvvx #
+#
+# Two-way time transfer collector for WCHBLE2ETH gateways (APP/include/twsync.h),
+# the same fit as host/collector/twsync_col.c: probes every period, offset and
+# rate of each gateway clock against the host clock, TWSYNC_SET corrections.
+# Receive time records of all gateways are then in the host time base.
+#   python3 twsync.py 192.168.2.134 192.168.2.135 -i 1
+
+import sys
+import time
+import math
+import struct
+import socket
+import argparse
+
+TWSYNC_PORT = 1124
+TWSYNC_MAGIC = b'TW'
+TWSYNC_PROBE = 0x01
+TWSYNC_REPLY = 0x02
+TWSYNC_SET = 0x03
+TWSYNC_F_T2_HW = 0x01
+TWSYNC_F_T3_HW = 0x02
+TWSYNC_F_SET = 0x04
+
+# twsync_msg_t, twsync_set_t
+TWSYNC_MSG = '<2sBBIQQQI6s6s'
+TWSYNC_SET_MSG = '<2sBBIQQiI'
+
+TWSYNC_COL_WIN = 64
+TWSYNC_COL_MIN = 4
+TWSYNC_COL_RATE_SPAN_US = 4000000
+
+SO_TIMESTAMPNS = getattr(socket, 'SO_TIMESTAMPNS', 35)
+
+class Collector:
+	"""One gateway: samples and the fit, see twsync_col.c."""
+
+	def __init__(self):
+		self.seq = 1
+		self.wait = None
+		self.win = []
+		self.gw_id = b''
+		self.gw_set = False
+		self.valid = False
+		self.ref_local = self.ref_utc = 0
+		self.rate = 0.0
+		self.step = 0
+		self.rms = 0.0
+		self.delay_min = 0
+		self.used = 0
+		self.replies = self.samples = self.sw_stamps = 0
+
+	def probe(self, t1):
+		m = struct.pack(TWSYNC_MSG, TWSYNC_MAGIC, TWSYNC_PROBE, 0, self.seq, t1, 0, 0, 0, bytes(6), bytes(6))
+		self.seq = (self.seq + 1) & 0xFFFFFFFF
+		return m
+
+	def reply(self, msg, t4):
+		if len(msg) < struct.calcsize(TWSYNC_MSG) or msg[:2] != TWSYNC_MAGIC or msg[2] != TWSYNC_REPLY:
+			return False
+		_, _, flags, seq, t1, t2, prev_t3, prev_seq, gw_id, _ = \
+			struct.unpack_from(TWSYNC_MSG, msg)
+		self.replies += 1
+		self.gw_id = gw_id
+		self.gw_set = bool(flags & TWSYNC_F_SET)
+		ret = False
+		if self.wait and flags & TWSYNC_F_T3_HW and prev_seq == self.wait[0]:
+			_, w1, w2, w4 = self.wait
+			self.win.append((w1, w2, prev_t3, w4))
+			del self.win[:-TWSYNC_COL_WIN]
+			self.samples += 1
+			ret = True
+		self.wait = None
+		if not flags & TWSYNC_F_T2_HW:
+			self.sw_stamps += 1
+			return ret
+		self.wait = (seq, t1, t2, t4)
+		return ret
+
+	def fit(self):
+		self.valid = False
+		n = len(self.win)
+		if n < TWSYNC_COL_MIN:
+			return False
+		delay = sorted((t4 - t1) - (t3 - t2) for t1, t2, t3, t4 in self.win)
+		self.delay_min = delay[0]
+		dmed = delay[(n - 1) // 2]
+		l1, l2, l3, l4 = self.win[-1]
+		x2_last = l2 + l3
+		y2_last = (l1 - l2) + (l4 - l3)
+		pts = []
+		for t1, t2, t3, t4 in self.win:
+			if (t4 - t1) - (t3 - t2) > dmed:
+				continue
+			pts.append(((t2 + t3 - x2_last) / 2, ((t1 - t2) + (t4 - t3) - y2_last) / 2))
+		n = len(pts)
+		sx = sum(x for x, _ in pts)
+		sy = sum(y for _, y in pts)
+		b = 0.0
+		if n >= 2 and max(x for x, _ in pts) - min(x for x, _ in pts) >= TWSYNC_COL_RATE_SPAN_US:
+			sxx = sum(x * x for x, _ in pts)
+			sxy = sum(x * y for x, y in pts)
+			b = (n * sxy - sx * sy) / (n * sxx - sx * sx)
+		a = (sy - b * sx) / n
+		self.rms = math.sqrt(sum((y - a - b * x) ** 2 for x, y in pts) / n)
+		self.used = n
+		ref_local = x2_last >> 1
+		ref_utc = ref_local + (y2_last >> 1) + math.floor((y2_last & 1) / 2 + a - b * (x2_last & 1) / 2 + 0.5)
+		# correction against the previous fit the gateway follows
+		self.step = ref_utc - self.utc(ref_local) if self.ref_local else 0
+		self.ref_local = ref_local
+		self.ref_utc = ref_utc
+		self.rate = b * 1e9
+		self.valid = True
+		return True
+
+	def utc(self, local):
+		"""Gateway local time -> collector time by the fit."""
+		d = local - self.ref_local
+		return self.ref_utc + d + math.floor(d * self.rate / 1e9 + 0.5)
+
+	def set_msg(self):
+		return struct.pack(TWSYNC_SET_MSG, TWSYNC_MAGIC, TWSYNC_SET, 0, (self.seq - 1) & 0xFFFFFFFF,
+			self.ref_local, self.ref_utc, int(round(self.rate)), 0)
+
+def now_us():
+	return time.time_ns() // 1000
+
+def recv_stamped(sock):
+	"""Datagram with the kernel receive time, us."""
+	try:
+		data, anc, _, addr = sock.recvmsg(256, 64)
+	except socket.timeout:
+		return None, None, None
+	for level, typ, val in anc:
+		if level == socket.SOL_SOCKET and typ == SO_TIMESTAMPNS:
+			sec, ns = struct.unpack('=qq', val[:16])
+			return data, addr, sec * 1000000 + ns // 1000
+	return data, addr, now_us()
+
+def main():
+	parser = argparse.ArgumentParser(description='WCHBLE2ETH two-way time transfer collector')
+	parser.add_argument('hosts', nargs='+', help='gateway IP addresses')
+	parser.add_argument('-p', '--port', type=int, default=TWSYNC_PORT, help='gateway UDP port (default: %d)' % TWSYNC_PORT)
+	parser.add_argument('-i', '--interval', type=float, default=1.0, help='probe period, s (default: 1)')
+	parser.add_argument('-n', '--count', type=int, default=0, help='stop after N periods')
+	parser.add_argument('-d', '--dry', action='store_true', help='measure only, no TWSYNC_SET')
+	args = parser.parse_args()
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	try:
+		sock.setsockopt(socket.SOL_SOCKET, SO_TIMESTAMPNS, 1)
+	except OSError:
+		sys.stderr.write('no SO_TIMESTAMPNS, user space receive time\n')
+	gws = {socket.gethostbyname(h): Collector() for h in args.hosts}
+	rounds = 0
+	try:
+		while not args.count or rounds < args.count:
+			t_end = time.monotonic() + args.interval
+			for ip, c in gws.items():
+				m = c.probe(now_us())
+				sock.sendto(m, (ip, args.port))
+			while True:
+				left = t_end - time.monotonic()
+				if left <= 0:
+					break
+				sock.settimeout(left)
+				data, addr, t4 = recv_stamped(sock)
+				if data is None:
+					continue
+				c = gws.get(addr[0])
+				if c and c.reply(data, t4) and c.fit() and not args.dry:
+					sock.sendto(c.set_msg(), (addr[0], args.port))
+			rounds += 1
+			for ip, c in gws.items():
+				if c.valid:
+					print('%-15s %s step %+d us, rate %+.3f ppm, delay %d us, rms %.1f us, %d/%d samples%s' % (
+						ip, c.gw_id.hex(), c.step, c.rate / 1000, c.delay_min, c.rms, c.used, c.samples,
+						', set' if c.gw_set else ''))
+				else:
+					print('%-15s %d replies, %d samples' % (ip, c.replies, c.samples))
+	except KeyboardInterrupt:
+		pass
+	finally:
+		sock.close()
+
+if __name__ == '__main__':
+	main()